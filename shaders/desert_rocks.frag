@@ -40,7 +40,7 @@ void main() {
     float noise_value = float_noise(to_uint_seed(noise_coord), 3);
     
     fout_color = vec4(textureLod(s_base_color, noise_value, 0.0).rgb, 1.0);
-    vec3 normal_input = texture(s_normal, uv).rgb * 2.0 - 1.0;
+    vec3 normal_input = sample_normal(s_normal, uv);
     normal_input.b /= max(roughness_metallic_normals_scale.z, 0.00001);
     fout_normal = vec4(normalize(fin.TBN * normal_input), texture(s_metallic_roughness, uv).g * roughness_metallic_normals_scale.r);
 
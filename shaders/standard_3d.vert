@@ -3,6 +3,20 @@
 
 #include "include.glsli"
 
+// PACKED_VERTEX is defined for the _packed pipeline variants, which read VertexPacked
+#ifdef PACKED_VERTEX
+layout (location = 0) in vec3 vin_position;
+layout (location = 1) in vec2 vin_normal_oct;
+layout (location = 2) in vec2 vin_tangent_oct;
+layout (location = 3) in vec3 vin_color;
+layout (location = 4) in vec2 vin_uv;
+layout (location = 5) in uvec4 vin_bone_id;
+layout (location = 6) in vec4 vin_bone_weight;
+
+vec3 vertex_normal() { return octahedral_decode(vin_normal_oct); }
+vec3 vertex_tangent() { return octahedral_decode(vin_tangent_oct); }
+int vertex_bone_id(int i) { return vin_bone_id[i] == 255u ? -1 : int(vin_bone_id[i]); }
+#else
 layout (location = 0) in vec3 vin_position;
 layout (location = 1) in vec3 vin_normal;
 layout (location = 2) in vec3 vin_tangent;
@@ -11,6 +25,11 @@ layout (location = 4) in vec2 vin_uv;
 layout (location = 5) in ivec4 vin_bone_id;
 layout (location = 6) in vec4 vin_bone_weight;
 
+vec3 vertex_normal() { return vin_normal; }
+vec3 vertex_tangent() { return vin_tangent; }
+int vertex_bone_id(int i) { return vin_bone_id[i]; }
+#endif
+
 layout (binding = CAMERA_BINDING) uniform CameraData {
 	mat4 vp;
 };
@@ -23,11 +42,15 @@ layout (binding = ID_BINDING) buffer readonly SelectionIds {
 	int selection_id[];
 };
 
+// Every skinned instance's palette packed together, bone_offset is where this instance's palette starts
 layout (binding = BONES_BINDING) buffer readonly Bones {
-	int bone_count;
 	mat4 bones[];
 };
 
+layout (binding = BONE_OFFSETS_BINDING) buffer readonly BoneOffsets {
+	uint bone_offset[];
+};
+
 out gl_PerVertex {
     vec4 gl_Position;
 };
@@ -45,26 +68,29 @@ void main() {
 	vec4 total_position = vec4(0.0);
 	vec3 total_normal = vec3(0.0);
 	vec3 total_tangent = vec3(0.0);
+	vec3 normal = vertex_normal();
+	vec3 tangent = vertex_tangent();
 	
 	int bones_used = 0;
 	for (int i = 0 ; i < 4 ; i++) {
-		if (vin_bone_id[i] == -1)
+		int bone_id = vertex_bone_id(i);
+		if (bone_id == -1)
 			continue;
 		bones_used++;
 
-		vec4 local_position = bones[vin_bone_id[i]] * vec4(vin_position, 1.0);
+		vec4 local_position = bones[bone_offset[gl_InstanceIndex] + bone_id] * vec4(vin_position, 1.0);
 		total_position += local_position * vin_bone_weight[i];
 		
-		mat3 N = transpose(inverse(mat3(bones[vin_bone_id[i]])));
-		vec3 local_normal = normalize(N * normalize(vin_normal));
-		vec3 local_tangent = normalize(N * normalize(vin_tangent));
+		mat3 N = transpose(inverse(mat3(bones[bone_offset[gl_InstanceIndex] + bone_id])));
+		vec3 local_normal = normalize(N * normalize(normal));
+		vec3 local_tangent = normalize(N * normalize(tangent));
 		total_normal += local_normal * vin_bone_weight[i];
 		total_tangent += local_tangent * vin_bone_weight[i];
 	}
 
 	total_position = bones_used > 0 ? total_position : vec4(vin_position, 1.0);
-	total_normal = normalize(bones_used > 0 ? total_normal : vin_normal);
-	total_tangent = normalize(bones_used > 0 ? total_tangent : vin_tangent);
+	total_normal = normalize(bones_used > 0 ? total_normal : normal);
+	total_tangent = normalize(bones_used > 0 ? total_tangent : tangent);
 	
     vec4 h_position = model[gl_InstanceIndex] * total_position;
 	vout.position = h_position.xyz / h_position.w;
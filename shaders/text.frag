@@ -0,0 +1,22 @@
+#version 450
+#pragma shader_stage(fragment)
+
+#include "include.glsli"
+
+layout (location = 0) in VS_OUT {
+    vec2 position;
+    vec4 color;
+    vec2 uv;
+} fin;
+
+layout (location = 0) out vec4 fout_color;
+
+layout(binding = TEXTURE_BINDING) uniform sampler2D s_texture;
+
+void main() {
+    // The atlas holds signed distance with the outline at 0.5, scaled so the edge stays one pixel wide at any size
+    float distance = texture(s_texture, fin.uv).r;
+    float width = max(length(vec2(dFdx(distance), dFdy(distance))), 0.0001);
+    float coverage = clamp((distance - 0.5) / width + 0.5, 0.0, 1.0);
+    fout_color = vec4(fin.color.rgb, coverage * fin.color.a);
+}
@@ -34,7 +34,7 @@ void main() {
     vec2 uv = calculate_uv();
 
     fout_color = texture(s_base_color, uv) * base_color_tint;
-    vec3 normal_input = texture(s_normal, uv).rgb * 2.0 - 1.0;
+    vec3 normal_input = sample_normal(s_normal, uv);
     normal_input.b /= max(roughness_metallic_normals_scale.z, 0.00001);
     fout_normal = vec4(normalize(fin.TBN * normal_input), texture(s_metallic_roughness, uv).g * roughness_metallic_normals_scale.r);
 
@@ -11,6 +11,12 @@ layout (binding = VIEW_BINDING) uniform ViewData {
     mat4 screen_pixels_to_NDC;
 };
 
+layout (push_constant) uniform DrawData {
+    mat4 transform;
+    // x is the offset amount in pixels, y is the noise time
+    vec2 distortion;
+};
+
 out gl_PerVertex {
     vec4 gl_Position;
 };
@@ -21,9 +27,20 @@ layout(location = 0) out VS_OUT {
     vec2 uv;
 } vout;
 
+float glyph_noise(vec3 pos, uint seed) {
+    return 0.667 * perlin_noise(pos, seed) + 0.333 * perlin_noise(pos * 2.0, seed);
+}
+
 void main() {
-    vec4 h_position = screen_pixels_to_NDC * vec4(vin_position, 1.0);
-    vout.position = vin_position.xy;
+    vec3 position = (transform * vec4(vin_position, 1.0)).xyz;
+    if (distortion.x != 0.0) {
+        // Every glyph is one quad, so the whole glyph moves together
+        float glyph = float(gl_VertexIndex / 4);
+        vec3 noise_pos = vec3(transform[3].xy * 0.02 + vec2(glyph * 0.3, 0.0), distortion.y * 0.02);
+        position.xy += round(distortion.x * (1.0 - 2.0 * vec2(glyph_noise(noise_pos, 0u), glyph_noise(noise_pos, 1u))));
+    }
+    vec4 h_position = screen_pixels_to_NDC * vec4(position, 1.0);
+    vout.position = position.xy;
     vout.color = vin_color / 255.0;
     vout.uv = vin_uv;
     gl_Position = h_position;
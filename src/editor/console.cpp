@@ -14,6 +14,26 @@
 #include "general/math/math.hpp"
 #include "general/logger.hpp"
 #include "game/game.hpp"
+#include "game/path_cache.hpp"
+#include "game/broadphase.hpp"
+#include "game/map_targeting.hpp"
+#include "game/entities/targeting.hpp"
+#include "game/flow_field.hpp"
+#include "game/entities/stat.hpp"
+#include "game/timer.hpp"
+#include "game/audio.hpp"
+#include "game/map.hpp"
+#include "game/replay.hpp"
+#include "game/simulation.hpp"
+#include "renderer/renderer.hpp"
+#include "renderer/render_scene.hpp"
+#include "renderer/font_manager.hpp"
+#include "renderer/aabb_tree.hpp"
+#include "renderer/assets/asset_container.hpp"
+#include "renderer/assets/mesh.hpp"
+#include "renderer/assets/mesh_optimizer.hpp"
+#include "renderer/assets/skeleton.hpp"
+#include "renderer/assets/texture_compression.hpp"
 
 namespace fs = std::filesystem;
 
@@ -327,6 +347,35 @@ void Console::_handle_call_request(std::istringstream& iss) {
     // custom types need a "string2type" method, and fmt support
     HOOK_FUNCTION_CASE1(math::euler2vector, euler);
     HOOK_FUNCTION_CASE1(math::to_quat, euler);
+
+    // benchmarks
+    HOOK_FUNCTION_CASE2(benchmark_path_cache, int, int);
+    HOOK_FUNCTION_CASE2(benchmark_broadphase, int, int);
+    HOOK_FUNCTION_CASE2(benchmark_map_targeting, int, int);
+    HOOK_FUNCTION_CASE2(benchmark_flow_field, int, int);
+    HOOK_FUNCTION_CASE2(benchmark_stat, int, int);
+    HOOK_FUNCTION_CASE2(benchmark_timers, int, int);
+    HOOK_FUNCTION_CASE2(benchmark_render_scene, int, int);
+    HOOK_FUNCTION_CASE2(benchmark_skinning, int, int);
+    HOOK_FUNCTION_CASE2(verify_aabb_tree, int, int);
+    HOOK_FUNCTION_CASE2(benchmark_ik, int, int);
+    HOOK_FUNCTION_CASE2(verify_ik_chains, int, int);
+    HOOK_FUNCTION_CASE2(benchmark_audio, int, int);
+    HOOK_FUNCTION_CASE2(benchmark_text, int, int);
+    HOOK_FUNCTION_CASE2(verify_sdf_glyphs, int, int);
+    HOOK_FUNCTION_CASE2(benchmark_lines, int, int);
+    HOOK_FUNCTION_CASE2(verify_replay, int, int);
+    HOOK_FUNCTION_CASE2(verify_entry_scores, int, int);
+    HOOK_FUNCTION_CASE1(verify_vertex_packing, int);
+    HOOK_FUNCTION_CASE1(verify_mesh_optimizer, int);
+    HOOK_FUNCTION_CASE1(convert_asset_containers, bool);
+    HOOK_FUNCTION_CASE1(benchmark_asset_loading, int);
+    HOOK_FUNCTION_CASE1(benchmark_map_loading, int);
+    HOOK_FUNCTION_CASE1(benchmark_simulation, int);
+    HOOK_FUNCTION_CASE1(benchmark_scheduler, int);
+    HOOK_FUNCTION_CASE1(benchmark_replay, int);
+    HOOK_FUNCTION_CASE1(benchmark_texture_compression, int);
+    HOOK_FUNCTION_CASE1(report_startup_times, int);
 }
 
 }
\ No newline at end of file
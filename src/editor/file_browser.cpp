@@ -2,7 +2,6 @@
 
 #include <imgui.h>
 #include <imgui/misc/cpp/imgui_stdlib.h>
-#include <stb_image.h>
 
 #include "extension/imgui_extra.hpp"
 #include "extension/icons/font_awesome4.h"
@@ -107,6 +106,7 @@ void file_browser(const string& window_name, bool* p_open, FilePath* out) {
             FilePath input;
             FilePath folder_path;
             string name;
+            TextureCompression compression = TextureCompression_BC7;
         };
         static umap<string, TextureConvertInfo> tex_convert_map;
 
@@ -122,23 +122,14 @@ void file_browser(const string& window_name, bool* p_open, FilePath* out) {
         ImGui::PathSelect<ModelCPU>("Input", &tex_convert_map[window_name].input);
         ImGui::PathSelect<Directory>("Output folder", &tex_convert_map[window_name].folder_path);
         ImGui::InputText("Output name", &tex_convert_map[window_name].name);
+        ImGui::EnumCombo("Compression", &tex_convert_map[window_name].compression);
 
 
         if (ImGui::Button("Convert")) {
             auto& convert_info = tex_convert_map[window_name];
-
-            string abs_path = convert_info.input.abs_string();
-            v2i size;
-            auto pixels = stbi_load(abs_path.c_str(), &size.x, &size.y, nullptr, 4);
-
-            TextureCPU texture_cpu = {
-                FilePath(convert_info.folder_path.rel_string() + convert_info.name + string(TextureCPU::extension())),
-                {},
-                v2i{size.x, size.y},
-                vuk::Format::eR8G8B8A8Srgb,
-                vector<uint8>(pixels, pixels + size.x * size.y * 4)
-            };
-            save_texture(texture_cpu);
+            TextureCPU texture_cpu = convert_to_texture(convert_info.input, convert_info.folder_path, convert_info.name, convert_info.compression);
+            if (!texture_cpu.pixels.empty())
+                save_texture(texture_cpu);
             ImGui::CloseCurrentPopup();
         }
         ImGui::EndPopup();
@@ -2,6 +2,8 @@
 
 #include "renderer/draw_functions.hpp"
 #include "game/game.hpp"
+#include "game/scene.hpp"
+#include "game/replay.hpp"
 #include "game/entities/components.hpp"
 
 namespace spellbook {
@@ -26,7 +28,7 @@ bool game_scene_click_dragging(ClickCallbackArgs args) {
         return true;
     }
     if (Input::mouse_release[GLFW_MOUSE_BUTTON_LEFT]) {
-        game_scene.p_scene->release_selected();
+        game_scene.p_scene->command({.type = SceneCommand_Release});
     }
     return false;
 }
@@ -37,16 +39,18 @@ void GameScene::setup(const MapPrefab& map_prefab) {
     assert_else(p_scene == nullptr)
         delete p_scene;
     p_scene = instance_map(map_prefab, "Game Scene");
-    p_scene->set_edit_mode(false);
     p_scene->time_scale = 1.0f;
+    // Fixed steps so the recording plays back the same regardless of frame rate
+    p_scene->fixed_step = 1.0f / 60.0f;
     setup_player_stuff();
+    p_scene->start_recording(map_prefab.file_path);
 }
 
 void GameScene::update() {
     p_scene->update();
 
     if (Input::mouse_release[GLFW_MOUSE_BUTTON_LEFT]) {
-        p_scene->release_selected();
+        p_scene->command({.type = SceneCommand_Release});
     }
 }
 
@@ -56,13 +60,13 @@ void GameScene::window(bool* p_open) {
 
 void GameScene::shutdown() {
     Input::remove_callback<KeyCallback>("Game Scene");
+    if (p_scene->recording && p_scene->recording->tick_count > 0)
+        save_replay(*p_scene->recording, last_replay_path());
     p_scene->cleanup();
 }
 
 void GameScene::setup_player_stuff() {
-    p_scene->player.scene = p_scene;
-    p_scene->shop.shop_generator = std::make_unique<FirstFreeShopGenerator>();
-    p_scene->shop.shop_generator->setup(p_scene);
+    p_scene->start_game();
 }
 
 
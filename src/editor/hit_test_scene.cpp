@@ -115,7 +115,7 @@ void HitTestScene::build_visuals(Scene* scene) {
             math::scale(v3(tile_entry.rotation.flip_x ? -1.0f : 1.0f, 1.0f, tile_entry.rotation.flip_z ? -1.0f : 1.0f))
         );
         for (StaticRenderable* renderable : model.renderables) {
-            renderable->transform = tfm;
+            scene->render_scene.set_transform(renderable, tfm);
         }
     }
 }
@@ -454,7 +454,7 @@ void MapEditor::build_visuals(Scene* scene, v3i* tile) {
             math::scale(v3(tile_entry.rotation.flip_x ? -1.0f : 1.0f, 1.0f, tile_entry.rotation.flip_z ? -1.0f : 1.0f))
         );
         for (StaticRenderable* renderable : model.renderables) {
-            renderable->transform = tfm;
+            scene->render_scene.set_transform(renderable, tfm);
         }
     }
 }
@@ -464,7 +464,7 @@ void MapEditor::draw_preview(v3i cell) {
     constexpr float line_width = 0.03f;
     auto camera = p_scene->render_scene.viewport.camera;
     if (eraser_selected) {
-        auto line_mesh = generate_formatted_line(camera,
+        p_scene->render_scene.draw_line(camera,
         {
             {(v3) cell + v3(0.f, 0.f, 0.f), palette::gray_4, line_width},
             {(v3) cell + v3(1.f, 1.f, 0.f), palette::gray_4, line_width},
@@ -482,9 +482,7 @@ void MapEditor::draw_preview(v3i cell) {
             {(v3) cell + v3(1.f, 1.f, 1.f), palette::gray_4, line_width},
             {(v3) cell + v3(1.f, 1.f, 0.f), palette::gray_4, line_width},
             {(v3) cell + v3(1.f, 0.f, 0.f), palette::gray_4, line_width}
-        });
-
-        p_scene->render_scene.quick_mesh(line_mesh, true, true);
+        }, true);
     } else if (selected_tile != -1) {
         TilePrefab tile_prefab = load_resource<TilePrefab>(tile_buttons[selected_tile].item_path);
         if (tile_prefab.type == TileType_Ramp) {
@@ -537,8 +535,7 @@ void MapEditor::draw_preview(v3i cell) {
             vertices.emplace_back(center + 0.4f * v3(math::cos(angle), math::sin(angle), 0.04f), palette::white, line_width);
         }
 
-        auto line_mesh = generate_formatted_line(camera, std::move(vertices));
-        p_scene->render_scene.quick_mesh(line_mesh, true, true);
+        p_scene->render_scene.draw_line(camera, vertices, true);
     }
 }
 
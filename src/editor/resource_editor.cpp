@@ -354,8 +354,9 @@ void ResourceEditor::window(bool* p_open) {
                 }
             });
             asset_tab(*this, ICON_FA_TINT " Material", Tab_Material, &material_cpu, [this](bool changed) {
-                if (changed)
-                    get_gpu_asset_cache().materials.at(material_preview->material_id).update_from_cpu(material_cpu);
+                MaterialGPU* material = get_gpu_asset_cache().get_material(material_preview->material_id);
+                if (changed && material)
+                    material->update_from_cpu(material_cpu);
             });
 //            asset_tab(*this, ICON_FA_USER " Lizard", Tab_Lizard, &lizard_prefab, [this](bool changed) {
 //                if (ImGui::Checkbox("Force Target", &force_target)) {
@@ -1,5 +1,9 @@
 ﻿#include "audio.hpp"
 
+#include <chrono>
+#include <imgui.h>
+#include <tracy/Tracy.hpp>
+
 #include "extension/fmt.hpp"
 #include "general/logger.hpp"
 #include "game/scene.hpp"
@@ -7,11 +11,20 @@
 
 namespace spellbook {
 
-void Audio::setup() {
+void Audio::setup(bool headless) {
     ma_result result;
-    result = ma_engine_init(nullptr, &engine);
-    if (result != MA_SUCCESS)
+    ma_engine_config config = ma_engine_config_init();
+    config.noDevice = headless ? MA_TRUE : MA_FALSE;
+    if (headless) {
+        config.channels = 2;
+        config.sampleRate = 48000;
+    }
+    result = ma_engine_init(&config, &engine);
+    if (result != MA_SUCCESS) {
         log_warning("audio init failed");
+        return;
+    }
+    initialized = true;
 
     result = ma_sound_group_init(&engine, 0, nullptr, &default_group);
     if (result != MA_SUCCESS)
@@ -22,6 +35,8 @@ void Audio::setup() {
 }
 
 void Audio::update(Scene* scene) {
+    if (!initialized)
+        return;
     cleanup_done_sounds();
     
     const v3& pos = scene->camera.position;
@@ -32,39 +47,213 @@ void Audio::update(Scene* scene) {
 
 
 void Audio::shutdown() {
-    for (auto& sound : sounds)
-        ma_sound_uninit(&sound);
+    if (!initialized)
+        return;
+    for (Voice& voice : voices)
+        _release_voice(voice);
+    for (auto& [path, decoded] : decoded_sounds)
+        ma_free(decoded->frames, nullptr);
+    decoded_sounds.clear();
+    decoded_bytes = 0;
     
     ma_engine_uninit(&engine);
+    initialized = false;
+}
+
+DecodedSound* Audio::get_decoded(const string& abs_path) {
+    auto it = decoded_sounds.find(abs_path);
+    if (it != decoded_sounds.end())
+        return &*it->second;
+
+    ZoneScoped;
+    ma_decoder_config config = ma_decoder_config_init(ma_format_f32, ma_engine_get_channels(&engine), ma_engine_get_sample_rate(&engine));
+    void* frames = nullptr;
+    ma_uint64 frame_count = 0;
+    if (ma_decode_file(abs_path.c_str(), &config, &frame_count, &frames) != MA_SUCCESS)
+        return nullptr;
+    return add_decoded(abs_path, (float*) frames, frame_count);
 }
 
+// Takes ownership of frames, which must come from miniaudio's allocator. Sounds larger than the whole budget are freed
+// and not cached.
+DecodedSound* Audio::add_decoded(const string& key, float* frames, ma_uint64 frame_count) {
+    uint64 bytes = frame_count * ma_engine_get_channels(&engine) * sizeof(float);
+    if (bytes > decoded_budget) {
+        log_warning(fmt_("Decoded sound '{}' is larger than the decoded budget", key), "audio");
+        ma_free(frames, nullptr);
+        return nullptr;
+    }
+    // Room is made first, the new sound has no users yet and would otherwise be the first candidate
+    evict_decoded(bytes);
+
+    auto decoded = std::make_unique<DecodedSound>();
+    decoded->frames = frames;
+    decoded->frame_count = frame_count;
+    decoded->bytes = bytes;
+    decoded->last_used = play_count;
+    decoded_bytes += decoded->bytes;
+    DecodedSound* added = &*decoded;
+    decoded_sounds[key] = std::move(decoded);
+    return added;
+}
 
+void Audio::evict_decoded(uint64 incoming) {
+    while (decoded_bytes + incoming > decoded_budget) {
+        auto oldest = decoded_sounds.end();
+        for (auto it = decoded_sounds.begin(); it != decoded_sounds.end(); it++) {
+            if (it->second->users == 0 && (oldest == decoded_sounds.end() || it->second->last_used < oldest->second->last_used))
+                oldest = it;
+        }
+        // Everything left is playing
+        if (oldest == decoded_sounds.end())
+            return;
+        decoded_bytes -= oldest->second->bytes;
+        ma_free(oldest->second->frames, nullptr);
+        decoded_sounds.erase(oldest);
+    }
+}
 
 void Audio::play_sound(const FilePath& file_path, SoundSettings settings) {
-    ma_sound& sound = *sounds.emplace();
+    if (!initialized)
+        return;
+    DecodedSound* decoded = get_decoded(file_path.abs_string());
+    if (decoded == nullptr) {
+        console({.str=fmt_("Playing sound '{}' failed", file_path.rel_string()), .group="audio", .color = palette::orange});
+        return;
+    }
+    play_sound(decoded, settings);
+}
+
+void Audio::play_sound(DecodedSound* decoded, SoundSettings settings) {
+    play_count++;
+    decoded->last_used = play_count;
+    Voice* voice = _acquire_voice(settings);
+    if (voice == nullptr) {
+        dropped_count++;
+        return;
+    }
+
     ma_uint32 flags = 0;
     if (settings.global)
         flags |= MA_SOUND_FLAG_NO_SPATIALIZATION;
-    ma_result result = ma_sound_init_from_file(&engine, file_path.abs_string().c_str(), flags, nullptr, nullptr, &sound);
-    if (result != MA_SUCCESS) {
-        console({.str=fmt_("Playing sound '{}' failed", file_path.rel_string()), .group="audio", .color = palette::orange});
+    ma_audio_buffer_ref_init(ma_format_f32, ma_engine_get_channels(&engine), decoded->frames, decoded->frame_count, &voice->source);
+    if (ma_sound_init_from_data_source(&engine, &voice->source, flags, nullptr, &voice->sound) != MA_SUCCESS) {
+        ma_audio_buffer_ref_uninit(&voice->source);
+        dropped_count++;
         return;
     }
-    ma_sound_set_position(&sound, settings.position.x, settings.position.y, settings.position.z);
-    ma_sound_set_volume(&sound, settings.volume);
-    ma_sound_start(&sound);
+    voice->decoded = decoded;
+    voice->sound_class = settings.sound_class;
+    voice->priority = settings.priority;
+    voice->started = play_count;
+    decoded->users++;
+    class_counts[settings.sound_class]++;
+
+    ma_sound_set_position(&voice->sound, settings.position.x, settings.position.y, settings.position.z);
+    ma_sound_set_volume(&voice->sound, settings.volume);
+    ma_sound_start(&voice->sound);
 }
 
-void Audio::cleanup_done_sounds() {
-    for (auto it = sounds.begin(); it != sounds.end();) {
-        if (it->atEnd) {
-            ma_sound_uninit(&*it);
-            it = sounds.erase(it);
+// A free voice if the class has room, otherwise the lowest priority and oldest voice the new sound may replace
+Voice* Audio::_acquire_voice(const SoundSettings& settings) {
+    bool class_full = class_counts[settings.sound_class] >= class_caps[settings.sound_class];
+    Voice* victim = nullptr;
+    for (Voice& voice : voices) {
+        if (voice.decoded == nullptr) {
+            if (!class_full)
+                return &voice;
+            continue;
         }
-        else
-            it++;
+        if (class_full && voice.sound_class != settings.sound_class)
+            continue;
+        if (voice.priority > settings.priority)
+            continue;
+        if (victim == nullptr || voice.priority < victim->priority || (voice.priority == victim->priority && voice.started < victim->started))
+            victim = &voice;
+    }
+    if (victim != nullptr) {
+        _release_voice(*victim);
+        stolen_count++;
+    }
+    return victim;
+}
+
+void Audio::_release_voice(Voice& voice) {
+    if (voice.decoded == nullptr)
+        return;
+    ma_sound_uninit(&voice.sound);
+    ma_audio_buffer_ref_uninit(&voice.source);
+    voice.decoded->users--;
+    class_counts[voice.sound_class]--;
+    voice.decoded = nullptr;
+}
+
+void Audio::cleanup_done_sounds() {
+    for (Voice& voice : voices) {
+        if (voice.decoded != nullptr && ma_sound_at_end(&voice.sound))
+            _release_voice(voice);
     }
+    evict_decoded();
+}
+
+void inspect(Audio* audio) {
+    uint32 active = 0;
+    for (const Voice& voice : audio->voices)
+        if (voice.decoded != nullptr)
+            active++;
+    ImGui::Text("Voices: %u / %u", active, Audio::max_voices);
+    ImGui::Text("Effect: %u, Step: %u, UI: %u", audio->class_counts[SoundClass_Effect], audio->class_counts[SoundClass_Step], audio->class_counts[SoundClass_UI]);
+    ImGui::Text("Stolen: %u, Dropped: %u", audio->stolen_count, audio->dropped_count);
+    ImGui::Text("Decoded: %u sounds, %.1f MB", uint32(audio->decoded_sounds.size()), audio->decoded_bytes / (1024.0f * 1024.0f));
 }
 
+string benchmark_audio(int plays_per_frame, int frames) {
+    using clock = std::chrono::steady_clock;
+    constexpr uint32 sound_count = 8;
+    constexpr uint32 mix_frames = 48000 / 60;
+
+    auto audio = std::make_unique<Audio>();
+    audio->setup(true);
+    if (!audio->initialized)
+        return "audio init failed";
+
+    // Short tones stand in for files so the benchmark doesn't depend on assets
+    uint32 channels = ma_engine_get_channels(&audio->engine);
+    vector<DecodedSound*> sounds;
+    for (uint32 i = 0; i < sound_count; i++) {
+        ma_uint64 frame_count = 4800 * (1 + i);
+        float* pcm = (float*) ma_malloc(frame_count * channels * sizeof(float), nullptr);
+        for (ma_uint64 frame = 0; frame < frame_count; frame++)
+            for (uint32 channel = 0; channel < channels; channel++)
+                pcm[frame * channels + channel] = 0.1f * math::sin(float(frame) * 0.05f * (1 + i));
+        sounds.push_back(audio->add_decoded(fmt_("benchmark_{}", i), pcm, frame_count));
+    }
+
+    vector<float> output(mix_frames * channels);
+    double play_ms = 0.0;
+    double mix_ms = 0.0;
+    for (int frame = 0; frame < frames; frame++) {
+        auto t0 = clock::now();
+        for (int i = 0; i < plays_per_frame; i++) {
+            SoundSettings settings = {
+                .position = v3(math::random_float(20.0f), math::random_float(20.0f), 0.0f),
+                .sound_class = SoundClass(math::random_int32(SoundClass_Count)),
+                .priority = math::random_int32(3)
+            };
+            audio->play_sound(sounds[math::random_int32(sound_count)], settings);
+        }
+        auto t1 = clock::now();
+        ma_engine_read_pcm_frames(&audio->engine, output.data(), mix_frames, nullptr);
+        audio->cleanup_done_sounds();
+        auto t2 = clock::now();
+        play_ms += std::chrono::duration<double, std::milli>(t1 - t0).count();
+        mix_ms += std::chrono::duration<double, std::milli>(t2 - t1).count();
+    }
+
+    string result = fmt_("{} plays/s: {:.4f}ms per play, {:.3f}ms/frame mixing, {} stolen, {} dropped",
+        plays_per_frame * 60, play_ms / std::max(uint64(1), audio->play_count), mix_ms / frames, audio->stolen_count, audio->dropped_count);
+    audio->shutdown();
+    return result;
+}
 
 }
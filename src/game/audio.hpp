@@ -1,8 +1,10 @@
 ﻿#pragma once
 
+#include <memory>
 #include <miniaudio.h>
-#include <plf_colony.h>
 
+#include "general/string.hpp"
+#include "general/umap.hpp"
 #include "general/math/geometry.hpp"
 #include "general/file/file_path.hpp"
 
@@ -10,25 +12,79 @@ namespace spellbook {
 
 struct Scene;
 
+enum SoundClass : uint8 {
+    SoundClass_Effect,
+    SoundClass_Step,
+    SoundClass_UI,
+    SoundClass_Count
+};
+
 struct SoundSettings {
     bool global = false;
     v3 position = v3(0.0f);
     float volume = 1.0f;
+    SoundClass sound_class = SoundClass_Effect;
+    // Higher priority sounds steal voices from lower ones when the pool or their class is full
+    int32 priority = 0;
+};
+
+// PCM decoded once into the engine's format, shared by every voice playing it
+struct DecodedSound {
+    float* frames = nullptr;
+    ma_uint64 frame_count = 0;
+    uint64 bytes = 0;
+    uint64 last_used = 0;
+    uint32 users = 0;
+};
+
+struct Voice {
+    ma_sound sound;
+    ma_audio_buffer_ref source;
+    DecodedSound* decoded = nullptr;
+    SoundClass sound_class = SoundClass_Effect;
+    int32 priority = 0;
+    uint64 started = 0;
 };
 
 struct Audio {
+    static constexpr uint32 max_voices = 32;
+
     ma_engine engine;
     ma_sound_group default_group;
-    
-    void setup();
+    bool initialized = false;
+
+    // Decoded sounds by absolute path, unused ones are evicted oldest first once over budget
+    umap<string, std::unique_ptr<DecodedSound>> decoded_sounds;
+    uint64 decoded_bytes = 0;
+    uint64 decoded_budget = 64 * 1024 * 1024;
+
+    Voice voices[max_voices];
+    uint32 class_caps[SoundClass_Count] = {24, 8, 4};
+    uint32 class_counts[SoundClass_Count] = {};
+    uint64 play_count = 0;
+    uint32 stolen_count = 0;
+    uint32 dropped_count = 0;
+
+    // Headless runs the engine without a device, output is pulled with ma_engine_read_pcm_frames
+    void setup(bool headless = false);
     void update(Scene* scene);
     void shutdown();
     void play_sound(const FilePath& file_path, SoundSettings settings);
+    void play_sound(DecodedSound* decoded, SoundSettings settings);
 
-    plf::colony<ma_sound> sounds;
+    DecodedSound* get_decoded(const string& abs_path);
+    DecodedSound* add_decoded(const string& key, float* frames, ma_uint64 frame_count);
+    // Evicts until incoming more bytes fit in the budget, or only playing sounds are left
+    void evict_decoded(uint64 incoming = 0);
 
+    Voice* _acquire_voice(const SoundSettings& settings);
+    void _release_voice(Voice& voice);
     void cleanup_done_sounds();
 };
 
+void inspect(Audio* audio);
+
+// Fires plays_per_frame random plays each 60hz frame on a headless engine, mixing in between
+string benchmark_audio(int plays_per_frame, int frames);
 
 }
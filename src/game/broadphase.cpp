@@ -0,0 +1,208 @@
+#include "broadphase.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <tracy/Tracy.hpp>
+
+#include "extension/fmt.hpp"
+#include "general/math/math.hpp"
+
+namespace spellbook {
+
+v3i Broadphase::_cell(v3 position) const {
+    return math::floor_cast(position / cell_size);
+}
+
+void Broadphase::_insert_cells(entt::entity entity, v3i min_cell, v3i max_cell) {
+    for (int32 x = min_cell.x; x <= max_cell.x; x++)
+        for (int32 y = min_cell.y; y <= max_cell.y; y++)
+            for (int32 z = min_cell.z; z <= max_cell.z; z++)
+                cells[v3i(x, y, z)].push_back(entity);
+}
+
+void Broadphase::_remove_cells(entt::entity entity, v3i min_cell, v3i max_cell) {
+    for (int32 x = min_cell.x; x <= max_cell.x; x++) {
+        for (int32 y = min_cell.y; y <= max_cell.y; y++) {
+            for (int32 z = min_cell.z; z <= max_cell.z; z++) {
+                auto it = cells.find(v3i(x, y, z));
+                if (it == cells.end())
+                    continue;
+                it->second.remove_value(entity);
+                if (it->second.empty())
+                    cells.erase(it);
+            }
+        }
+    }
+}
+
+void Broadphase::set(entt::entity entity, v3 position, float radius) {
+    v3i min_cell = _cell(position - v3(radius));
+    v3i max_cell = _cell(position + v3(radius));
+
+    auto it = proxies.find(entity);
+    if (it == proxies.end()) {
+        proxies[entity] = Proxy{position, radius, min_cell, max_cell, {}, true};
+        moved.push_back(entity);
+        _insert_cells(entity, min_cell, max_cell);
+        return;
+    }
+
+    Proxy& proxy = it->second;
+    proxy.position = position;
+    proxy.radius = radius;
+    if (!proxy.moved) {
+        proxy.moved = true;
+        moved.push_back(entity);
+    }
+    if (proxy.min_cell == min_cell && proxy.max_cell == max_cell)
+        return;
+    _remove_cells(entity, proxy.min_cell, proxy.max_cell);
+    _insert_cells(entity, min_cell, max_cell);
+    proxy.min_cell = min_cell;
+    proxy.max_cell = max_cell;
+}
+
+void Broadphase::remove(entt::entity entity) {
+    auto it = proxies.find(entity);
+    if (it == proxies.end())
+        return;
+    Proxy& proxy = it->second;
+    if (proxy.moved)
+        moved.remove_value(entity, /*unordered=*/false);
+    _remove_cells(entity, proxy.min_cell, proxy.max_cell);
+    for (entt::entity other : proxy.contacts) {
+        events.emplace_back(CollisionEventType_Exit, entity, other);
+        auto other_it = proxies.find(other);
+        if (other_it != proxies.end())
+            other_it->second.contacts.remove_value(entity, /*unordered=*/false);
+    }
+    proxies.erase(it);
+}
+
+void Broadphase::query(v3 position, float radius, vector<entt::entity>& out, entt::entity exclude) const {
+    v3i min_cell = _cell(position - v3(radius));
+    v3i max_cell = _cell(position + v3(radius));
+    for (int32 x = min_cell.x; x <= max_cell.x; x++) {
+        for (int32 y = min_cell.y; y <= max_cell.y; y++) {
+            for (int32 z = min_cell.z; z <= max_cell.z; z++) {
+                auto it = cells.find(v3i(x, y, z));
+                if (it == cells.end())
+                    continue;
+                for (entt::entity other : it->second) {
+                    if (other == exclude)
+                        continue;
+                    const Proxy& other_proxy = proxies.at(other);
+                    if (math::length(position - other_proxy.position) < (radius + other_proxy.radius))
+                        out.push_back(other);
+                }
+            }
+        }
+    }
+    // colliders spanning several cells are found once per cell
+    std::sort(out.begin(), out.end());
+    out.erase(std::unique(out.begin(), out.end()), out.end());
+}
+
+void Broadphase::update() {
+    ZoneScoped;
+    for (entt::entity entity : moved) {
+        Proxy& proxy = proxies.at(entity);
+        _scratch.clear();
+        query(proxy.position, proxy.radius, _scratch, entity);
+
+        // When both sides moved they see the same difference, so only the lower entity reports it. A side that stayed
+        // put isn't diffed, its contacts are patched from here.
+        auto reports = [this, entity](entt::entity other) -> Proxy* {
+            Proxy& other_proxy = proxies.at(other);
+            if (other_proxy.moved)
+                return entity < other ? &other_proxy : nullptr;
+            return &other_proxy;
+        };
+        auto old_it = proxy.contacts.begin();
+        auto new_it = _scratch.begin();
+        while (old_it != proxy.contacts.end() || new_it != _scratch.end()) {
+            if (new_it == _scratch.end() || (old_it != proxy.contacts.end() && *old_it < *new_it)) {
+                if (Proxy* other_proxy = reports(*old_it)) {
+                    events.emplace_back(CollisionEventType_Exit, entity, *old_it);
+                    if (!other_proxy->moved)
+                        other_proxy->contacts.remove_value(entity, /*unordered=*/false);
+                }
+                old_it++;
+            } else if (old_it == proxy.contacts.end() || *new_it < *old_it) {
+                if (Proxy* other_proxy = reports(*new_it)) {
+                    events.emplace_back(CollisionEventType_Enter, entity, *new_it);
+                    if (!other_proxy->moved) {
+                        vector<entt::entity>& contacts = other_proxy->contacts;
+                        contacts.insert(std::lower_bound(contacts.begin(), contacts.end(), entity), entity);
+                    }
+                }
+                new_it++;
+            } else {
+                if (reports(*new_it))
+                    events.emplace_back(CollisionEventType_Stay, entity, *new_it);
+                old_it++;
+                new_it++;
+            }
+        }
+        std::swap(proxy.contacts, _scratch);
+    }
+    for (entt::entity entity : moved)
+        proxies.at(entity).moved = false;
+    moved.clear();
+}
+
+void Broadphase::clear() {
+    proxies.clear();
+    cells.clear();
+    events.clear();
+    moved.clear();
+}
+
+string benchmark_broadphase(int colliders, int frames) {
+    using clock = std::chrono::steady_clock;
+    constexpr float area = 64.0f;
+    constexpr float speed = 0.05f;
+
+    Broadphase broadphase;
+    vector<v3> positions;
+    vector<float> radii;
+    for (int i = 0; i < colliders; i++) {
+        positions.push_back(v3(math::random_float(area), math::random_float(area), 0.0f));
+        radii.push_back(0.1f + math::random_float(0.3f));
+    }
+
+    double broadphase_ms = 0.0;
+    double brute_force_ms = 0.0;
+    uint64 broadphase_pairs = 0;
+    uint64 brute_force_pairs = 0;
+    for (int frame = 0; frame < frames; frame++) {
+        for (v3& position : positions) {
+            position += v3(math::random_float(2.0f * speed) - speed, math::random_float(2.0f * speed) - speed, 0.0f);
+            position.x = math::clamp(position.x, range{0.0f, area});
+            position.y = math::clamp(position.y, range{0.0f, area});
+        }
+
+        auto t0 = clock::now();
+        for (int i = 0; i < colliders; i++)
+            broadphase.set(entt::entity(i), positions[i], radii[i]);
+        broadphase.update();
+        for (const CollisionEvent& event : broadphase.events)
+            if (event.type != CollisionEventType_Exit)
+                broadphase_pairs++;
+        broadphase.events.clear();
+        auto t1 = clock::now();
+        for (int i = 0; i < colliders; i++)
+            for (int j = i + 1; j < colliders; j++)
+                if (math::length(positions[i] - positions[j]) < (radii[i] + radii[j]))
+                    brute_force_pairs++;
+        auto t2 = clock::now();
+
+        broadphase_ms += std::chrono::duration<double, std::milli>(t1 - t0).count();
+        brute_force_ms += std::chrono::duration<double, std::milli>(t2 - t1).count();
+    }
+
+    return fmt_("{} colliders, {} frames: broadphase {:.2f}ms ({} pairs), brute force {:.2f}ms ({} pairs)",
+        colliders, frames, broadphase_ms, broadphase_pairs, brute_force_ms, brute_force_pairs);
+}
+
+}
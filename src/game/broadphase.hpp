@@ -0,0 +1,62 @@
+#pragma once
+
+#include <entt/entity/entity.hpp>
+
+#include "general/string.hpp"
+#include "general/vector.hpp"
+#include "general/umap.hpp"
+#include "general/math/geometry.hpp"
+
+namespace spellbook {
+
+enum CollisionEventType {
+    CollisionEventType_Enter,
+    CollisionEventType_Stay,
+    CollisionEventType_Exit
+};
+
+struct CollisionEvent {
+    CollisionEventType type;
+    entt::entity a;
+    entt::entity b;
+};
+
+// Uniform grid over sphere colliders. Proxies are only rebucketed when the cells they cover change, and only proxies
+// set since the last update have their contacts diffed, producing enter/exit events and stay events for moved pairs.
+struct Broadphase {
+    struct Proxy {
+        v3 position;
+        float radius;
+        v3i min_cell;
+        v3i max_cell;
+        vector<entt::entity> contacts; // sorted
+        bool moved = false;
+    };
+
+    float cell_size = 1.0f;
+    umap<entt::entity, Proxy> proxies;
+    umap<v3i, vector<entt::entity>> cells;
+    // Set since the last update, in the order they were set
+    vector<entt::entity> moved;
+
+    // Accumulates until consumed, removal exits are pushed immediately
+    vector<CollisionEvent> events;
+
+    void set(entt::entity entity, v3 position, float radius);
+    void remove(entt::entity entity);
+    void update();
+    void clear();
+
+    void query(v3 position, float radius, vector<entt::entity>& out, entt::entity exclude = entt::null) const;
+
+    vector<entt::entity> _scratch;
+
+    v3i _cell(v3 position) const;
+    void _insert_cells(entt::entity entity, v3i min_cell, v3i max_cell);
+    void _remove_cells(entt::entity entity, v3i min_cell, v3i max_cell);
+};
+
+// Random walk of colliders through the broadphase compared against the all pairs test
+string benchmark_broadphase(int colliders, int frames);
+
+}
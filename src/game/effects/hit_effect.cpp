@@ -21,7 +21,7 @@ void Vulnerable::apply(Scene* scene, entt::entity caster, const vector<entt::ent
         StatEffect stat_effect = {
             .type = StatEffect::Type_Multiply,
             .value = 1.0f + effect[level - 1],
-            .until = Input::time + duration,
+            .until = duration,
             .unique = hash_view("Vulnerable")
         };
         dtm->add_effect(hash_view("Vulnerable") ^ uint64(caster), stat_effect);
@@ -36,7 +36,7 @@ void Resistance::apply(Scene* scene, entt::entity caster, const vector<entt::ent
         StatEffect stat_effect = {
             .type = StatEffect::Type_Multiply,
             .value = 1.0f - effect[level - 1],
-            .until = Input::time + duration,
+            .until = duration,
             .unique = hash_view("Resistance")
         };
         dtm->add_effect(hash_view("Resistance") ^ uint64(caster), stat_effect);
@@ -51,7 +51,7 @@ void Slow::apply(Scene* scene, entt::entity caster, const vector<entt::entity>&
         StatEffect stat_effect = {
             .type = StatEffect::Type_Multiply,
             .value = 1.0f - effect[level - 1],
-            .until = Input::time + duration,
+            .until = duration,
             .unique = hash_view("Slow")
         };
         speed->add_effect(hash_view("Slow") ^ uint64(caster), stat_effect);
@@ -67,7 +67,7 @@ void Haste::apply(Scene* scene, entt::entity caster, const vector<entt::entity>&
         StatEffect stat_effect = {
             .type = StatEffect::Type_Multiply,
             .value = 1.0f - effect[level - 1],
-            .until = Input::time + duration,
+            .until = duration,
             .unique = hash_view("Haste")
         };
         cast_speed->add_effect(hash_view("Haste") ^ uint64(caster), stat_effect);
@@ -100,7 +100,7 @@ void insert_newlines(int32& position, string& text, Font* font, const TextSettin
     bool replace_word_break = false;
 
     for (uint32 text_index = 0; text_index < text.size(); text_index++) {
-        char c = text[text_index];
+        uint32 c = _next_codepoint(text, text_index);
         if (reading_tag) {
             if (c == '}') {
                 reading_tag = false;
@@ -119,7 +119,7 @@ void insert_newlines(int32& position, string& text, Font* font, const TextSettin
             last_acceptable_word_break = text_index;
             replace_word_break = true;
         }
-        Glyph& glyph = font->glyphs[c];
+        const Glyph& glyph = font->get_glyph(c);
 
         position += glyph.mesh_advance.x;
         if (position > settings.width && last_acceptable_word_break >= 0) {
@@ -144,7 +144,7 @@ void preview_3d_components(Scene* scene, entt::entity entity) {
             vertices.emplace_back(center + radius * v3(math::cos(angle), math::sin(angle), 0.0f), palette::white, 0.02f);
         }
 
-        render_scene.quick_mesh(generate_formatted_line(render_scene.viewport.camera, std::move(vertices)), true, false);
+        render_scene.draw_line(render_scene.viewport.camera, vertices);
     }
 }
 
@@ -225,6 +225,9 @@ void Health::apply_dot(entt::entity damager, uint64 id, const StatEffect& effect
 
 
 void EmitterComponent::add_emitter(uint64 id, const EmitterCPU& emitter_cpu) {
+    // Particles only exist on the GPU
+    if (scene->headless)
+        return;
     emitters[id] = &instance_emitter(scene->render_scene, emitter_cpu, Input::time);
 }
 
@@ -306,7 +309,7 @@ void on_dragging_destroy(Scene& scene, entt::registry& registry, entt::entity en
         scene.registry.emplace<ForceDragging>(potential_swap, dragging.start_logic_position, 0.2f);
     }
 
-    scene.audio.play_sound("audio/step.flac"_resource, {.position = logic_tfm.position});
+    scene.audio.play_sound("audio/step.flac"_resource, {.position = logic_tfm.position, .sound_class = SoundClass_Step, .priority = -1});
     
     if (registry.any_of<Egg>(entity)) {
         entt::entity shrine_entity = scene.get_shrine(math::round_cast(dragging.potential_logic_position));
@@ -367,6 +370,24 @@ void on_emitter_component_destroy(Scene& scene, entt::registry& registry, entt::
         deinstance_emitter(*emitter_gpu, true);
 }
 
+void on_collision_destroy(Scene& scene, entt::registry& registry, entt::entity entity) {
+    Collision& collision = registry.get<Collision>(entity);
+    for (entt::entity other : collision.with) {
+        if (Collision* other_collision = registry.try_get<Collision>(other))
+            other_collision->with.erase(entity);
+    }
+    scene.broadphase.remove(entity);
+}
+
+// Colliders leave the broadphase with their transform, they're added back if one is emplaced again
+void on_logic_transform_destroy(Scene& scene, entt::registry& registry, entt::entity entity) {
+    Collision* collision = registry.try_get<Collision>(entity);
+    if (!collision)
+        return;
+    scene.broadphase.remove(entity);
+    collision->synced_radius = -1.0f;
+}
+
 void on_forcedrag_create(Scene& scene, entt::registry& registry, entt::entity entity) {
     if (registry.all_of<Draggable>(entity)) {
         Draggable& draggable = registry.get<Draggable>(entity);
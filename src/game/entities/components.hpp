@@ -127,6 +127,9 @@ struct ForceDragging {
 struct Collision {
     float                radius = 0.0f;
     uset<entt::entity> with = {};
+    // What the broadphase last saw, colliders that haven't moved since are skipped
+    v3                   synced_position = v3(0.0f);
+    float                synced_radius = -1.0f;
 };
 
 struct EmitterComponent {
@@ -157,6 +160,8 @@ void on_dragging_create(Scene& scene, entt::registry& registry, entt::entity ent
 void on_dragging_destroy(Scene& scene, entt::registry& registry, entt::entity entity);
 void on_model_destroy(Scene& scene, entt::registry& registry, entt::entity entity);
 void on_emitter_component_destroy(Scene& scene, entt::registry& registry, entt::entity entity);
+void on_collision_destroy(Scene& scene, entt::registry& registry, entt::entity entity);
+void on_logic_transform_destroy(Scene& scene, entt::registry& registry, entt::entity entity);
 
 void on_forcedrag_create(Scene& scene, entt::registry& registry, entt::entity entity);
 void on_forcedrag_destroy(Scene& scene, entt::registry& registry, entt::entity entity);
@@ -16,6 +16,7 @@
 #include "game/game.hpp"
 #include "game/pose_controller.hpp"
 #include "game/scene.hpp"
+#include "game/flow_field.hpp"
 #include "game/entities/components.hpp"
 #include "game/entities/consumer.hpp"
 #include "game/entities/caster.hpp"
@@ -57,7 +58,7 @@ void EnemyLaserAttack::trigger() {
                     float width = (timer->remaining_time / timer->total_time) * 0.05f + 0.03f;
                     vertices.emplace_back(logic_tfm->position + v3(0.5f, 0.5f, 0.19f), palette::light_pink, width + 0.05f);
                     vertices.emplace_back(liz_tfm->position + v3(0.5f), palette::red, width);
-                    timer->scene->render_scene.quick_mesh(generate_formatted_line(&timer->scene->camera, vertices), true, false);
+                    timer->scene->render_scene.draw_line(&timer->scene->camera, vertices);
                 }
             }
         }, false);
@@ -110,7 +111,7 @@ void EnemyResistorAttack::trigger() {
             add_formatted_square(vertices, logic_tfm.position + v3(0.5f, 0.5f, 0.0f), v3(radius, 0.f, 0.f), v3(0.f, radius, 0.f), color, line_width);
             if (vertices.empty())
                 return;
-            timer->scene->render_scene.quick_mesh(generate_formatted_line(&timer->scene->camera, vertices), true, false);
+            timer->scene->render_scene.draw_line(&timer->scene->camera, vertices);
         }
     }, false);
     aura_animate->start(duration);
@@ -152,7 +153,7 @@ void EnemyMortarAttack::trigger() {
             float width = (1.0f - timer->remaining_time / timer->total_time) * 0.05f + 0.05f;
             vertices.emplace_back(caster_logic_tfm.position + v3(0.5f, 0.5f, 0.0f), palette::light_pink, width);
             vertices.emplace_back(caster_logic_tfm.position + v3(0.5f, 0.5f, 0.0f) + v3::Z * 1.5f, palette::red, 0.0f);
-            timer->scene->render_scene.quick_mesh(generate_formatted_line(&timer->scene->camera, vertices), true, false);
+            timer->scene->render_scene.draw_line(&timer->scene->camera, vertices);
         }
     }, false);
     beam1_animate->start(beam_duration);
@@ -170,7 +171,7 @@ void EnemyMortarAttack::trigger() {
             add_formatted_square(vertices, v3(position_cap) + v3(0.5f, 0.5f, 0.02f), v3(radius, 0.0f, 0.f), v3(0.f, radius, 0.f), color, line_width);
             if (vertices.empty())
                 return;
-            timer->scene->render_scene.quick_mesh(generate_formatted_line(&timer->scene->camera, vertices), true, false);
+            timer->scene->render_scene.draw_line(&timer->scene->camera, vertices);
         }
     }, false);
     indicator_animate->start(indicator_duration);
@@ -194,7 +195,7 @@ void EnemyMortarAttack::trigger() {
                 float height = (timer->remaining_time / timer->total_time) * 1.0f + 0.5f;
                 vertices.emplace_back(v3(position_cap) + v3(0.5f, 0.5f, 0.0f), palette::light_pink, width);
                 vertices.emplace_back(v3(position_cap) + v3(0.5f, 0.5f, 0.0f) + v3::Z * height, palette::red, 0.0f);
-                timer->scene->render_scene.quick_mesh(generate_formatted_line(&timer->scene->camera, vertices), true, false);
+                timer->scene->render_scene.draw_line(&timer->scene->camera, vertices);
             }
         }, false);
         beam2_animate->start(beam_duration);
@@ -227,7 +228,7 @@ entt::entity instance_prefab(Scene* scene, const EnemyPrefab& prefab, v3i locati
         if (math::distance(path.path.get_start(), v3(location)) < 0.1f)
             available_paths.push_back(&path);
     }
-    PathInfo* selected_path = !available_paths.empty() ? available_paths[math::random_int32(available_paths.size())] : nullptr;
+    PathInfo* selected_path = !available_paths.empty() ? available_paths[scene->random[RandomStream_Spawning].random_int32(available_paths.size())] : nullptr;
     entt::entity spawner = selected_path ? selected_path->spawner : entt::null;
     entt::entity selected_consumer = selected_path ? selected_path->consumer : entt::null;
         
@@ -334,6 +335,7 @@ bool inspect(EnemyPrefab* enemy_prefab) {
 
 void enemy_ik_controller_system(Scene* scene) {
     ZoneScoped;
+    scene->ik_chains.clear();
     for (auto [entity, logic_tfm, model_tfm, model, ik] : scene->registry.view<LogicTransform, ModelTransform, Model, SpiderController>().each()) {
         if (!model.model_cpu->skeleton)
             continue;
@@ -366,9 +368,10 @@ void enemy_ik_controller_system(Scene* scene) {
         ik.update_constraints(scene, model, tfm_inv);
 
         if ((set0_moving && !ik.is_set_moving(0)) || (set1_moving && !ik.is_set_moving(1))) {
-            scene->audio.play_sound("audio/enemy/step.wav"_resource, {.position = logic_tfm.position});
+            scene->audio.play_sound("audio/enemy/step.wav"_resource, {.position = logic_tfm.position, .sound_class = SoundClass_Step, .priority = -1});
         }
     }
+    scene->ik_chains.solve();
 }
 
 void enemy_innate_bot_system(Scene* scene) {
@@ -480,7 +483,9 @@ void traveler_reset_system(Scene* scene) {
     ZoneScoped;
     for (auto [entity, traveler] : scene->registry.view<Traveler>().each()) {
         traveler.reset_target();
+        traveler.flow_field = nullptr;
     }
+    scene->flow_fields.evict_unused(scene->frame);
 }
 
 void travel_system(Scene* scene) {
@@ -490,13 +495,20 @@ void travel_system(Scene* scene) {
             continue;
         if (!traveler.has_target())
             continue;
+
+        // Sample the shared field when it covers us, otherwise fall back to our own path
+        if (scene->flow_fields.enabled) {
+            FlowField& field = scene->flow_fields.get(traveler.target.pos, scene->frame);
+            if (field.reachable(math::round_cast(transform.position)))
+                traveler.flow_field = &field;
+        }
         
         // Update pathing from target
-        if (!traveler.path.valid() || math::round_cast(traveler.path.get_destination()) != traveler.target.pos) {
+        if (!traveler.flow_field && (!traveler.path.valid() || math::round_cast(traveler.path.get_destination()) != traveler.target.pos)) {
             traveler.path = scene->navigation->find_path(math::round_cast(transform.position), traveler.target.pos);
         }
 
-        if (!traveler.path.valid())
+        if (!traveler.flow_field && !traveler.path.valid())
             continue;
 
         Enemy* enemy = scene->registry.try_get<Enemy>(entity);
@@ -505,11 +517,13 @@ void travel_system(Scene* scene) {
             continue;
         
         // Use pathing to move
-        v3   velocity        = v3(traveler.path.get_real_target(transform.position)) - transform.position;
+        v3   next_position   = traveler.flow_field ? traveler.flow_field->next_position(transform.position) : v3(traveler.path.get_real_target(transform.position));
+        v3   velocity        = next_position - transform.position;
         bool at_target       = math::length(velocity) < 0.05f;
         if (at_target) {
             velocity = v3(0);
-            traveler.path.reached--;
+            if (!traveler.flow_field)
+                traveler.path.reached--;
         }
         float max_velocity = traveler.max_speed->value() * scene->delta_time;
         float min_velocity = 0.0f;
@@ -531,7 +545,7 @@ void enemy_decollision_system(Scene* scene) {
             float push_amount = scene->delta_time * math::map_range(dist, {0.0f, 0.4f}, {1.0f, 0.0f});
             if (push_amount < scene->delta_time * 0.1f)
                 continue;
-            v2 jitter = {math::random_float(0.1f), math::random_float(0.1f)};
+            v2 jitter = {scene->random[RandomStream_Decollision].random_float(0.1f), scene->random[RandomStream_Decollision].random_float(0.1f)};
             v3 push_dir = math::normalize(v3(logic_tfm2.position.xy - logic_tfm1.position.xy + jitter, 0.0f));
             logic_tfm2.position += push_amount * push_dir;
         }
@@ -539,6 +553,8 @@ void enemy_decollision_system(Scene* scene) {
 }
 
 v3 predict_pos(Traveler& traveler, v3 pos, float time) {
+    if (traveler.flow_field)
+        return traveler.flow_field->predict_pos(pos, traveler.max_speed->value(), time);
     v3 expected_pos = pos;
     if (time == 0.0f)
         return expected_pos;
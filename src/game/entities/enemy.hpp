@@ -12,6 +12,7 @@
 namespace spellbook {
 
 struct Scene;
+struct FlowField;
 
 enum EnemyType {
     EnemyType_Empty,
@@ -53,6 +54,8 @@ struct Traveler {
 
     Target target = {};
     Path path = {};
+    // Set for the frame when the scene navigates with flow fields, path is unused then
+    FlowField* flow_field = nullptr;
     
     void set_target(Target new_target) {
         assert_else(new_target.priority != INT_MAX);
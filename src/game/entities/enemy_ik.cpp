@@ -128,7 +128,7 @@ void SpiderController::update_constraints(Scene* scene, const Model& model, cons
 
         v3 local_current_target = math::apply_transform(tfm_inv, get_control_point(i));
         IKTarget ik_target = {bone, local_current_target, 3};
-        apply_constraints(ik_target);
+        scene->ik_chains.add(ik_target, &leg_solutions[i]);
         lerp_t[i] += scene->delta_time / settings.step_time;
     }
 }
@@ -5,6 +5,7 @@
 #include "general/math/geometry.hpp"
 #include "general/math/matrix.hpp"
 #include "general/math/math.hpp"
+#include "renderer/assets/skeleton.hpp"
 
 namespace spellbook {
 
@@ -49,6 +50,8 @@ struct SpiderController {
 
     float updated_desired_dist_from_center;
 
+    IKWarmStart leg_solutions[4];
+
     SpiderController(SpiderControllerSettings& settings);
     
     v3 get_control_point(int i) {
@@ -75,6 +78,7 @@ struct SpiderController {
     void update_target(Scene* scene, const LogicTransform& logic_tfm);
     bool check_all_targets_set();
     void update_transform_linkers();
+    // Queues the legs into the scene's ik chains, which are solved together after every spider is updated
     void update_constraints(Scene* scene, const Model& model, const m44& tfm_inv);
 
     
@@ -116,7 +116,7 @@ void RangerAttack::trigger() {
                     add_formatted_square(vertices, pos, v3(0.40f, 0.f, 0.f), v3(0.f, 0.40f, 0.f), palette::steel_blue, width);
                     if (vertices.empty())
                         return;
-                    scene_cap->render_scene.quick_mesh(generate_formatted_line(&scene_cap->camera, vertices), true, false);         
+                    scene_cap->render_scene.draw_line(&scene_cap->camera, vertices);         
                 }, true)->start(0.2f);
                 
                 // Vulnerability
@@ -300,7 +300,7 @@ void draw_dragging_preview<LizardType_Ranger>(Scene* scene, entt::entity entity)
     add_formatted_square(vertices, pos, v3(3.5f, 0.f, 0.f), v3(0.f, 3.5f, 0.f), palette::steel_blue, 0.05f);
     if (vertices.empty())
         return;
-    scene->render_scene.quick_mesh(generate_formatted_line(&scene->camera, vertices), true, false);
+    scene->render_scene.draw_line(&scene->camera, vertices);
 }
 
 }
@@ -153,7 +153,7 @@ void draw_warlock_dragging_preview(Scene* scene, entt::entity entity) {
     add_formatted_square(vertices, pos, v3(2.5f, 0.f, 0.f), v3(0.f, 2.5f, 0.f), palette::indian_red, 0.05f);
     if (vertices.empty())
         return;
-    scene->render_scene.quick_mesh(generate_formatted_line(&scene->camera, vertices), true, false);
+    scene->render_scene.draw_line(&scene->camera, vertices);
 }
 
 }
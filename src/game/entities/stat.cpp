@@ -1,11 +1,16 @@
 ﻿#include "stat.hpp"
 
+#include <chrono>
 #include <imgui.h>
 #include <imgui/misc/cpp/imgui_stdlib.h>
+#include <tracy/Tracy.hpp>
 
+#include "extension/fmt.hpp"
 #include "extension/imgui_extra.hpp"
 #include "game/scene.hpp"
+#include "game/entities/caster.hpp"
 #include "game/entities/components.hpp"
+#include "game/entities/enemy.hpp"
 #include "renderer/assets/particles.hpp"
 
 namespace spellbook {
@@ -34,6 +39,9 @@ void Stat::add_effect(uint64 id, const StatEffect& init_effect, EmitterCPU* emit
     // Refresh and add stacks
     effect_value.stacks = math::min(effect_value.stacks + init_effect.stacks, effect_value.max_stacks);
     effect_value.until = scene->time + init_effect.until;
+    if (effect_value.until != FLT_MAX)
+        expiries.push({effect_value.until, id});
+    version++;
 
     if (emitter && adding) {
         EmitterComponent& emitters = scene->registry.get<EmitterComponent>(entity);
@@ -46,6 +54,7 @@ umap<uint64, StatEffect>::iterator Stat::remove_effect(umap<uint64, StatEffect>:
     if (emitters)
         emitters->remove_emitter(it->first);
 
+    version++;
     return effects.erase(it);
 }
 
@@ -56,79 +65,98 @@ void Stat::remove_effect(uint64 id) {
             emitters->remove_emitter(id);
 
         effects.erase(id);
+        version++;
     }
 }
 
-
-float Stat::value() {
-    float base = 0.0f;
-    float mult = 1.0f;
-    float add  = 0.0f;
-
-    for (auto it = effects.begin(); it != effects.end();) {
-        auto& [_, effect] = *it;
-            
-        if (effect.until < scene->time)
-            it = remove_effect(it);
-        else
-            it++;
+void Stat::prune() {
+    while (!expiries.empty() && expiries.top().until < scene->time) {
+        StatExpiry expiry = expiries.top();
+        expiries.pop();
+        auto it = effects.find(expiry.id);
+        // refreshed or already removed
+        if (it == effects.end() || it->second.until != expiry.until)
+            continue;
+        remove_effect(it);
     }
-    
+}
+
+static StatTotals fold_effects(const umap<uint64, StatEffect>& effects) {
+    StatTotals totals;
     for (auto& [_, effect] : effects) {
         switch (effect.type) {
             case (StatEffect::Type_Base): {
-                base += effect.value * effect.stacks;
+                totals.base += effect.value * effect.stacks;
             } break;
             case (StatEffect::Type_Multiply): {
-                mult *= math::pow(1.0f + effect.value, (float) effect.stacks);
+                totals.mult *= math::pow(1.0f + effect.value, (float) effect.stacks);
             } break;
             case (StatEffect::Type_Add): {
-                add += effect.value * effect.stacks;
+                totals.add += effect.value * effect.stacks;
             } break;
             case (StatEffect::Type_Override): {
-                return effect.value;
+                totals.overridden = true;
+                totals.override_value = effect.value;
             } break;
         }
+        if (totals.overridden)
+            break;
     }
-    
-    return base * mult + add;
+    return totals;
+}
+
+float StatTotals::apply(float instance_base) const {
+    if (overridden)
+        return override_value;
+    return (instance_base + base) * mult + add;
+}
+
+void Stat::refresh_cache() {
+    if (cached_version == version)
+        return;
+    cached = fold_effects(effects);
+    cached_version = version;
+}
+
+void Stat::update() {
+    prune();
+    refresh_cache();
+}
+
+StatTotals Stat::totals() const {
+    return cached_version == version ? cached : fold_effects(effects);
+}
+
+float Stat::value() const {
+    return totals().apply(0.0f);
 }
 
 float StatInstance::value() const {
     if (stat == nullptr)
         return 0.0f;
-    
-    float base = instance_base;
-    float mult = 1.0f;
-    float add  = 0.0f;
+    return stat->totals().apply(instance_base);
+}
 
-    for (auto it = stat->effects.begin(); it != stat->effects.end();) {
-        auto& [_, effect] = *it;
-            
-        if (effect.until < stat->scene->time)
-            it = stat->remove_effect(it);
-        else
-            it++;
+void stat_system(Scene* scene) {
+    ZoneScoped;
+    auto update = [](const std::unique_ptr<Stat>& stat) {
+        if (stat)
+            stat->update();
+    };
+    for (auto [entity, health] : scene->registry.view<Health>().each()) {
+        update(health.max_health);
+        update(health.damage_taken_multiplier);
+        update(health.regen);
+        for (auto& [dotter, dot] : health.dots)
+            update(dot);
     }
-    
-    for (auto& [_, effect] : stat->effects) {
-        switch (effect.type) {
-            case (StatEffect::Type_Base): {
-                base += effect.value * effect.stacks;
-            } break;
-            case (StatEffect::Type_Multiply): {
-                mult *= math::pow(1.0f + effect.value, (float) effect.stacks);
-            } break;
-            case (StatEffect::Type_Add): {
-                add += effect.value * effect.stacks;
-            } break;
-            case (StatEffect::Type_Override): {
-                return effect.value;
-            } break;
-        }
+    for (auto [entity, caster] : scene->registry.view<Caster>().each()) {
+        for (auto stat : {&caster.damage, &caster.heal, &caster.attack_speed, &caster.cooldown_speed, &caster.projectile_speed,
+                          &caster.range, &caster.buff_duration, &caster.debuff_duration, &caster.lifesteal})
+            update(*stat);
     }
-    
-    return base * mult + add;
+    for (auto [entity, traveler] : scene->registry.view<Traveler>().each())
+        update(traveler.max_speed);
 }
 
 void inspect(Stat* stat) {
@@ -150,13 +178,98 @@ void inspect(Stat* stat) {
         ImGui::TableSetColumnIndex(0);
         ImGui::Text("%llu", id);
         ImGui::TableSetColumnIndex(1);
-        ImGui::EnumCombo("##Effect", &effect.type);
+        if (ImGui::EnumCombo("##Effect", &effect.type))
+            stat->version++;
         ImGui::TableSetColumnIndex(2);
-        ImGui::DragFloat("##Value", &effect.value, 0.01f);
+        if (ImGui::DragFloat("##Value", &effect.value, 0.01f))
+            stat->version++;
         ImGui::PopID();
     }
     ImGui::EndTable();
     ImGui::PopID();
 }
 
+// Uncached evaluation, kept for comparison
+static float recompute_stat_value(Stat& stat) {
+    for (auto it = stat.effects.begin(); it != stat.effects.end();) {
+        if (it->second.until < stat.scene->time)
+            it = stat.effects.erase(it);
+        else
+            it++;
+    }
+
+    float base = 0.0f;
+    float mult = 1.0f;
+    float add  = 0.0f;
+    for (auto& [_, effect] : stat.effects) {
+        switch (effect.type) {
+            case (StatEffect::Type_Base): {
+                base += effect.value * effect.stacks;
+            } break;
+            case (StatEffect::Type_Multiply): {
+                mult *= math::pow(1.0f + effect.value, (float) effect.stacks);
+            } break;
+            case (StatEffect::Type_Add): {
+                add += effect.value * effect.stacks;
+            } break;
+            case (StatEffect::Type_Override): {
+                return effect.value;
+            } break;
+        }
+    }
+    return base * mult + add;
+}
+
+string benchmark_stat(int effect_count, int queries) {
+    using clock = std::chrono::steady_clock;
+    constexpr int frames = 600;
+    constexpr float frame_time = 1.0f / 60.0f;
+
+    auto scene = std::make_unique<Scene>();
+    Stat cached_stat(&*scene, entt::null, 10.0f);
+    Stat reference_stat(&*scene, entt::null, 10.0f);
+    auto add_random_effect = [&](uint64 id) {
+        StatEffect effect = {
+            .type = math::random_float(1.0f) < 0.5f ? StatEffect::Type_Multiply : StatEffect::Type_Add,
+            .value = math::random_float(0.2f),
+            .max_stacks = 5,
+            .until = 1.0f + math::random_float(8.0f),
+            .stacks = 1 + math::random_int32(5)
+        };
+        cached_stat.add_effect(id, effect);
+        reference_stat.add_effect(id, effect);
+    };
+    for (int i = 0; i < effect_count; i++)
+        add_random_effect(i + 1);
+
+    double cached_ms = 0.0;
+    double reference_ms = 0.0;
+    float max_error = 0.0f;
+    uint64 next_id = effect_count + 1;
+    for (int frame = 0; frame < frames; frame++) {
+        scene->time += frame_time;
+        // keep the stack count roughly steady as effects expire
+        while (reference_stat.effects.size() < uint32(effect_count))
+            add_random_effect(next_id++);
+
+        float cached_value = 0.0f;
+        float reference_value = 0.0f;
+        auto t0 = clock::now();
+        cached_stat.update();
+        for (int i = 0; i < queries; i++)
+            cached_value += cached_stat.value();
+        auto t1 = clock::now();
+        for (int i = 0; i < queries; i++)
+            reference_value += recompute_stat_value(reference_stat);
+        auto t2 = clock::now();
+
+        cached_ms += std::chrono::duration<double, std::milli>(t1 - t0).count();
+        reference_ms += std::chrono::duration<double, std::milli>(t2 - t1).count();
+        max_error = math::max(max_error, math::abs(cached_value - reference_value) / float(queries));
+    }
+
+    return fmt_("{} effects, {} queries/frame over {} frames: cached {:.2f}ms, recomputed {:.2f}ms, max error {}",
+        effect_count, queries, frames, cached_ms, reference_ms, max_error);
+}
+
 }
@@ -1,8 +1,10 @@
 #pragma once
 
+#include <queue>
 #include <entt/entity/fwd.hpp>
 
 #include "general/input.hpp"
+#include "general/string.hpp"
 #include "general/umap.hpp"
 #include "general/math/math.hpp"
 
@@ -22,12 +24,45 @@ struct StatEffect {
     uint64 unique = 0; // If multiple buffs of this id, take best
 };
 
+struct StatExpiry {
+    float until;
+    uint64 id;
+    bool operator>(const StatExpiry& other) const { return until > other.until; }
+};
+
+// Effects folded together, StatInstance applies its own base on top
+struct StatTotals {
+    float base = 0.0f;
+    float mult = 1.0f;
+    float add = 0.0f;
+    bool overridden = false;
+    float override_value = 0.0f;
+
+    float apply(float instance_base) const;
+};
+
 struct Stat {
     Scene* scene = nullptr;
     entt::entity entity;
     umap<uint64, StatEffect> effects;
 
-    float value();
+    // Bump when effects are modified directly, add_effect and remove_effect handle it
+    uint64 version = 0;
+    // Entries go stale when an effect is refreshed or removed, they're checked against the effect when popped
+    std::priority_queue<StatExpiry, std::vector<StatExpiry>, std::greater<StatExpiry>> expiries;
+
+    // Totals for cached_version
+    uint64 cached_version = UINT64_MAX;
+    StatTotals cached;
+
+    // Reads never change the stat, so systems running concurrently can query it. Effects changed since the last update
+    // are folded on the fly until the next one.
+    float value() const;
+    StatTotals totals() const;
+    // Drops expired effects and refreshes the cache, once per step from stat_system
+    void update();
+    void prune();
+    void refresh_cache();
     void add_effect(uint64 id, const StatEffect& effect, EmitterCPU* emitter = nullptr);
     umap<uint64, StatEffect>::iterator remove_effect(umap<uint64, StatEffect>::iterator it);
     void remove_effect(uint64 id);
@@ -47,6 +82,12 @@ struct StatInstance {
 
 float stat_instance_value(Stat* stat, float instance_base);
 
+// Updates every stat in the scene, expiring effects remove their emitters so this runs exclusively
+void stat_system(Scene* scene);
+
 void inspect(Stat* stat);
 
+// Queries a stat with many stacked effects against recomputing from the effect map every time
+string benchmark_stat(int effect_count, int queries);
+
 }
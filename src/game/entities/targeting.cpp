@@ -1,9 +1,13 @@
 ﻿#include "targeting.hpp"
 
+#include <chrono>
 #include <entt/core/hashed_string.hpp>
 
+#include "extension/fmt.hpp"
 #include "general/astar.hpp"
 #include "game/scene.hpp"
+#include "game/map.hpp"
+#include "game/simulation.hpp"
 #include "game/entities/enemy.hpp"
 #include "game/entities/spawner.hpp"
 #include "game/entities/ability.hpp"
@@ -26,84 +30,135 @@ bool taunted(Ability& ability, Caster& caster) {
     return false;
 }
 
+static bool is_eval(const EntryEvalFunction& eval_func, int (*func)(Scene*, const uset<entt::entity>&)) {
+    auto target = eval_func.target<int (*)(Scene*, const uset<entt::entity>&)>();
+    return target && *target == func;
+}
+
+void score_entries(Ability& ability, const EntryGatherFunction& gather_func, const EntryEvalFunction& eval_func,
+    std::span<const v3i> positions, std::span<const float> times_to, std::span<int32> scores) {
+    Scene* scene = ability.scene;
+    bool simple = is_eval(eval_func, simple_entry_eval);
+    bool eggs = is_eval(eval_func, basic_lizard_entry_eval);
+    EnemyWeight weight = eggs ? EnemyWeight_Egg : EnemyWeight_One;
+
+    if ((simple || eggs) && (gather_func.type == EntryGatherType_Enemies || gather_func.type == EntryGatherType_EnemiesAoe)) {
+        int32 radius = gather_func.type == EntryGatherType_EnemiesAoe ? gather_func.range : 0;
+        // Runs of equal times share one occupancy grid
+        for (uint32 begin = 0, end = 0; begin < positions.size(); begin = end) {
+            for (end = begin + 1; end < positions.size() && times_to[end] == times_to[begin]; end++) {}
+            scene->targeting->score_enemy_windows(positions.subspan(begin, end - begin), radius, times_to[begin], weight,
+                scores.subspan(begin, end - begin));
+        }
+        return;
+    }
+
+    if ((simple || eggs) && gather_func.type == EntryGatherType_EnemiesFloor) {
+        // Everything on a level scores the same, so each run of positions on one level counts the enemies once
+        for (uint32 begin = 0, end = 0; begin < positions.size(); begin = end) {
+            int32 score = 0;
+            for (auto [entity, enemy, logic_tfm] : scene->registry.view<Enemy, LogicTransform>().each()) {
+                if (math::round_cast(logic_tfm.position.z) == positions[begin].z)
+                    score += eggs && scene->registry.any_of<Egg>(enemy.attachment) ? 10 : 1;
+            }
+            for (end = begin; end < positions.size() && positions[end].z == positions[begin].z; end++)
+                scores[end] = score;
+        }
+        return;
+    }
+
+    if (simple && gather_func.type == EntryGatherType_Lizard) {
+        for (uint32 i = 0; i < positions.size(); i++) {
+            entt::entity liz = scene->targeting->select_lizard(positions[i]);
+            Tags* liz_tags = scene->registry.try_get<Tags>(liz);
+            scores[i] = liz != entt::null && !(liz_tags && liz_tags->has_tag("untargetable"_hs)) ? 1 : 0;
+        }
+        return;
+    }
+
+    for (uint32 i = 0; i < positions.size(); i++)
+        scores[i] = eval_func(scene, gather_func(ability, positions[i], times_to[i]));
+}
+
+// One of the best scoring entries, -1 when the best doesn't score. Picks like the lists of best entries always have,
+// where the first entry was listed twice when it's among the best, so the same seed still picks the same target.
+template <typename Score>
+static int32 pick_best_entry(std::span<const int32> scores, RandomStream& random) {
+    uint32 best = 0;
+    for (uint32 i = 1; i < scores.size(); i++) {
+        if (Score(scores[i]) > Score(scores[best]))
+            best = i;
+    }
+    if (!(Score(scores[best]) > 0))
+        return -1;
+
+    int32 ties = best == 0 ? 2 : 1;
+    for (uint32 i = best + 1; i < scores.size(); i++) {
+        if (Score(scores[i]) == Score(scores[best]))
+            ties++;
+    }
+    int32 pick = random.random_int32(ties) - (best == 0 ? 2 : 1);
+    if (pick < 0)
+        return best;
+    for (uint32 i = best + 1; i < scores.size(); i++) {
+        if (Score(scores[i]) == Score(scores[best]) && pick-- == 0)
+            return i;
+    }
+    return best;
+}
+
 bool square_targeting(int range, Ability& ability, const EntryGatherFunction& gather_func, const EntryEvalFunction& eval_func) {
     v3i caster_pos = math::round_cast(ability.scene->registry.get<LogicTransform>(ability.caster).position);
-    struct Entry {
-        v3i offset = {};
-        int count;
-    };
-    vector<Entry> entries;
-    auto add_entry = [&ability, &entries, &caster_pos, &gather_func, &eval_func](v3i offset) {
-        float time_to = ability.time_to_hit(caster_pos + offset);
-        int score = eval_func(ability.scene, gather_func(ability, caster_pos + offset, time_to));
-        entries.emplace_back(offset, score);
-    };
+    MapTargeting& targeting = *ability.scene->targeting;
+    targeting.entry_positions.clear();
+    targeting.entry_times.clear();
     for (int x = -range; x <= range; x++) {
         for (int y = -range; y <= range; y++) {
-            add_entry(v3i(x,y,0));
+            targeting.entry_positions.push_back(caster_pos + v3i(x, y, 0));
+            targeting.entry_times.push_back(ability.time_to_hit(caster_pos + v3i(x, y, 0)));
         }
     }
     
-    if (entries.empty()) {
+    if (targeting.entry_positions.empty()) {
         ability.has_target = false;
         return false;
     }
     
-    vector closest_entries = {entries.front()};
-    for (auto& entry : entries) {
-        if (entry.count > closest_entries.begin()->count)
-            closest_entries = {entry};
-        else if (entry.count == closest_entries.begin()->count)
-            closest_entries.push_back(entry);
-    }
-    if (closest_entries.front().count > 0) {
-        ability.target = caster_pos + closest_entries[math::random_int32(closest_entries.size())].offset;
-        ability.has_target = true;
-    } else {
-        ability.has_target = false;
-    }
+    targeting.entry_scores.resize(targeting.entry_positions.size());
+    score_entries(ability, gather_func, eval_func, targeting.entry_positions, targeting.entry_times, targeting.entry_scores);
+    int32 picked = pick_best_entry<int32>(targeting.entry_scores, ability.scene->random[RandomStream_Targeting]);
+    ability.has_target = picked != -1;
+    if (ability.has_target)
+        ability.target = targeting.entry_positions[picked];
     return ability.has_target;
 }
 
 bool plus_targeting(int range, Ability& ability, const EntryGatherFunction& gather_func, const EntryEvalFunction& eval_func) {
     v3i caster_pos = math::round_cast(ability.scene->registry.get<LogicTransform>(ability.caster).position);
-    struct Entry {
-        v3i offset = {};
-        uint32 count;
-    };
-    vector<Entry> entries;
-    auto add_entry = [&ability, &entries, &caster_pos, &gather_func, &eval_func](v3i offset) {
-        float time_to = ability.time_to_hit(caster_pos + offset);
-        int score = eval_func(ability.scene, gather_func(ability, caster_pos + offset, time_to));
-        entries.emplace_back(offset, score);
-    };
-
+    MapTargeting& targeting = *ability.scene->targeting;
+    targeting.entry_positions.clear();
+    targeting.entry_times.clear();
     for (const v2i& offset : {v2i{-range, 0}, v2i{0, -range}, v2i{range, 0}, v2i{0, range}}) {
         bool blocked = ability.scene->map_data.solids.get(caster_pos + v3i(offset.x, offset.y, 0));
         bool has_floor = ability.scene->map_data.solids.get(caster_pos + v3i(offset.x, offset.y, -1));
         if (blocked || !has_floor)
             continue;
-        add_entry(v3i(offset.x, offset.y, 0)); 
+        targeting.entry_positions.push_back(caster_pos + v3i(offset.x, offset.y, 0));
+        targeting.entry_times.push_back(ability.time_to_hit(caster_pos + v3i(offset.x, offset.y, 0)));
     }
 
-    if (entries.empty()) {
+    if (targeting.entry_positions.empty()) {
         ability.has_target = false;
         return false;
     }
     
-    vector closest_entries = {entries.front()};
-    for (auto& entry : entries) {
-        if (entry.count > closest_entries.begin()->count)
-            closest_entries = {entry};
-        else if (entry.count == closest_entries.begin()->count)
-            closest_entries.push_back(entry);
-    }
-    if (closest_entries.front().count > 0) {
-        ability.target = caster_pos + closest_entries[math::random_int32(closest_entries.size())].offset;
-        ability.has_target = true;
-    } else {
-        ability.has_target = false;
-    }
+    targeting.entry_scores.resize(targeting.entry_positions.size());
+    score_entries(ability, gather_func, eval_func, targeting.entry_positions, targeting.entry_times, targeting.entry_scores);
+    // Compared unsigned, as the entries always were here
+    int32 picked = pick_best_entry<uint32>(targeting.entry_scores, ability.scene->random[RandomStream_Targeting]);
+    ability.has_target = picked != -1;
+    if (ability.has_target)
+        ability.target = targeting.entry_positions[picked];
     return ability.has_target;
 }
 
@@ -145,7 +200,7 @@ bool trap_targeting(Ability& ability) {
 
 
 EntryGatherFunction gather_enemies_aoe(int range) {
-    return [range](Ability& ability, v3i pos, float time_to) -> uset<entt::entity> {
+    return {EntryGatherType_EnemiesAoe, range, [range](Ability& ability, v3i pos, float time_to) -> uset<entt::entity> {
         uset<entt::entity> enemies;
         for (int x = -range; x <= range; x++) {
             for (int y = -range; y <= range; y++) {
@@ -154,11 +209,11 @@ EntryGatherFunction gather_enemies_aoe(int range) {
             }
         }
         return enemies;
-    };
+    }};
 }
 
 EntryGatherFunction gather_enemies_floor() {
-    return [](Ability& ability, v3i pos, float time_to) -> uset<entt::entity> {
+    return {EntryGatherType_EnemiesFloor, 0, [](Ability& ability, v3i pos, float time_to) -> uset<entt::entity> {
         uset<entt::entity> enemies;
         for (auto [entity, enemy, logic_tfm] : ability.scene->registry.view<Enemy, LogicTransform>().each()) {
             int level_diff = math::round_cast(logic_tfm.position.z) - pos.z;
@@ -166,11 +221,11 @@ EntryGatherFunction gather_enemies_floor() {
                 enemies.insert(entity);
         }
         return enemies;
-    };
+    }};
 }
 
 EntryGatherFunction gather_lizard() {
-    return [](Ability& ability, v3i pos, float time_to) -> uset<entt::entity> {
+    return {EntryGatherType_Lizard, 0, [](Ability& ability, v3i pos, float time_to) -> uset<entt::entity> {
         entt::entity liz = ability.scene->targeting->select_lizard(pos);
 
         Tags* liz_tags = ability.scene->registry.try_get<Tags>(liz);
@@ -179,16 +234,16 @@ EntryGatherFunction gather_lizard() {
                 return uset<entt::entity>{};
         }
         return liz == entt::null ? uset<entt::entity>{} : uset<entt::entity>{liz};
-    };
+    }};
 }
 
 EntryGatherFunction gather_enemies() {
-    return [](Ability& ability, v3i pos, float time_to) -> uset<entt::entity> {
+    return {EntryGatherType_Enemies, 0, [](Ability& ability, v3i pos, float time_to) -> uset<entt::entity> {
         uset<entt::entity> enemies;
         for (entt::entity e : ability.scene->targeting->select_enemies(pos, time_to))
             enemies.insert(e);
         return enemies;
-    };
+    }};
 }
 
 int simple_entry_eval(Scene* scene, const uset<entt::entity>& units) {
@@ -207,6 +262,97 @@ int basic_lizard_entry_eval(Scene* scene, const uset<entt::entity>& units) {
     return counter;
 }
 
+string verify_entry_scores(int casters, int enemies) {
+    using clock = std::chrono::steady_clock;
+    constexpr int frames = 30;
+    constexpr int range = 2;
+    if (casters <= 0 || enemies <= 0)
+        return "needs at least one caster and enemy";
+
+    FilePath map_path = map_with_most_rounds();
+    if (!map_path.is_file())
+        return "no maps with spawn rounds";
+    Scene* scene = instance_map(load_resource<MapPrefab>(map_path), "entry_scores", true);
+    scene->set_edit_mode(false);
+    scene->set_seed(1);
+    if (!spawn_enemy_crowd(scene, enemies)) {
+        scene->registry.clear();
+        scene->cleanup();
+        delete scene;
+        return fmt_("{} has no enemies to spawn", map_path.rel_string());
+    }
+    for (int i = 0; i < 10; i++) {
+        scene->step(1.0f / 60.0f);
+        scene->render_scene.delete_frame_allocated();
+    }
+
+    // Casters stand in the crowd, each with its own time to hit
+    vector<v3i> enemy_cells;
+    for (auto [entity, enemy, logic_tfm] : scene->registry.view<Enemy, LogicTransform>().each())
+        enemy_cells.push_back(math::round_cast(logic_tfm.position));
+    RandomStream random;
+    random.seed(1, 0);
+    vector<v3i> caster_cells;
+    for (int i = 0; i < casters; i++)
+        caster_cells.push_back(enemy_cells[random.random_int32(enemy_cells.size())]);
+
+    struct Pairing {
+        EntryGatherFunction gather;
+        EntryEvalFunction eval;
+    };
+    vector<Pairing> pairings;
+    for (EntryEvalFunction eval : {EntryEvalFunction(simple_entry_eval), EntryEvalFunction(basic_lizard_entry_eval)}) {
+        pairings.push_back({gather_enemies(), eval});
+        pairings.push_back({gather_enemies_aoe(1), eval});
+        pairings.push_back({gather_enemies_aoe(2), eval});
+        pairings.push_back({gather_enemies_floor(), eval});
+    }
+    pairings.push_back({gather_lizard(), simple_entry_eval});
+
+    Ability ability(scene, entt::null);
+    vector<v3i> positions;
+    vector<float> times_to;
+    vector<int32> scores;
+    double scored_ms = 0.0;
+    double gathered_ms = 0.0;
+    uint64 checked = 0;
+    uint32 mismatches = 0;
+    for (int frame = 0; frame < frames; frame++) {
+        scene->frame++;
+        scene->time += 1.0f / 60.0f;
+        for (uint32 c = 0; c < caster_cells.size(); c++) {
+            positions.clear();
+            times_to.clear();
+            for (int x = -range; x <= range; x++) {
+                for (int y = -range; y <= range; y++) {
+                    positions.push_back(caster_cells[c] + v3i(x, y, 0));
+                    times_to.push_back(0.1f * float(1 + c % 8));
+                }
+            }
+            scores.resize(positions.size());
+            for (const Pairing& pairing : pairings) {
+                auto t0 = clock::now();
+                score_entries(ability, pairing.gather, pairing.eval, positions, times_to, scores);
+                auto t1 = clock::now();
+                for (uint32 i = 0; i < positions.size(); i++) {
+                    if (scores[i] != pairing.eval(scene, pairing.gather(ability, positions[i], times_to[i])))
+                        mismatches++;
+                }
+                auto t2 = clock::now();
+                scored_ms += std::chrono::duration<double, std::milli>(t1 - t0).count();
+                gathered_ms += std::chrono::duration<double, std::milli>(t2 - t1).count();
+                checked += positions.size();
+            }
+        }
+    }
+
+    scene->registry.clear();
+    scene->cleanup();
+    delete scene;
+    return fmt_("{} casters, {} enemies, {} frames: {} of {} scores differ, scored {:.3f}ms/frame, gathered sets {:.3f}ms/frame",
+        casters, enemies, frames, mismatches, checked, scored_ms / frames, gathered_ms / frames);
+}
+
 
 
 }
@@ -1,7 +1,10 @@
 ﻿#pragma once
 
+#include <functional>
+#include <span>
 #include <entt/entity/entity.hpp>
 
+#include "general/string.hpp"
 #include "general/math/geometry.hpp"
 #include "general/umap.hpp"
 
@@ -12,7 +15,23 @@ struct Caster;
 struct Scene;
 
 using EntryEvalFunction = std::function<int(Scene*, const uset<entt::entity>&)>;
-using EntryGatherFunction = std::function<uset<entt::entity>(Ability&, v3i, float)>;
+
+// What the built in gathers collect, so targeting can score candidates without building their sets
+enum EntryGatherType {
+    EntryGatherType_Custom,
+    EntryGatherType_Enemies,
+    EntryGatherType_EnemiesAoe,
+    EntryGatherType_EnemiesFloor,
+    EntryGatherType_Lizard
+};
+
+struct EntryGatherFunction {
+    EntryGatherType type = EntryGatherType_Custom;
+    int range = 0;
+    std::function<uset<entt::entity>(Ability&, v3i, float)> func;
+
+    uset<entt::entity> operator()(Ability& ability, v3i pos, float time_to) const { return func(ability, pos, time_to); }
+};
 
 bool trap_targeting(Ability& ability);
 
@@ -21,6 +40,11 @@ bool plus_targeting(int range, Ability& ability, const EntryGatherFunction& gath
 
 bool taunted(Ability&, Caster&);
 
+// Scores every position the same as eval_func(scene, gather_func(ability, position, time_to)). The built in gathers
+// paired with the built in evaluators are answered from the targeting grids without building any sets.
+void score_entries(Ability& ability, const EntryGatherFunction& gather_func, const EntryEvalFunction& eval_func,
+    std::span<const v3i> positions, std::span<const float> times_to, std::span<int32> scores);
+
 int simple_entry_eval(Scene* scene, const uset<entt::entity>& units);
 int basic_lizard_entry_eval(Scene* scene, const uset<entt::entity>& units);
 EntryGatherFunction gather_enemies_aoe(int range);
@@ -28,4 +52,8 @@ EntryGatherFunction gather_enemies_floor();
 EntryGatherFunction gather_lizard();
 EntryGatherFunction gather_enemies();
 
+// Scores square targeting candidates around casters casters in a crowd of enemies enemies with every built in
+// gather and evaluator, checks score_entries against building the sets, and times both
+string verify_entry_scores(int casters, int enemies);
+
 }
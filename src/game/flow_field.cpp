@@ -0,0 +1,410 @@
+#include "flow_field.hpp"
+
+#include <chrono>
+#include <queue>
+#include <imgui.h>
+#include <tracy/Tracy.hpp>
+
+#include "extension/fmt.hpp"
+#include "general/math/math.hpp"
+#include "general/astar.hpp"
+#include "game/scene.hpp"
+#include "game/path_cache.hpp"
+
+namespace spellbook {
+
+static const v3i horizontal_steps[4] = {v3i(1, 0, 0), v3i(-1, 0, 0), v3i(0, 1, 0), v3i(0, -1, 0)};
+
+static bool ramp_step(const MapData& map_data, v3i ramp_cell, v3i& step) {
+    auto it = map_data.ramps.find(ramp_cell);
+    if (it == map_data.ramps.end())
+        return false;
+    switch (it->second) {
+        case Direction_PosX: step = v3i(1, 0, 0); return true;
+        case Direction_NegX: step = v3i(-1, 0, 0); return true;
+        case Direction_PosY: step = v3i(0, 1, 0); return true;
+        case Direction_NegY: step = v3i(0, -1, 0); return true;
+        default: return false;
+    }
+}
+
+struct FlowQueueEntry {
+    float cost;
+    v3i cell;
+    bool operator>(const FlowQueueEntry& other) const { return cost > other.cost; }
+};
+using FlowQueue = std::priority_queue<FlowQueueEntry, std::vector<FlowQueueEntry>, std::greater<FlowQueueEntry>>;
+
+bool FlowField::standable(v3i cell) const {
+    if (map_data->solids.get(cell))
+        return false;
+    return map_data->path_solids.get(cell - v3i::Z) || map_data->ramps.contains(cell - v3i::Z);
+}
+
+// A ramp tile at v rising along d is stood on from v + Z, and joins the low side v - d with the high side v + d + Z
+void FlowField::neighbors(v3i cell, vector<v3i>& out) const {
+    out.clear();
+    v3i ramp_dir;
+    if (ramp_step(*map_data, cell - v3i::Z, ramp_dir)) {
+        if (standable(cell + ramp_dir))
+            out.push_back(cell + ramp_dir);
+        if (standable(cell - ramp_dir - v3i::Z))
+            out.push_back(cell - ramp_dir - v3i::Z);
+        return;
+    }
+    for (const v3i& step : horizontal_steps) {
+        v3i flat = cell + step;
+        if (standable(flat)) {
+            v3i flat_ramp_dir;
+            // ramps can only be entered horizontally from their high side
+            if (!ramp_step(*map_data, flat - v3i::Z, flat_ramp_dir) || flat_ramp_dir == -step)
+                out.push_back(flat);
+        }
+        v3i up = cell + step + v3i::Z;
+        v3i up_ramp_dir;
+        if (ramp_step(*map_data, cell + step, up_ramp_dir) && up_ramp_dir == step && standable(up))
+            out.push_back(up);
+    }
+}
+
+// Mirrors neighbors for a single pair
+bool FlowField::can_step(v3i from, v3i to) const {
+    if (!standable(from) || !standable(to))
+        return false;
+    v3i ramp_dir;
+    if (ramp_step(*map_data, from - v3i::Z, ramp_dir))
+        return to == from + ramp_dir || to == from - ramp_dir - v3i::Z;
+    v3i step = v3i(to.x - from.x, to.y - from.y, 0);
+    if (step.x * step.x + step.y * step.y != 1)
+        return false;
+    v3i to_ramp_dir;
+    if (to.z == from.z)
+        return !ramp_step(*map_data, to - v3i::Z, to_ramp_dir) || to_ramp_dir == -step;
+    return to.z == from.z + 1 && ramp_step(*map_data, to - v3i::Z, to_ramp_dir) && to_ramp_dir == step;
+}
+
+// Every step in neighbors moves one cell horizontally and at most one cell vertically
+void FlowField::predecessors(v3i cell, vector<v3i>& out) const {
+    out.clear();
+    for (const v3i& step : horizontal_steps) {
+        for (int32 dz = -1; dz <= 1; dz++) {
+            v3i from = cell + step + v3i(0, 0, dz);
+            if (can_step(from, cell))
+                out.push_back(from);
+        }
+    }
+}
+
+void FlowField::build() {
+    ZoneScoped;
+    costs.clear();
+    if (!standable(target))
+        return;
+
+    FlowQueue queue;
+    queue.push({0.0f, target});
+    vector<v3i> adjacent;
+    while (!queue.empty()) {
+        FlowQueueEntry entry = queue.top();
+        queue.pop();
+        if (costs.contains(entry.cell))
+            continue;
+        costs[entry.cell] = entry.cost;
+        predecessors(entry.cell, adjacent);
+        for (const v3i& prev : adjacent) {
+            if (!costs.contains(prev))
+                queue.push({entry.cost + 1.0f, prev});
+        }
+    }
+}
+
+void FlowField::repair(const vector<v3i>& changed_cells) {
+    ZoneScoped;
+    if (changed_cells.empty())
+        return;
+
+    // Standable cells and links only change directly around an edited tile
+    uset<v3i> affected;
+    for (const v3i& tile : changed_cells) {
+        for (int32 dz = -1; dz <= 2; dz++) {
+            affected.insert(tile + v3i(0, 0, dz));
+            for (const v3i& step : horizontal_steps)
+                affected.insert(tile + step + v3i(0, 0, dz));
+        }
+    }
+    if (affected.contains(target)) {
+        build();
+        return;
+    }
+
+    vector<v3i> adjacent;
+    auto supported = [this, &adjacent](v3i cell) {
+        if (!standable(cell))
+            return false;
+        float cost = costs[cell];
+        neighbors(cell, adjacent);
+        for (const v3i& next : adjacent) {
+            auto it = costs.find(next);
+            if (it != costs.end() && it->second < cost)
+                return true;
+        }
+        return false;
+    };
+
+    // Raise: drop cells that lost the neighbor their cost came from, and everything downstream of them
+    vector<v3i> invalidated;
+    vector<v3i> stack;
+    for (const v3i& cell : affected) {
+        if (costs.contains(cell) && !supported(cell))
+            stack.push_back(cell);
+    }
+    while (!stack.empty()) {
+        v3i cell = stack.back();
+        stack.pop_back();
+        if (!costs.contains(cell))
+            continue;
+        costs.erase(cell);
+        invalidated.push_back(cell);
+        // Only cells stepping into this one could have taken their cost from it
+        predecessors(cell, adjacent);
+        vector<v3i> dependents = adjacent;
+        for (const v3i& next : dependents) {
+            if (costs.contains(next) && !supported(next))
+                stack.push_back(next);
+        }
+    }
+
+    // Lower: seed the dropped and edited cells from their surviving neighbors and propagate
+    FlowQueue queue;
+    auto seed = [this, &adjacent, &queue](v3i cell) {
+        if (!standable(cell))
+            return;
+        neighbors(cell, adjacent);
+        for (const v3i& next : adjacent) {
+            auto it = costs.find(next);
+            if (it != costs.end())
+                queue.push({it->second + 1.0f, cell});
+        }
+    };
+    for (const v3i& cell : invalidated)
+        seed(cell);
+    for (const v3i& cell : affected)
+        seed(cell);
+    while (!queue.empty()) {
+        FlowQueueEntry entry = queue.top();
+        queue.pop();
+        auto it = costs.find(entry.cell);
+        if (it != costs.end() && it->second <= entry.cost)
+            continue;
+        costs[entry.cell] = entry.cost;
+        predecessors(entry.cell, adjacent);
+        for (const v3i& prev : adjacent) {
+            auto prev_it = costs.find(prev);
+            if (prev_it == costs.end() || prev_it->second > entry.cost + 1.0f)
+                queue.push({entry.cost + 1.0f, prev});
+        }
+    }
+}
+
+bool FlowField::reachable(v3i cell) const {
+    return costs.contains(cell);
+}
+
+v3i FlowField::next_cell(v3i cell) const {
+    auto it = costs.find(cell);
+    if (it == costs.end())
+        return cell;
+    v3i best = cell;
+    float best_cost = it->second;
+    vector<v3i> adjacent;
+    neighbors(cell, adjacent);
+    for (const v3i& next : adjacent) {
+        auto next_it = costs.find(next);
+        if (next_it != costs.end() && next_it->second < best_cost) {
+            best = next;
+            best_cost = next_it->second;
+        }
+    }
+    return best;
+}
+
+v3 FlowField::next_position(v3 pos) const {
+    v3i cell = math::round_cast(pos);
+    v3i next = next_cell(cell);
+    if (next == cell)
+        return v3(cell);
+
+    // Stay on the line between cell centers so corners aren't cut
+    v3 offset = pos - v3(cell);
+    v3 dir = math::normalize(v3(next - cell));
+    v3 lateral = offset - dir * math::dot(offset, dir);
+    if (math::length(lateral) > 0.05f)
+        return v3(cell);
+    return v3(next);
+}
+
+v3 FlowField::predict_pos(v3 pos, float speed, float time) const {
+    v3 expected_pos = pos;
+    if (time == 0.0f)
+        return expected_pos;
+    v3 from = pos;
+    v3i cell = math::round_cast(pos);
+    // bounded so an unexpected cycle can't hang targeting
+    for (int32 i = 0; i < 256; i++) {
+        v3i next = next_cell(cell);
+        if (next == cell)
+            break;
+        float time_delta = math::distance(from, v3(next)) / speed;
+        if (time_delta > time) {
+            expected_pos = math::lerp(time / time_delta, range3{from, v3(next)});
+            break;
+        }
+        time -= time_delta;
+        expected_pos = v3(next);
+        from = v3(next);
+        cell = next;
+    }
+    return expected_pos;
+}
+
+FlowField& FlowFields::get(v3i target, uint32 frame) {
+    auto it = fields.find(target);
+    if (it == fields.end()) {
+        auto field = std::make_unique<FlowField>();
+        field->map_data = map_data;
+        field->target = target;
+        field->build();
+        it = fields.emplace(target, std::move(field)).first;
+    }
+    it->second->last_used_frame = frame;
+    return *it->second;
+}
+
+void FlowFields::sync(const MapData& new_map_data) {
+    if (map_data == &new_map_data && new_map_data.revision == revision)
+        return;
+    bool incremental = map_data == &new_map_data && new_map_data.revision == revision + 1;
+    map_data = &new_map_data;
+    for (auto& [target, field] : fields) {
+        field->map_data = map_data;
+        if (incremental)
+            field->repair(map_data->changed_cells);
+        else
+            field->build();
+    }
+    revision = new_map_data.revision;
+}
+
+void FlowFields::evict_unused(uint32 frame, uint32 max_age) {
+    for (auto it = fields.begin(); it != fields.end();) {
+        if (frame - it->second->last_used_frame > max_age)
+            it = fields.erase(it);
+        else
+            it++;
+    }
+}
+
+void inspect(FlowFields* flow_fields) {
+    ImGui::Checkbox("Enabled", &flow_fields->enabled);
+    ImGui::Text("Revision: %u", flow_fields->revision);
+    for (auto& [target, field] : flow_fields->fields) {
+        ImGui::Text("(%d, %d, %d): %u cells", target.x, target.y, target.z, uint32(field->costs.size()));
+    }
+}
+
+// Walks the field downhill from start, bounded by the field size so a cycle can't hang the caller
+static void follow_flow_field(const FlowField& field, v3i start, vector<v3i>& out) {
+    out.clear();
+    out.push_back(start);
+    for (uint32 i = 0; i < field.costs.size() && out.back() != field.target; i++) {
+        v3i next = field.next_cell(out.back());
+        if (next == out.back())
+            break;
+        out.push_back(next);
+    }
+}
+
+string benchmark_flow_field(int size, int agents) {
+    using clock = std::chrono::steady_clock;
+
+    MapData map_data;
+    astar::Navigation navigation(&map_data.path_solids, &map_data.slot_solids, &map_data.unstandable_solids, &map_data.ramps);
+
+    umap<v3i, MapCell> cells;
+    for (int x = 0; x < size; x++) {
+        for (int y = 0; y < size; y++) {
+            bool blocked = math::random_float(1.0f) < 0.2f;
+            cells[v3i(x, y, 0)] = MapCell{uint8(blocked ? MapCellFlag_Slot : MapCellFlag_Path)};
+        }
+    }
+    v3i target = v3i(size - 1, size / 2, 1);
+    cells[target - v3i::Z].flags = MapCellFlag_Path;
+    map_data.apply(umap<v3i, MapCell>(cells));
+
+    vector<v3i> starts;
+    for (int i = 0; i < agents; i++) {
+        v3i tile = v3i(math::random_int32(size), math::random_int32(size), 0);
+        cells[tile].flags = MapCellFlag_Path;
+        starts.push_back(tile + v3i::Z);
+    }
+    map_data.apply(umap<v3i, MapCell>(cells));
+
+    vector<Path> astar_paths;
+    auto t0 = clock::now();
+    for (const v3i& start : starts)
+        astar_paths.push_back(navigation.find_path(start, target));
+    auto t1 = clock::now();
+
+    FlowFields flow_fields;
+    flow_fields.sync(map_data);
+    FlowField& field = flow_fields.get(target, 0);
+    vector<vector<v3i>> flow_paths(starts.size());
+    for (uint32 i = 0; i < starts.size(); i++)
+        follow_flow_field(field, starts[i], flow_paths[i]);
+    auto t2 = clock::now();
+
+    // Each flow step has to be one A* would take on its own, and a followed path can't be longer than A*'s
+    uint32 reach_mismatches = 0;
+    uint32 invalid_steps = 0;
+    uint32 longer_paths = 0;
+    float astar_length = 0.0f;
+    float flow_length = 0.0f;
+    for (uint32 i = 0; i < starts.size(); i++) {
+        const vector<v3i>& flow_path = flow_paths[i];
+        bool astar_reached = math::distance(astar_paths[i].get_destination(), v3(target)) < 0.1f;
+        bool flow_reached = flow_path.back() == target;
+        if (astar_reached != flow_reached)
+            reach_mismatches++;
+
+        float length = 0.0f;
+        for (uint32 j = 1; j < flow_path.size(); j++) {
+            float step_length = math::distance(v3(flow_path[j - 1]), v3(flow_path[j]));
+            Path step = navigation.find_path(flow_path[j - 1], flow_path[j]);
+            if (math::distance(step.get_destination(), v3(flow_path[j])) > 0.1f || path_length(step) > step_length + 0.01f)
+                invalid_steps++;
+            length += step_length;
+        }
+        if (astar_reached && flow_reached) {
+            float reference = path_length(astar_paths[i]);
+            if (length > reference + 0.01f)
+                longer_paths++;
+            astar_length += reference;
+            flow_length += length;
+        }
+    }
+
+    v3i edit = v3i(size / 2, size / 2, 0);
+    cells[edit].flags = cells[edit].flags == MapCellFlag_Path ? MapCellFlag_Slot : MapCellFlag_Path;
+    map_data.apply(umap<v3i, MapCell>(cells));
+    auto t3 = clock::now();
+    flow_fields.sync(map_data);
+    auto t4 = clock::now();
+
+    auto ms = [](auto from, auto to) { return std::chrono::duration<double, std::milli>(to - from).count(); };
+    return fmt_("{} agents on {}x{}: A* {:.2f}ms, flow field build+follow {:.2f}ms, repair after edit {:.3f}ms, "
+                "{} reach mismatches, {} invalid steps, {} paths longer than A*, total length {:.1f} vs A* {:.1f}",
+        agents, size, size, ms(t0, t1), ms(t1, t2), ms(t3, t4),
+        reach_mismatches, invalid_steps, longer_paths, flow_length, astar_length);
+}
+
+}
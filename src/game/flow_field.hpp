@@ -0,0 +1,57 @@
+#pragma once
+
+#include <memory>
+
+#include "general/string.hpp"
+#include "general/vector.hpp"
+#include "general/umap.hpp"
+#include "general/math/geometry.hpp"
+
+namespace spellbook {
+
+struct MapData;
+
+// Integration field over standable path cells, costs are steps to the target. Travelers sample the downhill
+// neighbor of their cell instead of owning a path, so one field serves every traveler with the same target.
+// Steps aren't symmetric around ramps, so costs spread backwards over predecessors from the target.
+struct FlowField {
+    const MapData* map_data = nullptr;
+    v3i target;
+    umap<v3i, float> costs;
+    uint32 last_used_frame = 0;
+
+    void build();
+    // Only recomputes the cells whose cost could have been affected by the changed tiles
+    void repair(const vector<v3i>& changed_cells);
+
+    bool reachable(v3i cell) const;
+    v3i next_cell(v3i cell) const;
+    v3 next_position(v3 pos) const;
+    v3 predict_pos(v3 pos, float speed, float time) const;
+
+    bool standable(v3i cell) const;
+    // Cells a traveler can step to from cell
+    void neighbors(v3i cell, vector<v3i>& out) const;
+    // Cells a traveler can step to cell from, the reverse of neighbors
+    void predecessors(v3i cell, vector<v3i>& out) const;
+    bool can_step(v3i from, v3i to) const;
+};
+
+struct FlowFields {
+    bool enabled = false;
+    const MapData* map_data = nullptr;
+    uint32 revision = 0;
+    // Fields are boxed so travelers can hold on to them for the frame
+    umap<v3i, std::unique_ptr<FlowField>> fields;
+
+    FlowField& get(v3i target, uint32 frame);
+    void sync(const MapData& map_data);
+    void evict_unused(uint32 frame, uint32 max_age = 120);
+};
+
+void inspect(FlowFields* flow_fields);
+
+// Plans every agent toward one target with per-agent A* and with a shared flow field, then repairs after an edit
+string benchmark_flow_field(int size, int agents);
+
+}
@@ -0,0 +1,139 @@
+#include "job_pool.hpp"
+
+#include <algorithm>
+#include <tracy/Tracy.hpp>
+
+namespace spellbook {
+
+// The pool and queue of the current thread, threads outside any pool share the pool's last queue
+static thread_local JobPool* current_pool = nullptr;
+static thread_local uint32   current_queue = 0;
+
+JobPool::~JobPool() {
+    stop();
+}
+
+void JobPool::start(uint32 worker_count) {
+    stop();
+    stopping    = false;
+    queue_count = worker_count + 1;
+    queues      = std::make_unique<Queue[]>(queue_count);
+    for (uint32 i = 0; i < worker_count; i++)
+        workers.emplace_back(&JobPool::_work, this, i);
+}
+
+void JobPool::stop() {
+    {
+        std::scoped_lock guard(sleep_lock);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (std::thread& worker : workers)
+        worker.join();
+    workers.clear();
+    queued = 0;
+    queues.reset();
+    queue_count = 0;
+}
+
+void JobPool::submit(JobGroup& group, std::function<void()> func) {
+    group.pending.fetch_add(1, std::memory_order_relaxed);
+    if (workers.empty()) {
+        func();
+        group.pending.fetch_sub(1, std::memory_order_release);
+        return;
+    }
+
+    uint32 index = current_pool == this ? current_queue : queue_count - 1;
+    {
+        std::scoped_lock guard(queues[index].lock);
+        queues[index].jobs.push_back(Job{std::move(func), &group});
+    }
+    queued.fetch_add(1, std::memory_order_release);
+    // Taken so a worker between checking for jobs and going to sleep can't miss the notify
+    { std::scoped_lock guard(sleep_lock); }
+    wake.notify_one();
+}
+
+void JobPool::wait(JobGroup& group) {
+    ZoneScoped;
+    uint32 index = current_pool == this ? current_queue : queue_count - 1;
+    while (group.pending.load(std::memory_order_acquire) > 0) {
+        if (!_run_one(index))
+            std::this_thread::yield();
+    }
+}
+
+bool JobPool::_run_one(uint32 queue_index) {
+    Job job;
+    bool found = false;
+    // Newest from our own queue while it's still warm, then the oldest, and likely largest, of someone else's
+    {
+        Queue& own = queues[queue_index];
+        std::scoped_lock guard(own.lock);
+        if (!own.jobs.empty()) {
+            job = std::move(own.jobs.back());
+            own.jobs.pop_back();
+            found = true;
+        }
+    }
+    for (uint32 i = 1; i < queue_count && !found; i++) {
+        Queue& other = queues[(queue_index + i) % queue_count];
+        std::scoped_lock guard(other.lock);
+        if (!other.jobs.empty()) {
+            job = std::move(other.jobs.front());
+            other.jobs.pop_front();
+            found = true;
+        }
+    }
+    if (!found)
+        return false;
+
+    queued.fetch_sub(1, std::memory_order_relaxed);
+    job.func();
+    job.group->pending.fetch_sub(1, std::memory_order_release);
+    return true;
+}
+
+void JobPool::_work(uint32 index) {
+    current_pool  = this;
+    current_queue = index;
+    while (true) {
+        if (_run_one(index))
+            continue;
+        std::unique_lock guard(sleep_lock);
+        wake.wait(guard, [this] { return stopping || queued.load(std::memory_order_acquire) > 0; });
+        if (stopping)
+            return;
+    }
+}
+
+JobPool& get_job_pool() {
+    static JobPool pool;
+    if (pool.queue_count == 0)
+        pool.start(std::max(std::thread::hardware_concurrency(), 1u) - 1);
+    return pool;
+}
+
+void parallel_for(uint32 count, uint32 grain, const std::function<void(uint32, uint32)>& func) {
+    if (count == 0)
+        return;
+    JobPool& pool = get_job_pool();
+    // A few ranges per thread so an uneven range doesn't hold up the rest
+    uint32 ranges = std::min((count + std::max(grain, 1u) - 1) / std::max(grain, 1u), (pool.worker_count() + 1) * 4);
+    if (pool.worker_count() == 0 || ranges <= 1) {
+        func(0, count);
+        return;
+    }
+
+    JobGroup group;
+    for (uint32 i = 1; i < ranges; i++) {
+        uint32 begin = uint64(count) * i / ranges;
+        uint32 end   = uint64(count) * (i + 1) / ranges;
+        pool.submit(group, [&func, begin, end] { func(begin, end); });
+    }
+    func(0, count / ranges);
+    pool.wait(group);
+}
+
+}
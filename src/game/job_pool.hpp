@@ -0,0 +1,68 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include "general/vector.hpp"
+
+namespace spellbook {
+
+// Counts the jobs submitted against it that haven't finished, jobs may submit more into their own group
+struct JobGroup {
+    std::atomic<uint32> pending = 0;
+};
+
+// Work stealing pool, every worker owns a deque it pushes and pops at the back while idle workers steal from the
+// front of the others. The submitting thread gets a deque of its own and runs jobs while it waits, so nested waits
+// from inside a job can't starve the pool.
+struct JobPool {
+    struct Job {
+        std::function<void()> func;
+        JobGroup*             group;
+    };
+    struct Queue {
+        std::mutex      lock;
+        std::deque<Job> jobs;
+    };
+
+    vector<std::thread>      workers;
+    // One per worker and a last one shared by every thread outside the pool
+    std::unique_ptr<Queue[]> queues;
+    uint32                   queue_count = 0;
+
+    std::mutex              sleep_lock;
+    std::condition_variable wake;
+    std::atomic<uint32>     queued = 0;
+    bool                    stopping = false;
+
+    JobPool() = default;
+    JobPool(const JobPool&) = delete;
+    JobPool& operator=(const JobPool&) = delete;
+    ~JobPool();
+
+    // 0 workers runs every job on the submitting thread
+    void   start(uint32 worker_count);
+    void   stop();
+    uint32 worker_count() const { return workers.size(); }
+
+    void submit(JobGroup& group, std::function<void()> func);
+    // Runs queued jobs on this thread until the group is done
+    void wait(JobGroup& group);
+
+    bool _run_one(uint32 queue_index);
+    void _work(uint32 index);
+};
+
+// Started on first use with one worker fewer than the hardware threads, the caller is the last one
+JobPool& get_job_pool();
+
+// Splits [0, count) into ranges of at least grain and runs func(begin, end) on them across the pool, returns once all
+// of them are done. Small counts and an empty pool run inline.
+void parallel_for(uint32 count, uint32 grain, const std::function<void(uint32, uint32)>& func);
+
+}
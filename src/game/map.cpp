@@ -1,9 +1,15 @@
 ﻿#include "map.hpp"
 
+#include <chrono>
 #include <imgui/imgui.h>
 
+#include "extension/fmt.hpp"
 #include "extension/imgui_extra.hpp"
 #include "general/logger.hpp"
+#include "general/file/file_cache.hpp"
+#include "renderer/asset_loader.hpp"
+#include "renderer/assets/model.hpp"
+#include "renderer/assets/material.hpp"
 #include "game/scene.hpp"
 #include "game/entities/components.hpp"
 #include "game/entities/tile.hpp"
@@ -62,9 +68,9 @@ bool inspect(MapPrefab* map_prefab) {
     return false;
 }
 
-Scene* instance_map(const MapPrefab& map_prefab, const string& name) {
+Scene* instance_map(const MapPrefab& map_prefab, const string& name, bool headless) {
     auto scene = new Scene();
-    scene->setup(name);
+    scene->setup(name, headless);
     for (auto& [pos, entry] : map_prefab.tiles) {
         if (!entry.prefab_path.is_file())
             continue;
@@ -83,5 +89,128 @@ Scene* instance_map(const MapPrefab& map_prefab, const string& name) {
     return scene;
 }
 
+uint32 spawn_round_count(const MapPrefab& map_prefab) {
+    uint32 round_count = 0;
+    for (auto& [pos, prefab] : map_prefab.spawners) {
+        if (prefab.is_file())
+            round_count = std::max(round_count, uint32(load_resource<SpawnerPrefab>(prefab).level_spawn_info.rounds.size()));
+    }
+    return round_count;
+}
+
+FilePath map_with_most_rounds() {
+    FilePath map_path;
+    uint32 most_rounds = 0;
+    for (const auto& entry : fs::recursive_directory_iterator(MapPrefab::folder().abs_path())) {
+        if (entry.path().extension().string() != MapPrefab::extension())
+            continue;
+        MapPrefab& map_prefab = load_resource<MapPrefab>(FilePath(entry.path()));
+        uint32 round_count = spawn_round_count(map_prefab);
+        if (round_count > most_rounds) {
+            most_rounds = round_count;
+            map_path = map_prefab.file_path;
+        }
+    }
+    return map_path;
+}
+
+string benchmark_map_loading(int threads) {
+    using clock = std::chrono::steady_clock;
+    auto ms = [](auto from, auto to) { return std::chrono::duration<double, std::milli>(to - from).count(); };
+
+    // The map with the most tiles stands in for a full level
+    FilePath map_path;
+    uint32 most_tiles = 0;
+    for (const auto& entry : fs::recursive_directory_iterator(MapPrefab::folder().abs_path())) {
+        if (entry.path().extension().string() != MapPrefab::extension())
+            continue;
+        MapPrefab& map_prefab = load_resource<MapPrefab>(FilePath(entry.path()));
+        if (map_prefab.tiles.size() >= most_tiles) {
+            most_tiles = map_prefab.tiles.size();
+            map_path = map_prefab.file_path;
+        }
+    }
+    if (most_tiles == 0)
+        return "no maps with tiles";
+
+    uset<FilePath> mesh_set;
+    uset<FilePath> texture_set;
+    for (auto& [pos, entry] : load_resource<MapPrefab>(map_path).tiles) {
+        if (!entry.prefab_path.is_file())
+            continue;
+        TilePrefab& tile_prefab = load_resource<TilePrefab>(entry.prefab_path);
+        if (!tile_prefab.model_path.is_file())
+            continue;
+        for (id_ptr<ModelCPU::Node> node : load_resource<ModelCPU>(tile_prefab.model_path).nodes) {
+            if (fs::exists(node->mesh_asset_path.abs_path()))
+                mesh_set.insert(node->mesh_asset_path);
+            if (!fs::exists(node->material_asset_path.abs_path()))
+                continue;
+            MaterialCPU& material = load_resource<MaterialCPU>(node->material_asset_path);
+            for (const FilePath& texture : {material.color_asset_path, material.orm_asset_path, material.normal_asset_path, material.emissive_asset_path}) {
+                if (fs::exists(texture.abs_path()))
+                    texture_set.insert(texture);
+            }
+        }
+    }
+    vector<FilePath> meshes;
+    vector<FilePath> textures;
+    for (const FilePath& path : mesh_set)
+        meshes.push_back(path);
+    for (const FilePath& path : texture_set)
+        textures.push_back(path);
+    // Legacy assets would otherwise come out of the parsed file cache
+    auto drop_cached = [&] {
+        for (const FilePath& path : meshes)
+            get_file_cache().parsed_assets.erase(path);
+        for (const FilePath& path : textures)
+            get_file_cache().parsed_assets.erase(path);
+    };
+
+    drop_cached();
+    auto t0 = clock::now();
+    for (const FilePath& path : meshes)
+        load_mesh(path);
+    for (const FilePath& path : textures)
+        load_texture(path);
+    auto t1 = clock::now();
+
+    drop_cached();
+    AssetLoader loader;
+    loader.start(std::max(threads, 1));
+    auto t2 = clock::now();
+    for (const FilePath& path : meshes)
+        loader.request(AssetKind_Mesh, hash_path(path), path);
+    for (const FilePath& path : textures)
+        loader.request(AssetKind_Texture, hash_path(path), path);
+    double main_thread_ms = ms(t2, clock::now());
+    uint32 legacy = 0;
+    vector<AssetLoader::Result> results;
+    while (!loader.pending.empty()) {
+        results.clear();
+        loader.take_results(results);
+        auto t3 = clock::now();
+        for (AssetLoader::Result& result : results) {
+            if (!result.loaded) {
+                legacy++;
+                if (result.kind == AssetKind_Mesh)
+                    load_mesh(result.path);
+                else
+                    load_texture(result.path);
+            }
+            loader.finish(result.id);
+        }
+        main_thread_ms += ms(t3, clock::now());
+        if (results.empty())
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+    auto t4 = clock::now();
+
+    return fmt_("{} ({} tiles): {} meshes, {} textures. Synchronous {:.2f}ms on the main thread, {} workers {:.2f}ms total with "
+        "{:.2f}ms on the main thread ({} legacy files). GPU upload not included",
+        map_path.rel_string(), most_tiles, meshes.size(), textures.size(), ms(t0, t1),
+        std::max(threads, 1), ms(t2, t4), main_thread_ms, legacy);
+}
+
 
 }
@@ -27,7 +27,14 @@ JSON_IMPL(MapPrefab::TileEntry, prefab_path, rotation);
 JSON_IMPL(MapPrefab, tiles, spawners, consumers, solid_tiles);
 
 bool inspect(MapPrefab* prefab);
-Scene* instance_map(const MapPrefab&, const string& name);
+Scene* instance_map(const MapPrefab&, const string& name, bool headless = false);
+// Most rounds of any of the map's spawners
+uint32 spawn_round_count(const MapPrefab& map_prefab);
+// Stands in for a full session in the simulation benchmarks, empty if no map has spawn rounds
+FilePath map_with_most_rounds();
+
+// Cold loads every mesh and texture of the largest map, on the main thread and then through the asset loader
+string benchmark_map_loading(int threads);
 
 
 }
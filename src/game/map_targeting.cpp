@@ -1,47 +1,164 @@
 ﻿#include "map_targeting.hpp"
 
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <tracy/Tracy.hpp>
+
+#include "extension/fmt.hpp"
 #include "game/scene.hpp"
+#include "game/map.hpp"
+#include "game/simulation.hpp"
 #include "game/entities/enemy.hpp"
 #include "game/entities/components.hpp"
+#include "game/entities/consumer.hpp"
 
 namespace spellbook {
 
-vector<entt::entity> MapTargeting::select_enemies(v3i pos, float in_future) {
+// Times are bucketed to a 20th of a second
+constexpr float occupancy_buckets_per_second = 20.0f;
+
+std::span<const entt::entity> EnemyOccupancy::at(v3i pos) const {
+    v3i local = pos - origin;
+    if (local.x < 0 || local.y < 0 || local.z < 0 || local.x >= size.x || local.y >= size.y || local.z >= size.z)
+        return {};
+    uint32 index = (local.z * size.y + local.y) * size.x + local.x;
+    return {entities.data() + starts[index], starts[index + 1] - starts[index]};
+}
+
+int32 EnemyOccupancy::window_sum(v3i pos, int32 radius, EnemyWeight weight) const {
+    int32 z = pos.z - origin.z;
+    if (z < 0 || z >= size.z)
+        return 0;
+    int32 stride = size.x + 1;
+    int32 layer = stride * (size.y + 1);
+    int32 total = 0;
+    // A footprint two cells wide touches the window when its min corner is up to a cell before it
+    for (int32 shape = 0; shape < 4; shape++) {
+        int32 x0 = std::max(pos.x - radius - (shape & 1) - origin.x, 0);
+        int32 y0 = std::max(pos.y - radius - (shape >> 1) - origin.y, 0);
+        int32 x1 = std::min(pos.x + radius + 1 - origin.x, size.x);
+        int32 y1 = std::min(pos.y + radius + 1 - origin.y, size.y);
+        if (x0 >= x1 || y0 >= y1)
+            continue;
+        const int32* table = sums[weight].data() + (shape * size.z + z) * layer;
+        total += table[y1 * stride + x1] - table[y0 * stride + x1] - table[y1 * stride + x0] + table[y0 * stride + x0];
+    }
+    return total;
+}
+
+std::span<const entt::entity> MapTargeting::select_enemies(v3i pos, float in_future) {
+    return enemy_occupancy(in_future).at(pos);
+}
+
+void MapTargeting::score_enemy_windows(std::span<const v3i> positions, int32 radius, float in_future, EnemyWeight weight, std::span<int32> scores) {
+    EnemyOccupancy& occupancy = enemy_occupancy(in_future);
+    if (!occupancy.has_sums[weight])
+        _build_sums(occupancy, weight);
+    for (uint32 i = 0; i < positions.size(); i++)
+        scores[i] = occupancy.window_sum(positions[i], radius, weight);
+}
+
+EnemyOccupancy& MapTargeting::enemy_occupancy(float in_future) {
     if (enemy_frame_ack < scene->frame) {
         enemy_frame_ack = scene->frame;
-        enemy_cache.clear();
+        enemy_bucket_count = 0;
     }
-    
-    float used_time = math::round((scene->time + in_future) * 20.0f) / 20.0f;
-    if (enemy_cache.contains(used_time)) {
-        auto& enemy_map = enemy_cache[used_time];
-        return enemy_map.contains(pos) ? enemy_map[pos] : vector<entt::entity>{};
+
+    int32 key = int32(math::round((scene->time + in_future) * occupancy_buckets_per_second));
+    for (uint32 i = 0; i < enemy_bucket_count; i++) {
+        if (enemy_buckets[i].key == key)
+            return enemy_buckets[i];
     }
 
-    auto& enemy_map = enemy_cache.emplace(used_time, umap<v3i, vector<entt::entity>>{}).first->second;
+    if (enemy_bucket_count == enemy_buckets.size())
+        enemy_buckets.emplace_back();
+    EnemyOccupancy& occupancy = enemy_buckets[enemy_bucket_count++];
+    occupancy.key = key;
+    for (bool& has_sums : occupancy.has_sums)
+        has_sums = false;
+    _build_occupancy(occupancy, float(key) / occupancy_buckets_per_second);
+    return occupancy;
+}
+
+void MapTargeting::_build_occupancy(EnemyOccupancy& occupancy, float used_time) {
+    ZoneScoped;
+    // Predicted first, the bounds have to be known before the grid can be laid out
+    vector<EnemyOccupancy::Footprint>& footprints = occupancy.footprints;
+    footprints.clear();
+    v3i bounds_min = v3i(INT_MAX);
+    v3i bounds_max = v3i(INT_MIN);
     for (auto [entity, enemy, logic_tfm] : scene->registry.view<Enemy, LogicTransform>().each()) {
         auto traveler = scene->registry.try_get<Traveler>(entity);
-        v3i pos_min, pos_max;
-        if (!traveler) {
-            pos_min = math::round_cast(logic_tfm.position - v3(0.1f, 0.1f, 0.0f));
-            pos_max = math::round_cast(logic_tfm.position + v3(0.1f, 0.1f, 0.0f));
-        } else {
-            v3 expected_pos = predict_pos(*traveler, logic_tfm.position, used_time - scene->time);
-            pos_min = math::round_cast(expected_pos - v3(0.1f, 0.1f, 0.0f));
-            pos_max = math::round_cast(expected_pos + v3(0.1f, 0.1f, 0.0f));
-        }
-        for (int x = pos_min.x; x <= pos_max.x; x++) {
-            for (int y = pos_min.y; y <= pos_max.y; y++) {
-                v3i map_pos = v3i(x, y, pos_min.z);
-                if (!enemy_map.contains(map_pos))
-                    enemy_map[map_pos] = {};
-    
-                enemy_map[map_pos].push_back(entity);
+        v3 expected_pos = traveler ? predict_pos(*traveler, logic_tfm.position, used_time - scene->time) : logic_tfm.position;
+        v3i pos_min = math::round_cast(expected_pos - v3(0.1f, 0.1f, 0.0f));
+        v3i pos_max = math::round_cast(expected_pos + v3(0.1f, 0.1f, 0.0f));
+        footprints.push_back(EnemyOccupancy::Footprint{entity, pos_min, pos_max.xy});
+        bounds_min = v3i(std::min(bounds_min.x, pos_min.x), std::min(bounds_min.y, pos_min.y), std::min(bounds_min.z, pos_min.z));
+        bounds_max = v3i(std::max(bounds_max.x, pos_max.x), std::max(bounds_max.y, pos_max.y), std::max(bounds_max.z, pos_min.z));
+    }
+
+    occupancy.entities.clear();
+    if (footprints.empty()) {
+        occupancy.size = v3i(0);
+        occupancy.starts.clear();
+        return;
+    }
+    occupancy.origin = bounds_min;
+    occupancy.size = bounds_max - bounds_min + v3i(1);
+    uint32 cell_count = occupancy.size.x * occupancy.size.y * occupancy.size.z;
+    auto cell_index = [&occupancy](int32 x, int32 y, int32 z) {
+        v3i local = v3i(x, y, z) - occupancy.origin;
+        return uint32((local.z * occupancy.size.y + local.y) * occupancy.size.x + local.x);
+    };
+
+    // Counted, summed into offsets, then filled in view order so every cell lists its enemies in the same order the
+    // hash maps did
+    occupancy.starts.assign(cell_count + 1, 0);
+    for (const EnemyOccupancy::Footprint& footprint : footprints) {
+        for (int32 x = footprint.min.x; x <= footprint.max.x; x++)
+            for (int32 y = footprint.min.y; y <= footprint.max.y; y++)
+                occupancy.starts[cell_index(x, y, footprint.min.z) + 1]++;
+    }
+    for (uint32 i = 0; i < cell_count; i++)
+        occupancy.starts[i + 1] += occupancy.starts[i];
+    occupancy.entities.resize(occupancy.starts[cell_count]);
+    for (const EnemyOccupancy::Footprint& footprint : footprints) {
+        for (int32 x = footprint.min.x; x <= footprint.max.x; x++) {
+            for (int32 y = footprint.min.y; y <= footprint.max.y; y++) {
+                // starts[i] is used as the cursor and ends up at the next cell's start, shifted back below
+                uint32& cursor = occupancy.starts[cell_index(x, y, footprint.min.z)];
+                occupancy.entities[cursor++] = footprint.entity;
             }
         }
     }
+    for (uint32 i = cell_count; i > 0; i--)
+        occupancy.starts[i] = occupancy.starts[i - 1];
+    occupancy.starts[0] = 0;
+}
 
-    return enemy_map[pos];
+void MapTargeting::_build_sums(EnemyOccupancy& occupancy, EnemyWeight weight) {
+    ZoneScoped;
+    v3i size = occupancy.size;
+    int32 stride = size.x + 1;
+    int32 layer = stride * (size.y + 1);
+    vector<int32>& sums = occupancy.sums[weight];
+    sums.assign(4 * size.z * layer, 0);
+    for (const EnemyOccupancy::Footprint& footprint : occupancy.footprints) {
+        int32 value = 1;
+        if (weight == EnemyWeight_Egg && scene->registry.any_of<Egg>(scene->registry.get<Enemy>(footprint.entity).attachment))
+            value = 10;
+        int32 shape = (footprint.max.x - footprint.min.x) | (footprint.max.y - footprint.min.y) << 1;
+        v3i local = footprint.min - occupancy.origin;
+        sums[(shape * size.z + local.z) * layer + (local.y + 1) * stride + local.x + 1] += value;
+    }
+    for (int32 slice = 0; slice < 4 * size.z; slice++) {
+        int32* table = sums.data() + slice * layer;
+        for (int32 y = 1; y <= size.y; y++)
+            for (int32 x = 1; x <= size.x; x++)
+                table[y * stride + x] += table[y * stride + x - 1] + table[(y - 1) * stride + x] - table[(y - 1) * stride + x - 1];
+    }
+    occupancy.has_sums[weight] = true;
 }
 
 entt::entity MapTargeting::select_lizard(v3i pos, entt::entity exclude) {
@@ -59,5 +176,116 @@ entt::entity MapTargeting::select_lizard(v3i pos, entt::entity exclude) {
     return lizard_cache[pos];
 }
 
+// The per frame hash maps the occupancy grids replaced, kept for comparison
+static const vector<entt::entity>& select_enemies_hashed(Scene* scene, umap<float, umap<v3i, vector<entt::entity>>>& enemy_cache, v3i pos,
+    float in_future) {
+    float used_time = math::round((scene->time + in_future) * 20.0f) / 20.0f;
+    auto [it, inserted] = enemy_cache.try_emplace(used_time);
+    auto& enemy_map = it->second;
+    if (inserted) {
+        for (auto [entity, enemy, logic_tfm] : scene->registry.view<Enemy, LogicTransform>().each()) {
+            auto traveler = scene->registry.try_get<Traveler>(entity);
+            v3 expected_pos = traveler ? predict_pos(*traveler, logic_tfm.position, used_time - scene->time) : logic_tfm.position;
+            v3i pos_min = math::round_cast(expected_pos - v3(0.1f, 0.1f, 0.0f));
+            v3i pos_max = math::round_cast(expected_pos + v3(0.1f, 0.1f, 0.0f));
+            for (int x = pos_min.x; x <= pos_max.x; x++)
+                for (int y = pos_min.y; y <= pos_max.y; y++)
+                    enemy_map[v3i(x, y, pos_min.z)].push_back(entity);
+        }
+    }
+    return enemy_map[pos];
+}
+
+string benchmark_map_targeting(int casters, int enemies) {
+    using clock = std::chrono::steady_clock;
+    constexpr int frames = 60;
+    // Square targeting over a range of 2, gathering a 3x3 area at every candidate
+    constexpr int range = 2;
+    constexpr int area = 1;
+    if (casters <= 0 || enemies <= 0)
+        return "needs at least one caster and enemy";
+
+    FilePath map_path = map_with_most_rounds();
+    if (!map_path.is_file())
+        return "no maps with spawn rounds";
+    Scene* scene = instance_map(load_resource<MapPrefab>(map_path), "targeting", true);
+    scene->set_edit_mode(false);
+    scene->set_seed(1);
+    if (!spawn_enemy_crowd(scene, enemies)) {
+        scene->registry.clear();
+        scene->cleanup();
+        delete scene;
+        return fmt_("{} has no enemies to spawn", map_path.rel_string());
+    }
+    // Gives the crowd targets and paths to predict along
+    for (int i = 0; i < 10; i++) {
+        scene->step(1.0f / 60.0f);
+        scene->render_scene.delete_frame_allocated();
+    }
+
+    // Casters aim around the crowd, each with its own trigger time like abilities have
+    vector<v3i> enemy_cells;
+    for (auto [entity, enemy, logic_tfm] : scene->registry.view<Enemy, LogicTransform>().each())
+        enemy_cells.push_back(math::round_cast(logic_tfm.position));
+    RandomStream random;
+    random.seed(1, 0);
+    struct BenchmarkCaster {
+        v3i pos;
+        float time_to;
+    };
+    vector<BenchmarkCaster> benchmark_casters;
+    for (int i = 0; i < casters; i++)
+        benchmark_casters.push_back(BenchmarkCaster{enemy_cells[random.random_int32(enemy_cells.size())], 0.1f * float(1 + i % 8)});
+
+    double grid_ms = 0.0;
+    double hashed_ms = 0.0;
+    uint64 grid_found = 0;
+    uint64 hashed_found = 0;
+    uint32 mismatches = 0;
+    umap<float, umap<v3i, vector<entt::entity>>> enemy_cache;
+    for (int frame = 0; frame < frames; frame++) {
+        // Steps the clock without moving anything, both sides rebuild every frame either way
+        scene->frame++;
+        scene->time += 1.0f / 60.0f;
+
+        auto t0 = clock::now();
+        for (const BenchmarkCaster& caster : benchmark_casters)
+            for (int x = -range - area; x <= range + area; x++)
+                for (int y = -range - area; y <= range + area; y++)
+                    grid_found += scene->targeting->select_enemies(caster.pos + v3i(x, y, 0), caster.time_to).size();
+        auto t1 = clock::now();
+        enemy_cache.clear();
+        for (const BenchmarkCaster& caster : benchmark_casters)
+            for (int x = -range - area; x <= range + area; x++)
+                for (int y = -range - area; y <= range + area; y++)
+                    hashed_found += select_enemies_hashed(scene, enemy_cache, caster.pos + v3i(x, y, 0), caster.time_to).size();
+        auto t2 = clock::now();
+
+        grid_ms += std::chrono::duration<double, std::milli>(t1 - t0).count();
+        hashed_ms += std::chrono::duration<double, std::milli>(t2 - t1).count();
+
+        for (const BenchmarkCaster& caster : benchmark_casters) {
+            for (int x = -range - area; x <= range + area; x++) {
+                for (int y = -range - area; y <= range + area; y++) {
+                    auto grid = scene->targeting->select_enemies(caster.pos + v3i(x, y, 0), caster.time_to);
+                    auto& hashed = select_enemies_hashed(scene, enemy_cache, caster.pos + v3i(x, y, 0), caster.time_to);
+                    if (!std::equal(grid.begin(), grid.end(), hashed.begin(), hashed.end()))
+                        mismatches++;
+                }
+            }
+        }
+    }
+
+    string result = fmt_("{} casters, {} enemies, {} frames: grid {:.3f}ms/frame ({} found), hash maps {:.3f}ms/frame ({} found), {:.1f}x",
+        casters, enemies, frames, grid_ms / frames, grid_found, hashed_ms / frames, hashed_found, hashed_ms / std::max(grid_ms, 0.0001));
+    if (mismatches > 0)
+        result += fmt_(", {} cells differ", mismatches);
+
+    scene->registry.clear();
+    scene->cleanup();
+    delete scene;
+    return result;
+}
+
 
 }
\ No newline at end of file
@@ -1,7 +1,9 @@
 ﻿#pragma once
 
+#include <span>
 #include <entt/entity/entity.hpp>
 
+#include "general/string.hpp"
 #include "general/vector.hpp"
 #include "general/umap.hpp"
 #include "general/math/geometry.hpp"
@@ -10,16 +12,71 @@ namespace spellbook {
 
 struct Scene;
 
+// What an enemy adds to a score, matching the built in entry evaluators
+enum EnemyWeight {
+    EnemyWeight_One,
+    // 10 for enemies carrying an egg, 1 otherwise
+    EnemyWeight_Egg,
+    EnemyWeight_Count
+};
+
+// Where every enemy is expected to be at one quantized time, over the bounds of the enemies' footprints. The cells are
+// flattened x, then y, then z, and the entities of cell i are entities[starts[i]] up to entities[starts[i + 1]].
+struct EnemyOccupancy {
+    // The cells an enemy covers, at most 2x2 on one level
+    struct Footprint {
+        entt::entity entity;
+        v3i min;
+        v2i max;
+    };
+
+    int32 key = 0;
+    v3i origin = {};
+    v3i size = {};
+    vector<uint32> starts;
+    vector<entt::entity> entities;
+    vector<Footprint> footprints;
+
+    // Summed-area tables of footprint min corners per weight, split by footprint shape so a window counts every enemy
+    // touching it exactly once. Built on first use.
+    vector<int32> sums[EnemyWeight_Count];
+    bool has_sums[EnemyWeight_Count] = {};
+
+    std::span<const entt::entity> at(v3i pos) const;
+    // Total weight of the distinct enemies touching the cells within radius of pos on its level, needs the weight's sums
+    int32 window_sum(v3i pos, int32 radius, EnemyWeight weight) const;
+};
+
 struct MapTargeting {
     Scene* scene;
 
     umap<v3i, entt::entity> lizard_cache;
     uint32 lizard_frame_ack = 0;
-    umap<float, umap<v3i, vector<entt::entity>>> enemy_cache;
+    // The first enemy_bucket_count are this frame's, the rest keep their allocations for later frames
+    vector<EnemyOccupancy> enemy_buckets;
+    uint32 enemy_bucket_count = 0;
     uint32 enemy_frame_ack = 0;
 
-    vector<entt::entity> select_enemies(v3i pos, float in_future);
+    // Candidates of the targeting function running now, kept so scoring them doesn't allocate
+    vector<v3i> entry_positions;
+    vector<float> entry_times;
+    vector<int32> entry_scores;
+
+    // Valid until the next frame's first call
+    std::span<const entt::entity> select_enemies(v3i pos, float in_future);
     entt::entity select_lizard(v3i pos, entt::entity exclude = {});
+    // Scores of the square windows within radius of each position, the same as summing the weights of the distinct
+    // enemies select_enemies finds over each window
+    void score_enemy_windows(std::span<const v3i> positions, int32 radius, float in_future, EnemyWeight weight, std::span<int32> scores);
+
+    // Built on the first request for its time each frame and shared by every caster after that
+    EnemyOccupancy& enemy_occupancy(float in_future);
+    void _build_occupancy(EnemyOccupancy& occupancy, float used_time);
+    void _build_sums(EnemyOccupancy& occupancy, EnemyWeight weight);
 };
 
+// Runs the square targeting gathers of casters casters over enemies enemies for a number of frames, against the
+// per frame hash maps the grids replaced, and checks both find the same enemies
+string benchmark_map_targeting(int casters, int enemies);
+
 }
\ No newline at end of file
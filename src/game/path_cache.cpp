@@ -0,0 +1,165 @@
+#include "path_cache.hpp"
+
+#include <chrono>
+#include <imgui.h>
+#include <tracy/Tracy.hpp>
+
+#include "extension/fmt.hpp"
+#include "general/math/math.hpp"
+#include "general/astar.hpp"
+#include "game/scene.hpp"
+
+namespace spellbook {
+
+// Covers the z offset between a standing position and its tile, and neighbor cells that affect standability
+constexpr float footprint_slack = 2.0f;
+
+static bool footprint_contains(v3i start, v3i end, const PathCache::Entry& entry, v3i cell) {
+    // An unreachable destination can become reachable through any cell
+    if (entry.length == FLT_MAX)
+        return true;
+    float through_cell = math::distance(v3(start), v3(cell)) + math::distance(v3(cell), v3(end));
+    return through_cell <= entry.length + footprint_slack;
+}
+
+float path_length(const Path& path) {
+    float length = 0.0f;
+    for (uint32 i = 1; i < path.waypoints.size(); i++)
+        length += math::distance(v3(path.waypoints[i - 1]), v3(path.waypoints[i]));
+    return length;
+}
+
+// The returned path is only valid until the next find_path, copy it if it needs to be kept
+const Path& PathCache::find_path(astar::Navigation& navigation, v3i start, v3i end) {
+    ZoneScoped;
+    umap<v3i, Entry>& end_entries = entries[start];
+    auto it = end_entries.find(end);
+    if (it != end_entries.end()) {
+        hits++;
+        return it->second.path;
+    }
+
+    misses++;
+    Entry& entry = end_entries[end];
+    entry.path = navigation.find_path(start, end);
+    entry.length = math::distance(entry.path.get_destination(), v3(end)) < 0.1f ? path_length(entry.path) : FLT_MAX;
+    return entry.path;
+}
+
+void PathCache::sync(const MapData& map_data) {
+    if (map_data.revision == revision)
+        return;
+    // changed_cells only describes the last update, so anything older needs a full clear
+    if (map_data.revision == revision + 1)
+        invalidate(map_data.changed_cells);
+    else
+        clear();
+    revision = map_data.revision;
+}
+
+void PathCache::invalidate(const vector<v3i>& changed_cells) {
+    ZoneScoped;
+    if (changed_cells.empty())
+        return;
+    for (auto& [start, end_entries] : entries) {
+        for (auto it = end_entries.begin(); it != end_entries.end();) {
+            bool touched = false;
+            for (const v3i& cell : changed_cells) {
+                if (footprint_contains(start, it->first, it->second, cell)) {
+                    touched = true;
+                    break;
+                }
+            }
+            if (touched) {
+                it = end_entries.erase(it);
+                invalidations++;
+            } else {
+                it++;
+            }
+        }
+    }
+}
+
+void PathCache::clear() {
+    for (auto& [start, end_entries] : entries)
+        invalidations += end_entries.size();
+    entries.clear();
+}
+
+void PathCache::reset_counters() {
+    hits = 0;
+    misses = 0;
+    invalidations = 0;
+}
+
+void inspect(PathCache* path_cache) {
+    uint32 entry_count = 0;
+    for (auto& [start, end_entries] : path_cache->entries)
+        entry_count += end_entries.size();
+    ImGui::Text("Revision: %u", path_cache->revision);
+    ImGui::Text("Entries: %u", entry_count);
+    ImGui::Text("Hits: %u", path_cache->hits);
+    ImGui::Text("Misses: %u", path_cache->misses);
+    ImGui::Text("Invalidations: %u", path_cache->invalidations);
+    if (ImGui::Button("Reset Counters"))
+        path_cache->reset_counters();
+}
+
+string benchmark_path_cache(int size, int edits) {
+    using clock = std::chrono::steady_clock;
+    constexpr int endpoint_count = 4;
+    constexpr int frames_per_edit = 8;
+
+    MapData map_data;
+    astar::Navigation navigation(&map_data.path_solids, &map_data.slot_solids, &map_data.unstandable_solids, &map_data.ramps);
+    PathCache path_cache;
+
+    // Path floor with scattered blocking slots, spawners on one edge and shrines on the other
+    umap<v3i, MapCell> cells;
+    for (int x = 0; x < size; x++) {
+        for (int y = 0; y < size; y++) {
+            bool blocked = math::random_float(1.0f) < 0.2f;
+            cells[v3i(x, y, 0)] = MapCell{uint8(blocked ? MapCellFlag_Slot : MapCellFlag_Path)};
+        }
+    }
+    vector<v3i> starts;
+    vector<v3i> ends;
+    for (int i = 0; i < endpoint_count; i++) {
+        int y = (i * 2 + 1) * size / (endpoint_count * 2);
+        starts.push_back(v3i(0, y, 1));
+        ends.push_back(v3i(size - 1, y, 1));
+        cells[v3i(0, y, 0)].flags = MapCellFlag_Path;
+        cells[v3i(size - 1, y, 0)].flags = MapCellFlag_Path;
+    }
+    map_data.apply(umap<v3i, MapCell>(cells));
+    path_cache.sync(map_data);
+
+    double cached_ms = 0.0;
+    double uncached_ms = 0.0;
+    for (int edit = 0; edit < edits; edit++) {
+        v3i cell = v3i(1 + math::random_int32(size - 2), math::random_int32(size), 0);
+        cells[cell].flags = cells[cell].flags == MapCellFlag_Path ? MapCellFlag_Slot : MapCellFlag_Path;
+        map_data.apply(umap<v3i, MapCell>(cells));
+
+        auto t0 = clock::now();
+        path_cache.sync(map_data);
+        for (int frame = 0; frame < frames_per_edit; frame++)
+            for (const v3i& start : starts)
+                for (const v3i& end : ends)
+                    path_cache.find_path(navigation, start, end);
+        auto t1 = clock::now();
+        for (int frame = 0; frame < frames_per_edit; frame++)
+            for (const v3i& start : starts)
+                for (const v3i& end : ends)
+                    navigation.find_path(start, end);
+        auto t2 = clock::now();
+
+        cached_ms += std::chrono::duration<double, std::milli>(t1 - t0).count();
+        uncached_ms += std::chrono::duration<double, std::milli>(t2 - t1).count();
+    }
+
+    return fmt_("{}x{} map, {} edits: cached {:.2f}ms, uncached {:.2f}ms, {} hits, {} misses, {} invalidations",
+        size, size, edits, cached_ms, uncached_ms, path_cache.hits, path_cache.misses, path_cache.invalidations);
+}
+
+}
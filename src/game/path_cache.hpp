@@ -0,0 +1,47 @@
+#pragma once
+
+#include "general/string.hpp"
+#include "general/vector.hpp"
+#include "general/umap.hpp"
+#include "general/math/geometry.hpp"
+#include "general/navigation_path.hpp"
+
+namespace spellbook {
+
+struct MapData;
+namespace astar {
+struct Navigation;
+}
+
+// Caches navigation results between endpoints for the current map revision. When tiles change, only entries
+// whose search footprint could contain a changed cell are dropped. The footprint is the region of cells that
+// a path no longer than the cached one could pass through, which bounds what A* could have expanded.
+struct PathCache {
+    struct Entry {
+        Path path;
+        float length = FLT_MAX; // FLT_MAX if the destination was not reached
+    };
+
+    umap<v3i, umap<v3i, Entry>> entries;
+    uint32 revision = 0;
+
+    uint32 hits = 0;
+    uint32 misses = 0;
+    uint32 invalidations = 0;
+
+    const Path& find_path(astar::Navigation& navigation, v3i start, v3i end);
+    // Brings the cache up to date with the map, should be called after MapData::update
+    void sync(const MapData& map_data);
+    void invalidate(const vector<v3i>& changed_cells);
+    void clear();
+    void reset_counters();
+};
+
+float path_length(const Path& path);
+
+void inspect(PathCache* path_cache);
+
+// Replays random tile edits on a generated size x size map and compares cached against uncached pathing
+string benchmark_path_cache(int size, int edits);
+
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include "general/math/math.hpp"
+
+namespace spellbook {
+
+// Gameplay draws come from per system streams, so a recorded seed reproduces a session and an extra draw in one
+// system doesn't shift the results of every other one
+enum RandomStreamId {
+    RandomStream_Spawning,
+    RandomStream_Decollision,
+    RandomStream_Targeting,
+    RandomStream_Drops,
+    RandomStream_Shop,
+    RandomStream_Count
+};
+
+// PCG32
+struct RandomStream {
+    uint64 state = 0x853c49e6748fea9bull;
+    uint64 increment = 0xda3e39cb94b95bdbull;
+
+    void seed(uint64 seed, uint64 stream) {
+        state = 0;
+        increment = (stream << 1u) | 1u;
+        next();
+        state += seed;
+        next();
+    }
+
+    uint32 next() {
+        uint64 old_state = state;
+        state = old_state * 6364136223846793005ull + increment;
+        uint32 xorshifted = uint32(((old_state >> 18u) ^ old_state) >> 27u);
+        uint32 rotation = uint32(old_state >> 59u);
+        return (xorshifted >> rotation) | (xorshifted << ((32u - rotation) & 31u));
+    }
+
+    // [0, max)
+    float random_float(float max = 1.0f) {
+        return float(next() >> 8) * (1.0f / 16777216.0f) * max;
+    }
+
+    // [0, max)
+    int32 random_int32(int32 max) {
+        if (max <= 0)
+            return 0;
+        return int32(next() % uint32(max));
+    }
+};
+
+}
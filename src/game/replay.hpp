@@ -0,0 +1,88 @@
+#pragma once
+
+#include <span>
+
+#include "general/string.hpp"
+#include "general/vector.hpp"
+#include "general/math/geometry.hpp"
+#include "general/file/file_path.hpp"
+
+namespace spellbook {
+
+struct Scene;
+struct SystemTimings;
+
+enum SceneCommandType : uint8 {
+    SceneCommand_Select,
+    SceneCommand_DragTo,
+    SceneCommand_Release,
+    SceneCommand_Ready,
+    SceneCommand_Reroll,
+    SceneCommand_Purchase
+};
+
+// Everything the player does to a running scene. Commands are queued by input and applied at the start of the next
+// step, so a session is reproduced by its seed and the commands of each step.
+struct SceneCommand {
+    SceneCommandType type = SceneCommand_Release;
+    // Select
+    uint32 entity = 0;
+    v3     point  = {};
+    // DragTo
+    v3i    cell   = {};
+    // Purchase
+    uint32 index  = 0;
+
+    bool operator==(const SceneCommand& other) const = default;
+};
+
+constexpr uint32 replay_magic   = 0x4c505253; // "SRPL"
+constexpr uint32 replay_version = 2;
+
+struct Replay {
+    struct Entry {
+        uint32       tick;
+        SceneCommand command;
+
+        bool operator==(const Entry& other) const = default;
+    };
+
+    FilePath      map_path;
+    uint64        seed       = 0;
+    float         fixed_step = 1.0f / 60.0f;
+    uint32        tick_count = 0;
+    // Sorted by tick, ticks start at 1 with the scene's first step
+    vector<Entry> commands;
+    // Registry checksum after each tick
+    vector<uint32> checksums;
+
+    static constexpr string_view extension() { return ".sbrpl"; }
+};
+
+// The game scene overwrites this with every session it records
+FilePath last_replay_path();
+
+// Ticks are delta coded varints and commands only store their own fields
+vector<uint8> serialize_replay(const Replay& replay);
+bool          deserialize_replay(std::span<const uint8> data, Replay& replay);
+bool          save_replay(const Replay& replay, const FilePath& file_path);
+bool          load_replay(const FilePath& file_path, Replay& replay);
+
+// Hashes the simulation state that later steps depend on, anything purely visual and the random streams are left out
+uint32 scene_checksum(Scene* scene);
+
+// Headless scene with the replay's map, seed and step, set up for play like the game scene
+Scene* instance_replay_scene(const Replay& replay);
+// Steps through the whole replay, returns the first tick whose checksum differs from the recording or 0 if none do.
+// step_ms receives the wall time of every tick.
+uint32 run_replay(const Replay& replay, SystemTimings* timings = nullptr, vector<double>* step_ms = nullptr);
+
+// Plays the replay headless repeats times, reports divergence, the slowest ticks and the cost of each system
+string play_replay(const FilePath& file_path, int repeats);
+// play_replay on the last session the game scene recorded
+string benchmark_replay(int repeats);
+// Records a scripted headless session of rounds rounds on the map with the most spawn rounds, round trips it through
+// the file format and checks that playback matches the recording's checksum on every tick
+string verify_replay(int rounds, int seed);
+
+}
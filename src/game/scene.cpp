@@ -1,5 +1,8 @@
 #include "scene.hpp"
 
+#include <algorithm>
+#include <chrono>
+#include <random>
 #include <tracy/Tracy.hpp>
 #include <entt/entity/entity.hpp>
 #include <entt/entity/registry.hpp>
@@ -9,7 +12,9 @@
 #include "extension/fmt_geometry.hpp"
 #include "general/math/math.hpp"
 #include "general/bitmask_3d.hpp"
+#include "general/logger.hpp"
 #include "renderer/draw_functions.hpp"
+#include "renderer/font_manager.hpp"
 #include "editor/console.hpp"
 #include "entities/area_trigger.hpp"
 #include "entities/caster.hpp"
@@ -17,30 +22,169 @@
 #include "game/systems.hpp"
 #include "game/pose_controller.hpp"
 #include "game/entities/components.hpp"
+#include "game/entities/stat.hpp"
 #include "game/entities/spawner.hpp"
 #include "game/entities/consumer.hpp"
 #include "game/entities/tile.hpp"
 #include "game/entities/enemy.hpp"
 #include "game/entities/tags.hpp"
 #include "game/entities/projectile.hpp"
+#include "game/entities/drop.hpp"
+#include "game/entities/enemy_ik.hpp"
+#include "game/entities/lizards/lizard.hpp"
 #include "general/astar.hpp"
 
 namespace spellbook {
 
 using namespace entt::literals;
 
+void SystemTimings::record(string_view name, double ms) {
+    auto [it, inserted] = indices.try_emplace(name, entries.size());
+    if (inserted)
+        entries.push_back(Entry{name});
+    Entry& entry = entries[it->second];
+    entry.total_ms += ms;
+    entry.max_ms = std::max(entry.max_ms, ms);
+    entry.calls++;
+}
+
+void SystemTimings::clear() {
+    entries.clear();
+    indices.clear();
+}
+
+void inspect(SystemTimings* timings) {
+    ImGui::Checkbox("Enabled", &timings->enabled);
+    ImGui::SameLine();
+    if (ImGui::Button("Clear"))
+        timings->clear();
+    for (const SystemTimings::Entry& entry : timings->entries) {
+        ImGui::Text("%-24.*s avg %.4fms, max %.4fms, %u calls", int(entry.name.size()), entry.name.data(),
+            entry.total_ms / std::max(entry.calls, 1u), entry.max_ms, entry.calls);
+    }
+}
+
+string format_system_timings(const SystemTimings& timings) {
+    vector<SystemTimings::Entry> entries = timings.entries;
+    std::sort(entries.begin(), entries.end(), [](const auto& a, const auto& b) { return a.total_ms > b.total_ms; });
+    double total_ms = 0.0;
+    for (const SystemTimings::Entry& entry : entries)
+        total_ms += entry.total_ms;
+    string result;
+    for (const SystemTimings::Entry& entry : entries) {
+        result += fmt_("\n  {:<24} {:.4f}ms/step, max {:.4f}ms, {:.1f}%", entry.name, entry.total_ms / std::max(entry.calls, 1u), entry.max_ms,
+            100.0 * entry.total_ms / std::max(total_ms, 0.001));
+    }
+    return result;
+}
+
+template <typename Func>
+static void run_system(Scene* scene, string_view name, Func&& func) {
+    if (!scene->system_timings.enabled) {
+        func(scene);
+        return;
+    }
+    auto start = std::chrono::steady_clock::now();
+    func(scene);
+    scene->system_timings.record(name, std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+}
+
+// Views and gets create missing pools, which isn't safe while other systems iterate, so everything the concurrent
+// systems touch exists up front. Pools stay around once created.
+static void assure_system_storages(entt::registry& registry) {
+    registry.storage<LogicTransform>();
+    registry.storage<ModelTransform>();
+    registry.storage<Model>();
+    registry.storage<TransformLink>();
+    registry.storage<Grounded>();
+    registry.storage<Dragging>();
+    registry.storage<Collision>();
+    registry.storage<GridSlot>();
+    registry.storage<Traveler>();
+    registry.storage<Enemy>();
+    registry.storage<Attachment>();
+    registry.storage<InnateBot>();
+    registry.storage<SpiderController>();
+    registry.storage<PoseController>();
+    registry.storage<Caster>();
+    registry.storage<Tags>();
+    registry.storage<Shrine>();
+    registry.storage<Spawner>();
+    registry.storage<CastingPlatform>();
+    registry.storage<Lizard>();
+    registry.storage<Pickup>();
+}
+
+// Systems run in this order, except that the ones between two exclusive systems overlap where their access allows
+static void setup_systems(Scene* scene) {
+    SystemScheduler& s = scene->scheduler;
+    // Expired effects are dropped here, so the systems below only ever read stats
+    s.add("stats", stat_system, 0, SystemAccess_All);
+    s.add("map_data", [](Scene* scene) {
+        if (scene->map_data.dirty)
+            scene->map_data.update(scene->registry);
+    }, SystemAccess_Static, SystemAccess_MapData);
+    s.add("path_cache", [](Scene* scene) { scene->path_cache.sync(scene->map_data); }, SystemAccess_MapData, SystemAccess_PathCache);
+    s.add("flow_fields", [](Scene* scene) { scene->flow_fields.sync(scene->map_data); }, SystemAccess_MapData, SystemAccess_FlowFields);
+    s.add("paths", [](Scene* scene) { update_paths(scene->paths, *scene); },
+        SystemAccess_MapData | SystemAccess_LogicTransform | SystemAccess_Static, SystemAccess_PathCache | SystemAccess_Navigation | SystemAccess_Paths);
+
+    s.add("timers", update_timers, 0, SystemAccess_All);
+
+    s.add("traveler_reset", traveler_reset_system, 0, SystemAccess_Traveler | SystemAccess_FlowFields);
+    s.add("collision_update", collision_update_system, SystemAccess_LogicTransform, SystemAccess_Collision);
+    s.add("enemy_aggro", enemy_aggro_system, 0, SystemAccess_All);
+    s.add("dragging", dragging_system, 0, SystemAccess_All);
+    s.add("spawner", spawner_system, 0, SystemAccess_All);
+    s.add("travel", travel_system, SystemAccess_Static | SystemAccess_MapData | SystemAccess_Stat,
+        SystemAccess_LogicTransform | SystemAccess_Traveler | SystemAccess_FlowFields | SystemAccess_Navigation);
+    s.add("enemy_decollision", enemy_decollision_system, SystemAccess_Static | SystemAccess_Traveler, SystemAccess_LogicTransform);
+    s.add("scene_vertical_offset", scene_vertical_offset_system, SystemAccess_Static | SystemAccess_LogicTransform, SystemAccess_Grounded);
+    s.add("area_trigger", area_trigger_system, 0, SystemAccess_All);
+    // The constraints pose the skeleton, attachments then read the anchor bone
+    s.add("enemy_ik_controller", enemy_ik_controller_system,
+        SystemAccess_Static | SystemAccess_LogicTransform | SystemAccess_Grounded | SystemAccess_MapData,
+        SystemAccess_ModelTransform | SystemAccess_Skeleton | SystemAccess_IK | SystemAccess_Audio);
+    // Innate bots spin their model nodes
+    s.add("attachment_transform", attachment_transform_system, SystemAccess_Static | SystemAccess_IK | SystemAccess_Skeleton,
+        SystemAccess_LogicTransform | SystemAccess_ModelTransform | SystemAccess_Renderables);
+
+    s.add("caster", caster_system, 0, SystemAccess_All);
+    s.add("projectile", projectile_system, 0, SystemAccess_All);
+
+    // Kills are deferred to the health system
+    s.add("pickup", pickup_system, SystemAccess_Static,
+        SystemAccess_Pickup | SystemAccess_TransformLink | SystemAccess_LogicTransform | SystemAccess_ModelTransform | SystemAccess_Player);
+    // Attachments and IK read the model transforms, so this isn't presentation only
+    s.add("transform", transform_system,
+        SystemAccess_Static | SystemAccess_LogicTransform | SystemAccess_Grounded | SystemAccess_Dragging | SystemAccess_TransformLink,
+        SystemAccess_ModelTransform | SystemAccess_Renderables);
+    // Animation runs on the step's time, skinning isn't needed without a renderer. Poses only touch skeletons, so this
+    // overlaps everything around it.
+    if (!scene->headless)
+        s.add("pose", pose_system, SystemAccess_Static, SystemAccess_Skeleton);
+    s.add("consumer", consumer_system, SystemAccess_Static, SystemAccess_LogicTransform);
+    s.add("health", health_system, 0, SystemAccess_All);
+    s.add("disposal", disposal_system, 0, SystemAccess_All);
+    s.compile();
+}
+
 Scene::Scene() {}
 Scene::~Scene() {}
 
-void Scene::setup(const string& input_name) {
+void Scene::setup(const string& input_name, bool input_headless) {
     name = input_name;
+    headless = input_headless;
 	render_scene.name = name + "::render_scene";
+	render_scene.headless = headless;
 	camera = Camera(v3(-8.0f, 8.0f, 6.0f), math::d2r(euler{-45.0f, -30.0f}));
 	render_scene.viewport.name	 = render_scene.name + "::viewport";
 	render_scene.viewport.camera = &camera;
-	render_scene.viewport.setup();
 	controller.name = name + "::controller";
-	controller.setup(&render_scene.viewport, &camera);
+    if (!headless) {
+        render_scene.viewport.setup();
+        controller.setup(&render_scene.viewport, &camera);
+    }
 
     registry.on_construct<Dragging>().connect<&on_dragging_create>(*this);
     registry.on_destroy<Model>().connect<&on_model_destroy>(*this);
@@ -49,13 +193,17 @@ void Scene::setup(const string& input_name) {
     registry.on_destroy<EmitterComponent>().connect<&on_emitter_component_destroy>(*this);
     registry.on_destroy<GridSlot>().connect<&on_gridslot_destroy>(*this);
     registry.on_destroy<Enemy>().connect<&on_enemy_destroy>(*this);
+    registry.on_destroy<Collision>().connect<&on_collision_destroy>(*this);
+    registry.on_destroy<LogicTransform>().connect<&on_logic_transform_destroy>(*this);
     registry.on_construct<GridSlot>().connect<&on_gridslot_create>(*this);
     registry.on_destroy<GridSlot>().connect<&on_gridslot_destroy>(*this);
     registry.on_construct<ForceDragging>().connect<&on_forcedrag_create>(*this);
     registry.on_destroy<ForceDragging>().connect<&on_forcedrag_destroy>(*this);
 
-    game.scenes.push_back(this);
-	get_renderer().add_scene(&render_scene);
+    if (!headless) {
+        game.scenes.push_back(this);
+        get_renderer().add_scene(&render_scene);
+    }
 
     spawn_state_info = new SpawnStateInfo();
     player.bank.beads[Bead_Quartz] = 2;
@@ -65,79 +213,143 @@ void Scene::setup(const string& input_name) {
 
     navigation = std::make_unique<astar::Navigation>(&map_data.path_solids, &map_data.slot_solids, &map_data.unstandable_solids, &map_data.ramps);
 
-    audio.setup();
+    assure_system_storages(registry);
+    setup_systems(this);
+
+    std::random_device device;
+    set_seed(uint64(device()) << 32 | device());
+
+    // Without an engine every play_sound is a no-op
+    if (!headless)
+        audio.setup();
 }
 
 void Scene::update() {
 	ZoneScoped;
+
+    if (!headless) {
+        controller.update();
+        audio.update(this);
+        gather_input();
+    }
+
+    advance(Input::delta_time);
+    present();
+}
+
+uint32 Scene::advance(float real_time) {
+    ZoneScoped;
+    float scaled_time = real_time * time_scale;
+    if (fixed_step <= 0.0f) {
+        step(scaled_time);
+        return 1;
+    }
+
+    accumulator += scaled_time;
+    uint32 steps = 0;
+    while (accumulator >= fixed_step) {
+        if (steps == max_steps_per_advance) {
+            accumulator = 0.0f;
+            break;
+        }
+        step(fixed_step);
+        accumulator -= fixed_step;
+        steps++;
+    }
+    return steps;
+}
+
+void Scene::step(float step_time) {
+	ZoneScoped;
     
     frame++;
-    delta_time = Input::delta_time * time_scale;
+    delta_time = step_time;
     time += delta_time;
 
-    if (map_data.dirty)
-        map_data.update(registry);
-    update_paths(paths, *this);
-    
-    update_timers(this);
-    
-	controller.update();
-    audio.update(this);
+    for (const SceneCommand& queued : queued_commands) {
+        if (recording)
+            recording->commands.push_back({frame, queued});
+        apply_command(queued);
+    }
+    queued_commands.clear();
 
-    traveler_reset_system(this);
-    
-    dragging_update_system(this);
-    collision_update_system(this);
-    enemy_aggro_system(this);
-    dragging_system(this);
-    spawner_system(this);
-    travel_system(this);
-    enemy_decollision_system(this);
-    scene_vertical_offset_system(this);
-    area_trigger_system(this);
-    enemy_ik_controller_system(this);
-    attachment_transform_system(this);
-
-    caster_system(this);
-    projectile_system(this);
-
-    pickup_system(this);
-    
-    visual_tile_widget_system(this);
-    transform_system(this);
-    emitter_system(this);
-    pose_system(this);
-    selection_id_system(this);
-    consumer_system(this);
-    health_system(this);
-    health_draw_system(this);
-    disposal_system(this);
-
-
-    for (auto entity : registry.view<Name>()) {
-        preview_3d_components(this, entity);
+    scheduler.run(this);
+
+    if (recording) {
+        recording->checksums.push_back(scene_checksum(this));
+        recording->tick_count = frame;
     }
 }
 
+void Scene::present() {
+    ZoneScoped;
+    if (headless)
+        return;
+
+    run_system(this, "visual_tile_widget", visual_tile_widget_system);
+    run_system(this, "emitter", emitter_system);
+    run_system(this, "selection_id", selection_id_system);
+    run_system(this, "health_draw", health_draw_system);
+    run_system(this, "preview_3d", [](Scene* scene) {
+        for (auto entity : scene->registry.view<Name>()) {
+            preview_3d_components(scene, entity);
+        }
+    });
+}
+
 void MapData::update(entt::registry& registry) {
     ZoneScoped;
-    clear();
+    umap<v3i, MapCell> new_cells;
     for (auto [entity, slot, logic_tfm] : registry.view<GridSlot, LogicTransform>().each()) {
+        MapCell& cell = new_cells[v3i(logic_tfm.position)];
         if (slot.ramp) {
-            ramps[v3i(logic_tfm.position)] = slot.direction;
+            cell.flags |= MapCellFlag_Ramp;
+            cell.ramp_direction = slot.direction;
             continue;
         }
         if (!slot.standable)
-            unstandable_solids.set(v3i(logic_tfm.position));
+            cell.flags |= MapCellFlag_Unstandable;
         else if (slot.path)
-            path_solids.set(v3i(logic_tfm.position));
+            cell.flags |= MapCellFlag_Path;
         else
-            slot_solids.set(v3i(logic_tfm.position));
-        solids.set(v3i(logic_tfm.position));
+            cell.flags |= MapCellFlag_Slot;
     }
+    apply(std::move(new_cells));
+}
+
+void MapData::apply(umap<v3i, MapCell>&& new_cells) {
+    ZoneScoped;
+    changed_cells.clear();
+    for (auto& [pos, cell] : new_cells) {
+        auto it = cells.find(pos);
+        if (it == cells.end() || it->second != cell)
+            changed_cells.push_back(pos);
+    }
+    for (auto& [pos, cell] : cells) {
+        if (!new_cells.contains(pos))
+            changed_cells.push_back(pos);
+    }
+    cells = std::move(new_cells);
+
+    clear();
+    for (auto& [pos, cell] : cells) {
+        if (cell.flags & MapCellFlag_Ramp)
+            ramps[pos] = cell.ramp_direction;
+        if (cell.flags & MapCellFlag_Unstandable)
+            unstandable_solids.set(pos);
+        if (cell.flags & MapCellFlag_Path)
+            path_solids.set(pos);
+        if (cell.flags & MapCellFlag_Slot)
+            slot_solids.set(pos);
+        if (cell.flags & (MapCellFlag_Unstandable | MapCellFlag_Path | MapCellFlag_Slot))
+            solids.set(pos);
+    }
+    if (!changed_cells.empty())
+        revision++;
     dirty = false;
 }
-    
+
+// Clears the derived bitmasks, cells are kept so the next apply can diff against them
 void MapData::clear() {
     solids.clear();
     path_solids.clear();
@@ -151,9 +363,9 @@ void update_paths(vector<PathInfo>& paths, Scene& scene) {
     paths.clear();
     for (auto [spawner_e, spawner, spawner_tfm] : scene.registry.view<Spawner, LogicTransform>().each()) {
         for (auto [consumer_e, consumer, consumer_tfm] : scene.registry.view<Shrine, LogicTransform>().each()) {
-            Path path = scene.navigation->find_path(math::round_cast(spawner_tfm.position), math::round_cast(consumer_tfm.position));
+            const Path& path = scene.path_cache.find_path(*scene.navigation, math::round_cast(spawner_tfm.position), math::round_cast(consumer_tfm.position));
             if (math::distance(path.get_destination(), consumer_tfm.position) < 0.1f) {
-                paths.emplace_back(spawner_e, consumer_e, std::move(path));
+                paths.emplace_back(spawner_e, consumer_e, path);
             }
         }
     }
@@ -171,10 +383,112 @@ void render_paths(vector<PathInfo>& paths, RenderScene& render_scene, float time
             vertices.emplace_back(v + v3(0.5f, 0.5f, 0.05f), Color::hsv(hue, saturation, 0.8f), width);
             x += 1.5f;
         }
-        render_scene.quick_mesh(generate_formatted_line(render_scene.viewport.camera, std::move(vertices)), true, false);
+        render_scene.draw_line(render_scene.viewport.camera, vertices);
+    }
+}
+
+
+void Scene::start_game() {
+    set_edit_mode(false);
+    player.scene = this;
+    shop.shop_generator = std::make_unique<FirstFreeShopGenerator>();
+    shop.shop_generator->setup(this);
+}
+
+void Scene::set_seed(uint64 new_seed) {
+    seed = new_seed;
+    for (uint32 i = 0; i < RandomStream_Count; i++)
+        random[i].seed(seed, i);
+}
+
+void Scene::command(const SceneCommand& new_command) {
+    // Drags repeat every frame the mouse is held, anything else is a separate action even when it matches
+    if (new_command.type == SceneCommand_DragTo && !queued_commands.empty() && queued_commands.back() == new_command)
+        return;
+    // Mouse releases come in whether or not anything is held
+    if (new_command.type == SceneCommand_Release && selected_entity == entt::null) {
+        bool selecting = false;
+        for (const SceneCommand& queued : queued_commands)
+            selecting |= queued.type == SceneCommand_Select;
+        if (!selecting)
+            return;
+    }
+    queued_commands.push_back(new_command);
+}
+
+void Scene::apply_command(const SceneCommand& applied) {
+    switch (applied.type) {
+        case SceneCommand_Select: {
+            if (registry.valid(entt::entity(applied.entity)))
+                select_entity(entt::entity(applied.entity), applied.point);
+            has_drag_cell = false;
+        } break;
+        case SceneCommand_DragTo: {
+            has_drag_cell = true;
+            drag_cell = applied.cell;
+        } break;
+        case SceneCommand_Release: {
+            release_selected();
+            has_drag_cell = false;
+        } break;
+        case SceneCommand_Ready: {
+            if (!shop.shop_generator)
+                break;
+            shop.shop_generator->reset();
+            shop.shop_generator->round_info->advance_round();
+        } break;
+        case SceneCommand_Reroll: {
+            if (!shop.shop_generator)
+                break;
+            shop.shop_generator->reset();
+            shop.entries = shop.shop_generator->generate_shop();
+        } break;
+        case SceneCommand_Purchase: {
+            if (shop.entries == nullptr || applied.index >= shop.entries->size())
+                break;
+            ShopEntry* entry = shop.entries->at(applied.index);
+            if (player.bank.beads[entry->cost_type] < entry->cost_amount)
+                break;
+            player.bank.beads[entry->cost_type] -= entry->cost_amount;
+            shop.shop_generator->purchase(applied.index);
+        } break;
     }
 }
 
+void Scene::start_recording(const FilePath& map_path) {
+    assert_else(frame == 0)
+        return;
+    // Playback seeds after instancing the map, so the streams have to start over here too
+    set_seed(seed);
+    recording = std::make_unique<Replay>();
+    recording->map_path = map_path;
+    recording->seed = seed;
+    recording->fixed_step = fixed_step;
+}
+
+void Scene::gather_input() {
+    ZoneScoped;
+    dragging_update_system(this);
+
+    if (registry.view<Dragging>(entt::exclude<ForceDragging>).size_hint() == 0)
+        return;
+    v3i cell;
+    if (!get_object_placement(cell))
+        return;
+    // Compared against the target once the queue is applied
+    bool has_target = has_drag_cell;
+    v3i target = drag_cell;
+    for (const SceneCommand& queued : queued_commands) {
+        if (queued.type == SceneCommand_DragTo) {
+            has_target = true;
+            target = queued.cell;
+        } else if (queued.type == SceneCommand_Select || queued.type == SceneCommand_Release) {
+            has_target = false;
+        }
+    }
+    if (!has_target || cell != target)
+        command({.type = SceneCommand_DragTo, .cell = cell});
+}
 
 void Scene::set_edit_mode(bool to) {
     render_scene.render_grid = false;
@@ -186,6 +500,8 @@ void Scene::cleanup() {
     audio.shutdown();
     delete spawn_state_info;
     
+    if (headless)
+        return;
     controller.cleanup();
 	render_scene.cleanup(*get_renderer().global_allocator);
     game.scenes.remove_value(this);
@@ -242,6 +558,34 @@ void Scene::settings_window(bool* p_open) {
 			    render_scene.settings_gui();
 				ImGui::EndTabItem();
 			}
+			if (ImGui::BeginTabItem("Pathing")) {
+			    inspect(&path_cache);
+				ImGui::Separator();
+				ImGui::Text("Flow Fields");
+			    inspect(&flow_fields);
+				ImGui::EndTabItem();
+			}
+			if (ImGui::BeginTabItem("Timers")) {
+			    inspect(&timer_manager);
+				ImGui::EndTabItem();
+			}
+			if (ImGui::BeginTabItem("Audio")) {
+			    inspect(&audio);
+				ImGui::EndTabItem();
+			}
+			if (ImGui::BeginTabItem("IK")) {
+			    inspect(&ik_chains);
+				ImGui::EndTabItem();
+			}
+			if (ImGui::BeginTabItem("Systems")) {
+			    ImGui::Checkbox("Parallel", &scheduler.parallel);
+			    inspect(&system_timings);
+				ImGui::EndTabItem();
+			}
+			if (ImGui::BeginTabItem("Text")) {
+			    inspect(&get_font_manager().text_meshes);
+				ImGui::EndTabItem();
+			}
 			ImGui::EndTabBar();
 		}
 	}
@@ -367,9 +711,8 @@ entt::entity quick_emitter(Scene* scene, const string& name, v3 position, Emitte
     return e;
 }
 
-void Scene::select_entity(entt::entity entity) {
+void Scene::select_entity(entt::entity entity, v3 intersect) {
     selected_entity = entity;
-    v3  intersect = math::intersect_axis_plane(render_scene.viewport.ray((v2i) Input::mouse_pos), Z, 0.0f);
     LogicTransform* logic_tfm = registry.try_get<LogicTransform>(selected_entity);
     if (!logic_tfm)
         return;
@@ -6,12 +6,19 @@
 #include "general/navigation_path.hpp"
 #include "general/bitmask_3d.hpp"
 #include "renderer/render_scene.hpp"
+#include "renderer/assets/skeleton.hpp"
 #include "game/camera_controller.hpp"
 #include "game/timer.hpp"
 #include "game/shop.hpp"
 #include "game/player.hpp"
 #include "game/map_targeting.hpp"
 #include "game/audio.hpp"
+#include "game/path_cache.hpp"
+#include "game/broadphase.hpp"
+#include "game/flow_field.hpp"
+#include "game/random_stream.hpp"
+#include "game/replay.hpp"
+#include "game/system_scheduler.hpp"
 
 
 namespace spellbook {
@@ -30,8 +37,27 @@ struct PathInfo {
     Path path;
 };
 
+enum MapCellFlag : uint8 {
+    MapCellFlag_Path        = 1 << 0,
+    MapCellFlag_Slot        = 1 << 1,
+    MapCellFlag_Unstandable = 1 << 2,
+    MapCellFlag_Ramp        = 1 << 3
+};
+
+struct MapCell {
+    uint8 flags = 0;
+    Direction ramp_direction = Direction_Up;
+
+    bool operator==(const MapCell& other) const = default;
+};
+
 struct MapData {
     bool dirty = false;
+    // Incremented whenever an update changes any cell, changed_cells holds the cells that differ from the previous revision
+    uint32 revision = 0;
+    umap<v3i, MapCell> cells;
+    vector<v3i> changed_cells;
+
     Bitmask3D solids;
     Bitmask3D path_solids;
     Bitmask3D slot_solids;
@@ -39,14 +65,38 @@ struct MapData {
     umap<v3i, Direction> ramps;
 
     void update(entt::registry& registry);
+    void apply(umap<v3i, MapCell>&& new_cells);
     void clear();
 };
 
+// Wall time of each system, only sampled while enabled so regular frames don't pay for the clock reads
+struct SystemTimings {
+    struct Entry {
+        string_view name;
+        double total_ms = 0.0;
+        double max_ms = 0.0;
+        uint32 calls = 0;
+    };
+    bool enabled = false;
+    // In first run order, names are the string literals given to the scene
+    vector<Entry> entries;
+    umap<string_view, uint32> indices;
+
+    void record(string_view name, double ms);
+    void clear();
+};
+
+void inspect(SystemTimings* timings);
+// One line per system, costliest first
+string format_system_timings(const SystemTimings& timings);
+
 struct Scene {
     string           name;
     RenderScene      render_scene;
     Camera           camera;
     CameraController controller;
+    // Declared before the registry so components holding timers release them into a live manager
+    TimerManager     timer_manager;
     entt::registry   registry;
     entt::entity     selected_entity;
     Shop             shop;
@@ -55,32 +105,70 @@ struct Scene {
     Audio            audio;
     
     bool edit_mode = true; // disables certain features
+    // No window, renderer or audio device, systems that only feed those are skipped
+    bool headless = false;
     uint32 frame = 0;
     float time = 0.0f;
     float delta_time = 0.0f;
     float time_scale = 1.0f;
+    // 0 steps once per update with the frame time, otherwise updates advance in fixed steps through the accumulator
+    float fixed_step = 0.0f;
+    float accumulator = 0.0f;
+    // Steps past this in one advance are dropped instead of catching up
+    uint32 max_steps_per_advance = 8;
+    SystemTimings system_timings;
+    // The step's systems, built in setup
+    SystemScheduler scheduler;
+
+    uint64 seed = 0;
+    RandomStream random[RandomStream_Count];
+    // Input goes through here and is applied at the start of the next step
+    vector<SceneCommand> queued_commands;
+    // Steps append their commands and checksum while set
+    std::unique_ptr<Replay> recording;
+    // Target of the player's drags, set by drag commands
+    bool has_drag_cell = false;
+    v3i drag_cell = {};
 
     bool pause = false;
 
-    TimerManager timer_manager;
-
     umap<v3i, entt::entity> visual_map_entities;
     MapData map_data;
+    Broadphase broadphase;
     std::unique_ptr<MapTargeting> targeting;
     
     std::unique_ptr<astar::Navigation> navigation;
+    PathCache path_cache;
+    FlowFields flow_fields;
+    // Enemy legs, rebuilt and solved together each frame
+    IKChains ik_chains;
     vector<PathInfo> paths;
 
     Scene();
     ~Scene();
-    void setup(const string& name);
+    void setup(const string& name, bool headless = false);
     void update();
+    // Scales real_time by time_scale and runs the steps it covers, returns the number of steps taken
+    uint32 advance(float real_time);
+    void step(float step_time);
+    // Systems that only feed the renderer, once per frame however many steps ran
+    void present();
     void cleanup();
 
+    // Play mode with the player's shop, shared by the game scene and replays so both start from the same state
+    void start_game();
+    void set_seed(uint64 seed);
+    void command(const SceneCommand& command);
+    void apply_command(const SceneCommand& command);
+    // Must start before the first step, replays always play from the map's initial state
+    void start_recording(const FilePath& map_path);
+    // Turns mouse picking and drag placement into commands
+    void gather_input();
+
     void inspect_entity(entt::entity entity);
     void settings_window(bool* p_open);
     void output_window(bool* p_open);
-    void select_entity(entt::entity entity);
+    void select_entity(entt::entity entity, v3 intersect);
 
     // Helper query functions
     bool is_casting_platform(v3i);
@@ -14,7 +14,7 @@
 
 namespace spellbook {
 
-ShopEntry* Warehouse::get_entry() {
+ShopEntry* Warehouse::get_entry(RandomStream& random) {
     assert_else(entries.size() == probabilities.size() && probabilities.size() == stock.size())
         return &entries.front();
 
@@ -24,7 +24,7 @@ ShopEntry* Warehouse::get_entry() {
     }
 
     float current_probability = 0.0f;
-    float target_probability = math::random_float();
+    float target_probability = random.random_float();
     for (uint32 i = 0; i < entries.size(); i++) {
         float entry_probability = stock[i] ? probabilities[i] / total_probability : 0.0f;
         current_probability += entry_probability;
@@ -64,6 +64,7 @@ void ShopGenerator::inspect() {
 
 void FirstFreeShopGenerator::setup(Scene* scene) {
     round_info = scene->spawn_state_info;
+    random = &scene->random[RandomStream_Shop];
     first_warehouse.add_entry({Bead_Oak, 0, LizardType_Assassin}, 1.0f);
 }
 vector<ShopEntry*>* FirstFreeShopGenerator::generate_shop() {
@@ -71,7 +72,7 @@ vector<ShopEntry*>* FirstFreeShopGenerator::generate_shop() {
         return &out_shop;
 
     for (uint32 i = 0; i < shop_size; i++) {
-        auto entry = round_info->round_number >= 0 ? warehouse.get_entry() : first_warehouse.get_entry();
+        auto entry = round_info->round_number >= 0 ? warehouse.get_entry(*random) : first_warehouse.get_entry(*random);
         if (entry == nullptr)
             break;
         out_shop.push_back(entry);
@@ -106,6 +107,7 @@ void FirstFreeShopGenerator::inspect() {
 
 void SimpleShopGenerator::setup(Scene* scene) {
     round_info = scene->spawn_state_info;
+    random = &scene->random[RandomStream_Shop];
     warehouse.add_entry({Bead_Oak, 4, LizardType_Assassin}, 1.0f);
 }
 vector<ShopEntry*>* SimpleShopGenerator::generate_shop() {
@@ -113,7 +115,7 @@ vector<ShopEntry*>* SimpleShopGenerator::generate_shop() {
         return &out_shop;
 
     for (uint32 i = 0; i < shop_size; i++) {
-        auto entry = warehouse.get_entry();
+        auto entry = warehouse.get_entry(*random);
         if (entry == nullptr)
             break;
         out_shop.push_back(entry);
@@ -190,14 +192,12 @@ void show_shop(Shop* shop, Player* player) {
     
     ImGui::BeginGroup();
     if (ImGui::Button("Get Shop")) {
-        player->scene->audio.play_sound("audio/reroll.flac"_resource, {.global = true, .volume = 0.3f});
-        shop->shop_generator->reset();
-        shop->entries = shop->shop_generator->generate_shop();
+        player->scene->audio.play_sound("audio/reroll.flac"_resource, {.global = true, .volume = 0.3f, .sound_class = SoundClass_UI, .priority = 1});
+        player->scene->command({.type = SceneCommand_Reroll});
     }
     ImGui::SameLine();
     if (ImGui::Button("Ready")) {
-        shop->shop_generator->reset();
-        shop->shop_generator->round_info->advance_round();
+        player->scene->command({.type = SceneCommand_Ready});
     }
     if (shop->entries != nullptr) {
         for (uint32 i = 0; i < shop->entries->size(); i++) {
@@ -217,10 +217,9 @@ void show_shop(Shop* shop, Player* player) {
                     v3  intersect = math::intersect_axis_plane(player->scene->render_scene.viewport.ray((v2i) Input::mouse_pos), Z, 0.0f);
 
                     // TODO: instance
-                    player->scene->audio.play_sound("audio/drop.flac"_resource, {.global = true, .volume = 0.3f});
+                    player->scene->audio.play_sound("audio/drop.flac"_resource, {.global = true, .volume = 0.3f, .sound_class = SoundClass_UI, .priority = 1});
                     //player->scene->select_entity(lizard);
-                    player->bank.beads[bead_type] -= shop->entries->at(i)->cost_amount;
-                    shop->shop_generator->purchase(i);
+                    player->scene->command({.type = SceneCommand_Purchase, .index = i});
                 }
                 ImGui::Text("Place");
                 ImGui::EndDragDropSource();
@@ -4,6 +4,7 @@
 #include "general/vector.hpp"
 #include "game/entities/drop.hpp"
 #include "game/entities/lizards/lizard.hpp"
+#include "game/random_stream.hpp"
 
 namespace spellbook {
 
@@ -24,12 +25,13 @@ struct Warehouse {
     vector<float> probabilities = {};
     vector<uint8> stock = {};
 
-    ShopEntry* get_entry();
+    ShopEntry* get_entry(RandomStream& random);
     void add_entry(ShopEntry&& shop_entry, float probability);
 };
 
 struct ShopGenerator {
     SpawnStateInfo* round_info = nullptr;
+    RandomStream* random = nullptr;
     
     virtual void setup(Scene* scene);
     virtual vector<ShopEntry*>* generate_shop();
@@ -0,0 +1,191 @@
+#include "simulation.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <tracy/Tracy.hpp>
+
+#include "extension/fmt.hpp"
+#include "game/scene.hpp"
+#include "game/map.hpp"
+#include "game/job_pool.hpp"
+#include "game/entities/components.hpp"
+#include "game/entities/enemy.hpp"
+#include "game/entities/spawner.hpp"
+
+namespace spellbook {
+
+// Rounds that run past this are cut off, enemies can get stuck when nothing on the map kills them
+constexpr float round_time_limit = 600.0f;
+
+static uint32 alive_enemies(Scene* scene) {
+    return scene->registry.view<Enemy>(entt::exclude<Killed>).size_hint();
+}
+
+bool round_finished(Scene* scene) {
+    if (alive_enemies(scene) != 0)
+        return false;
+    for (auto [entity, spawner] : scene->registry.view<Spawner>().each()) {
+        if (spawner.state.round_number < scene->spawn_state_info->round_number)
+            return false;
+        if (spawner.state.round_number >= int(spawner.spawn_info.rounds.size()))
+            continue;
+        RoundSpawnInfo& round = *spawner.spawn_info.rounds[spawner.state.round_number];
+        if (spawner.state.wave_number + 1 < int(round.waves.size()))
+            return false;
+        if (spawner.state.wave_number >= 0 && spawner.state.enemy_number < int(round.waves[spawner.state.wave_number]->enemies.size()))
+            return false;
+    }
+    return true;
+}
+
+string run_headless_simulation(const FilePath& map_path, int rounds, float fixed_step) {
+    ZoneScoped;
+    using clock = std::chrono::steady_clock;
+    auto ms = [](auto from, auto to) { return std::chrono::duration<double, std::milli>(to - from).count(); };
+
+    if (!map_path.is_file())
+        return fmt_("map {} not found", map_path.rel_string());
+    if (fixed_step <= 0.0f)
+        return "fixed step must be positive";
+    const MapPrefab& map_prefab = load_resource<MapPrefab>(map_path);
+    rounds = std::min(rounds, int(spawn_round_count(map_prefab)));
+    if (rounds <= 0)
+        return fmt_("{} has no spawn rounds", map_path.rel_string());
+
+    auto t0 = clock::now();
+    Scene* scene = instance_map(map_prefab, "headless", true);
+    scene->set_edit_mode(false);
+    scene->fixed_step = fixed_step;
+    scene->system_timings.enabled = true;
+    auto t1 = clock::now();
+
+    uint32 steps = 0;
+    uint32 peak_enemies = 0;
+    uint32 cut_off = 0;
+    for (int round = 0; round < rounds; round++) {
+        scene->spawn_state_info->advance_round();
+        float round_start = scene->time;
+        do {
+            steps += scene->advance(fixed_step);
+            // Stands in for the renderer dropping the frame's debug draws
+            scene->render_scene.delete_frame_allocated();
+            peak_enemies = std::max(peak_enemies, alive_enemies(scene));
+            if (scene->time - round_start > round_time_limit) {
+                cut_off++;
+                break;
+            }
+        } while (!round_finished(scene));
+    }
+    auto t2 = clock::now();
+
+    double wall_ms = ms(t1, t2);
+    string result = fmt_("{}: {} rounds, {} steps of {:.2f}ms, {:.1f}s simulated in {:.1f}ms ({:.0f}x real time), setup {:.1f}ms, peak {} enemies",
+        map_path.rel_string(), rounds, steps, fixed_step * 1000.0f, scene->time, wall_ms, scene->time * 1000.0 / std::max(wall_ms, 0.001),
+        ms(t0, t1), peak_enemies);
+    if (cut_off > 0)
+        result += fmt_(", {} rounds cut off at {:.0f}s", cut_off, round_time_limit);
+    result += format_system_timings(scene->system_timings);
+
+    // Cleared first so the destroy callbacks return the model references to the asset cache
+    scene->registry.clear();
+    scene->cleanup();
+    delete scene;
+    return result;
+}
+
+string benchmark_simulation(int rounds) {
+    FilePath map_path = map_with_most_rounds();
+    if (!map_path.is_file())
+        return "no maps with spawn rounds";
+    return run_headless_simulation(map_path, rounds);
+}
+
+bool spawn_enemy_crowd(Scene* scene, int enemy_count) {
+    vector<std::pair<v3i, FilePath>> spawns;
+    for (auto [entity, spawner, logic_tfm] : scene->registry.view<Spawner, LogicTransform>().each()) {
+        if (spawner.spawn_info.rounds.empty() || spawner.spawn_info.rounds[0]->waves.empty() || spawner.spawn_info.rounds[0]->waves[0]->enemies.empty())
+            continue;
+        spawns.emplace_back(v3i(logic_tfm.position), spawner.spawn_info.rounds[0]->waves[0]->enemies[0]->enemy_prefab_path);
+    }
+    if (spawns.empty())
+        return false;
+    for (int i = 0; i < enemy_count; i++) {
+        auto& [location, enemy_path] = spawns[i % spawns.size()];
+        instance_prefab(scene, load_resource<EnemyPrefab>(enemy_path), location);
+    }
+    return true;
+}
+
+string benchmark_scheduler(int enemy_count) {
+    ZoneScoped;
+    using clock = std::chrono::steady_clock;
+    constexpr uint32 warmup_steps = 10;
+    constexpr uint32 measured_steps = 120;
+    constexpr float step_time = 1.0f / 60.0f;
+
+    FilePath map_path = map_with_most_rounds();
+    if (!map_path.is_file())
+        return "no maps with spawn rounds";
+    const MapPrefab& map_prefab = load_resource<MapPrefab>(map_path);
+
+    // 1, 2, 4... threads up to the hardware's, the calling thread is always one of them
+    uint32 hardware_threads = std::max(std::thread::hardware_concurrency(), 1u);
+    vector<uint32> thread_counts;
+    for (uint32 threads = 1; threads < hardware_threads; threads *= 2)
+        thread_counts.push_back(threads);
+    thread_counts.push_back(hardware_threads);
+
+    string result = fmt_("{}: {} enemies, {} steps", map_path.rel_string(), enemy_count, measured_steps);
+    string timings;
+    double serial_ms = 0.0;
+    uint32 serial_checksum = 0;
+    for (uint32 threads : thread_counts) {
+        get_job_pool().start(threads - 1);
+        Scene* scene = instance_map(map_prefab, "scheduler", true);
+        scene->set_edit_mode(false);
+        scene->set_seed(1);
+
+        if (!spawn_enemy_crowd(scene, enemy_count)) {
+            scene->registry.clear();
+            scene->cleanup();
+            delete scene;
+            get_job_pool().start(hardware_threads - 1);
+            return fmt_("{} has no enemies to spawn", map_path.rel_string());
+        }
+
+        for (uint32 i = 0; i < warmup_steps; i++) {
+            scene->step(step_time);
+            scene->render_scene.delete_frame_allocated();
+        }
+        scene->system_timings.enabled = true;
+        auto start = clock::now();
+        for (uint32 i = 0; i < measured_steps; i++) {
+            scene->step(step_time);
+            scene->render_scene.delete_frame_allocated();
+        }
+        double step_ms = std::chrono::duration<double, std::milli>(clock::now() - start).count() / measured_steps;
+        uint32 checksum = scene_checksum(scene);
+
+        if (threads == 1) {
+            serial_ms = step_ms;
+            serial_checksum = checksum;
+        }
+        result += fmt_("\n  {:>2} threads: {:.3f}ms/step, {:.2f}x", threads, step_ms, serial_ms / std::max(step_ms, 0.0001));
+        // The schedule keeps every ordering that matters, so the outcome can't depend on the thread count
+        if (checksum != serial_checksum)
+            result += ", diverged from 1 thread";
+        if (threads == thread_counts.back())
+            timings = format_system_timings(scene->system_timings);
+
+        scene->registry.clear();
+        scene->cleanup();
+        delete scene;
+    }
+    get_job_pool().start(hardware_threads - 1);
+
+    result += fmt_("\nsystems at {} threads:", thread_counts.back());
+    result += timings;
+    return result;
+}
+
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include "general/string.hpp"
+#include "general/file/file_path.hpp"
+
+namespace spellbook {
+
+struct Scene;
+
+// Every spawner has caught up to the level's round and spawned all of it, and nothing it spawned is left
+bool round_finished(Scene* scene);
+
+// Instances the map into a headless scene and plays up to rounds rounds as fast as possible on fixed steps. Reports the
+// simulated and wall time along with the per step cost of every system.
+string run_headless_simulation(const FilePath& map_path, int rounds, float fixed_step = 1.0f / 60.0f);
+
+// Spreads enemy_count enemies over the spawners, each sending what its first wave starts with. False if no spawner
+// has anything to send.
+bool spawn_enemy_crowd(Scene* scene, int enemy_count);
+
+// Runs the map with the most spawn rounds for rounds rounds
+string benchmark_simulation(int rounds);
+
+// Steps the same crowd of enemy_count enemies on 1, 2, 4... threads up to the hardware's. Reports the step time and
+// speedup of each thread count, checks the outcome didn't change, and gives per system timings at the most threads.
+string benchmark_scheduler(int enemy_count);
+
+}
@@ -0,0 +1,115 @@
+#include "system_scheduler.hpp"
+
+#include <chrono>
+#include <tracy/Tracy.hpp>
+
+#include "game/scene.hpp"
+#include "game/job_pool.hpp"
+
+namespace spellbook {
+
+// Buffer of the system running on this thread, null while nothing runs concurrently
+static thread_local CommandBuffer* current_commands = nullptr;
+
+void CommandBuffer::flush(Scene* scene) {
+    for (auto& command : commands)
+        command(scene);
+    commands.clear();
+}
+
+void defer(Scene* scene, std::function<void(Scene*)> command) {
+    if (current_commands)
+        current_commands->commands.push_back(std::move(command));
+    else
+        command(scene);
+}
+
+static bool conflicts(const SystemScheduler::Node& a, const SystemScheduler::Node& b) {
+    return (a.writes & (b.reads | b.writes)) != 0 || (b.writes & a.reads) != 0;
+}
+
+void SystemScheduler::add(string_view name, SystemFunction func, uint64 reads, uint64 writes) {
+    nodes.push_back(Node{name, func, reads, writes});
+}
+
+void SystemScheduler::compile() {
+    batches.clear();
+    for (uint32 i = 0; i < nodes.size(); i++) {
+        nodes[i].dependents.clear();
+        nodes[i].dependency_count = 0;
+        bool exclusive = nodes[i].writes == SystemAccess_All;
+        if (exclusive || batches.empty() || batches.back().exclusive)
+            batches.push_back(Batch{i, i + 1, exclusive});
+        else
+            batches.back().end = i + 1;
+    }
+    // Anything a system conflicts with earlier in its batch has to finish first, which keeps conflicting systems in the
+    // order they were added
+    for (const Batch& batch : batches) {
+        for (uint32 j = batch.begin; j < batch.end; j++) {
+            for (uint32 i = batch.begin; i < j; i++) {
+                if (conflicts(nodes[i], nodes[j])) {
+                    nodes[i].dependents.push_back(j);
+                    nodes[j].dependency_count++;
+                }
+            }
+        }
+    }
+    remaining = std::make_unique<std::atomic<uint32>[]>(nodes.size());
+}
+
+void SystemScheduler::_run_node(Scene* scene, uint32 index, JobGroup* group) {
+    Node& node = nodes[index];
+    // Saved since a thread waiting inside one system can pick up another
+    CommandBuffer* previous_commands = current_commands;
+    current_commands = node.writes != SystemAccess_All ? &node.commands : nullptr;
+    if (scene->system_timings.enabled) {
+        auto start = std::chrono::steady_clock::now();
+        node.func(scene);
+        node.ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    } else {
+        node.func(scene);
+    }
+    current_commands = previous_commands;
+
+    if (!group)
+        return;
+    for (uint32 dependent : node.dependents) {
+        if (remaining[dependent].fetch_sub(1, std::memory_order_acq_rel) == 1)
+            get_job_pool().submit(*group, [this, scene, dependent, group] { _run_node(scene, dependent, group); });
+    }
+}
+
+void SystemScheduler::run(Scene* scene) {
+    ZoneScoped;
+    JobPool& pool = get_job_pool();
+    for (const Batch& batch : batches) {
+        if (batch.exclusive) {
+            _run_node(scene, batch.begin, nullptr);
+        } else {
+            JobGroup group;
+            for (uint32 i = batch.begin; i < batch.end; i++)
+                remaining[i].store(nodes[i].dependency_count, std::memory_order_relaxed);
+            if (parallel && pool.worker_count() > 0 && batch.end - batch.begin > 1) {
+                for (uint32 i = batch.begin; i < batch.end; i++) {
+                    if (nodes[i].dependency_count == 0)
+                        pool.submit(group, [this, scene, i, group = &group] { _run_node(scene, i, group); });
+                }
+                pool.wait(group);
+            } else {
+                // Dependents are only ever later in the batch, so order alone satisfies them
+                for (uint32 i = batch.begin; i < batch.end; i++)
+                    _run_node(scene, i, nullptr);
+            }
+            for (uint32 i = batch.begin; i < batch.end; i++)
+                nodes[i].commands.flush(scene);
+        }
+
+        if (scene->system_timings.enabled) {
+            for (uint32 i = batch.begin; i < batch.end; i++)
+                scene->system_timings.record(nodes[i].name, nodes[i].ms);
+        }
+    }
+}
+
+}
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <memory>
+
+#include "general/string.hpp"
+#include "general/vector.hpp"
+
+namespace spellbook {
+
+struct Scene;
+struct JobGroup;
+
+// What a system touches, two systems can run at the same time when neither writes anything the other reads or writes.
+// Static covers the components that only exclusive systems create, destroy or change, everything else reads them.
+enum SystemAccess : uint64 {
+    SystemAccess_LogicTransform = 1 << 0,
+    SystemAccess_ModelTransform = 1 << 1,
+    // Model node transforms and the renderables they place
+    SystemAccess_Renderables    = 1 << 2,
+    SystemAccess_TransformLink  = 1 << 3,
+    SystemAccess_Traveler       = 1 << 4,
+    SystemAccess_Collision      = 1 << 5,
+    SystemAccess_Grounded       = 1 << 6,
+    SystemAccess_Dragging       = 1 << 7,
+    // Spider controllers and the scene's IK chains
+    SystemAccess_IK             = 1 << 8,
+    SystemAccess_Pickup         = 1 << 9,
+    SystemAccess_Static         = 1 << 10,
+    SystemAccess_MapData        = 1 << 11,
+    SystemAccess_Navigation     = 1 << 12,
+    SystemAccess_PathCache      = 1 << 13,
+    SystemAccess_FlowFields     = 1 << 14,
+    SystemAccess_Paths          = 1 << 15,
+    SystemAccess_Audio          = 1 << 16,
+    SystemAccess_Player         = 1 << 17,
+    // Skeleton bones, palettes and pose controllers
+    SystemAccess_Skeleton       = 1 << 18,
+    // Stat effects, only exclusive systems change them, reading never mutates
+    SystemAccess_Stat           = 1 << 19,
+    // Timers, abilities, spawning and destroying, anything that can reach the whole scene runs alone on the calling thread
+    SystemAccess_All            = ~0ull
+};
+
+using SystemFunction = void (*)(Scene*);
+
+// Structural changes from systems that run alongside others, applied in system order before the next exclusive system
+struct CommandBuffer {
+    vector<std::function<void(Scene*)>> commands;
+
+    void flush(Scene* scene);
+};
+
+// Goes into the running system's buffer while the scheduler runs it concurrently, otherwise applies now. Not for use
+// inside parallel_for, the ranges run on threads that don't know the system.
+void defer(Scene* scene, std::function<void(Scene*)> command);
+
+// Runs the step's systems in the order they were added, except that systems without conflicting access between two
+// exclusive systems run concurrently on the job pool. Results don't depend on the thread count, deferred changes land
+// at the same points whether or not anything ran in parallel.
+struct SystemScheduler {
+    struct Node {
+        string_view    name;
+        SystemFunction func;
+        uint64         reads  = 0;
+        uint64         writes = 0;
+        // Later systems in the same batch that have to wait for this one
+        vector<uint32> dependents;
+        uint32         dependency_count = 0;
+        CommandBuffer  commands;
+        double         ms = 0.0;
+    };
+    // Runs of concurrent systems, or a single exclusive one
+    struct Batch {
+        uint32 begin;
+        uint32 end;
+        bool   exclusive;
+    };
+
+    vector<Node>                           nodes;
+    vector<Batch>                          batches;
+    std::unique_ptr<std::atomic<uint32>[]> remaining;
+    // Off runs every system in order on the calling thread
+    bool                                   parallel = true;
+
+    void add(string_view name, SystemFunction func, uint64 reads, uint64 writes);
+    // Builds the batches and dependencies, call after the last add
+    void compile();
+    void run(Scene* scene);
+
+    void _run_node(Scene* scene, uint32 index, JobGroup* group);
+};
+
+}
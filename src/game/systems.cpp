@@ -21,6 +21,8 @@
 #include "game/entities/enemy.hpp"
 #include "game/entities/spawner.hpp"
 #include "game/entities/consumer.hpp"
+#include "game/broadphase.hpp"
+#include "game/job_pool.hpp"
 
 namespace spellbook {
 
@@ -111,47 +113,63 @@ void health_draw_system(Scene* scene) {
 void transform_system(Scene* scene) {
     auto& registry = scene->registry;
     ZoneScoped;
+    // Both passes only write the entity's own transform and renderables, so they're split across the job pool
+    vector<entt::entity> entities;
     // Transform Link
     {
         ZoneScopedN("Transform Link");
-        for (auto [entity, link, logic_tfm, model_tfm] : registry.view<TransformLink, LogicTransform, ModelTransform>().each()) {
-            // We disable links for dragging
-            if (registry.any_of<Dragging>(entity))
-                continue;
-
-            Grounded* grounded = registry.try_get<Grounded>(entity);
-            v3 step_up = grounded ? v3::Z * grounded->step_up : v3{};
-            quat logic_quat = math::to_quat(math::normal_yaw(logic_tfm.normal, logic_tfm.yaw));
-            model_tfm.set_rotation(math::normalize(math::slerp(model_tfm.rotation, logic_quat, 0.5f)));
-            // model_tfm.set_rotation(logic_quat);
-            model_tfm.set_translation(logic_tfm.position + link.offset + step_up);
-        }
+        auto link_view = registry.view<TransformLink, LogicTransform, ModelTransform>();
+        for (auto entity : link_view)
+            entities.push_back(entity);
+        parallel_for(entities.size(), 64, [&registry, &link_view, &entities](uint32 begin, uint32 end) {
+            for (uint32 i = begin; i < end; i++) {
+                entt::entity entity = entities[i];
+                // We disable links for dragging
+                if (registry.any_of<Dragging>(entity))
+                    continue;
+
+                auto [link, logic_tfm, model_tfm] = link_view.get(entity);
+                Grounded* grounded = registry.try_get<Grounded>(entity);
+                v3 step_up = grounded ? v3::Z * grounded->step_up : v3{};
+                quat logic_quat = math::to_quat(math::normal_yaw(logic_tfm.normal, logic_tfm.yaw));
+                model_tfm.set_rotation(math::normalize(math::slerp(model_tfm.rotation, logic_quat, 0.5f)));
+                // model_tfm.set_rotation(logic_quat);
+                model_tfm.set_translation(logic_tfm.position + link.offset + step_up);
+            }
+        });
     }
     {
         ZoneScopedN("Apply Transform");
         // Apply transforms to renderables
-        for (auto [entity, model, transform] : registry.view<Model, ModelTransform>().each()) {
-            // Note, this isn't correct, if the transform is accessed early the dirty flag will clear,
-            // but it's just for investigating optimization options
-            if (!transform.renderable_dirty)
-                continue;
-            for (auto& [node, renderable] : model.model_gpu.renderables) {
-                ZoneScoped;
-                renderable->transform = (m44GPU) (transform.get_transform() * node->cached_transform);
+        auto model_view = registry.view<Model, ModelTransform>();
+        entities.clear();
+        for (auto entity : model_view)
+            entities.push_back(entity);
+        parallel_for(entities.size(), 64, [&model_view, &entities](uint32 begin, uint32 end) {
+            for (uint32 i = begin; i < end; i++) {
+                auto [model, transform] = model_view.get(entities[i]);
+                // Note, this isn't correct, if the transform is accessed early the dirty flag will clear,
+                // but it's just for investigating optimization options
+                if (!transform.renderable_dirty)
+                    continue;
+                for (auto& [node, renderable] : model.model_gpu.renderables) {
+                    renderable->transform = (m44GPU) (transform.get_transform() * node->cached_transform);
+                }
+                transform.renderable_dirty = false;
             }
-            transform.renderable_dirty = false;
-        }
+        });
     }
 }
 
 void disposal_system(Scene* scene) {
     ZoneScoped;
+    RandomStream& random = scene->random[RandomStream_Drops];
     for (auto [entity, transform, drop_chance, killed] : scene->registry.view<LogicTransform, DropChance, Killed>().each()) {
         if (killed.drop) {
             for (auto& entry : drop_chance.entries) {
-                if (math::random_float(1.0f) < entry.drop_chance) {
-                    float phase = math::random_float(math::TAU);
-                    float radius = math::random_float(0.2f);
+                if (random.random_float(1.0f) < entry.drop_chance) {
+                    float phase = random.random_float(math::TAU);
+                    float radius = random.random_float(0.2f);
                     v3 offset = radius * v3(math::cos(phase), math::sin(phase), 0.0f);
                     instance_prefab(scene, load_resource<BeadPrefab>(entry.bead_prefab_path), transform.position + offset);
                 }
@@ -201,7 +219,7 @@ void selection_id_system(Scene* scene) {
 
 
 
-// Adds dragging to entities
+// Turns pick results into select commands, runs with input rather than in the step
 void dragging_update_system(Scene* scene) {
     ZoneScoped;
     if (scene->render_scene.fut_query_result.get_control()) {
@@ -210,7 +228,8 @@ void dragging_update_system(Scene* scene) {
         scene->render_scene.fut_query_result = {};
 
         if (scene->registry.valid((entt::entity) result_int)) {
-            scene->select_entity((entt::entity) result_int);
+            v3 intersect = math::intersect_axis_plane(scene->render_scene.viewport.ray((v2i) Input::mouse_pos), Z, 0.0f);
+            scene->command({.type = SceneCommand_Select, .entity = result_int, .point = intersect});
         }
     }
 }
@@ -220,16 +239,11 @@ void dragging_system(Scene* scene) {
     constexpr float raise_speed = 0.10f;
     auto drags = scene->registry.view<LogicTransform, Dragging>(entt::exclude<ForceDragging>);
     
-    v3i cell;
-    bool has_new_cell = false;
-    if (drags.size_hint() > 0) {
-        has_new_cell = scene->get_object_placement(cell);
-    }
-    
+    // The cell under the mouse comes in as a command, so replays don't depend on the camera
     for (auto [entity, transform, drag] : drags.each()) {
-        if (has_new_cell) {
-            drag.target_position = v3(cell);
-            drag.potential_logic_position = v3(cell);
+        if (scene->has_drag_cell) {
+            drag.target_position = v3(scene->drag_cell);
+            drag.potential_logic_position = v3(scene->drag_cell);
         }
     }
     
@@ -270,32 +284,34 @@ void collision_update_system(Scene* scene) {
     if (scene->edit_mode)
         return;
     
-    auto view = scene->registry.view<LogicTransform, Collision>();
-    for (auto it1 = view.begin(); it1 != view.end(); it1++) {
-        auto  entity1    = *it1;
-        auto& transform1 = view.get<LogicTransform>(entity1);
-        auto& collision1 = view.get<Collision>(entity1);
-
-        auto begin2 = it1;
-        begin2++;
-        for (auto it2 = begin2; it2 != view.end(); it2++) {
-            auto entity2 = *it2;
-            auto& transform2 = view.get<LogicTransform>(entity2);
-            auto& collision2 = view.get<Collision>(entity2);
-
-            if (math::length(transform1.position - transform2.position) < (collision1.radius + collision2.radius)) {
-                if (!collision1.with.contains(entity2))
-                    collision1.with.insert(entity2);
-                if (!collision2.with.contains(entity1))
-                    collision2.with.insert(entity1);
-            } else {
-                if (collision1.with.contains(entity2))
-                    collision1.with.erase(entity2);
-                if (collision2.with.contains(entity1))
-                    collision2.with.erase(entity1);
-            }
+    // Only colliders that moved are handed to the broadphase, and only those get their contacts recomputed
+    for (auto [entity, transform, collision] : scene->registry.view<LogicTransform, Collision>().each()) {
+        if (transform.position == collision.synced_position && collision.radius == collision.synced_radius)
+            continue;
+        scene->broadphase.set(entity, transform.position, collision.radius);
+        collision.synced_position = transform.position;
+        collision.synced_radius = collision.radius;
+    }
+    scene->broadphase.update();
+
+    for (const CollisionEvent& event : scene->broadphase.events) {
+        if (event.type == CollisionEventType_Stay)
+            continue;
+        Collision* collision1 = scene->registry.try_get<Collision>(event.a);
+        Collision* collision2 = scene->registry.try_get<Collision>(event.b);
+        if (event.type == CollisionEventType_Enter) {
+            if (collision1)
+                collision1->with.insert(event.b);
+            if (collision2)
+                collision2->with.insert(event.a);
+        } else {
+            if (collision1)
+                collision1->with.erase(event.b);
+            if (collision2)
+                collision2->with.erase(event.a);
         }
     }
+    scene->broadphase.events.clear();
 }
 
 void emitter_system(Scene* scene) {
@@ -318,7 +334,7 @@ void pickup_system(Scene* scene) {
             float distance = math::length(logic_tfm.position - lizard_transform.position);
             if (distance < 0.2f) {
                 scene->player.bank.beads[pickup.bead_type]++;
-                scene->registry.emplace<Killed>(entity);
+                defer(scene, [entity](Scene* scene) { scene->registry.emplace_or_replace<Killed>(entity); });
             } else {
                 if (math::abs(logic_tfm.position.z - lizard_transform.position.z) >= 0.8f)
                     continue;
@@ -394,9 +410,17 @@ float calculate_step_up(Scene* scene, entt::entity id, v3 pos) {
 
 void scene_vertical_offset_system(Scene* scene) {
     ZoneScoped;
-    for (auto [entity, logic_tfm, grounded] : scene->registry.view<LogicTransform, Grounded>().each()) {
-        grounded.step_up = calculate_step_up(scene, entity, logic_tfm.position);
-    }
+    // Each step up only depends on the entity's own position, so the entities are split across the job pool
+    auto grounded_view = scene->registry.view<LogicTransform, Grounded>();
+    vector<entt::entity> entities;
+    for (auto entity : grounded_view)
+        entities.push_back(entity);
+    parallel_for(entities.size(), 32, [scene, &grounded_view, &entities](uint32 begin, uint32 end) {
+        for (uint32 i = begin; i < end; i++) {
+            auto [logic_tfm, grounded] = grounded_view.get(entities[i]);
+            grounded.step_up = calculate_step_up(scene, entities[i], logic_tfm.position);
+        }
+    });
 }
 
 }
@@ -1,30 +1,37 @@
 ﻿#include "timer.hpp"
 
+#include <algorithm>
+#include <chrono>
 #include <imgui.h>
+#include <tracy/Tracy.hpp>
 
+#include "extension/fmt.hpp"
 #include "game/scene.hpp"
 
 namespace spellbook {
 
+struct TimerReleaser {
+    TimerManager* manager;
+    void operator()(Timer* timer) const {
+        manager->release(timer);
+    }
+};
+
+static std::shared_ptr<Timer> make_timer(Scene* scene, TimerFunction&& callback, bool trigger_every_tick, bool unowned_oneshot) {
+    TimerManager& manager = scene->timer_manager;
+    Timer* timer = manager.allocate(scene);
+    timer->callback = std::move(callback);
+    timer->trigger_every_tick = trigger_every_tick;
+    timer->unowned = unowned_oneshot;
+    return std::shared_ptr<Timer>(timer, TimerReleaser{&manager}, std::pmr::polymorphic_allocator<Timer>(&manager.control_blocks));
+}
 
-std::shared_ptr<Timer> add_timer(Scene* scene, std::function<void(Timer*)> callback, bool unowned_oneshot) {
-    std::shared_ptr<Timer> timer_ptr = std::make_shared<Timer>(scene);
-    scene->timer_manager.timers.push_back(timer_ptr);
-    Timer& timer = *timer_ptr;
-    timer.callback = TimerCallback{&timer, std::move(callback)};
-    timer.trigger_every_tick = false;
-    timer.unowned = unowned_oneshot;
-    return timer_ptr;
+std::shared_ptr<Timer> add_timer(Scene* scene, TimerFunction callback, bool unowned_oneshot) {
+    return make_timer(scene, std::move(callback), false, unowned_oneshot);
 }
 
-std::shared_ptr<Timer> add_tween_timer(Scene* scene, std::function<void(Timer*)> callback, bool unowned_oneshot) {
-    std::shared_ptr<Timer> timer_ptr = std::make_shared<Timer>(scene);
-    scene->timer_manager.timers.push_back(timer_ptr);
-    Timer& timer = *timer_ptr;
-    timer.callback = TimerCallback{&timer, callback};
-    timer.trigger_every_tick = true;
-    timer.unowned = unowned_oneshot;
-    return timer_ptr;
+std::shared_ptr<Timer> add_tween_timer(Scene* scene, TimerFunction callback, bool unowned_oneshot) {
+    return make_timer(scene, std::move(callback), true, unowned_oneshot);
 }
 
 void Timer::start(float new_time) {
@@ -32,56 +39,280 @@ void Timer::start(float new_time) {
         total_time = new_time;
     remaining_time = total_time;
     ticking = true;
+    scene->timer_manager.schedule(this);
 }
 
 void Timer::update(float delta) {
     if (!ticking)
         return;
-
     remaining_time -= delta;
     if (trigger_every_tick)
-        if (callback.callback)
-            scene->timer_manager.timer_callbacks.push_back(callback);
+        if (callback)
+            scene->timer_manager.due.push_back(handle);
     if (remaining_time < 0.0f)
         timeout();
 }
 
 void Timer::timeout() {
-    if (!trigger_every_tick && callback.callback)
-        scene->timer_manager.timer_callbacks.push_back(callback);
+    if (!trigger_every_tick && callback)
+        scene->timer_manager.due.push_back(handle);
     stop();
 }
 
 void Timer::stop() {
     remaining_time = 0.0f;
     ticking = false;
+    scene->timer_manager.unschedule(this);
+    // unowned oneshot that has nothing referencing it anymore
+    if (released)
+        scene->timer_manager.pending_free.push_back(handle);
 }
 
-void inspect(Timer* timer) {
-    if (timer->ticking)
-        ImGui::SliderFloat("Timer", &timer->remaining_time, 0.0f, timer->total_time, "%.2f", ImGuiSliderFlags_NoInput);
+float Timer::get_remaining_time() const {
+    if (!ticking || trigger_every_tick)
+        return remaining_time;
+    const TimerManager& manager = scene->timer_manager;
+    return float(end_tick - manager.current_tick) / TimerManager::ticks_per_second;
+}
+
+TimerManager::TimerManager() {
+    for (uint32& head : wheel_heads)
+        head = UINT32_MAX;
+}
+
+// Callbacks can hold the last reference to other timers, and releasing those goes back through free and slot. They
+// have to be dropped while the chunks are still intact instead of from the chunk destructors.
+TimerManager::~TimerManager() {
+    for (uint32 index = 0; index < slot_count; index++) {
+        // Moved out first so a release from inside it sees this slot already cleared
+        TimerFunction callback = std::move(slot(index).timer.callback);
+    }
+    tweens.clear();
+    tween_scratch.clear();
+    due.clear();
+    pending_free.clear();
+    for (uint32& head : wheel_heads)
+        head = UINT32_MAX;
+    scheduled_count = 0;
+}
+
+TimerManager::TimerSlot& TimerManager::slot(uint32 index) {
+    return chunks[index / chunk_size][index % chunk_size];
+}
+
+Timer* TimerManager::get(TimerHandle handle) {
+    if (handle.index >= slot_count)
+        return nullptr;
+    TimerSlot& timer_slot = slot(handle.index);
+    if (timer_slot.generation != handle.generation)
+        return nullptr;
+    return &timer_slot.timer;
+}
+
+Timer* TimerManager::allocate(Scene* scene) {
+    if (free_head == UINT32_MAX) {
+        if (slot_count % chunk_size == 0)
+            chunks.push_back(std::make_unique<TimerSlot[]>(chunk_size));
+        slot(slot_count).next_free = free_head;
+        free_head = slot_count++;
+    }
+    uint32 index = free_head;
+    TimerSlot& timer_slot = slot(index);
+    free_head = timer_slot.next_free;
+    live_count++;
+
+    timer_slot.timer = Timer{.scene = scene};
+    timer_slot.timer.handle = {index, timer_slot.generation};
+    return &timer_slot.timer;
+}
+
+// Called when the last shared reference drops
+void TimerManager::release(Timer* timer) {
+    timer->released = true;
+    if (timer->unowned && timer->ticking)
+        return;
+    if (dispatching)
+        pending_free.push_back(timer->handle);
     else
+        free(timer->handle.index);
+}
+
+void TimerManager::free(uint32 index) {
+    TimerSlot& timer_slot = slot(index);
+    unschedule(&timer_slot.timer);
+    timer_slot.timer.callback.reset();
+    timer_slot.generation++;
+    timer_slot.next_free = free_head;
+    free_head = index;
+    live_count--;
+}
+
+void TimerManager::schedule(Timer* timer) {
+    unschedule(timer);
+    if (timer->trigger_every_tick) {
+        timer->tween_index = tweens.size();
+        tweens.push_back(timer->handle.index);
+        return;
+    }
+    // remaining_time < 0 is the timeout condition, so fire on the tick after total_time has fully passed
+    timer->end_tick = current_tick + uint64(std::max(timer->total_time, 0.0f) * ticks_per_second) + 1;
+    _insert(timer->handle.index);
+    scheduled_count++;
+}
+
+void TimerManager::unschedule(Timer* timer) {
+    if (timer->tween_index != UINT32_MAX) {
+        uint32 last = tweens.back();
+        tweens[timer->tween_index] = last;
+        slot(last).timer.tween_index = timer->tween_index;
+        tweens.pop_back();
+        timer->tween_index = UINT32_MAX;
+    }
+    if (timer->wheel_slot != UINT32_MAX) {
+        if (timer->wheel_prev != UINT32_MAX)
+            slot(timer->wheel_prev).timer.wheel_next = timer->wheel_next;
+        else
+            wheel_heads[timer->wheel_slot] = timer->wheel_next;
+        if (timer->wheel_next != UINT32_MAX)
+            slot(timer->wheel_next).timer.wheel_prev = timer->wheel_prev;
+        timer->wheel_slot = UINT32_MAX;
+        timer->wheel_prev = UINT32_MAX;
+        timer->wheel_next = UINT32_MAX;
+        scheduled_count--;
+    }
+}
+
+void TimerManager::_insert(uint32 index) {
+    Timer& timer = slot(index).timer;
+    // Cascading can land a timer on the tick being processed, which is fired right after
+    uint64 end_tick = std::max(timer.end_tick, current_tick);
+    uint64 delta = end_tick - current_tick;
+
+    uint32 wheel_slot = overflow_slot;
+    for (uint32 level = 0; level < wheel_levels; level++) {
+        if (delta < (1ull << (wheel_slot_bits * (level + 1)))) {
+            wheel_slot = level * wheel_slots + uint32((end_tick >> (wheel_slot_bits * level)) & (wheel_slots - 1));
+            break;
+        }
+    }
+
+    timer.wheel_slot = wheel_slot;
+    timer.wheel_prev = UINT32_MAX;
+    timer.wheel_next = wheel_heads[wheel_slot];
+    if (timer.wheel_next != UINT32_MAX)
+        slot(timer.wheel_next).timer.wheel_prev = index;
+    wheel_heads[wheel_slot] = index;
+}
+
+// Moves every timer in the current slot of a level down to the finer levels
+void TimerManager::_cascade(uint32 level) {
+    uint32 wheel_slot = level < wheel_levels ?
+        level * wheel_slots + uint32((current_tick >> (wheel_slot_bits * level)) & (wheel_slots - 1)) :
+        overflow_slot;
+    uint32 index = wheel_heads[wheel_slot];
+    wheel_heads[wheel_slot] = UINT32_MAX;
+    while (index != UINT32_MAX) {
+        uint32 next = slot(index).timer.wheel_next;
+        _insert(index);
+        index = next;
+    }
+}
+
+void TimerManager::advance(uint64 target_tick) {
+    ZoneScoped;
+    while (current_tick < target_tick) {
+        if (scheduled_count == 0) {
+            current_tick = target_tick;
+            break;
+        }
+        current_tick++;
+        for (uint32 level = 1; level <= wheel_levels; level++) {
+            if ((current_tick & ((1ull << (wheel_slot_bits * level)) - 1)) != 0)
+                break;
+            _cascade(level);
+        }
+
+        uint32 wheel_slot = uint32(current_tick & (wheel_slots - 1));
+        uint32 index = wheel_heads[wheel_slot];
+        while (index != UINT32_MAX) {
+            Timer& timer = slot(index).timer;
+            index = timer.wheel_next;
+            timer.timeout();
+        }
+    }
+}
+
+void inspect(Timer* timer) {
+    if (timer->ticking) {
+        float remaining_time = timer->get_remaining_time();
+        ImGui::SliderFloat("Timer", &remaining_time, 0.0f, timer->total_time, "%.2f", ImGuiSliderFlags_NoInput);
+    } else {
         ImGui::Text("Not ticking");
+    }
+}
+
+void inspect(TimerManager* timer_manager) {
+    ImGui::Text("Live: %u", timer_manager->live_count);
+    ImGui::Text("Scheduled: %u", timer_manager->scheduled_count);
+    ImGui::Text("Tweens: %u", uint32(timer_manager->tweens.size()));
+    ImGui::Text("Slab: %u", timer_manager->slot_count);
 }
 
 void update_timers(Scene* scene) {
-    scene->timer_manager.timers.remove_if([](const shared_ptr<Timer>& it) -> bool {
-        bool unowned_and_done = it->unowned && !it->ticking;
-        bool owned_and_dead = !it->unowned && it.use_count() == 1;
-        return unowned_and_done || owned_and_dead;
-    }, true);
-    for (auto timer : scene->timer_manager.timers) {
-        timer->update(scene->delta_time);
+    ZoneScoped;
+    TimerManager& manager = scene->timer_manager;
+    manager.time += scene->delta_time;
+
+    // stop() swap-removes from the live list, so iterate a copy
+    manager.tween_scratch = manager.tweens;
+    for (uint32 index : manager.tween_scratch)
+        manager.slot(index).timer.update(scene->delta_time);
+    manager.advance(uint64(manager.time * TimerManager::ticks_per_second));
+
+    manager.dispatching = true;
+    for (uint32 i = 0; i < manager.due.size(); i++) {
+        Timer* timer = manager.get(manager.due[i]);
+        if (timer && timer->callback)
+            timer->callback(timer);
+    }
+    manager.due.clear();
+    manager.dispatching = false;
+
+    // Callbacks may have restarted a released oneshot, those are kept until they stop again
+    for (TimerHandle handle : manager.pending_free) {
+        Timer* timer = manager.get(handle);
+        if (timer && !(timer->unowned && timer->ticking))
+            manager.free(handle.index);
     }
-    for (auto& timer_callback : scene->timer_manager.timer_callbacks) {
-        timer_callback.callback(timer_callback.timer);
+    manager.pending_free.clear();
+    manager.tween_scratch.clear();
+}
+
+string benchmark_timers(int count, int frames) {
+    using clock = std::chrono::steady_clock;
+    constexpr float frame_time = 1.0f / 60.0f;
+
+    auto scene = std::make_unique<Scene>();
+    scene->delta_time = frame_time;
+    uint64 fired = 0;
+    vector<std::shared_ptr<Timer>> timers;
+    for (int i = 0; i < count; i++) {
+        auto timer = add_timer(&*scene, [&fired](Timer* timer) {
+            fired++;
+            timer->start(0.1f + math::random_float(10.0f));
+        });
+        timer->start(0.1f + math::random_float(10.0f));
+        timers.push_back(std::move(timer));
     }
-    scene->timer_manager.timer_callbacks.clear();
-    scene->timer_manager.timers.remove_if([](const shared_ptr<Timer>& it) -> bool {
-        bool unowned_and_done = it->unowned && !it->ticking;
-        bool owned_and_dead = !it->unowned && it.use_count() == 1;
-        return unowned_and_done || owned_and_dead;
-    }, true);
+
+    auto t0 = clock::now();
+    for (int frame = 0; frame < frames; frame++)
+        update_timers(&*scene);
+    auto t1 = clock::now();
+    timers.clear();
+
+    double ms = std::chrono::duration<double, std::milli>(t1 - t0).count();
+    return fmt_("{} timers, {} frames: {:.3f}ms/frame, {} fired", count, frames, ms / frames, fired);
 }
 
-}
\ No newline at end of file
+}
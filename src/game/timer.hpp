@@ -2,6 +2,7 @@
 
 #include <functional>
 #include <memory>
+#include <memory_resource>
 #include "general/string.hpp"
 #include "general/vector.hpp"
 
@@ -10,42 +11,181 @@ namespace spellbook {
 struct Scene;
 struct Timer;
 
-struct TimerCallback {
-    Timer* timer;
-    std::function<void(Timer*)> callback = {};
+// Move-only callable that keeps small captures inline, larger ones fall back to the heap
+template <typename Signature, uint32 InlineSize = 48>
+struct SmallFunction;
+
+template <typename R, typename... Args, uint32 InlineSize>
+struct SmallFunction<R(Args...), InlineSize> {
+    alignas(std::max_align_t) std::byte storage[InlineSize];
+    R (*invoke_fn)(void*, Args...) = nullptr;
+    // Relocates src into dst, or destroys src when dst is null
+    void (*manage_fn)(void* dst, void* src) = nullptr;
+
+    SmallFunction() = default;
+    SmallFunction(std::nullptr_t) {}
+    template <typename F, typename = std::enable_if_t<!std::is_same_v<std::decay_t<F>, SmallFunction>>>
+    SmallFunction(F&& f) { assign(std::forward<F>(f)); }
+    SmallFunction(SmallFunction&& other) noexcept { move_from(other); }
+    SmallFunction& operator=(SmallFunction&& other) noexcept {
+        if (this != &other) {
+            reset();
+            move_from(other);
+        }
+        return *this;
+    }
+    SmallFunction(const SmallFunction&) = delete;
+    SmallFunction& operator=(const SmallFunction&) = delete;
+    ~SmallFunction() { reset(); }
+
+    explicit operator bool() const { return invoke_fn != nullptr; }
+    R operator()(Args... args) { return invoke_fn(storage, std::forward<Args>(args)...); }
+
+    void reset() {
+        if (manage_fn)
+            manage_fn(nullptr, storage);
+        invoke_fn = nullptr;
+        manage_fn = nullptr;
+    }
+
+    void move_from(SmallFunction& other) {
+        if (other.manage_fn)
+            other.manage_fn(storage, other.storage);
+        invoke_fn = other.invoke_fn;
+        manage_fn = other.manage_fn;
+        other.invoke_fn = nullptr;
+        other.manage_fn = nullptr;
+    }
+
+    template <typename F>
+    void assign(F&& f) {
+        using T = std::decay_t<F>;
+        if constexpr (std::is_constructible_v<bool, const T&>) {
+            if (!bool(f))
+                return;
+        }
+        if constexpr (sizeof(T) <= InlineSize && alignof(T) <= alignof(std::max_align_t) && std::is_nothrow_move_constructible_v<T>) {
+            new (storage) T(std::forward<F>(f));
+            invoke_fn = [](void* p, Args... args) -> R { return (*static_cast<T*>(p))(std::forward<Args>(args)...); };
+            manage_fn = [](void* dst, void* src) {
+                if (dst)
+                    new (dst) T(std::move(*static_cast<T*>(src)));
+                static_cast<T*>(src)->~T();
+            };
+        } else {
+            *reinterpret_cast<T**>(storage) = new T(std::forward<F>(f));
+            invoke_fn = [](void* p, Args... args) -> R { return (**static_cast<T**>(p))(std::forward<Args>(args)...); };
+            manage_fn = [](void* dst, void* src) {
+                if (dst)
+                    *static_cast<T**>(dst) = *static_cast<T**>(src);
+                else
+                    delete *static_cast<T**>(src);
+            };
+        }
+    }
+};
+
+using TimerFunction = SmallFunction<void(Timer*)>;
+
+struct TimerHandle {
+    uint32 index = UINT32_MAX;
+    uint32 generation = 0;
 };
 
 struct Timer {
     Scene* scene;
-    TimerCallback callback;
+    TimerFunction callback;
     bool trigger_every_tick = false;
     float total_time;
 
+    // Maintained every tick for tween timers, use get_remaining_time for the others
     float remaining_time;
     float time_scale = 1.0f;
     bool ticking = false;
-    
+
     // Don't delete while running even if all references are dropped
     bool unowned = true;
 
+    // Manager bookkeeping
+    TimerHandle handle;
+    bool released = false;
+    uint64 end_tick = 0;
+    uint32 wheel_slot = UINT32_MAX;
+    uint32 wheel_prev = UINT32_MAX;
+    uint32 wheel_next = UINT32_MAX;
+    uint32 tween_index = UINT32_MAX;
+
     void start(float time = -1.0f);
     void update(float delta);
     void timeout();
     void stop();
+    float get_remaining_time() const;
 };
 
+// Hierarchical timing wheel over a pooled slab of timers. Each level has 64 slots, level 0 slots are one tick,
+// and each level up covers 64 times the span of the one below. Advancing only touches the slots that are passed
+// and the timers that cascade or expire, tween timers are kept in their own list since they run every tick.
 struct TimerManager {
-    vector<std::shared_ptr<Timer>> timers;
-    vector<TimerCallback> timer_callbacks;
+    static constexpr float  ticks_per_second = 1000.0f;
+    static constexpr uint32 wheel_levels     = 4;
+    static constexpr uint32 wheel_slot_bits  = 6;
+    static constexpr uint32 wheel_slots      = 1 << wheel_slot_bits;
+    static constexpr uint32 overflow_slot    = wheel_levels * wheel_slots;
+    static constexpr uint32 chunk_size       = 256;
+
+    struct TimerSlot {
+        Timer timer;
+        uint32 generation = 0;
+        uint32 next_free = UINT32_MAX;
+    };
+
+    // Control blocks for the shared_ptrs handed out by add_timer. Declared before the chunks so it outlives them,
+    // timers in the chunks can hold the last reference to one.
+    std::pmr::unsynchronized_pool_resource control_blocks;
+
+    // Chunked so timer addresses stay stable as the slab grows
+    vector<std::unique_ptr<TimerSlot[]>> chunks;
+    uint32 slot_count = 0;
+    uint32 free_head = UINT32_MAX;
+    uint32 live_count = 0;
+
+    uint32 wheel_heads[overflow_slot + 1];
+    uint32 scheduled_count = 0;
+    uint64 current_tick = 0;
+    double time = 0.0;
+
+    vector<uint32> tweens;
+    vector<uint32> tween_scratch;
+    vector<TimerHandle> due;
+    bool dispatching = false;
+    vector<TimerHandle> pending_free;
+
+    TimerManager();
+    ~TimerManager();
+
+    Timer* get(TimerHandle handle);
+    TimerSlot& slot(uint32 index);
+    Timer* allocate(Scene* scene);
+    void release(Timer* timer);
+    void free(uint32 index);
+
+    void schedule(Timer* timer);
+    void unschedule(Timer* timer);
+    void advance(uint64 target_tick);
+    void _insert(uint32 index);
+    void _cascade(uint32 level);
 };
 
 void update_timers(Scene* scene);
 
-std::shared_ptr<Timer> add_timer(Scene* scene, std::function<void(Timer*)> callback = {}, bool unowned_oneshot = false);
-std::shared_ptr<Timer> add_tween_timer(Scene* scene, std::function<void(Timer*)> callback = {}, bool unowned_oneshot = false);
+std::shared_ptr<Timer> add_timer(Scene* scene, TimerFunction callback = {}, bool unowned_oneshot = false);
+std::shared_ptr<Timer> add_tween_timer(Scene* scene, TimerFunction callback = {}, bool unowned_oneshot = false);
 void inspect(Timer* timer);
+void inspect(TimerManager* timer_manager);
 
 // To get rid of a timer, just drop references to it
 
+// Keeps count timers running with random durations, restarting each as it fires
+string benchmark_timers(int count, int frames);
 
-}
\ No newline at end of file
+}
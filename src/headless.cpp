@@ -0,0 +1,29 @@
+#include <cstdlib>
+#include <filesystem>
+#include <iostream>
+
+#include "general/file/file_path.hpp"
+#include "game/replay.hpp"
+#include "game/simulation.hpp"
+
+// spellbook_headless <map, relative to the resource folder> [rounds] [fixed step in seconds]
+// spellbook_headless <replay.sbrpl> [repeats]
+int main(int argc, char** argv) {
+	if (argc < 2) {
+		std::cerr << "usage: spellbook_headless <map.sbjmap> [rounds] [step]\n";
+		std::cerr << "       spellbook_headless <replay.sbrpl> [repeats]\n";
+		return 1;
+	}
+	spellbook::get_filepath_app_name() = "spellbook";
+	spellbook::string path = argv[1];
+	if (path.ends_with(spellbook::Replay::extension())) {
+		int repeats = argc > 2 ? std::atoi(argv[2]) : 1;
+		std::cout << spellbook::play_replay(spellbook::FilePath(std::filesystem::path(path)), repeats) << "\n";
+		return 0;
+	}
+	int rounds = argc > 2 ? std::atoi(argv[2]) : 1;
+	float step = argc > 3 ? float(std::atof(argv[3])) : 1.0f / 60.0f;
+	std::cout << spellbook::run_headless_simulation(spellbook::FilePath(path, spellbook::FilePathLocation_Content), rounds, step) << "\n";
+
+	return 0;
+}
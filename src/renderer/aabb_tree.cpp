@@ -0,0 +1,379 @@
+#include "aabb_tree.hpp"
+
+#include <algorithm>
+#include <tracy/Tracy.hpp>
+
+#include "extension/fmt.hpp"
+#include "general/math/math.hpp"
+#include "general/math/matrix_math.hpp"
+#include "renderer/camera.hpp"
+
+namespace spellbook {
+
+static AABB merge(const AABB& a, const AABB& b) {
+    return AABB{
+        v3(std::min(a.min.x, b.min.x), std::min(a.min.y, b.min.y), std::min(a.min.z, b.min.z)),
+        v3(std::max(a.max.x, b.max.x), std::max(a.max.y, b.max.y), std::max(a.max.z, b.max.z))
+    };
+}
+
+static bool contains(const AABB& outer, const AABB& inner) {
+    return outer.min.x <= inner.min.x && outer.min.y <= inner.min.y && outer.min.z <= inner.min.z &&
+           outer.max.x >= inner.max.x && outer.max.y >= inner.max.y && outer.max.z >= inner.max.z;
+}
+
+static float surface_area(const AABB& box) {
+    v3 d = box.max - box.min;
+    return 2.0f * (d.x * d.y + d.y * d.z + d.z * d.x);
+}
+
+AABB transformed_bounds(const AABB& local, const m44GPU& transform) {
+    const float* m = (const float*) &transform;
+    v3 center = (local.min + local.max) * 0.5f;
+    v3 half = (local.max - local.min) * 0.5f;
+    v3 world_center, world_half;
+    for (int r = 0; r < 3; r++) {
+        world_center.data[r] = m[r] * center.x + m[4 + r] * center.y + m[8 + r] * center.z + m[12 + r];
+        world_half.data[r] = std::abs(m[r]) * half.x + std::abs(m[4 + r]) * half.y + std::abs(m[8 + r]) * half.z;
+    }
+    return AABB{world_center - world_half, world_center + world_half};
+}
+
+CullVolume::CullVolume(const m44GPU& view_projection) {
+    const float* m = (const float*) &view_projection;
+    auto row = [m](int r) { return v4(m[r], m[4 + r], m[8 + r], m[12 + r]); };
+    v4 x = row(0), y = row(1), w = row(3);
+    planes[0] = w + x;
+    planes[1] = w - x;
+    planes[2] = w + y;
+    planes[3] = w - y;
+    // in front of the eye, always passes for orthographic projections
+    planes[4] = w;
+}
+
+CullResult CullVolume::classify(const AABB& box) const {
+    CullResult result = CullResult_Inside;
+    for (const v4& plane : planes) {
+        v3 positive = v3(plane.x >= 0.0f ? box.max.x : box.min.x, plane.y >= 0.0f ? box.max.y : box.min.y, plane.z >= 0.0f ? box.max.z : box.min.z);
+        v3 negative = v3(plane.x >= 0.0f ? box.min.x : box.max.x, plane.y >= 0.0f ? box.min.y : box.max.y, plane.z >= 0.0f ? box.min.z : box.max.z);
+        if (plane.x * positive.x + plane.y * positive.y + plane.z * positive.z + plane.w < 0.0f)
+            return CullResult_Outside;
+        if (plane.x * negative.x + plane.y * negative.y + plane.z * negative.z + plane.w < 0.0f)
+            result = CullResult_Intersects;
+    }
+    return result;
+}
+
+int32 AABBTree::_allocate() {
+    if (free_list == -1) {
+        nodes.emplace_back();
+        nodes.back().height = 0;
+        return nodes.size() - 1;
+    }
+    int32 index = free_list;
+    free_list = nodes[index].parent;
+    nodes[index] = Node{};
+    nodes[index].height = 0;
+    return index;
+}
+
+void AABBTree::_free(int32 node) {
+    nodes[node] = Node{};
+    nodes[node].parent = free_list;
+    free_list = node;
+}
+
+int32 AABBTree::insert(const AABB& box, void* user) {
+    int32 leaf = _allocate();
+    nodes[leaf].box = AABB{box.min - v3(margin), box.max + v3(margin)};
+    nodes[leaf].user = user;
+    _insert_leaf(leaf);
+    leaf_count++;
+    return leaf;
+}
+
+void AABBTree::remove(int32 proxy) {
+    _remove_leaf(proxy);
+    _free(proxy);
+    leaf_count--;
+}
+
+bool AABBTree::move(int32 proxy, const AABB& box) {
+    if (contains(nodes[proxy].box, box))
+        return false;
+    _remove_leaf(proxy);
+    nodes[proxy].box = AABB{box.min - v3(margin), box.max + v3(margin)};
+    _insert_leaf(proxy);
+    return true;
+}
+
+void AABBTree::clear() {
+    nodes.clear();
+    root = -1;
+    free_list = -1;
+    leaf_count = 0;
+}
+
+void AABBTree::_insert_leaf(int32 leaf) {
+    if (root == -1) {
+        root = leaf;
+        nodes[root].parent = -1;
+        return;
+    }
+
+    // Descend toward the sibling that grows the total surface area least
+    AABB leaf_box = nodes[leaf].box;
+    int32 index = root;
+    while (!nodes[index].is_leaf()) {
+        const Node& node = nodes[index];
+        float area = surface_area(node.box);
+        float combined_area = surface_area(merge(node.box, leaf_box));
+        float cost = 2.0f * combined_area;
+        float inheritance_cost = 2.0f * (combined_area - area);
+
+        auto child_cost = [&](int32 child) {
+            AABB combined = merge(leaf_box, nodes[child].box);
+            if (nodes[child].is_leaf())
+                return surface_area(combined) + inheritance_cost;
+            return surface_area(combined) - surface_area(nodes[child].box) + inheritance_cost;
+        };
+        float cost_left = child_cost(node.left);
+        float cost_right = child_cost(node.right);
+        if (cost < cost_left && cost < cost_right)
+            break;
+        index = cost_left < cost_right ? node.left : node.right;
+    }
+
+    int32 sibling = index;
+    int32 old_parent = nodes[sibling].parent;
+    int32 new_parent = _allocate();
+    nodes[new_parent].parent = old_parent;
+    nodes[new_parent].box = merge(leaf_box, nodes[sibling].box);
+    nodes[new_parent].height = nodes[sibling].height + 1;
+    nodes[new_parent].left = sibling;
+    nodes[new_parent].right = leaf;
+    nodes[sibling].parent = new_parent;
+    nodes[leaf].parent = new_parent;
+    if (old_parent == -1)
+        root = new_parent;
+    else if (nodes[old_parent].left == sibling)
+        nodes[old_parent].left = new_parent;
+    else
+        nodes[old_parent].right = new_parent;
+
+    index = nodes[leaf].parent;
+    while (index != -1) {
+        index = _balance(index);
+        Node& node = nodes[index];
+        node.height = 1 + std::max(nodes[node.left].height, nodes[node.right].height);
+        node.box = merge(nodes[node.left].box, nodes[node.right].box);
+        index = node.parent;
+    }
+}
+
+void AABBTree::_remove_leaf(int32 leaf) {
+    if (leaf == root) {
+        root = -1;
+        return;
+    }
+
+    int32 parent = nodes[leaf].parent;
+    int32 grand_parent = nodes[parent].parent;
+    int32 sibling = nodes[parent].left == leaf ? nodes[parent].right : nodes[parent].left;
+    nodes[leaf].parent = -1;
+
+    if (grand_parent == -1) {
+        root = sibling;
+        nodes[sibling].parent = -1;
+        _free(parent);
+        return;
+    }
+
+    if (nodes[grand_parent].left == parent)
+        nodes[grand_parent].left = sibling;
+    else
+        nodes[grand_parent].right = sibling;
+    nodes[sibling].parent = grand_parent;
+    _free(parent);
+
+    int32 index = grand_parent;
+    while (index != -1) {
+        index = _balance(index);
+        Node& node = nodes[index];
+        node.height = 1 + std::max(nodes[node.left].height, nodes[node.right].height);
+        node.box = merge(nodes[node.left].box, nodes[node.right].box);
+        index = node.parent;
+    }
+}
+
+// Rotates the taller child up if the subtree is unbalanced, returns the new subtree root
+int32 AABBTree::_balance(int32 a) {
+    Node& A = nodes[a];
+    if (A.is_leaf() || A.height < 2)
+        return a;
+
+    int32 b = A.left;
+    int32 c = A.right;
+    Node& B = nodes[b];
+    Node& C = nodes[c];
+    int32 balance = C.height - B.height;
+
+    auto replace_child = [this](int32 parent, int32 from, int32 to) {
+        if (parent == -1)
+            root = to;
+        else if (nodes[parent].left == from)
+            nodes[parent].left = to;
+        else
+            nodes[parent].right = to;
+    };
+
+    if (balance > 1) {
+        int32 f = C.left;
+        int32 g = C.right;
+        Node& F = nodes[f];
+        Node& G = nodes[g];
+
+        C.left = a;
+        C.parent = A.parent;
+        A.parent = c;
+        replace_child(C.parent, a, c);
+
+        if (F.height > G.height) {
+            C.right = f;
+            A.right = g;
+            G.parent = a;
+            A.box = merge(B.box, G.box);
+            C.box = merge(A.box, F.box);
+            A.height = 1 + std::max(B.height, G.height);
+            C.height = 1 + std::max(A.height, F.height);
+        } else {
+            C.right = g;
+            A.right = f;
+            F.parent = a;
+            A.box = merge(B.box, F.box);
+            C.box = merge(A.box, G.box);
+            A.height = 1 + std::max(B.height, F.height);
+            C.height = 1 + std::max(A.height, G.height);
+        }
+        return c;
+    }
+
+    if (balance < -1) {
+        int32 d = B.left;
+        int32 e = B.right;
+        Node& D = nodes[d];
+        Node& E = nodes[e];
+
+        B.left = a;
+        B.parent = A.parent;
+        A.parent = b;
+        replace_child(B.parent, a, b);
+
+        if (D.height > E.height) {
+            B.right = d;
+            A.left = e;
+            E.parent = a;
+            A.box = merge(C.box, E.box);
+            B.box = merge(A.box, D.box);
+            A.height = 1 + std::max(C.height, E.height);
+            B.height = 1 + std::max(A.height, D.height);
+        } else {
+            B.right = e;
+            A.left = d;
+            D.parent = a;
+            A.box = merge(C.box, D.box);
+            B.box = merge(A.box, E.box);
+            A.height = 1 + std::max(C.height, D.height);
+            B.height = 1 + std::max(A.height, E.height);
+        }
+        return b;
+    }
+
+    return a;
+}
+
+// Conservative ground truth that doesn't go through CullVolume, a box with any sampled point inside the clip volume
+// is visible. Depth isn't tested, matching the cull volumes.
+static bool samples_visible(const AABB& box, const m44& vp) {
+    for (int x = 0; x <= 2; x++) {
+        for (int y = 0; y <= 2; y++) {
+            for (int z = 0; z <= 2; z++) {
+                v3 size = box.max - box.min;
+                v3 point = box.min + v3(size.x * x, size.y * y, size.z * z) * 0.5f;
+                v4 clip = vp * v4(point, 1.0f);
+                if (clip.w > 0.0f && std::abs(clip.x) <= clip.w && std::abs(clip.y) <= clip.w)
+                    return true;
+            }
+        }
+    }
+    return false;
+}
+
+string verify_aabb_tree(int boxes, int trials) {
+    constexpr float area = 100.0f;
+    auto random_box = [] {
+        v3 min = v3(math::random_float(area), math::random_float(area), math::random_float(10.0f));
+        return AABB{min, min + v3(0.1f + math::random_float(2.0f))};
+    };
+
+    uint32 culled_visible = 0;
+    uint32 duplicates = 0;
+    uint64 visible = 0;
+    uint64 returned = 0;
+    uint64 total = 0;
+    for (int trial = 0; trial < trials; trial++) {
+        AABBTree tree;
+        vector<int32> proxies;
+        vector<AABB> world_boxes;
+        vector<uint8> hits;
+        for (int i = 0; i < boxes; i++) {
+            world_boxes.push_back(random_box());
+            proxies.push_back(tree.insert(world_boxes[i], (void*) uintptr_t(i)));
+        }
+        // Refit half of them, some far enough to be reinserted
+        for (int i = 0; i < boxes; i += 2) {
+            world_boxes[i] = random_box();
+            tree.move(proxies[i], world_boxes[i]);
+        }
+        for (int i = 1; i < boxes; i += 6) {
+            tree.remove(proxies[i]);
+            proxies[i] = -1;
+        }
+
+        // Built the same way RenderScene builds its camera, sun and top views
+        euler heading = {.yaw = math::random_float(2.0f * math::PI)};
+        heading.pitch = -math::random_float(1.0f);
+        Camera camera(v3(math::random_float(area), math::random_float(area), 5.0f + math::random_float(20.0f)), heading);
+        camera.pre_render();
+        v3 center = v3(area * 0.5f, area * 0.5f, 0.0f);
+        v3 sun_vec = math::normalize(v3(math::random_float(2.0f) - 1.0f, math::random_float(2.0f) - 1.0f, 1.0f));
+        m44 sun_vp = math::orthographic(v3(30.0f, 30.0f, 40.0f)) * math::look(center + sun_vec * 25.0f, -sun_vec, v3::Z);
+        float water_level = math::random_float(10.0f);
+        m44 top_vp = math::orthographic(v3(20.0f, 20.0f, 0.2f)) *
+            math::look(center + v3(0.0f, 0.0f, 0.1f + water_level), -v3::Z + v3(0.01f, 0.005f, 0.0f), v3::Y);
+
+        for (const m44& vp : {camera.vp, sun_vp, top_vp}) {
+            hits.assign(boxes, 0);
+            tree.query(CullVolume((m44GPU) vp), [&hits](void* user) {
+                hits[uintptr_t(user)]++;
+            });
+            for (int i = 0; i < boxes; i++) {
+                if (hits[i] > 1)
+                    duplicates++;
+                returned += hits[i];
+                if (proxies[i] == -1 || !samples_visible(world_boxes[i], vp))
+                    continue;
+                visible++;
+                if (hits[i] == 0)
+                    culled_visible++;
+            }
+            total += boxes;
+        }
+    }
+    return fmt_("{} trials of {} boxes over camera, sun and top views: {} visible boxes culled, {} duplicates, "
+                "{:.1f}% visible, {:.1f}% returned",
+        trials, boxes, culled_visible, duplicates, 100.0 * double(visible) / double(std::max(total, uint64(1))),
+        100.0 * double(returned) / double(std::max(total, uint64(1))));
+}
+
+}
@@ -0,0 +1,104 @@
+#pragma once
+
+#include "general/string.hpp"
+#include "general/vector.hpp"
+#include "general/math/geometry.hpp"
+#include "general/math/matrix.hpp"
+
+namespace spellbook {
+
+struct AABB {
+    v3 min;
+    v3 max;
+};
+
+// Bounds of a transformed box, transform is column major as uploaded to the GPU
+AABB transformed_bounds(const AABB& local, const m44GPU& transform);
+
+enum CullResult { CullResult_Outside, CullResult_Intersects, CullResult_Inside };
+
+// Side and near planes of a view projection. Depth isn't tested so shadow casters beyond the volume are kept.
+struct CullVolume {
+    v4 planes[5];
+
+    CullVolume() = default;
+    explicit CullVolume(const m44GPU& view_projection);
+
+    CullResult classify(const AABB& box) const;
+};
+
+// Incrementally balanced bounding volume tree. Leaves store a fattened box so small movements don't touch the tree.
+struct AABBTree {
+    struct Node {
+        AABB   box;
+        void*  user   = nullptr;
+        int32  parent = -1;
+        int32  left   = -1;
+        int32  right  = -1;
+        // -1 while on the free list, 0 for leaves
+        int32  height = -1;
+
+        bool is_leaf() const { return left == -1; }
+    };
+
+    vector<Node> nodes;
+    int32 root = -1;
+    int32 free_list = -1;
+    uint32 leaf_count = 0;
+    float margin = 0.1f;
+
+    int32 insert(const AABB& box, void* user);
+    void  remove(int32 proxy);
+    // Returns true if the proxy left its fat box and was reinserted
+    bool  move(int32 proxy, const AABB& box);
+    void  clear();
+
+    // Calls visit(user) for every leaf whose fat box isn't outside the volume
+    template <typename F>
+    void query(const CullVolume& volume, F&& visit) const;
+    template <typename F>
+    void _visit_all(int32 node, F& visit) const;
+
+    int32 _allocate();
+    void  _free(int32 node);
+    void  _insert_leaf(int32 leaf);
+    void  _remove_leaf(int32 leaf);
+    int32 _balance(int32 node);
+};
+
+template <typename F>
+void AABBTree::_visit_all(int32 node, F& visit) const {
+    if (nodes[node].is_leaf()) {
+        visit(nodes[node].user);
+        return;
+    }
+    _visit_all(nodes[node].left, visit);
+    _visit_all(nodes[node].right, visit);
+}
+
+template <typename F>
+void AABBTree::query(const CullVolume& volume, F&& visit) const {
+    if (root == -1)
+        return;
+    int32 stack[64];
+    int32 stack_size = 0;
+    stack[stack_size++] = root;
+    while (stack_size > 0) {
+        int32 index = stack[--stack_size];
+        const Node& node = nodes[index];
+        CullResult result = volume.classify(node.box);
+        if (result == CullResult_Outside)
+            continue;
+        if (result == CullResult_Inside || node.is_leaf()) {
+            _visit_all(index, visit);
+            continue;
+        }
+        stack[stack_size++] = node.left;
+        stack[stack_size++] = node.right;
+    }
+}
+
+// Checks that tree queries keep every box visible from randomized camera, sun and top views, headless
+string verify_aabb_tree(int boxes, int trials);
+
+}
@@ -0,0 +1,97 @@
+#include "asset_loader.hpp"
+
+#include <algorithm>
+#include <tracy/Tracy.hpp>
+
+#include "extension/fmt.hpp"
+#include "renderer/renderer.hpp"
+#include "renderer/assets/asset_container.hpp"
+#include "renderer/assets/texture_compression.hpp"
+
+namespace spellbook {
+
+AssetLoader::~AssetLoader() {
+    stop();
+}
+
+void AssetLoader::start(uint32 thread_count) {
+    stopping = false;
+    for (uint32 i = 0; i < thread_count; i++)
+        workers.emplace_back(&AssetLoader::_work, this);
+}
+
+void AssetLoader::stop() {
+    {
+        std::scoped_lock guard(lock);
+        stopping = true;
+        jobs.clear();
+        results.clear();
+    }
+    wake.notify_all();
+    for (std::thread& worker : workers)
+        worker.join();
+    workers.clear();
+    // The dropped jobs and results will never be finished, so their ids have to be requestable again
+    pending.clear();
+}
+
+bool AssetLoader::request(AssetKind kind, uint64 id, const FilePath& path) {
+    if (pending.contains(id))
+        return false;
+    if (workers.empty())
+        start(std::clamp(std::thread::hardware_concurrency(), 2u, 5u) - 1);
+    pending.insert(id);
+    {
+        std::scoped_lock guard(lock);
+        jobs.push_back(Job{kind, id, path});
+    }
+    wake.notify_one();
+    return true;
+}
+
+void AssetLoader::take_results(vector<Result>& out) {
+    std::scoped_lock guard(lock);
+    for (Result& result : results)
+        out.push_back(std::move(result));
+    results.clear();
+}
+
+void AssetLoader::finish(uint64 id) {
+    pending.erase(id);
+}
+
+void AssetLoader::_work() {
+    while (true) {
+        Job job;
+        {
+            std::unique_lock guard(lock);
+            wake.wait(guard, [this] { return stopping || !jobs.empty(); });
+            if (stopping)
+                return;
+            job = std::move(jobs.front());
+            jobs.pop_front();
+        }
+
+        ZoneScopedN("AssetLoader::load");
+        Result result = {job.kind, job.id, job.path};
+        // Mapped once, the sections are read straight out of this mapping
+        AssetContainer container;
+        if (container.open(job.path, &result.error)) {
+            bool read = job.kind == AssetKind_Mesh
+                ? load_mesh(container, job.path, result.mesh)
+                : load_texture(container, job.path, result.texture);
+            // Decoded here rather than on the main thread when the device can't sample BC formats
+            if (read && job.kind == AssetKind_Texture && !get_renderer().bc_supported)
+                decompress_texture(result.texture);
+            if (read)
+                result.loaded = true;
+            else
+                result.error = fmt_("Couldn't read {} {}", job.kind == AssetKind_Mesh ? "mesh" : "texture", job.path.rel_string());
+        }
+
+        std::scoped_lock guard(lock);
+        results.push_back(std::move(result));
+    }
+}
+
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+#include "general/vector.hpp"
+#include "general/umap.hpp"
+#include "general/file/file_path.hpp"
+#include "renderer/assets/mesh.hpp"
+#include "renderer/assets/texture.hpp"
+
+namespace spellbook {
+
+enum AssetKind { AssetKind_Mesh, AssetKind_Texture, AssetKind_Material, AssetKind_Count };
+
+// Reads and decompresses meshes and textures on worker threads, the results are uploaded by the main thread.
+// Legacy json assets go through the file cache, which isn't thread safe, so those come back unloaded.
+struct AssetLoader {
+    struct Job {
+        AssetKind kind;
+        uint64    id;
+        FilePath  path;
+    };
+    struct Result {
+        AssetKind  kind;
+        uint64     id;
+        FilePath   path;
+        // False if the main thread still has to load it
+        bool       loaded = false;
+        // Set when the container is broken, logged by the main thread since the logger isn't thread safe
+        string     error;
+        MeshCPU    mesh;
+        TextureCPU texture;
+    };
+
+    vector<std::thread>     workers;
+    std::mutex              lock;
+    std::condition_variable wake;
+    std::deque<Job>         jobs;
+    vector<Result>          results;
+    bool                    stopping = false;
+
+    // Main thread only, requested and not yet taken
+    uset<uint64> pending;
+
+    AssetLoader() = default;
+    AssetLoader(const AssetLoader&) = delete;
+    AssetLoader& operator=(const AssetLoader&) = delete;
+    ~AssetLoader();
+
+    void start(uint32 thread_count);
+    // Drops queued jobs and unclaimed results along with everything pending
+    void stop();
+
+    // False if the asset is already on its way
+    bool request(AssetKind kind, uint64 id, const FilePath& path);
+    // Moves finished loads into out, they stay pending until finish is called for them
+    void take_results(vector<Result>& out);
+    void finish(uint64 id);
+
+    void _work();
+};
+
+}
@@ -0,0 +1,368 @@
+#include "asset_container.hpp"
+
+#include <chrono>
+#include <fstream>
+#include <lz4/lz4.h>
+#include <tracy/Tracy.hpp>
+#include <utility>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "extension/fmt.hpp"
+#include "general/logger.hpp"
+#include "general/file/file_cache.hpp"
+#include "renderer/assets/mesh.hpp"
+#include "renderer/assets/model.hpp"
+#include "renderer/assets/texture.hpp"
+
+namespace spellbook {
+
+ContainerString ContainerStrings::add(string_view value) {
+    ContainerString result = {uint32(blob.size()), uint32(value.size())};
+    blob.insert(blob.end(), value.begin(), value.end());
+    return result;
+}
+
+string_view ContainerStrings::get(ContainerString value) const {
+    if (uint64(value.offset) + value.length > blob.size())
+        return {};
+    return string_view(blob.data() + value.offset, value.length);
+}
+
+MappedFile::MappedFile(const FilePath& file_path) {
+#ifdef _WIN32
+    HANDLE file = CreateFileW(file_path.abs_path().wstring().c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+        return;
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size) || size.QuadPart == 0) {
+        CloseHandle(file);
+        return;
+    }
+    HANDLE mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (mapping == nullptr) {
+        CloseHandle(file);
+        return;
+    }
+    data     = (const uint8*) MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    bsize    = data ? uint64(size.QuadPart) : 0;
+    _file    = file;
+    _mapping = mapping;
+#else
+    int file = open(file_path.abs_string().c_str(), O_RDONLY);
+    if (file == -1)
+        return;
+    struct stat info;
+    if (fstat(file, &info) == 0 && info.st_size > 0) {
+        void* mapped = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+        if (mapped != MAP_FAILED) {
+            data  = (const uint8*) mapped;
+            bsize = info.st_size;
+        }
+    }
+    // The mapping keeps the file alive on its own
+    ::close(file);
+#endif
+}
+
+MappedFile::MappedFile(MappedFile&& other) {
+    *this = std::move(other);
+}
+
+MappedFile& MappedFile::operator=(MappedFile&& other) {
+    if (this == &other)
+        return *this;
+    close();
+    data     = std::exchange(other.data, nullptr);
+    bsize    = std::exchange(other.bsize, 0);
+    _file    = std::exchange(other._file, nullptr);
+    _mapping = std::exchange(other._mapping, nullptr);
+    return *this;
+}
+
+MappedFile::~MappedFile() {
+    close();
+}
+
+void MappedFile::close() {
+#ifdef _WIN32
+    if (data)
+        UnmapViewOfFile(data);
+    if (_mapping)
+        CloseHandle(_mapping);
+    if (_file)
+        CloseHandle(_file);
+#else
+    if (data)
+        munmap((void*) data, bsize);
+#endif
+    data     = nullptr;
+    bsize    = 0;
+    _file    = nullptr;
+    _mapping = nullptr;
+}
+
+// Loader threads pass an error, the logger is main thread only
+static void report(string* error, bool warning, string message) {
+    if (error)
+        *error = std::move(message);
+    else if (warning)
+        log_warning(message);
+    else
+        log_error(message);
+}
+
+bool AssetContainer::open(const FilePath& file_path, string* error) {
+    file          = MappedFile(file_path);
+    sections      = nullptr;
+    section_count = 0;
+    if (file.bsize < sizeof(ContainerHeader)) {
+        file.close();
+        return false;
+    }
+
+    const ContainerHeader* header = (const ContainerHeader*) file.data;
+    if (header->magic != asset_container_magic) {
+        file.close();
+        return false;
+    }
+    if (header->version != asset_container_version) {
+        report(error, true, fmt_("Asset container {} is version {}, expected {}", file_path.rel_string(), header->version, asset_container_version));
+        file.close();
+        return false;
+    }
+    if (sizeof(ContainerHeader) + uint64(header->section_count) * sizeof(ContainerSection) > file.bsize) {
+        report(error, false, fmt_("Asset container {} is truncated", file_path.rel_string()));
+        file.close();
+        return false;
+    }
+
+    sections      = (const ContainerSection*) (file.data + sizeof(ContainerHeader));
+    section_count = header->section_count;
+    for (uint32 i = 0; i < section_count; i++) {
+        // Compared without adding so a huge offset or size can't wrap around
+        if (sections[i].offset > file.bsize || sections[i].bsize > file.bsize - sections[i].offset) {
+            report(error, false, fmt_("Asset container {} is truncated", file_path.rel_string()));
+            file.close();
+            sections      = nullptr;
+            section_count = 0;
+            return false;
+        }
+    }
+    return true;
+}
+
+const ContainerSection* AssetContainer::find(uint32 tag) const {
+    for (uint32 i = 0; i < section_count; i++) {
+        if (sections[i].tag == tag)
+            return &sections[i];
+    }
+    return nullptr;
+}
+
+uint64 AssetContainer::raw_bsize(uint32 tag) const {
+    const ContainerSection* section = find(tag);
+    return section ? section->raw_bsize : 0;
+}
+
+std::span<const uint8> AssetContainer::view(uint32 tag) const {
+    const ContainerSection* section = find(tag);
+    if (!section || (section->flags & SectionFlags_LZ4))
+        return {};
+    return std::span<const uint8>(file.data + section->offset, section->bsize);
+}
+
+bool AssetContainer::read(uint32 tag, void* dst, uint64 dst_bsize) const {
+    const ContainerSection* section = find(tag);
+    if (!section || section->raw_bsize != dst_bsize)
+        return false;
+    if (dst_bsize == 0)
+        return true;
+    if (section->flags & SectionFlags_LZ4) {
+        int32 decompressed = LZ4_decompress_safe((const char*) file.data + section->offset, (char*) dst, int32(section->bsize), int32(dst_bsize));
+        return decompressed == int32(dst_bsize);
+    }
+    memcpy(dst, file.data + section->offset, dst_bsize);
+    return true;
+}
+
+void AssetContainerWriter::add(uint32 tag, const void* data, uint64 bsize, bool compress) {
+    PendingSection& section = sections.emplace_back();
+    section.tag       = tag;
+    section.flags     = SectionFlags_None;
+    section.raw_bsize = bsize;
+    if (compress && bsize > 0) {
+        int32 compress_staging = LZ4_compressBound(int32(bsize));
+        section.data.resize(compress_staging);
+        int32 compressed_bsize = LZ4_compress_default((const char*) data, (char*) section.data.data(), int32(bsize), compress_staging);
+        if (compressed_bsize > 0 && uint64(compressed_bsize) <= bsize - bsize / 8) {
+            section.data.resize(compressed_bsize);
+            section.flags = SectionFlags_LZ4;
+            return;
+        }
+    }
+    section.data.resize(bsize);
+    if (bsize > 0)
+        memcpy(section.data.data(), data, bsize);
+}
+
+bool AssetContainerWriter::save(const FilePath& file_path) const {
+    ZoneScoped;
+    auto align = [](uint64 offset) { return (offset + asset_section_alignment - 1) & ~(asset_section_alignment - 1); };
+
+    ContainerHeader header;
+    header.section_count = sections.size();
+    vector<ContainerSection> table;
+    uint64 offset = align(sizeof(ContainerHeader) + sections.size() * sizeof(ContainerSection));
+    for (const PendingSection& pending : sections) {
+        table.push_back(ContainerSection{pending.tag, pending.flags, offset, pending.data.size(), pending.raw_bsize});
+        offset = align(offset + pending.data.size());
+    }
+
+    fs::create_directories(file_path.abs_path().parent_path());
+    std::ofstream stream(file_path.abs_path(), std::ios::binary | std::ios::trunc);
+    if (!stream) {
+        log_error(fmt_("Couldn't write asset container {}", file_path.rel_string()));
+        return false;
+    }
+    const char padding[asset_section_alignment] = {};
+    uint64 written = 0;
+    auto write = [&stream, &written](const void* data, uint64 bsize) {
+        stream.write((const char*) data, bsize);
+        written += bsize;
+    };
+    write(&header, sizeof(header));
+    write(table.data(), table.bsize());
+    for (uint32 i = 0; i < sections.size(); i++) {
+        write(padding, table[i].offset - written);
+        write(sections[i].data.data(), sections[i].data.size());
+    }
+    return bool(stream);
+}
+
+static vector<FilePath> _collect_container_assets() {
+    vector<FilePath> paths;
+    for (const auto& entry : fs::recursive_directory_iterator(get_resource_folder().abs_path())) {
+        string extension = entry.path().extension().string();
+        if (extension == MeshCPU::extension() || extension == TextureCPU::extension() || extension == ModelCPU::extension())
+            paths.push_back(FilePath(entry.path()));
+    }
+    return paths;
+}
+
+string convert_asset_containers(bool dry_run) {
+    uint32 converted = 0;
+    uint32 already   = 0;
+    uint32 unpacked  = 0;
+    uint64 bsize_before = 0;
+    uint64 bsize_after  = 0;
+    // Collected up front so rewriting files doesn't disturb the directory walk
+    for (const FilePath& path : _collect_container_assets()) {
+        AssetContainer container;
+        if (container.open(path)) {
+            // Meshes saved with compressed vertex or index sections are rewritten so uploads can map them
+            if (path.extension() != MeshCPU::extension() || mesh_mappable(container)) {
+                already++;
+                continue;
+            }
+            unpacked++;
+            if (!dry_run) {
+                MeshCPU mesh_cpu;
+                if (load_mesh(container, path, mesh_cpu)) {
+                    // Unmapped before the file is rewritten
+                    container.file.close();
+                    save_mesh(mesh_cpu);
+                }
+            }
+            continue;
+        }
+        converted++;
+        bsize_before += fs::file_size(path.abs_path());
+        if (dry_run)
+            continue;
+
+        string extension = path.extension();
+        if (extension == MeshCPU::extension())
+            save_mesh(load_mesh(path));
+        else if (extension == TextureCPU::extension())
+            save_texture(load_texture(path));
+        else
+            save_resource<ModelCPU>(load_resource<ModelCPU>(path, true, true));
+        bsize_after += fs::file_size(path.abs_path());
+    }
+    if (dry_run)
+        return fmt_("{} legacy assets ({:.1f}KB) would be converted, {} compressed meshes stored raw, {} already containers",
+            converted, bsize_before / 1024.0, unpacked, already);
+    return fmt_("converted {} assets, {:.1f}KB -> {:.1f}KB, stored {} compressed meshes raw, {} already containers",
+        converted, bsize_before / 1024.0, bsize_after / 1024.0, unpacked, already);
+}
+
+string benchmark_asset_loading(int passes) {
+    using clock = std::chrono::steady_clock;
+    enum { Mesh, Texture, Model, Kind_Count };
+    struct Timing {
+        uint32 files = 0;
+        double ms    = 0.0;
+    };
+    Timing timings[Kind_Count][2] = {};
+
+    vector<FilePath> paths = _collect_container_assets();
+    vector<uint8>    is_container;
+    // Container meshes whose upload maps the file instead of copying through load_mesh
+    uint32           mapped_meshes = 0;
+    for (const FilePath& path : paths) {
+        AssetContainer container;
+        is_container.push_back(container.open(path));
+        if (is_container.back() && path.extension() == MeshCPU::extension() && mesh_mappable(container))
+            mapped_meshes++;
+    }
+
+    for (int pass = 0; pass < passes; pass++) {
+        for (uint32 i = 0; i < paths.size(); i++) {
+            const FilePath& path = paths[i];
+            string extension = path.extension();
+            // Legacy assets would otherwise come out of the parsed file cache after the first pass
+            get_file_cache().parsed_assets.erase(path);
+
+            auto t0 = clock::now();
+            int kind;
+            if (extension == MeshCPU::extension()) {
+                kind = Mesh;
+                load_mesh(path);
+            } else if (extension == TextureCPU::extension()) {
+                kind = Texture;
+                load_texture(path);
+            } else {
+                kind = Model;
+                load_resource<ModelCPU>(path, true, true);
+            }
+            auto t1 = clock::now();
+
+            Timing& timing = timings[kind][is_container[i]];
+            timing.ms += std::chrono::duration<double, std::milli>(t1 - t0).count();
+            timing.files += pass == 0;
+        }
+    }
+
+    string report = fmt_("{} of {} container meshes upload from the mapping; ", mapped_meshes, timings[Mesh][1].files);
+    const char* names[Kind_Count] = {"meshes", "textures", "models"};
+    auto per_load = [passes](const Timing& timing) { return timing.files > 0 ? timing.ms / (timing.files * passes) : 0.0; };
+    for (int kind = 0; kind < Kind_Count; kind++) {
+        report += fmt_("{}: {} legacy {:.3f}ms, {} container {:.3f}ms per load{}", names[kind],
+            timings[kind][0].files, per_load(timings[kind][0]),
+            timings[kind][1].files, per_load(timings[kind][1]),
+            kind + 1 < Kind_Count ? "; " : "");
+    }
+    return report;
+}
+
+}
@@ -0,0 +1,129 @@
+#pragma once
+
+#include <span>
+
+#include "general/string.hpp"
+#include "general/vector.hpp"
+#include "general/file/file_path.hpp"
+
+namespace spellbook {
+
+// Binary asset file: a header, the table of contents, then every section aligned to asset_section_alignment.
+// Raw sections are used straight out of the mapping, LZ4 sections decompress directly into their destination.
+constexpr uint32 asset_container_magic   = 0x43414253; // "SBAC"
+constexpr uint32 asset_container_version = 1;
+constexpr uint64 asset_section_alignment = 16;
+
+constexpr uint32 section_tag(const char (&name)[5]) {
+    return uint32(name[0]) | uint32(name[1]) << 8 | uint32(name[2]) << 16 | uint32(name[3]) << 24;
+}
+
+enum SectionFlags : uint32 {
+    SectionFlags_None = 0,
+    SectionFlags_LZ4  = 1 << 0
+};
+
+struct ContainerHeader {
+    uint32 magic         = asset_container_magic;
+    uint32 version       = asset_container_version;
+    uint32 section_count = 0;
+    uint32 reserved      = 0;
+};
+
+struct ContainerSection {
+    uint32 tag    = 0;
+    uint32 flags  = SectionFlags_None;
+    uint64 offset = 0;
+    // Stored size, and size once decompressed
+    uint64 bsize     = 0;
+    uint64 raw_bsize = 0;
+};
+static_assert(sizeof(ContainerHeader) == 16 && sizeof(ContainerSection) == 32);
+
+// Strings and paths are stored as ranges of one string section
+struct ContainerString {
+    uint32 offset = 0;
+    uint32 length = 0;
+};
+
+struct ContainerStrings {
+    vector<char> blob;
+
+    ContainerString add(string_view value);
+    string_view     get(ContainerString value) const;
+};
+
+// Read only mapping of a whole file
+struct MappedFile {
+    const uint8* data  = nullptr;
+    uint64       bsize = 0;
+    void*        _file    = nullptr;
+    void*        _mapping = nullptr;
+
+    MappedFile() = default;
+    explicit MappedFile(const FilePath& file_path);
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    MappedFile(MappedFile&& other);
+    MappedFile& operator=(MappedFile&& other);
+    ~MappedFile();
+
+    void close();
+};
+
+struct AssetContainer {
+    MappedFile              file;
+    const ContainerSection* sections      = nullptr;
+    uint32                  section_count = 0;
+
+    // False if the file is missing, truncated or not a container, legacy json assets fall back on this. Problems with
+    // a file that is a container go to error when given, otherwise they're logged.
+    bool open(const FilePath& file_path, string* error = nullptr);
+
+    const ContainerSection* find(uint32 tag) const;
+    uint64 raw_bsize(uint32 tag) const;
+    // Empty unless the section is stored raw, the span points into the mapping
+    std::span<const uint8> view(uint32 tag) const;
+    // Copies or decompresses the section into dst, which must be exactly its raw size
+    bool read(uint32 tag, void* dst, uint64 dst_bsize) const;
+
+    template <typename T>
+    bool read(uint32 tag, vector<T>& values) const;
+    template <typename T>
+    bool read_struct(uint32 tag, T& value) const { return read(tag, &value, sizeof(T)); }
+};
+
+template <typename T>
+bool AssetContainer::read(uint32 tag, vector<T>& values) const {
+    uint64 bsize = raw_bsize(tag);
+    if (bsize % sizeof(T) != 0)
+        return false;
+    values.resize(bsize / sizeof(T));
+    return read(tag, values.data(), bsize);
+}
+
+struct AssetContainerWriter {
+    struct PendingSection {
+        uint32        tag;
+        uint32        flags;
+        uint64        raw_bsize;
+        vector<uint8> data;
+    };
+    vector<PendingSection> sections;
+
+    // Compressed sections are stored raw anyway unless LZ4 saves an eighth, so they can still be mapped
+    void add(uint32 tag, const void* data, uint64 bsize, bool compress);
+    template <typename T>
+    void add(uint32 tag, const vector<T>& values, bool compress) { add(tag, values.data(), values.bsize(), compress); }
+    template <typename T>
+    void add_struct(uint32 tag, const T& value) { add(tag, &value, sizeof(T), false); }
+
+    bool save(const FilePath& file_path) const;
+};
+
+// Rewrites the json meshes, textures and models in the resource folder as containers
+string convert_asset_containers(bool dry_run);
+// Loads every mesh, texture and model in the resource folder, split by container and legacy files
+string benchmark_asset_loading(int passes);
+
+}
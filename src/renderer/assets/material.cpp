@@ -26,7 +26,7 @@ void MaterialGPU::bind_textures(vuk::CommandBuffer& cbuf) {
 
 uint64 make_ui_material(const FilePath& fp) {
     uint64 id = hash_path(fp) ^ hash_view("ui_mat");
-    if (get_gpu_asset_cache().materials.contains(id))
+    if (get_gpu_asset_cache().get_material(id))
         return id;
 
     auto& tex = get_gpu_asset_cache().get_texture_or_upload(fp).value.view;
@@ -35,19 +35,19 @@ uint64 make_ui_material(const FilePath& fp) {
     return make_ui_material(id, image);
 }
 
-uint64 make_ui_material(uint64 id, vuk::SampledImage& image) {
-    if (get_gpu_asset_cache().materials.contains(id))
+uint64 make_ui_material(uint64 id, vuk::SampledImage& image, string_view pipeline) {
+    if (get_gpu_asset_cache().get_material(id))
         return id;
 
     MaterialGPU material_gpu = {};
-    material_gpu.pipeline      = get_renderer().context->get_named_pipeline(vuk::Name("ui"));
+    material_gpu.pipeline      = get_renderer().context->get_named_pipeline(vuk::Name(pipeline));
     material_gpu.images.emplace(ATLAS_BINDING, image);
     material_gpu.cull_mode = vuk::CullModeFlagBits::eNone;
     material_gpu.frame_allocated = false;
 
     assert_else(material_gpu.pipeline != nullptr);
 
-    get_gpu_asset_cache().materials[id] = std::move(material_gpu);
+    get_gpu_asset_cache().add_material(id, std::move(material_gpu));
     return id;
 }
 
@@ -60,12 +60,18 @@ uint64 upload_material(const MaterialCPU& material_cpu, bool frame_allocation) {
     MaterialGPU material_gpu;
     material_gpu.frame_allocated = frame_allocation;
     material_gpu.pipeline      = get_renderer().context->get_named_pipeline(vuk::Name(material_cpu.shader_name));
+    material_gpu.packed_pipeline = get_renderer().get_pipeline(material_cpu.shader_name, VertexLayout_Packed);
     assert_else(material_gpu.pipeline != nullptr);
 
-    material_gpu.images.emplace(BASE_COLOR_BINDING, vuk::make_sampled_image(get_gpu_asset_cache().get_texture_or_upload(material_cpu.color_asset_path).value.view.get(), material_cpu.sampler.get()));
-    material_gpu.images.emplace(EMISSIVE_BINDING, vuk::make_sampled_image(get_gpu_asset_cache().get_texture_or_upload(material_cpu.emissive_asset_path).value.view.get(), material_cpu.sampler.get()));
-    material_gpu.images.emplace(NORMAL_BINDING, vuk::make_sampled_image(get_gpu_asset_cache().get_texture_or_upload(material_cpu.normal_asset_path).value.view.get(), material_cpu.sampler.get()));
-    material_gpu.images.emplace(ORM_BINDING, vuk::make_sampled_image(get_gpu_asset_cache().get_texture_or_upload(material_cpu.orm_asset_path).value.view.get(), material_cpu.sampler.get()));
+    vector<uint64> texture_ids;
+    auto texture = [material_cpu_hash, &texture_ids](const FilePath& path) {
+        texture_ids.push_back(hash_path(path));
+        return get_gpu_asset_cache().get_texture_or_request(path, material_cpu_hash).value.view.get();
+    };
+    material_gpu.images.emplace(BASE_COLOR_BINDING, vuk::make_sampled_image(texture(material_cpu.color_asset_path), material_cpu.sampler.get()));
+    material_gpu.images.emplace(EMISSIVE_BINDING, vuk::make_sampled_image(texture(material_cpu.emissive_asset_path), material_cpu.sampler.get()));
+    material_gpu.images.emplace(NORMAL_BINDING, vuk::make_sampled_image(texture(material_cpu.normal_asset_path), material_cpu.sampler.get()));
+    material_gpu.images.emplace(ORM_BINDING, vuk::make_sampled_image(texture(material_cpu.orm_asset_path), material_cpu.sampler.get()));
 
     BasicMaterialDataGPU gpu_tints = {
         (v4) material_cpu.color_tint,
@@ -77,13 +83,15 @@ uint64 upload_material(const MaterialCPU& material_cpu, bool frame_allocation) {
     material_gpu.cull_mode = material_cpu.cull_mode;
     material_gpu.frame_allocated = frame_allocation;
 
-    get_gpu_asset_cache().materials[material_cpu_hash] = std::move(material_gpu);
     get_gpu_asset_cache().paths[material_cpu_hash] = material_cpu.file_path;
+    get_gpu_asset_cache().add_material(material_cpu_hash, std::move(material_gpu));
+    get_gpu_asset_cache().set_material_textures(material_cpu_hash, std::move(texture_ids));
     return material_cpu_hash;
 }
 
 void MaterialGPU::update_from_cpu(const MaterialCPU& new_material) {
     pipeline      = get_renderer().context->get_named_pipeline(vuk::Name(new_material.shader_name));
+    packed_pipeline = get_renderer().get_pipeline(new_material.shader_name, VertexLayout_Packed);
     BasicMaterialDataGPU tints = {
         (v4) new_material.color_tint,
         (v4) new_material.emissive_tint,
@@ -91,10 +99,17 @@ void MaterialGPU::update_from_cpu(const MaterialCPU& new_material) {
     };
     cull_mode = new_material.cull_mode;
 
-    images.at(BASE_COLOR_BINDING) = vuk::make_sampled_image(get_gpu_asset_cache().get_texture_or_upload(new_material.color_asset_path).value.view.get(), new_material.sampler.get());
-    images.at(NORMAL_BINDING) = vuk::make_sampled_image(get_gpu_asset_cache().get_texture_or_upload(new_material.normal_asset_path).value.view.get(), new_material.sampler.get());
-    images.at(ORM_BINDING) = vuk::make_sampled_image(get_gpu_asset_cache().get_texture_or_upload(new_material.orm_asset_path).value.view.get(), new_material.sampler.get());
-    images.at(EMISSIVE_BINDING) = vuk::make_sampled_image(get_gpu_asset_cache().get_texture_or_upload(new_material.emissive_asset_path).value.view.get(), new_material.sampler.get());
+    uint64 material_id = hash_path(new_material.file_path);
+    vector<uint64> texture_ids;
+    auto texture = [material_id, &texture_ids](const FilePath& path) {
+        texture_ids.push_back(hash_path(path));
+        return get_gpu_asset_cache().get_texture_or_request(path, material_id).value.view.get();
+    };
+    images.at(BASE_COLOR_BINDING) = vuk::make_sampled_image(texture(new_material.color_asset_path), new_material.sampler.get());
+    images.at(NORMAL_BINDING) = vuk::make_sampled_image(texture(new_material.normal_asset_path), new_material.sampler.get());
+    images.at(ORM_BINDING) = vuk::make_sampled_image(texture(new_material.orm_asset_path), new_material.sampler.get());
+    images.at(EMISSIVE_BINDING) = vuk::make_sampled_image(texture(new_material.emissive_asset_path), new_material.sampler.get());
+    get_gpu_asset_cache().set_material_textures(material_id, std::move(texture_ids));
 }
 
 
@@ -53,6 +53,8 @@ struct BasicMaterialDataGPU {
 struct MaterialGPU {
     // uses master shader
     vuk::PipelineBaseInfo* pipeline;
+    // Variant for meshes in the packed vertex layout, null if the shader has none
+    vuk::PipelineBaseInfo* packed_pipeline = nullptr;
 
     umap<uint32, vuk::SampledImage> images;
     vector<uint8> extra_material_data;
@@ -61,6 +63,9 @@ struct MaterialGPU {
 
     bool frame_allocated = false;
 
+    uint64 bsize     = 0;
+    uint64 last_used = 0;
+
     void bind_parameters(vuk::CommandBuffer& cbuf);
     void bind_textures(vuk::CommandBuffer& cbuf);
 
@@ -68,7 +73,7 @@ struct MaterialGPU {
 };
 
 uint64 make_ui_material(const FilePath& texture);
-uint64 make_ui_material(uint64 id, vuk::SampledImage& image);
+uint64 make_ui_material(uint64 id, vuk::SampledImage& image, string_view pipeline = "ui");
 
 bool inspect(MaterialCPU* material);
 void inspect(MaterialGPU* material);
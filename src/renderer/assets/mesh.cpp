@@ -1,6 +1,9 @@
 #include "mesh.hpp"
 
+#include <algorithm>
+#include <cmath>
 #include <imgui/imgui.h>
+#include <tracy/Tracy.hpp>
 #include <vuk/Partials.hpp>
 #include <lz4/lz4.h>
 
@@ -9,6 +12,7 @@
 #include "general/logger.hpp"
 #include "renderer/renderer.hpp"
 #include "renderer/gpu_asset_cache.hpp"
+#include "renderer/assets/asset_container.hpp"
 
 namespace spellbook {
 
@@ -28,6 +32,19 @@ static v3 get_tangent(Vertex a, Vertex b, Vertex c) {
     return math::normalize(unnormalized);
 }
 
+bool MeshCPU::pack() {
+    for (const Vertex& vertex : vertices) {
+        if (!can_pack_vertex(vertex))
+            return false;
+    }
+    packed_vertices.clear();
+    packed_vertices.reserve(vertices.size());
+    for (const Vertex& vertex : vertices)
+        packed_vertices.push_back(pack_vertex(vertex));
+    layout = VertexLayout_Packed;
+    return true;
+}
+
 void MeshCPU::fix_tangents() {
     for (int i = 0; (i + 2) < indices.size(); i+=3) {
         v3 tangent = get_tangent(vertices[indices[i+0]],vertices[indices[i+1]],vertices[indices[i+2]]);
@@ -35,30 +52,80 @@ void MeshCPU::fix_tangents() {
     }
 }
 
-uint64 upload_mesh(const MeshCPU& mesh_cpu, bool frame_allocation) {
-    if (!mesh_cpu.file_path.is_file())
-        return 0;
-    uint64 mesh_cpu_hash = hash_path(mesh_cpu.file_path);
-    if (get_gpu_asset_cache().meshes.contains(mesh_cpu_hash))
+constexpr uint32 mesh_section_info     = section_tag("INFO");
+constexpr uint32 mesh_section_bounds   = section_tag("BNDS");
+constexpr uint32 mesh_section_vertices = section_tag("VERT");
+constexpr uint32 mesh_section_indices  = section_tag("INDX");
+
+static uint64 _upload_mesh(const FilePath& file_path, VertexLayout layout, std::span<const uint8> vertex_data, std::span<const uint32> indices, bool frame_allocation) {
+    uint64 mesh_cpu_hash = hash_path(file_path);
+    if (get_gpu_asset_cache().get_mesh(mesh_cpu_hash))
         return mesh_cpu_hash;
     MeshGPU         mesh_gpu;
     mesh_gpu.frame_allocated = frame_allocation;
+    mesh_gpu.layout          = layout;
+    bool packed              = layout == VertexLayout_Packed;
+    std::span<const VertexPacked> packed_vertices((const VertexPacked*) vertex_data.data(), vertex_data.size() / sizeof(VertexPacked));
+    std::span<const Vertex>       vertices((const Vertex*) vertex_data.data(), vertex_data.size() / sizeof(Vertex));
     vuk::Allocator& alloc                = frame_allocation ? *get_renderer().frame_allocator : *get_renderer().global_allocator;
-    auto            [vert_buf, vert_fut] = vuk::create_buffer(alloc, vuk::MemoryUsage::eGPUonly, vuk::DomainFlagBits::eTransferOnTransfer, std::span(mesh_cpu.vertices));
+    auto            [vert_buf, vert_fut] = packed ?
+        vuk::create_buffer(alloc, vuk::MemoryUsage::eGPUonly, vuk::DomainFlagBits::eTransferOnTransfer, packed_vertices) :
+        vuk::create_buffer(alloc, vuk::MemoryUsage::eGPUonly, vuk::DomainFlagBits::eTransferOnTransfer, vertices);
     mesh_gpu.vertex_buffer               = std::move(vert_buf);
-    auto [idx_buf, idx_fut]              = vuk::create_buffer(alloc, vuk::MemoryUsage::eGPUonly, vuk::DomainFlagBits::eTransferOnTransfer, std::span(mesh_cpu.indices));
+    auto [idx_buf, idx_fut]              = vuk::create_buffer(alloc, vuk::MemoryUsage::eGPUonly, vuk::DomainFlagBits::eTransferOnTransfer, indices);
     mesh_gpu.index_buffer                = std::move(idx_buf);
-    mesh_gpu.index_count                 = mesh_cpu.indices.size();
-    mesh_gpu.vertex_count                = mesh_cpu.vertices.size();
+    mesh_gpu.index_count                 = indices.size();
+    mesh_gpu.vertex_count                = packed ? packed_vertices.size() : vertices.size();
+    mesh_gpu.bsize                       = vertex_data.size() + indices.size_bytes();
+    auto fit_bounds = [&mesh_gpu](const auto& vertices) {
+        if (vertices.empty())
+            return;
+        mesh_gpu.bounds = AABB{vertices.front().position, vertices.front().position};
+        for (const auto& vertex : vertices) {
+            mesh_gpu.bounds.min = math::min(mesh_gpu.bounds.min, vertex.position);
+            mesh_gpu.bounds.max = math::max(mesh_gpu.bounds.max, vertex.position);
+        }
+        mesh_gpu.bounds_valid = true;
+    };
+    if (packed)
+        fit_bounds(packed_vertices);
+    else
+        fit_bounds(vertices);
 
     get_renderer().enqueue_setup(std::move(vert_fut));
     get_renderer().enqueue_setup(std::move(idx_fut));
 
-    get_gpu_asset_cache().meshes[mesh_cpu_hash] = std::move(mesh_gpu);
-    get_gpu_asset_cache().paths[mesh_cpu_hash] = mesh_cpu.file_path;
+    get_gpu_asset_cache().paths[mesh_cpu_hash] = file_path;
+    get_gpu_asset_cache().add_mesh(mesh_cpu_hash, std::move(mesh_gpu));
     return mesh_cpu_hash;
 }
 
+uint64 upload_mesh(const MeshCPU& mesh_cpu, bool frame_allocation) {
+    if (!mesh_cpu.file_path.is_file())
+        return 0;
+    bool packed = mesh_cpu.layout == VertexLayout_Packed;
+    std::span<const uint8> vertex_data(
+        packed ? (const uint8*) mesh_cpu.packed_vertices.data() : (const uint8*) mesh_cpu.vertices.data(),
+        packed ? mesh_cpu.packed_vertices.bsize() : mesh_cpu.vertices.bsize());
+    return _upload_mesh(mesh_cpu.file_path, mesh_cpu.layout, vertex_data, std::span(mesh_cpu.indices), frame_allocation);
+}
+
+uint64 upload_mesh(const FilePath& file_path) {
+    ZoneScoped;
+    AssetContainer container;
+    MeshInfo mesh_info;
+    if (container.open(file_path) && container.read_struct(mesh_section_info, mesh_info)) {
+        std::span<const uint8> vertex_data = container.view(mesh_section_vertices);
+        std::span<const uint8> index_data = container.view(mesh_section_indices);
+        // Compressed sections need somewhere to decompress to, those go through load_mesh
+        if (vertex_data.size() == mesh_info.vertices_bsize && index_data.size() == mesh_info.indices_bsize) {
+            std::span<const uint32> indices((const uint32*) index_data.data(), index_data.size() / sizeof(uint32));
+            return _upload_mesh(file_path, mesh_info.vertex_layout, vertex_data, indices, false);
+        }
+    }
+    return upload_mesh(load_mesh(file_path));
+}
+
 void upload_mesh(const MeshUICPU& mesh_cpu, bool frame_allocation) {
     MeshGPU         mesh_gpu;
     mesh_gpu.frame_allocated = frame_allocation;
@@ -69,58 +136,159 @@ void upload_mesh(const MeshUICPU& mesh_cpu, bool frame_allocation) {
     mesh_gpu.index_buffer                = std::move(idx_buf);
     mesh_gpu.index_count                 = mesh_cpu.indices.size();
     mesh_gpu.vertex_count                = mesh_cpu.vertices.size();
+    mesh_gpu.bsize                       = mesh_cpu.vertices.bsize() + mesh_cpu.indices.bsize();
 
     get_renderer().enqueue_setup(std::move(vert_fut));
     get_renderer().enqueue_setup(std::move(idx_fut));
 
-    get_gpu_asset_cache().meshes[mesh_cpu.id] = std::move(mesh_gpu);
+    get_gpu_asset_cache().add_mesh(mesh_cpu.id, std::move(mesh_gpu));
 }
 
-MeshCPU load_mesh(const FilePath& file_path) {
+static MeshCPU _load_mesh_json(const FilePath& file_path) {
     AssetFile& asset_file = get_file_cache().load_asset(file_path);
 
     MeshInfo mesh_info = from_jv<MeshInfo>(*asset_file.asset_json["mesh_info"]);
     MeshCPU mesh_cpu = from_jv<MeshCPU>(*asset_file.asset_json["mesh_cpu"]);
     mesh_cpu.file_path = file_path;
+    mesh_cpu.layout = mesh_info.vertex_layout;
 
     vector<uint8> decompressed;
     decompressed.resize(mesh_info.vertices_bsize + mesh_info.indices_bsize);
     LZ4_decompress_safe((const char*) asset_file.binary_blob.data(), (char*) decompressed.data(), asset_file.binary_blob.size(), (int32) (decompressed.size()));
 
-    mesh_cpu.vertices.rebsize(mesh_info.vertices_bsize);
+    void* vertex_data;
+    if (mesh_cpu.layout == VertexLayout_Packed) {
+        mesh_cpu.packed_vertices.rebsize(mesh_info.vertices_bsize);
+        vertex_data = mesh_cpu.packed_vertices.data();
+    } else {
+        mesh_cpu.vertices.rebsize(mesh_info.vertices_bsize);
+        vertex_data = mesh_cpu.vertices.data();
+    }
     mesh_cpu.indices.rebsize(mesh_info.indices_bsize);
 
-    memcpy(mesh_cpu.vertices.data(), decompressed.data(), mesh_info.vertices_bsize);
+    memcpy(vertex_data, decompressed.data(), mesh_info.vertices_bsize);
     memcpy(mesh_cpu.indices.data(), decompressed.data() + mesh_info.vertices_bsize, mesh_info.indices_bsize);
 
     return mesh_cpu;
 }
 
-void save_mesh(const MeshCPU& mesh_cpu) {
-    AssetFile file;
-    file.file_path = mesh_cpu.file_path;
+bool load_mesh(const AssetContainer& container, const FilePath& file_path, MeshCPU& mesh_cpu) {
+    mesh_cpu.file_path = file_path;
+    MeshInfo mesh_info;
+    bool read = container.read_struct(mesh_section_info, mesh_info) && container.read_struct(mesh_section_bounds, mesh_cpu.bounds);
+    mesh_cpu.layout = mesh_info.vertex_layout;
+    if (mesh_cpu.layout == VertexLayout_Packed)
+        read = read && container.read(mesh_section_vertices, mesh_cpu.packed_vertices);
+    else
+        read = read && container.read(mesh_section_vertices, mesh_cpu.vertices);
+    return read && container.read(mesh_section_indices, mesh_cpu.indices);
+}
+
+bool mesh_mappable(const AssetContainer& container) {
+    MeshInfo mesh_info;
+    return container.read_struct(mesh_section_info, mesh_info) &&
+        container.view(mesh_section_vertices).size() == mesh_info.vertices_bsize &&
+        container.view(mesh_section_indices).size() == mesh_info.indices_bsize;
+}
+
+MeshCPU load_mesh(const FilePath& file_path) {
+    ZoneScoped;
+    AssetContainer container;
+    if (!container.open(file_path))
+        return _load_mesh_json(file_path);
 
+    MeshCPU mesh_cpu;
+    if (!load_mesh(container, file_path, mesh_cpu))
+        log_error(fmt_("Couldn't read mesh {}", file_path.rel_string()));
+    return mesh_cpu;
+}
+
+void save_mesh(const MeshCPU& mesh_cpu) {
+    bool packed = mesh_cpu.layout == VertexLayout_Packed;
     MeshInfo mesh_info;
-    mesh_info.vertices_bsize = mesh_cpu.vertices.bsize();
+    mesh_info.vertices_bsize = packed ? mesh_cpu.packed_vertices.bsize() : mesh_cpu.vertices.bsize();
     mesh_info.indices_bsize  = mesh_cpu.indices.bsize();
     mesh_info.index_bsize    = sizeof(uint32);
+    mesh_info.vertex_layout  = mesh_cpu.layout;
 
-    vector<uint8> merged_buffer;
-    merged_buffer.resize(uint32(mesh_info.vertices_bsize + mesh_info.indices_bsize));
-    memcpy(merged_buffer.data(), mesh_cpu.vertices.data(), mesh_info.vertices_bsize);
-    memcpy(merged_buffer.data() + mesh_info.vertices_bsize, mesh_cpu.indices.data(), mesh_info.indices_bsize);
+    AssetContainerWriter writer;
+    writer.add_struct(mesh_section_info, mesh_info);
+    writer.add_struct(mesh_section_bounds, mesh_cpu.bounds);
+    // Left uncompressed, upload_mesh only maps them straight into the upload when they're stored raw
+    if (packed)
+        writer.add(mesh_section_vertices, mesh_cpu.packed_vertices, false);
+    else
+        writer.add(mesh_section_vertices, mesh_cpu.vertices, false);
+    writer.add(mesh_section_indices, mesh_cpu.indices, false);
+    writer.save(mesh_cpu.file_path);
+    // Drop any parsed copy of the json file this replaced
+    get_file_cache().parsed_assets.erase(mesh_cpu.file_path);
+}
+
+string verify_vertex_packing(int samples) {
+    auto random_unit = [] {
+        v3 v;
+        do {
+            v = v3(math::random_float(2.0f) - 1.0f, math::random_float(2.0f) - 1.0f, math::random_float(2.0f) - 1.0f);
+        } while (math::length(v) < 0.01f || math::length(v) > 1.0f);
+        return math::normalize(v);
+    };
+    auto angle = [](v3 a, v3 b) {
+        return std::acos(std::clamp(math::dot(a, b), -1.0f, 1.0f)) * 180.0f / math::PI;
+    };
 
-    int32 compress_staging = LZ4_compressBound(int32(mesh_info.vertices_bsize + mesh_info.indices_bsize));
-    file.binary_blob.resize(compress_staging);
-    int32 compressed_bsize = LZ4_compress_default((char*) merged_buffer.data(), (char*) file.binary_blob.data(), int32(merged_buffer.size()), int32(compress_staging));
-    file.binary_blob.resize(compressed_bsize);
+    float normal_error = 0.0f, tangent_error = 0.0f, uv_error = 0.0f, color_error = 0.0f, weight_error = 0.0f;
+    uint32 id_mismatches = 0;
+    for (int sample = 0; sample < samples; sample++) {
+        Vertex vertex;
+        vertex.position = v3(math::random_float(10.0f), math::random_float(10.0f), math::random_float(10.0f));
+        vertex.normal = random_unit();
+        vertex.tangent = random_unit();
+        vertex.color = v3(math::random_float(1.0f), math::random_float(1.0f), math::random_float(1.0f));
+        vertex.uv = v2(math::random_float(1.0f), math::random_float(1.0f));
+        int32 bones = math::random_int32(5);
+        float weight_total = 0.0f;
+        for (int32 i = 0; i < bones; i++) {
+            vertex.bone_ids[i] = math::random_int32(64);
+            vertex.bone_weights[i] = 0.05f + math::random_float(1.0f);
+            weight_total += vertex.bone_weights[i];
+        }
+        for (int32 i = 0; i < bones; i++)
+            vertex.bone_weights[i] /= weight_total;
 
-    json j;
-    j["mesh_cpu"] = make_shared<json_value>(to_jv(mesh_cpu));
-    j["mesh_info"] = make_shared<json_value>(to_jv(mesh_info));
-    file.asset_json = j;
+        Vertex result = unpack_vertex(pack_vertex(vertex));
+        normal_error = std::max(normal_error, angle(vertex.normal, result.normal));
+        tangent_error = std::max(tangent_error, angle(vertex.tangent, result.tangent));
+        for (int i = 0; i < 2; i++)
+            uv_error = std::max(uv_error, std::abs(vertex.uv[i] - result.uv[i]));
+        for (int i = 0; i < 3; i++)
+            color_error = std::max(color_error, std::abs(vertex.color[i] - result.color[i]));
+        for (int i = 0; i < 4; i++) {
+            weight_error = std::max(weight_error, std::abs(vertex.bone_weights[i] - result.bone_weights[i]));
+            id_mismatches += vertex.bone_ids[i] != result.bone_ids[i];
+        }
+    }
+
+    uint32 mesh_count = 0;
+    uint32 packed_count = 0;
+    uint64 full_bsize = 0;
+    uint64 packed_bsize = 0;
+    for (const auto& entry : fs::recursive_directory_iterator(get_resource_folder().abs_path())) {
+        if (entry.path().extension().string() != MeshCPU::extension())
+            continue;
+        MeshCPU mesh_cpu = load_mesh(FilePath(entry.path()));
+        uint32 vertex_count = mesh_cpu.layout == VertexLayout_Packed ? mesh_cpu.packed_vertices.size() : mesh_cpu.vertices.size();
+        bool packed = mesh_cpu.layout == VertexLayout_Packed || mesh_cpu.pack();
+        mesh_count++;
+        packed_count += packed;
+        full_bsize += uint64(vertex_count) * sizeof(Vertex);
+        packed_bsize += uint64(vertex_count) * (packed ? sizeof(VertexPacked) : sizeof(Vertex));
+    }
 
-    save_asset_file(file);
+    return fmt_("{} vertices: normal {:.4f} deg, tangent {:.4f} deg, uv {:.6f}, color {:.4f}, weight {:.4f}, {} bone id mismatches. "
+        "{} of {} resource meshes packable, vertex data {:.1f}KB -> {:.1f}KB read per instance",
+        samples, normal_error, tangent_error, uv_error, color_error, weight_error, id_mismatches,
+        packed_count, mesh_count, full_bsize / 1024.0, packed_bsize / 1024.0);
 }
 
 }
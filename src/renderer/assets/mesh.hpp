@@ -9,13 +9,17 @@
 #include "general/file/file_path.hpp"
 #include "general/file/resource.hpp"
 #include "renderer/vertex.hpp"
+#include "renderer/aabb_tree.hpp"
 
 namespace spellbook {
 
+struct AssetContainer;
+
 struct MeshInfo {
     uint32 vertices_bsize = 0;
     uint32 indices_bsize  = 0;
     uint32 index_bsize    = 0;
+    VertexLayout vertex_layout = VertexLayout_Full;
 };
 
 struct MeshBounds {
@@ -28,17 +32,22 @@ struct MeshBounds {
 struct MeshCPU : Resource {
     vector<Vertex> vertices;
     vector<uint32> indices;
+    // Packed meshes load and upload only these
+    VertexLayout layout = VertexLayout_Full;
+    vector<VertexPacked> packed_vertices;
 
     MeshBounds bounds;
 
     void fix_tangents();
+    // Switches to the packed layout if every vertex fits it, chosen per mesh when converting
+    bool pack();
 
     static constexpr string_view extension() { return ".sbamsh"; }
     static constexpr string_view dnd_key() { return "DND_MESH"; }
     static FilePath folder() { return get_resource_folder(); }
     static std::function<bool(const FilePath&)> path_filter() { return [](const FilePath& path) { return path.extension() == MeshCPU::extension(); }; }
 };
-JSON_IMPL(MeshInfo, vertices_bsize, indices_bsize, index_bsize);
+JSON_IMPL(MeshInfo, vertices_bsize, indices_bsize, index_bsize, vertex_layout);
 JSON_IMPL(MeshBounds, valid, extents, origin, radius);
 JSON_IMPL(MeshCPU, bounds);
 
@@ -54,13 +63,30 @@ struct MeshGPU {
 
     uint32 vertex_count;
     uint32 index_count;
+    VertexLayout layout = VertexLayout_Full;
+
+    // Local space bounds for culling, UI meshes have none
+    AABB bounds;
+    bool bounds_valid = false;
 
     bool frame_allocated;
+
+    uint64 bsize     = 0;
+    uint64 last_used = 0;
 };
 
 MeshCPU load_mesh(const FilePath& file_path);
+// Reads an opened container without logging, false if a section is missing or corrupt
+bool    load_mesh(const AssetContainer& container, const FilePath& file_path, MeshCPU& mesh_cpu);
 void    save_mesh(const MeshCPU& mesh_cpu);
 uint64 upload_mesh(const MeshCPU&, bool frame_allocation = false);
+// Uploads raw container sections straight from the file mapping, anything else goes through load_mesh
+uint64 upload_mesh(const FilePath& file_path);
+// Whether the vertex and index sections are stored raw, so upload_mesh can take them from the mapping
+bool   mesh_mappable(const AssetContainer& container);
 void upload_mesh(const MeshUICPU&, bool frame_allocation = false);
 
+// Round trip error of the packed layout on random vertices, and vertex bytes of the meshes in the resource folder
+string verify_vertex_packing(int samples);
+
 }
@@ -0,0 +1,394 @@
+#include "mesh_optimizer.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <tracy/Tracy.hpp>
+
+#include "extension/fmt.hpp"
+#include "general/math/math.hpp"
+#include "renderer/assets/mesh.hpp"
+
+namespace spellbook {
+
+// Cache size the triangle scoring assumes, larger than any real cache so the order holds up across GPUs
+constexpr uint32 forsyth_cache_size = 32;
+
+static float vertex_score(int32 cache_position, uint32 live_triangles) {
+    constexpr float cache_decay_power   = 1.5f;
+    constexpr float last_triangle_score = 0.75f;
+    constexpr float valence_boost_scale = 2.0f;
+    constexpr float valence_boost_power = 0.5f;
+    if (live_triangles == 0)
+        return -1.0f;
+
+    float score = 0.0f;
+    if (cache_position >= 0) {
+        // The last triangle's vertices score the same so it isn't favored to repeat them
+        if (cache_position < 3)
+            score = last_triangle_score;
+        else
+            score = std::pow(1.0f - float(cache_position - 3) / float(forsyth_cache_size - 3), cache_decay_power);
+    }
+    // Vertices with few triangles left are finished first so they can leave the cache
+    return score + valence_boost_scale * std::pow(float(live_triangles), -valence_boost_power);
+}
+
+VertexCacheStats analyze_vertex_cache(const vector<uint32>& indices, uint32 vertex_count, uint32 cache_size) {
+    vector<uint32> timestamps;
+    timestamps.assign(vertex_count, 0);
+    vector<uint8> referenced;
+    referenced.assign(vertex_count, 0);
+    uint32 time = cache_size + 1;
+    uint32 misses = 0;
+    uint32 unique = 0;
+    for (uint32 index : indices) {
+        if (time - timestamps[index] > cache_size) {
+            timestamps[index] = time++;
+            misses++;
+        }
+        if (!referenced[index]) {
+            referenced[index] = 1;
+            unique++;
+        }
+    }
+    uint32 triangle_count = indices.size() / 3;
+    return VertexCacheStats{
+        triangle_count > 0 ? float(misses) / float(triangle_count) : 0.0f,
+        unique > 0 ? float(misses) / float(unique) : 0.0f
+    };
+}
+
+void optimize_vertex_cache(vector<uint32>& indices, uint32 vertex_count) {
+    ZoneScoped;
+    uint32 triangle_count = indices.size() / 3;
+    if (triangle_count == 0)
+        return;
+
+    // Triangles around each vertex, the live ones are kept at the front of each range
+    vector<uint32> live;
+    live.assign(vertex_count, 0);
+    for (uint32 index : indices)
+        live[index]++;
+    vector<uint32> offsets;
+    offsets.assign(vertex_count + 1, 0);
+    for (uint32 v = 0; v < vertex_count; v++)
+        offsets[v + 1] = offsets[v] + live[v];
+    vector<uint32> cursor;
+    cursor.assign(vertex_count, 0);
+    vector<uint32> adjacency;
+    adjacency.resize(indices.size());
+    for (uint32 t = 0; t < triangle_count; t++) {
+        for (uint32 k = 0; k < 3; k++) {
+            uint32 v = indices[t * 3 + k];
+            adjacency[offsets[v] + cursor[v]++] = t;
+        }
+    }
+
+    vector<float> scores;
+    scores.resize(vertex_count);
+    for (uint32 v = 0; v < vertex_count; v++)
+        scores[v] = vertex_score(-1, live[v]);
+    vector<float> triangle_scores;
+    triangle_scores.resize(triangle_count);
+    for (uint32 t = 0; t < triangle_count; t++)
+        triangle_scores[t] = scores[indices[t * 3 + 0]] + scores[indices[t * 3 + 1]] + scores[indices[t * 3 + 2]];
+    vector<uint8> emitted;
+    emitted.assign(triangle_count, 0);
+
+    vector<uint32> cache;
+    vector<uint32> next_cache;
+    vector<uint32> result;
+    result.reserve(indices.size());
+    uint32 dead_end_cursor = 0;
+    int32 best = -1;
+    while (result.size() < indices.size()) {
+        // Nothing around the cache is left, continue from the next triangle in input order
+        if (best == -1) {
+            while (emitted[dead_end_cursor])
+                dead_end_cursor++;
+            best = dead_end_cursor;
+        }
+
+        uint32 triangle = best;
+        emitted[triangle] = 1;
+        next_cache.clear();
+        for (uint32 k = 0; k < 3; k++) {
+            uint32 v = indices[triangle * 3 + k];
+            result.push_back(v);
+            if (std::find(next_cache.begin(), next_cache.end(), v) == next_cache.end())
+                next_cache.push_back(v);
+
+            uint32 begin = offsets[v];
+            uint32 end = begin + live[v];
+            for (uint32 a = begin; a < end; a++) {
+                if (adjacency[a] == triangle) {
+                    std::swap(adjacency[a], adjacency[end - 1]);
+                    break;
+                }
+            }
+            live[v]--;
+        }
+        uint32 emitted_vertices = next_cache.size();
+        for (uint32 v : cache) {
+            if (std::find(next_cache.begin(), next_cache.begin() + emitted_vertices, v) == next_cache.begin() + emitted_vertices)
+                next_cache.push_back(v);
+        }
+
+        // Vertices pushed past the end lose their cache score along with everything else that moved
+        for (uint32 i = 0; i < next_cache.size(); i++) {
+            uint32 v = next_cache[i];
+            float new_score = vertex_score(i < forsyth_cache_size ? int32(i) : -1, live[v]);
+            float delta = new_score - scores[v];
+            scores[v] = new_score;
+            for (uint32 a = offsets[v]; a < offsets[v] + live[v]; a++)
+                triangle_scores[adjacency[a]] += delta;
+        }
+        best = -1;
+        float best_score = -1.0f;
+        for (uint32 v : next_cache) {
+            for (uint32 a = offsets[v]; a < offsets[v] + live[v]; a++) {
+                uint32 t = adjacency[a];
+                if (triangle_scores[t] > best_score) {
+                    best = t;
+                    best_score = triangle_scores[t];
+                }
+            }
+        }
+
+        if (next_cache.size() > forsyth_cache_size)
+            next_cache.resize(forsyth_cache_size);
+        std::swap(cache, next_cache);
+    }
+    indices = std::move(result);
+}
+
+void optimize_overdraw(vector<uint32>& indices, const vector<v3>& positions, const vector<v3>& normals, float threshold) {
+    ZoneScoped;
+    constexpr uint32 cache_size = 16;
+    constexpr uint32 min_cluster_size = 8;
+    uint32 triangle_count = indices.size() / 3;
+    if (triangle_count < min_cluster_size * 2)
+        return;
+
+    vector<uint32> timestamps;
+    timestamps.assign(positions.size(), 0);
+    uint32 time = cache_size + 1;
+    auto triangle_misses = [&](uint32 t) {
+        uint32 misses = 0;
+        for (uint32 k = 0; k < 3; k++) {
+            uint32 index = indices[t * 3 + k];
+            if (time - timestamps[index] > cache_size) {
+                timestamps[index] = time++;
+                misses++;
+            }
+        }
+        return misses;
+    };
+    auto flush = [&] { time += cache_size + 1; };
+
+    // Hard boundaries are where the cache is already cold, so starting a cluster there costs nothing
+    vector<uint32> hard_boundaries;
+    for (uint32 t = 0; t < triangle_count; t++) {
+        if (triangle_misses(t) == 3 || t == 0)
+            hard_boundaries.push_back(t);
+    }
+    hard_boundaries.push_back(triangle_count);
+
+    // Soft boundaries split a cluster wherever restarting the cache keeps the run within threshold of its ACMR
+    vector<uint32> boundaries;
+    for (uint32 h = 0; h + 1 < hard_boundaries.size(); h++) {
+        uint32 cluster_start = hard_boundaries[h];
+        uint32 cluster_end = hard_boundaries[h + 1];
+        flush();
+        uint32 cluster_misses = 0;
+        for (uint32 t = cluster_start; t < cluster_end; t++)
+            cluster_misses += triangle_misses(t);
+        float cluster_acmr = float(cluster_misses) / float(cluster_end - cluster_start);
+
+        flush();
+        boundaries.push_back(cluster_start);
+        uint32 start = cluster_start;
+        uint32 misses = 0;
+        for (uint32 t = cluster_start; t < cluster_end; t++) {
+            misses += triangle_misses(t);
+            uint32 count = t + 1 - start;
+            if (t + 1 < cluster_end && count >= min_cluster_size && float(misses) / float(count) <= cluster_acmr * threshold) {
+                boundaries.push_back(t + 1);
+                start = t + 1;
+                misses = 0;
+                flush();
+            }
+        }
+    }
+    boundaries.push_back(triangle_count);
+    if (boundaries.size() < 3)
+        return;
+
+    v3 mesh_center = v3(0.0f);
+    for (const v3& position : positions)
+        mesh_center += position;
+    mesh_center = mesh_center / float(std::max(positions.size(), size_t(1)));
+
+    // Clusters facing away from the center are drawn first, they tend to occlude the rest
+    struct Cluster {
+        uint32 start;
+        uint32 end;
+        float  sort_key;
+    };
+    vector<Cluster> clusters;
+    for (uint32 c = 0; c + 1 < boundaries.size(); c++) {
+        Cluster cluster = {boundaries[c], boundaries[c + 1], 0.0f};
+        v3 centroid = v3(0.0f);
+        v3 normal = v3(0.0f);
+        for (uint32 t = cluster.start; t < cluster.end; t++) {
+            for (uint32 k = 0; k < 3; k++) {
+                centroid += positions[indices[t * 3 + k]];
+                normal += normals[indices[t * 3 + k]];
+            }
+        }
+        centroid = centroid / float((cluster.end - cluster.start) * 3);
+        if (math::length(normal) > 0.0f)
+            cluster.sort_key = math::dot(centroid - mesh_center, math::normalize(normal));
+        clusters.push_back(cluster);
+    }
+    std::stable_sort(clusters.begin(), clusters.end(), [](const Cluster& a, const Cluster& b) {
+        return a.sort_key > b.sort_key;
+    });
+
+    vector<uint32> sorted;
+    sorted.reserve(indices.size());
+    for (const Cluster& cluster : clusters)
+        sorted.insert(sorted.end(), indices.begin() + cluster.start * 3, indices.begin() + cluster.end * 3);
+    float cache_acmr = analyze_vertex_cache(indices, positions.size(), cache_size).acmr;
+    float sorted_acmr = analyze_vertex_cache(sorted, positions.size(), cache_size).acmr;
+    if (sorted_acmr <= cache_acmr * threshold)
+        indices = std::move(sorted);
+}
+
+vector<uint32> optimize_vertex_fetch(vector<uint32>& indices, uint32 vertex_count) {
+    ZoneScoped;
+    vector<uint32> remap;
+    remap.assign(vertex_count, UINT32_MAX);
+    uint32 next = 0;
+    for (uint32& index : indices) {
+        if (remap[index] == UINT32_MAX)
+            remap[index] = next++;
+        index = remap[index];
+    }
+    return remap;
+}
+
+MeshOptimizeStats optimize_mesh(MeshCPU& mesh_cpu, bool overdraw) {
+    ZoneScoped;
+    bool packed = mesh_cpu.layout == VertexLayout_Packed;
+    uint32 vertex_count = packed ? mesh_cpu.packed_vertices.size() : mesh_cpu.vertices.size();
+
+    MeshOptimizeStats stats;
+    stats.before = analyze_vertex_cache(mesh_cpu.indices, vertex_count);
+    optimize_vertex_cache(mesh_cpu.indices, vertex_count);
+    if (overdraw) {
+        vector<v3> positions;
+        vector<v3> normals;
+        positions.reserve(vertex_count);
+        normals.reserve(vertex_count);
+        for (uint32 i = 0; i < vertex_count; i++) {
+            Vertex vertex = packed ? unpack_vertex(mesh_cpu.packed_vertices[i]) : mesh_cpu.vertices[i];
+            positions.push_back(vertex.position);
+            normals.push_back(vertex.normal);
+        }
+        optimize_overdraw(mesh_cpu.indices, positions, normals);
+    }
+    vector<uint32> remap = optimize_vertex_fetch(mesh_cpu.indices, vertex_count);
+    if (packed)
+        remap_vertices(mesh_cpu.packed_vertices, remap);
+    else
+        remap_vertices(mesh_cpu.vertices, remap);
+    stats.after = analyze_vertex_cache(mesh_cpu.indices, packed ? mesh_cpu.packed_vertices.size() : mesh_cpu.vertices.size());
+    return stats;
+}
+
+// Compares triangles by the bytes of their vertices, rotations that keep the winding are equal
+template <typename V>
+static bool same_triangles(const vector<uint32>& indices_a, const vector<V>& vertices_a, const vector<uint32>& indices_b, const vector<V>& vertices_b) {
+    auto triangle_keys = [](const vector<uint32>& indices, const vector<V>& vertices) {
+        vector<string> keys;
+        keys.reserve(indices.size() / 3);
+        for (uint32 t = 0; t < indices.size() / 3; t++) {
+            const V* corners[3] = {&vertices[indices[t * 3 + 0]], &vertices[indices[t * 3 + 1]], &vertices[indices[t * 3 + 2]]};
+            uint32 first = 0;
+            for (uint32 k = 1; k < 3; k++) {
+                if (memcmp(corners[k], corners[first], sizeof(V)) < 0)
+                    first = k;
+            }
+            string key;
+            for (uint32 k = 0; k < 3; k++)
+                key.append((const char*) corners[(first + k) % 3], sizeof(V));
+            keys.push_back(std::move(key));
+        }
+        std::sort(keys.begin(), keys.end());
+        return keys;
+    };
+    if (indices_a.size() != indices_b.size())
+        return false;
+    vector<string> keys_a = triangle_keys(indices_a, vertices_a);
+    vector<string> keys_b = triangle_keys(indices_b, vertices_b);
+    return std::equal(keys_a.begin(), keys_a.end(), keys_b.begin());
+}
+
+static bool same_triangles(const MeshCPU& a, const MeshCPU& b) {
+    if (a.layout == VertexLayout_Packed)
+        return same_triangles(a.indices, a.packed_vertices, b.indices, b.packed_vertices);
+    return same_triangles(a.indices, a.vertices, b.indices, b.vertices);
+}
+
+string verify_mesh_optimizer(int overdraw) {
+    string report;
+    uint32 mesh_count = 0;
+    uint32 changed = 0;
+    auto check = [&](const string& name, MeshCPU& mesh_cpu) {
+        MeshCPU original = mesh_cpu;
+        MeshOptimizeStats stats = optimize_mesh(mesh_cpu, overdraw != 0);
+        bool same = same_triangles(original, mesh_cpu);
+        mesh_count++;
+        changed += !same;
+        report += fmt_("{}: ACMR {:.3f} -> {:.3f}, ATVR {:.3f} -> {:.3f}{}\n", name,
+            stats.before.acmr, stats.after.acmr, stats.before.atvr, stats.after.atvr, same ? "" : ", GEOMETRY CHANGED");
+    };
+
+    // A shuffled grid so there's always something with a known bad order
+    constexpr uint32 grid_size = 64;
+    MeshCPU grid;
+    for (uint32 y = 0; y <= grid_size; y++) {
+        for (uint32 x = 0; x <= grid_size; x++) {
+            Vertex vertex;
+            vertex.position = v3(x, y, math::random_float(0.1f));
+            vertex.normal = v3(0.0f, 0.0f, 1.0f);
+            vertex.uv = v2(x, y) / float(grid_size);
+            grid.vertices.push_back(vertex);
+        }
+    }
+    vector<uint32> quads;
+    for (uint32 i = 0; i < grid_size * grid_size; i++)
+        quads.push_back(i);
+    for (uint32 i = quads.size() - 1; i > 0; i--)
+        std::swap(quads[i], quads[math::random_int32(i + 1)]);
+    for (uint32 quad : quads) {
+        uint32 corner = quad / grid_size * (grid_size + 1) + quad % grid_size;
+        for (uint32 offset : {0u, grid_size + 1, 1u, 1u, grid_size + 1, grid_size + 2})
+            grid.indices.push_back(corner + offset);
+    }
+    check("shuffled grid", grid);
+
+    for (const auto& entry : fs::recursive_directory_iterator(get_resource_folder().abs_path())) {
+        if (entry.path().extension().string() != MeshCPU::extension())
+            continue;
+        MeshCPU mesh_cpu = load_mesh(FilePath(entry.path()));
+        check(entry.path().stem().string(), mesh_cpu);
+    }
+
+    report += fmt_("{} meshes, {} with changed geometry", mesh_count, changed);
+    return report;
+}
+
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include "general/string.hpp"
+#include "general/vector.hpp"
+#include "general/math/geometry.hpp"
+
+namespace spellbook {
+
+struct MeshCPU;
+
+struct VertexCacheStats {
+    // Transformed vertices per triangle and per unique vertex
+    float acmr = 0.0f;
+    float atvr = 0.0f;
+};
+
+struct MeshOptimizeStats {
+    VertexCacheStats before;
+    VertexCacheStats after;
+};
+
+// Simulates a FIFO post transform cache
+VertexCacheStats analyze_vertex_cache(const vector<uint32>& indices, uint32 vertex_count, uint32 cache_size = 16);
+
+// Reorders triangles for post transform cache hits with Forsyth's linear speed scoring
+void optimize_vertex_cache(vector<uint32>& indices, uint32 vertex_count);
+// Sorts runs of triangles that start with a cold cache so outward facing runs draw first, kept only if the ACMR
+// stays within threshold of the cache optimized order
+void optimize_overdraw(vector<uint32>& indices, const vector<v3>& positions, const vector<v3>& normals, float threshold = 1.05f);
+// Renumbers vertices in first use order and rewrites the indices, returns old to new with UINT32_MAX for unused vertices
+vector<uint32> optimize_vertex_fetch(vector<uint32>& indices, uint32 vertex_count);
+
+template <typename V>
+void remap_vertices(vector<V>& vertices, const vector<uint32>& remap) {
+    uint32 used = 0;
+    for (uint32 new_index : remap)
+        used += new_index != UINT32_MAX;
+    vector<V> remapped;
+    remapped.resize(used);
+    for (uint32 i = 0; i < remap.size(); i++) {
+        if (remap[i] != UINT32_MAX)
+            remapped[remap[i]] = vertices[i];
+    }
+    vertices = std::move(remapped);
+}
+
+// Runs all the passes on either vertex layout, triangles and vertex values are only reordered
+MeshOptimizeStats optimize_mesh(MeshCPU& mesh_cpu, bool overdraw = true);
+
+// Optimizes a shuffled grid and every mesh in the resource folder in memory, reporting the cache stats and checking
+// the triangles are unchanged. overdraw toggles the overdraw pass to compare its cache cost.
+string verify_mesh_optimizer(int overdraw);
+
+}
@@ -15,7 +15,9 @@
 #include "renderer/renderable.hpp"
 #include "renderer/render_scene.hpp"
 #include "renderer/gpu_asset_cache.hpp"
+#include "renderer/assets/asset_container.hpp"
 #include "renderer/assets/mesh.hpp"
+#include "renderer/assets/mesh_optimizer.hpp"
 #include "renderer/assets/material.hpp"
 #include "renderer/assets/skeleton.hpp"
 
@@ -181,10 +183,13 @@ vector<StaticRenderable*> instance_static_model(RenderScene& render_scene, const
         get_gpu_asset_cache().paths[mesh_id] = node.mesh_asset_path;
         get_gpu_asset_cache().paths[material_id] = node.material_asset_path;
 
-        get_gpu_asset_cache().get_mesh_or_upload(mesh_id);
-        get_gpu_asset_cache().get_material_or_upload(material_id);
+        // Headless scenes only keep the ids, requesting would bring up the renderer and the loader threads
+        if (!render_scene.headless) {
+            get_gpu_asset_cache().get_mesh_or_upload(mesh_id);
+            get_gpu_asset_cache().get_material_or_upload(material_id);
+        }
 
-        renderables.push_back(&*render_scene.static_renderables.emplace(StaticRenderable{
+        renderables.push_back(render_scene.add_static_renderable(StaticRenderable{
             mesh_id,
             material_id
         }));
@@ -193,30 +198,126 @@ vector<StaticRenderable*> instance_static_model(RenderScene& render_scene, const
     return renderables;
 }
 
-template<>
-bool save_resource(const ModelCPU& model) {
-    json j;
-    j["dependencies"] = make_shared<json_value>(to_jv(model.dependencies));
-    j["root_node"] = make_shared<json_value>(to_jv(model.root_node));
+constexpr uint32 model_section_info         = section_tag("INFO");
+constexpr uint32 model_section_nodes        = section_tag("NODE");
+constexpr uint32 model_section_children     = section_tag("CHLD");
+constexpr uint32 model_section_dependencies = section_tag("DEPS");
+constexpr uint32 model_section_strings      = section_tag("STRS");
 
-    vector<json_value> json_nodes;
+struct ModelContainerInfo {
+    uint64          root_node = 0;
+    ContainerString skeleton  = {};
+};
+
+struct ModelContainerNode {
+    uint64          id            = 0;
+    uint64          parent        = 0;
+    ContainerString name          = {};
+    ContainerString mesh_path     = {};
+    ContainerString material_path = {};
+    uint32          first_child   = 0;
+    uint32          child_count   = 0;
+    m44             transform     = {};
+};
+
+static bool _save_model_container(const ModelCPU& model) {
+    ContainerStrings strings;
+    ModelContainerInfo info;
+    info.root_node = model.root_node.id;
+    if (model.skeleton && model.skeleton->prefab)
+        info.skeleton = strings.add(model.skeleton->prefab->file_path.rel_string());
+
+    vector<ContainerString> dependencies;
+    for (const FilePath& dependency : model.dependencies)
+        dependencies.push_back(strings.add(dependency.rel_string()));
+
+    vector<ModelContainerNode> nodes;
+    vector<uint64> children;
     for (id_ptr<ModelCPU::Node> node : model.nodes) {
-        json_nodes.push_back(to_jv_full(node));
+        ModelContainerNode& record = nodes.emplace_back();
+        record.id            = node.id;
+        record.parent        = node->parent.id;
+        record.name          = strings.add(node->name);
+        record.mesh_path     = strings.add(node->mesh_asset_path.rel_string());
+        record.material_path = strings.add(node->material_asset_path.rel_string());
+        record.first_child   = children.size();
+        record.child_count   = node->children.size();
+        record.transform     = node->transform;
+        for (id_ptr<ModelCPU::Node> child : node->children)
+            children.push_back(child.id);
+    }
+
+    AssetContainerWriter writer;
+    writer.add_struct(model_section_info, info);
+    writer.add(model_section_nodes, nodes, true);
+    writer.add(model_section_children, children, true);
+    writer.add(model_section_dependencies, dependencies, true);
+    writer.add(model_section_strings, strings.blob, true);
+    return writer.save(model.file_path);
+}
+
+// Nodes get fresh ids so a model loaded twice doesn't collide with itself
+static bool _load_model_container(const AssetContainer& container, ModelCPU& model) {
+    ContainerStrings strings;
+    ModelContainerInfo info;
+    vector<ModelContainerNode> nodes;
+    vector<uint64> children;
+    vector<ContainerString> dependencies;
+    bool read = container.read_struct(model_section_info, info) &&
+        container.read(model_section_nodes, nodes) &&
+        container.read(model_section_children, children) &&
+        container.read(model_section_dependencies, dependencies) &&
+        container.read(model_section_strings, strings.blob);
+    if (!read)
+        return false;
+
+    for (ContainerString dependency : dependencies)
+        model.dependencies.push_back(FilePath(string(strings.get(dependency))));
+
+    umap<uint64, uint64> old_to_new;
+    for (const ModelContainerNode& record : nodes) {
+        id_ptr<ModelCPU::Node> node = id_ptr<ModelCPU::Node>::emplace();
+        node->name                = string(strings.get(record.name));
+        node->mesh_asset_path     = FilePath(string(strings.get(record.mesh_path)));
+        node->material_asset_path = FilePath(string(strings.get(record.material_path)));
+        node->transform           = record.transform;
+        old_to_new[record.id]     = node.id;
+        model.nodes.push_back(node);
+    }
+    for (uint32 i = 0; i < nodes.size(); i++) {
+        const ModelContainerNode& record = nodes[i];
+        id_ptr<ModelCPU::Node> node = model.nodes[i];
+        if (record.parent != 0)
+            node->parent.id = old_to_new[record.parent];
+        for (uint32 c = record.first_child; c < record.first_child + record.child_count && c < children.size(); c++) {
+            id_ptr<ModelCPU::Node> child = id_ptr<ModelCPU::Node>::null();
+            child.id = old_to_new[children[c]];
+            node->children.push_back(child);
+        }
     }
-    j["nodes"] = make_shared<json_value>(to_jv(json_nodes));
+    if (info.root_node != 0)
+        model.root_node.id = old_to_new[info.root_node];
+
+    if (info.skeleton.length > 0) {
+        model.skeleton = std::make_unique<SkeletonCPU>(instance_prefab(
+            load_resource<SkeletonPrefab>(FilePath(string(strings.get(info.skeleton))), true)
+        ));
+    }
+    return true;
+}
+
+template<>
+bool save_resource(const ModelCPU& model) {
     if (model.skeleton) {
-        if (model.skeleton->prefab) {
+        if (model.skeleton->prefab)
             save_resource<SkeletonPrefab>(*model.skeleton->prefab);
-            j["skeleton"] = make_shared<json_value>(to_jv(model.skeleton->prefab->file_path));
-        }
     }
     
     string ext = model.file_path.rel_path().extension().string();
     assert_else(ext == ModelCPU::extension())
         return false;
     
-    file_dump(j, model.file_path.abs_string());
-    return true;
+    return _save_model_container(model);
 }
 
 template<>
@@ -238,30 +339,38 @@ ModelCPU& load_resource(const FilePath& input_path, bool assert_exists, bool cle
             return model;
     }
 
-    json& j = get_file_cache().load_json(input_path);
     model.file_path = input_path;
-    model.dependencies = get_file_cache().load_dependencies(j);
-    
-    if (j.contains("nodes")) {
-        for (const json_value& jv : j["nodes"]->get_list()) {
-            id_ptr<ModelCPU::Node> node = from_jv_impl(jv, (id_ptr<ModelCPU::Node>*) 0);
-            model.nodes.push_back(node);
+    AssetContainer container;
+    if (container.open(input_path)) {
+        if (!_load_model_container(container, model))
+            log_error(fmt_("Couldn't read model {}", input_path.rel_string()));
+    } else {
+        json& j = get_file_cache().load_json(input_path);
+        model.dependencies = get_file_cache().load_dependencies(j);
+        
+        if (j.contains("nodes")) {
+            for (const json_value& jv : j["nodes"]->get_list()) {
+                id_ptr<ModelCPU::Node> node = from_jv_impl(jv, (id_ptr<ModelCPU::Node>*) 0);
+                model.nodes.push_back(node);
+            }
+        }
+        
+        if (j.contains("root_node"))
+            model.root_node = from_jv<id_ptr<ModelCPU::Node>>(*j["root_node"]);
+
+        if (j.contains("skeleton")) {
+            model.skeleton = std::make_unique<SkeletonCPU>(instance_prefab(
+                load_resource<SkeletonPrefab>(from_jv<FilePath>(*j["skeleton"]), true)
+            ));
         }
     }
-    
-    if (j.contains("root_node"))
-        model.root_node = from_jv<id_ptr<ModelCPU::Node>>(*j["root_node"]);
 
     if (model.root_node.id == 0)
         for (auto node : model.nodes)
             if (!node->parent.valid())
                 model.root_node = node;
-
-    if (j.contains("skeleton")) {
-        model.skeleton = std::make_unique<SkeletonCPU>(instance_prefab(
-            load_resource<SkeletonPrefab>(from_jv<FilePath>(*j["skeleton"]), true)
-        ));
-    }
+    if (!model.root_node.valid())
+        return model;
     model.root_node->cache_transform();
     
     return model;
@@ -945,6 +1054,9 @@ bool _convert_gltf_meshes(tinygltf::Model& model, const FilePath& output_folder)
             if (math::length(mesh_cpu.vertices.back().tangent) < 0.1f) {
                 mesh_cpu.fix_tangents();
             }
+            optimize_mesh(mesh_cpu);
+            // Falls back to the full layout if any vertex would lose too much
+            mesh_cpu.pack();
             
             save_mesh(mesh_cpu);
         }
@@ -990,6 +1102,7 @@ bool _convert_gltf_materials(tinygltf::Model& model, const FilePath& output_fold
                 format,
                 vector<uint8>(&*baseImage.image.begin(), &*baseImage.image.begin() + baseImage.image.size())
             };
+            compress_texture(texture_cpu, texture_files[i] == &material_cpu.normal_asset_path ? TextureCompression_BC5 : TextureCompression_BC7);
             save_texture(texture_cpu);
             *texture_files[i] = texture_cpu.file_path;
         }
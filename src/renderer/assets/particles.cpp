@@ -18,13 +18,13 @@ void setup_emitter() {
     if (!setup) {
         {
             vuk::PipelineBaseCreateInfo pci;
-            pci.add_glsl(get_contents("shaders/particle_emitter.comp"_distributed), "shaders/particle_emitter.comp"_distributed.abs_string());
+            get_renderer().add_shader(pci, "shaders/particle_emitter.comp"_distributed);
             get_renderer().context->create_named_pipeline("emitter", pci);
         }
         {
             vuk::PipelineBaseCreateInfo pci;
-            pci.add_glsl(get_contents("shaders/particle.vert"_distributed), "shaders/particle.vert"_distributed.abs_string());
-            pci.add_glsl(get_contents("shaders/textured_3d.frag"_distributed), "shaders/textured_3d.frag"_distributed.abs_string());
+            get_renderer().add_shader(pci, "shaders/particle.vert"_distributed);
+            get_renderer().add_shader(pci, "shaders/textured_3d.frag"_distributed);
             get_renderer().context->create_named_pipeline("particle", pci);
         }
 
@@ -44,9 +44,12 @@ EmitterGPU& instance_emitter(RenderScene& scene, const EmitterCPU& emitter_cpu,
     EmitterGPU emitter;
     uint64 mat_id = hash_path(emitter_cpu.material);
     get_gpu_asset_cache().paths[mat_id] = emitter_cpu.material;
-    assert_else(get_gpu_asset_cache().materials.contains(mat_id));
-    get_gpu_asset_cache().materials.at(mat_id).pipeline = get_renderer().context->get_named_pipeline("particle");
-    assert_else(get_gpu_asset_cache().materials.at(mat_id).pipeline != nullptr);
+    MaterialGPU* material = get_gpu_asset_cache().get_material(mat_id);
+    assert_else(material != nullptr);
+    material->pipeline = get_renderer().context->get_named_pipeline("particle");
+    assert_else(material->pipeline != nullptr);
+    // A reload would lose the particle pipeline
+    get_gpu_asset_cache().pinned.insert(mat_id);
     emitter.update_from_cpu(emitter_cpu, current_time);
     
     return *scene.emitters.emplace(std::move(emitter));
@@ -137,8 +140,7 @@ void EmitterGPU::update_color() {
 
     uint64 tex_id = hash_path(color_texture.file_path);
     get_gpu_asset_cache().paths[tex_id] = color_texture.file_path;
-    if (get_gpu_asset_cache().textures.contains(tex_id))
-        get_gpu_asset_cache().textures.erase(tex_id);
+    get_gpu_asset_cache().erase_texture(tex_id);
     upload_texture(color_texture);
     color = {color_texture.file_path, Sampler().address(Address_Clamp)};
 }
@@ -224,8 +226,10 @@ void render_particles(EmitterGPU& emitter, vuk::CommandBuffer& command_buffer) {
 
     uint64 tex_id = hash_path(emitter.color.texture);
     get_gpu_asset_cache().paths[tex_id] = emitter.color.texture;
-    TextureGPU& tex = get_gpu_asset_cache().textures[tex_id];
-    command_buffer.bind_image(0, SPARE_BINDING_1, tex.value.view.get()).bind_sampler(0, SPARE_BINDING_1, emitter.color.sampler.get());
+    TextureGPU* tex = get_gpu_asset_cache().get_texture(tex_id);
+    if (tex == nullptr)
+        return;
+    command_buffer.bind_image(0, SPARE_BINDING_1, tex->value.view.get()).bind_sampler(0, SPARE_BINDING_1, emitter.color.sampler.get());
     material->bind_parameters(command_buffer);
     material->bind_textures(command_buffer);
     command_buffer.draw_indexed(mesh->index_count, emitter.settings.max_particles, 0, 0, 0);
@@ -1,8 +1,7 @@
 #include "skeleton.hpp"
 
+#include <chrono>
 #include <tracy/Tracy.hpp>
-#include <vuk/Buffer.hpp>
-#include <vuk/AllocatorHelpers.hpp>
 #include <imgui/imgui.h>
 #include <imgui/misc/cpp/imgui_stdlib.h>
 #include <magic_enum.hpp>
@@ -43,8 +42,11 @@ void apply_constraints(IKTarget ik) {
     }
 
     apply_constraints(points, lengths);
-    
-    for (int32 i = 0; i < bones.size(); i++) {
+    set_ik_transforms(bones.data(), points.data(), bones.size());
+}
+
+void set_ik_transforms(Bone** bones, const v3* points, uint32 bone_count) {
+    for (uint32 i = 0; i < bone_count; i++) {
         bool use_z_up = i == 0 || math::dot(math::normalize(points[i] - points[i-1]), math::normalize(points[i+1] - points[i])) > 0.99f;
         bones[i]->ik_transform = math::look_ik(points[i], points[i+1] - points[i], !use_z_up ? math::normalize(points[i] - points[i-1]) : v3(0.0f, 0.0f, 1.0f));
         bones[i]->ik_set_this_frame = true;
@@ -89,6 +91,271 @@ void apply_constraints(vector<v3>& points, const vector<float>& lengths) {
     }
 }
 
+void IKChains::clear() {
+    origins.clear();
+    directions.clear();
+    point_counts.clear();
+    iterations.clear();
+    warm_starts.clear();
+    x.clear();
+    y.clear();
+    in_x.clear();
+    in_y.clear();
+    lengths.clear();
+    bones.clear();
+    count = 0;
+}
+
+uint32 IKChains::add(const v3* points, const float* chain_lengths, uint32 point_count, IKWarmStart* warm_start) {
+    assert_else(point_count >= 2 && point_count <= max_ik_points)
+        return UINT32_MAX;
+    uint32 chain = count++;
+    uint32 base = chain * max_ik_points;
+    uint32 size = base + max_ik_points;
+    x.resize(size);
+    y.resize(size);
+    in_x.resize(size);
+    in_y.resize(size);
+    lengths.resize(size);
+    bones.resize(size, nullptr);
+
+    v2 direction = math::normalize((points[point_count - 1] - points[0]).xy);
+    origins.push_back(points[0]);
+    directions.push_back(direction);
+    point_counts.push_back(point_count);
+    iterations.push_back(0);
+    warm_starts.push_back(warm_start);
+
+    bool warm = warm_start != nullptr && warm_start->count == point_count;
+    for (uint32 i = 0; i < point_count; i++) {
+        v2 point = v2(math::dot(points[i].xy - points[0].xy, direction), points[i].z);
+        // The root and target always come from this frame
+        if (warm && i > 0 && i + 1 < point_count)
+            point = warm_start->points[i];
+        x[base + i] = point.x;
+        y[base + i] = point.y;
+        if (i + 1 < point_count)
+            lengths[base + i] = chain_lengths[i];
+    }
+    return chain;
+}
+
+uint32 IKChains::add(const IKTarget& ik, IKWarmStart* warm_start) {
+    assert_else(ik.length > 0 && ik.length < max_ik_points)
+        return UINT32_MAX;
+    v3 points[max_ik_points];
+    float chain_lengths[max_ik_points];
+    Bone* chain_bones[max_ik_points];
+    Bone* current = ik.source;
+    points[ik.length] = ik.target;
+    for (int32 i = ik.length - 1; i >= 0; i--) {
+        points[i] = current->calculate_position();
+        chain_bones[i] = current;
+        chain_lengths[i] = current->length;
+        current = current->parent;
+    }
+
+    uint32 chain = add(points, chain_lengths, ik.length + 1, warm_start);
+    if (chain != UINT32_MAX) {
+        for (int32 i = 0; i < ik.length; i++)
+            bones[chain * max_ik_points + i] = chain_bones[i];
+    }
+    return chain;
+}
+
+// Same passes as apply_constraints, x/y start as the initial guess and are solved in place
+void IKChains::_solve_chain(uint32 chain) {
+    uint32 base = chain * max_ik_points;
+    uint32 n = point_counts[chain];
+    float* out_x = &x[base];
+    float* out_y = &y[base];
+    float* back_x = &in_x[base];
+    float* back_y = &in_y[base];
+    const float* chain_lengths = &lengths[base];
+    v2 target = v2(out_x[n - 1], out_y[n - 1]);
+
+    float previous_error = FLT_MAX;
+    uint32 iter_idx = 0;
+    for (; iter_idx < max_iterations; iter_idx++) {
+        for (uint32 i = 1; i < n; i++) {
+            v2 p1 = v2(out_x[i-1], out_y[i-1]);
+            v2 p2 = i + 1 == n ? target : iter_idx == 0 ? v2(out_x[i], out_y[i]) : v2(back_x[i], back_y[i]);
+            v2 out = constr(p1, p2, chain_lengths[i-1]);
+            out_x[i] = out.x;
+            out_y[i] = out.y;
+        }
+        // Either reached, or out of reach and no longer straightening
+        float error = math::length(v2(out_x[n - 1], out_y[n - 1]) - target);
+        if (error < tolerance || math::abs(previous_error - error) < tolerance * 0.1f || iter_idx + 1 == max_iterations)
+            break;
+        previous_error = error;
+
+        for (uint32 i = n - 2; i > 0; i--) {
+            v2 p1 = i == n - 2 ? target : v2(back_x[i+1], back_y[i+1]);
+            v2 in = constr(p1, v2(out_x[i], out_y[i]), chain_lengths[i]);
+            back_x[i] = in.x;
+            back_y[i] = in.y;
+        }
+    }
+    iterations[chain] = iter_idx + 1;
+}
+
+void IKChains::solve() {
+    ZoneScoped;
+    for (uint32 chain = 0; chain < count; chain++)
+        _solve_chain(chain);
+
+    v3 points[max_ik_points];
+    for (uint32 chain = 0; chain < count; chain++) {
+        uint32 base = chain * max_ik_points;
+        uint32 n = point_counts[chain];
+        if (IKWarmStart* warm_start = warm_starts[chain]) {
+            warm_start->count = n;
+            for (uint32 i = 0; i < n; i++)
+                warm_start->points[i] = v2(x[base + i], y[base + i]);
+        }
+        if (bones[base] != nullptr) {
+            get_points(chain, points);
+            set_ik_transforms(&bones[base], points, n - 1);
+        }
+    }
+}
+
+void IKChains::get_points(uint32 chain, v3* points) const {
+    uint32 base = chain * max_ik_points;
+    v3 origin = origins[chain];
+    v2 direction = directions[chain];
+    points[0] = origin;
+    for (uint32 i = 1; i < point_counts[chain]; i++)
+        points[i] = v3(origin.xy, 0.0f) + v3(direction, 0.0f) * x[base + i] + v3(0.0f, 0.0f, 1.0f) * y[base + i];
+}
+
+void inspect(IKChains* chains) {
+    ImGui::DragFloat("Tolerance", &chains->tolerance, 0.0001f, 0.0f, 0.1f, "%.4f");
+    int max_iterations = chains->max_iterations;
+    if (ImGui::DragInt("Max Iterations", &max_iterations, 1.0f, 1, 1000))
+        chains->max_iterations = max_iterations;
+    uint32 total = 0;
+    for (uint32 chain = 0; chain < chains->count; chain++)
+        total += chains->iterations[chain];
+    ImGui::Text("Chains: %u", chains->count);
+    ImGui::Text("Average iterations: %.1f", chains->count > 0 ? float(total) / chains->count : 0.0f);
+}
+
+// Chains of up to 7 bones reaching for a target that's sometimes out of reach
+static void random_chain(vector<v3>& points, vector<float>& lengths) {
+    uint32 bone_count = 1 + math::random_int32(max_ik_points - 1);
+    points.resize(bone_count + 1);
+    lengths.resize(bone_count);
+    points[0] = v3(math::random_float(1.0f), math::random_float(1.0f), 0.5f);
+    float reach = 0.0f;
+    for (uint32 i = 0; i < bone_count; i++) {
+        lengths[i] = 0.05f + math::random_float(0.15f);
+        reach += lengths[i];
+        points[i + 1] = points[i] + v3(math::random_float(0.1f) - 0.05f, math::random_float(0.1f) - 0.05f, -lengths[i] * 0.5f);
+    }
+    float angle = math::random_float(2.0f * math::PI);
+    float distance = reach * (0.2f + math::random_float(1.0f));
+    points.back() = points[0] + v3(math::cos(angle) * distance * 0.8f, math::sin(angle) * distance * 0.8f, -distance * 0.6f);
+}
+
+string verify_ik_chains(int chain_count, int trials) {
+    IKChains exact;
+    exact.tolerance = 0.0f;
+    IKChains early;
+    vector<vector<v3>> references;
+    vector<vector<v3>> inputs;
+    vector<float> lengths;
+    v3 points[max_ik_points];
+
+    uint32 exact_mismatches = 0;
+    float max_end_error = 0.0f;
+    float max_joint_error = 0.0f;
+    uint64 iterations = 0;
+    uint64 solved = 0;
+    for (int trial = 0; trial < trials; trial++) {
+        exact.clear();
+        early.clear();
+        references.resize(chain_count);
+        inputs.resize(chain_count);
+        for (int i = 0; i < chain_count; i++) {
+            random_chain(inputs[i], lengths);
+            references[i] = inputs[i];
+            apply_constraints(references[i], lengths);
+            exact.add(inputs[i].data(), lengths.data(), inputs[i].size());
+            early.add(inputs[i].data(), lengths.data(), inputs[i].size());
+        }
+        exact.solve();
+        early.solve();
+        for (int i = 0; i < chain_count; i++) {
+            exact.get_points(i, points);
+            for (uint32 j = 0; j < references[i].size(); j++)
+                if (math::length(points[j] - references[i][j]) > 0.0001f)
+                    exact_mismatches++;
+            // Joints keep drifting slightly after the end has converged, so they're reported separately
+            early.get_points(i, points);
+            for (uint32 j = 0; j + 1 < references[i].size(); j++)
+                max_joint_error = std::max(max_joint_error, math::length(points[j] - references[i][j]));
+            max_end_error = std::max(max_end_error, math::length(points[references[i].size() - 1] - references[i].back()));
+            iterations += early.iterations[i];
+            solved++;
+        }
+    }
+    return fmt_("{} trials of {} chains: {} exact mismatches, early out end within {:.5f} and joints within {:.3f} of the reference using {:.1f} iterations on average",
+        trials, chain_count, exact_mismatches, max_end_error, max_joint_error, double(iterations) / double(std::max(solved, uint64(1))));
+}
+
+string benchmark_ik(int spiders, int frames) {
+    using clock = std::chrono::steady_clock;
+    constexpr uint32 legs = 4;
+    auto ms = [](auto from, auto to) { return std::chrono::duration<double, std::milli>(to - from).count(); };
+
+    vector<vector<v3>> rest_poses;
+    vector<vector<float>> rest_lengths;
+    for (int i = 0; i < spiders * legs; i++) {
+        vector<v3> points;
+        vector<float> lengths;
+        do {
+            random_chain(points, lengths);
+        } while (points.size() != 4);
+        rest_poses.push_back(points);
+        rest_lengths.push_back(lengths);
+    }
+    auto target_at = [&](uint32 leg, int frame) {
+        return rest_poses[leg].back() + v3(0.05f * math::sin(0.1f * frame + leg), 0.05f * math::cos(0.1f * frame + leg), 0.0f);
+    };
+
+    auto t0 = clock::now();
+    for (int frame = 0; frame < frames; frame++) {
+        for (uint32 leg = 0; leg < rest_poses.size(); leg++) {
+            vector<v3> points = rest_poses[leg];
+            points.back() = target_at(leg, frame);
+            apply_constraints(points, rest_lengths[leg]);
+        }
+    }
+    auto t1 = clock::now();
+
+    IKChains chains;
+    vector<IKWarmStart> warm_starts(rest_poses.size());
+    uint64 iterations = 0;
+    v3 points[max_ik_points];
+    for (int frame = 0; frame < frames; frame++) {
+        chains.clear();
+        for (uint32 leg = 0; leg < rest_poses.size(); leg++) {
+            memcpy(points, rest_poses[leg].data(), sizeof(v3) * 4);
+            points[3] = target_at(leg, frame);
+            chains.add(points, rest_lengths[leg].data(), 4, &warm_starts[leg]);
+        }
+        chains.solve();
+        for (uint32 chain = 0; chain < chains.count; chain++)
+            iterations += chains.iterations[chain];
+    }
+    auto t2 = clock::now();
+
+    return fmt_("{} spiders, {} frames: one at a time {:.3f}ms/frame, batched {:.3f}ms/frame averaging {:.1f} iterations",
+        spiders, frames, ms(t0, t1) / frames, ms(t1, t2) / frames, double(iterations) / double(std::max(uint64(frames) * rest_poses.size(), uint64(1))));
+}
+
 SkeletonCPU instance_prefab(SkeletonPrefab& prefab) {
     umap<uint64, Bone*> bones;
     SkeletonCPU skeleton_cpu;
@@ -114,10 +381,7 @@ SkeletonCPU instance_prefab(SkeletonPrefab& prefab) {
 
 SkeletonGPU upload_skeleton(const SkeletonCPU& skeleton_cpu) {
     SkeletonGPU skeleton_gpu;
-    vuk::Allocator& alloc = *get_renderer().global_allocator;
-    uint32 alloc_size = sizeof(uint32) * 4 + sizeof(m44GPU) * skeleton_cpu.bones.size();
-
-    skeleton_gpu.buffer = *vuk::allocate_buffer(alloc, {vuk::MemoryUsage::eCPUtoGPU, alloc_size, 1});
+    skeleton_gpu.palette.resize(skeleton_cpu.bones.size(), m44GPU(m44::identity()));
     return skeleton_gpu;
 }
 
@@ -284,21 +548,12 @@ void SkeletonCPU::update() {
 }
 
 void SkeletonGPU::update(const SkeletonCPU& skeleton) {
-    vector<uint8> bones_data( sizeof(uint32) * 4 + sizeof(m44GPU) * skeleton.bones.size());
-    bones_data.append_data(skeleton.bones.size());
-    struct { uint32 a,b,c; } padding;
-    bones_data.append_data(padding);
-    for (const std::unique_ptr<Bone>& bone : skeleton.bones) {
-        bones_data.append_data(m44GPU(bone->ik_set_this_frame ? bone->final_ik_transform() : bone->final_transform()));
+    palette.resize(skeleton.bones.size());
+    for (uint32 i = 0; i < skeleton.bones.size(); i++) {
+        Bone* bone = skeleton.bones[i].get();
+        palette[i] = m44GPU(bone->ik_set_this_frame ? bone->final_ik_transform() : bone->final_transform());
         bone->ik_set_this_frame = false;
     }
-    memcpy(buffer->mapped_ptr, bones_data.data(), bones_data.size());
-}
-
-vuk::Unique<vuk::Buffer>* SkeletonGPU::empty_buffer() {
-    static SkeletonCPU empty_skeleton = {};
-    static SkeletonGPU skeleton_gpu = upload_skeleton(empty_skeleton);
-    return &skeleton_gpu.buffer;
 }
 
 
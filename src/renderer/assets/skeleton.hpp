@@ -112,10 +112,10 @@ struct SkeletonCPU {
     Bone* find_bone(const string& name);
 };
 
+// Bone palette written by the pose system, render scenes pack every palette into one shared buffer each frame
 struct SkeletonGPU {
-    vuk::Unique<vuk::Buffer> buffer = vuk::Unique<vuk::Buffer>();
+    vector<m44GPU> palette;
     
-    static vuk::Unique<vuk::Buffer>* empty_buffer();
     void update(const SkeletonCPU& skeleton);
 };
 
@@ -142,4 +142,54 @@ bool inspect(vector<AnimationFrame>* animation, int* load_pose);
 void apply_constraints(vector<v3>& points, const vector<float>& lengths);
 void apply_constraints(IKTarget ik);
 
+constexpr uint32 max_ik_points = 8;
+
+// Last 2D solution of a chain, kept by the chain's owner between solves
+struct IKWarmStart {
+    v2 points[max_ik_points];
+    uint8 count = 0;
+};
+
+// Chains solved together with the same planar FABRIK as apply_constraints, but stopping once the end is within
+// tolerance or has stalled. Points are stored chain-major with max_ik_points slots per chain, so nothing is
+// allocated once the batch has grown to its working size.
+struct IKChains {
+    float  tolerance      = 0.0005f;
+    uint32 max_iterations = 100;
+
+    // Per chain
+    vector<v3>           origins;
+    vector<v2>           directions;
+    vector<uint8>        point_counts;
+    vector<uint32>       iterations;
+    vector<IKWarmStart*> warm_starts;
+
+    // Per point, x is the distance along the chain's direction and y is the height
+    vector<float> x;
+    vector<float> y;
+    vector<float> in_x;
+    vector<float> in_y;
+    vector<float> lengths;
+    vector<Bone*> bones;
+    uint32 count = 0;
+
+    void   clear();
+    // lengths has point_count - 1 entries, the last point is the target
+    uint32 add(const v3* points, const float* lengths, uint32 point_count, IKWarmStart* warm_start = nullptr);
+    uint32 add(const IKTarget& ik, IKWarmStart* warm_start = nullptr);
+    // Solves every chain, then sets the ik transforms of chains added from an IKTarget
+    void   solve();
+    void   get_points(uint32 chain, v3* points) const;
+
+    void   _solve_chain(uint32 chain);
+};
+
+void set_ik_transforms(Bone** bones, const v3* points, uint32 bone_count);
+void inspect(IKChains* chains);
+
+// Compares IKChains against apply_constraints on random chains, headless
+string verify_ik_chains(int chains, int trials);
+// Solves 4 legs for each spider over frames of drifting targets, against solving them one at a time
+string benchmark_ik(int spiders, int frames);
+
 }
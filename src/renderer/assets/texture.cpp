@@ -3,29 +3,79 @@
 #include <vuk/Partials.hpp>
 #include <lz4/lz4.h>
 #include <stb_image.h>
+#include <tracy/Tracy.hpp>
 
+#include "extension/fmt.hpp"
 #include "general/logger.hpp"
 #include "general/file/file_cache.hpp"
 #include "renderer/gpu_asset_cache.hpp"
 #include "renderer/renderer.hpp"
+#include "renderer/assets/asset_container.hpp"
 
 namespace spellbook {
 
+// Copies precomputed levels as they are, block compressed textures can't be blitted for mips
+static vuk::Texture _upload_texture_levels(vuk::Allocator& alloc, const TextureCPU& tex_cpu) {
+    vuk::ImageCreateInfo ici;
+    ici.format        = tex_cpu.format;
+    ici.extent        = vuk::Extent3D(tex_cpu.size);
+    ici.samples       = vuk::Samples::e1;
+    ici.initialLayout = vuk::ImageLayout::eUndefined;
+    ici.tiling        = vuk::ImageTiling::eOptimal;
+    ici.usage         = vuk::ImageUsageFlagBits::eTransferDst | vuk::ImageUsageFlagBits::eSampled;
+    ici.mipLevels     = tex_cpu.mip_levels;
+    ici.arrayLayers   = 1;
+    vuk::Texture tex = alloc.get_context().allocate_texture(alloc, ici);
+
+    uint64 offset = 0;
+    for (uint32 level = 0; level < tex_cpu.mip_levels; level++) {
+        v2i level_size = texture_level_size(tex_cpu.size, level);
+        vuk::ImageAttachment attachment = vuk::ImageAttachment::from_texture(tex);
+        attachment.base_level  = level;
+        attachment.level_count = 1;
+        attachment.extent      = vuk::Dimension3D::absolute(level_size.x, level_size.y);
+        get_renderer().enqueue_setup(vuk::host_data_to_image(alloc, vuk::DomainFlagBits::eTransferOnTransfer, attachment, tex_cpu.pixels.data() + offset));
+        offset += texture_level_bsize(tex_cpu.format, level_size);
+    }
+    return tex;
+}
+
 FilePath upload_texture(const TextureCPU& tex_cpu, bool frame_allocation) {
     assert_else(tex_cpu.file_path.is_file());
     uint64 tex_cpu_hash = hash_path(tex_cpu.file_path);
     vuk::Allocator& alloc = frame_allocation ? *get_renderer().frame_allocator : *get_renderer().global_allocator;
-    auto [tex, tex_fut] = vuk::create_texture(alloc, tex_cpu.format, vuk::Extent3D(tex_cpu.size), (void*) tex_cpu.pixels.data(), tex_cpu.needs_mips);
+    vuk::Texture tex;
+    if (tex_cpu.mip_levels > 1 || is_block_compressed(tex_cpu.format)) {
+        tex = _upload_texture_levels(alloc, tex_cpu);
+    } else {
+        auto [created, tex_fut] = vuk::create_texture(alloc, tex_cpu.format, vuk::Extent3D(tex_cpu.size), (void*) tex_cpu.pixels.data(), tex_cpu.needs_mips);
+        tex = std::move(created);
+        get_renderer().enqueue_setup(std::move(tex_fut));
+    }
     get_renderer().context->set_name(tex, vuk::Name(tex_cpu.file_path.rel_string()));
-    get_renderer().enqueue_setup(std::move(tex_fut));
 
-    get_gpu_asset_cache().textures[tex_cpu_hash] = {std::move(tex), frame_allocation};
-    assert_else(get_gpu_asset_cache().textures[tex_cpu_hash].value.image->image != VK_NULL_HANDLE);
+    // Mips add a third on top of the base level
+    uint64 bsize = tex_cpu.pixels.bsize() + (tex_cpu.needs_mips ? tex_cpu.pixels.bsize() / 3 : 0);
+    if (!frame_allocation)
+        get_gpu_asset_cache().paths[tex_cpu_hash] = tex_cpu.file_path;
+    TextureGPU& texture_gpu = get_gpu_asset_cache().add_texture(tex_cpu_hash, {std::move(tex), frame_allocation, bsize});
+    assert_else(texture_gpu.value.image->image != VK_NULL_HANDLE);
 
     return tex_cpu.file_path;
 }
 
-TextureCPU load_texture(const FilePath& file_path) {
+constexpr uint32 texture_section_info   = section_tag("INFO");
+constexpr uint32 texture_section_pixels = section_tag("PIXL");
+// Only written for textures with a precomputed chain
+constexpr uint32 texture_section_levels = section_tag("LEVL");
+
+struct TextureContainerInfo {
+    v2i    size       = {};
+    uint32 format     = 0;
+    uint32 needs_mips = 1;
+};
+
+static TextureCPU _load_texture_json(const FilePath& file_path) {
     AssetFile& asset_file = get_file_cache().load_asset(file_path);
 
     TextureInfo texture_info = from_jv<TextureInfo>(*asset_file.asset_json["texture_info"]);
@@ -41,32 +91,47 @@ TextureCPU load_texture(const FilePath& file_path) {
     return texture_cpu;
 }
 
+bool load_texture(const AssetContainer& container, const FilePath& file_path, TextureCPU& texture_cpu) {
+    texture_cpu.file_path = file_path;
+    TextureContainerInfo info;
+    bool read = container.read_struct(texture_section_info, info) && container.read(texture_section_pixels, texture_cpu.pixels);
+    texture_cpu.size       = info.size;
+    texture_cpu.format     = vuk::Format(info.format);
+    texture_cpu.needs_mips = info.needs_mips != 0;
+    if (container.find(texture_section_levels) && !container.read_struct(texture_section_levels, texture_cpu.mip_levels))
+        read = false;
+    return read;
+}
+
+TextureCPU load_texture(const FilePath& file_path) {
+    ZoneScoped;
+    AssetContainer container;
+    if (!container.open(file_path))
+        return _load_texture_json(file_path);
+
+    TextureCPU texture_cpu;
+    if (!load_texture(container, file_path, texture_cpu))
+        log_error(fmt_("Couldn't read texture {}", file_path.rel_string()));
+    return texture_cpu;
+}
+
 void save_texture(const TextureCPU& texture_cpu) {
-    AssetFile file;
-    file.file_path = texture_cpu.file_path;
-    file.version   = 2;
-
-    TextureInfo texture_info;
-    texture_info.pixels_bsize = texture_cpu.pixels.size();
-
-    int32 compress_staging = LZ4_compressBound(int32(texture_info.pixels_bsize));
-    file.binary_blob.resize(compress_staging);
-    int32 compressed_bsize = LZ4_compress_default((char*) texture_cpu.pixels.data(),
-        (char*) file.binary_blob.data(),
-        int32(texture_cpu.pixels.size()),
-        int32(compress_staging));
-    file.binary_blob.resize(compressed_bsize);
-
-    json j;
-    j["texture_cpu"]  = make_shared<json_value>(to_jv(texture_cpu));
-    j["texture_info"] = make_shared<json_value>(to_jv(texture_info));
-    file.asset_json   = j;
-
-    get_file_cache().parsed_assets[file.file_path] = file;
-    save_asset_file(file);
+    TextureContainerInfo info;
+    info.size       = texture_cpu.size;
+    info.format     = uint32(texture_cpu.format);
+    info.needs_mips = texture_cpu.needs_mips;
+
+    AssetContainerWriter writer;
+    writer.add_struct(texture_section_info, info);
+    writer.add(texture_section_pixels, texture_cpu.pixels, true);
+    if (texture_cpu.mip_levels > 1)
+        writer.add_struct(texture_section_levels, texture_cpu.mip_levels);
+    writer.save(texture_cpu.file_path);
+    // Drop any parsed copy of the json file this replaced
+    get_file_cache().parsed_assets.erase(texture_cpu.file_path);
 }
 
-TextureCPU convert_to_texture(const FilePath& input_file_path, const FilePath& output_folder, const string& output_name) {
+TextureCPU convert_to_texture(const FilePath& input_file_path, const FilePath& output_folder, const string& output_name, TextureCompression compression) {
     fs::create_directories(output_folder.abs_path());
 
     TextureCPU texture;
@@ -90,6 +155,7 @@ TextureCPU convert_to_texture(const FilePath& input_file_path, const FilePath& o
         memcpy(texture.pixels.data(), pixel_data, texture.pixels.size());
         texture.format = vuk::Format::eR8G8B8A8Srgb;
         free(pixel_data);
+        compress_texture(texture, compression);
     }
     return texture;
 }
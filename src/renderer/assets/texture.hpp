@@ -7,9 +7,12 @@
 #include "general/math/geometry.hpp"
 #include "general/file/file_path.hpp"
 #include "general/file/resource.hpp"
+#include "renderer/assets/texture_compression.hpp"
 
 namespace spellbook {
 
+struct AssetContainer;
+
 struct TextureExternal {
     static constexpr string_view extension() { return "?"; }
     static constexpr string_view dnd_key() { return "DND_TEXTURE_EXTERNAL"; }
@@ -26,6 +29,8 @@ struct TextureCPU : Resource {
     vuk::Format format = {};
     vector<uint8>  pixels = {};
     bool needs_mips = true;
+    // Levels stored back to back in pixels, precomputed by the converter, see compress_texture
+    uint32 mip_levels = 1;
 
     static constexpr string_view extension() { return ".sbatex"; }
     static constexpr string_view dnd_key() { return "DND_TEXTURE"; }
@@ -39,11 +44,17 @@ JSON_IMPL(TextureCPU, size, format);
 struct TextureGPU {
     vuk::Texture value;
     bool frame_allocated;
+
+    uint64 bsize     = 0;
+    uint64 last_used = 0;
 };
 
 TextureCPU load_texture(const FilePath& file_name);
+// Reads an opened container without logging, false if a section is missing or corrupt
+bool       load_texture(const AssetContainer& container, const FilePath& file_path, TextureCPU& texture_cpu);
 void       save_texture(const TextureCPU& texture_cpu);
 FilePath   upload_texture(const TextureCPU& tex_cpu, bool frame_allocation = false);
-TextureCPU convert_to_texture(const FilePath& file_name, const FilePath& output_folder, const string& output_name);
+TextureCPU convert_to_texture(const FilePath& file_name, const FilePath& output_folder, const string& output_name,
+                              TextureCompression compression = TextureCompression_None);
 
 }
@@ -0,0 +1,620 @@
+#include "texture_compression.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cfloat>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <thread>
+#include <tracy/Tracy.hpp>
+
+#include "extension/fmt.hpp"
+#include "general/logger.hpp"
+#include "general/umap.hpp"
+#include "renderer/gpu_asset_cache.hpp"
+#include "renderer/renderer.hpp"
+#include "renderer/assets/material.hpp"
+#include "renderer/assets/texture.hpp"
+
+namespace spellbook {
+
+bool is_block_compressed(vuk::Format format) {
+    return format == vuk::Format::eBc7SrgbBlock || format == vuk::Format::eBc7UnormBlock || format == vuk::Format::eBc5UnormBlock;
+}
+
+uint32 texture_mip_count(v2i size) {
+    uint32 count = 1;
+    for (int32 extent = std::max(size.x, size.y); extent > 1; extent /= 2)
+        count++;
+    return count;
+}
+
+v2i texture_level_size(v2i size, uint32 level) {
+    return v2i(std::max(size.x >> level, 1), std::max(size.y >> level, 1));
+}
+
+uint64 texture_level_bsize(vuk::Format format, v2i size) {
+    if (is_block_compressed(format))
+        return uint64((size.x + 3) / 4) * uint64((size.y + 3) / 4) * 16;
+    uint64 texel_bsize = format == vuk::Format::eR32G32B32A32Sfloat ? 16 : 4;
+    return uint64(size.x) * uint64(size.y) * texel_bsize;
+}
+
+static float _srgb_to_linear(float srgb) {
+    return srgb < 0.04045f ? srgb / 12.92f : std::pow((srgb + 0.055f) / 1.055f, 2.4f);
+}
+
+static float _linear_to_srgb(float linear) {
+    return linear < 0.0031308f ? linear * 12.92f : 1.055f * std::pow(linear, 1.0f / 2.4f) - 0.055f;
+}
+
+static uint8 _to_unorm8(float value) {
+    return uint8(std::clamp(value * 255.0f + 0.5f, 0.0f, 255.0f));
+}
+
+void generate_mips(TextureCPU& texture, bool normal_map) {
+    ZoneScoped;
+    assert_else(texture.mip_levels == 1 && texture_level_bsize(texture.format, texture.size) == texture.pixels.bsize())
+        return;
+    bool srgb = texture.format == vuk::Format::eR8G8B8A8Srgb && !normal_map;
+    float srgb_table[256];
+    for (uint32 i = 0; i < 256; i++)
+        srgb_table[i] = _srgb_to_linear(i / 255.0f);
+
+    texture.mip_levels = texture_mip_count(texture.size);
+    uint64 src_offset = 0;
+    for (uint32 level = 1; level < texture.mip_levels; level++) {
+        v2i src_size = texture_level_size(texture.size, level - 1);
+        v2i dst_size = texture_level_size(texture.size, level);
+        uint64 dst_offset = texture.pixels.size();
+        texture.pixels.resize(dst_offset + texture_level_bsize(texture.format, dst_size));
+        const uint8* src = texture.pixels.data() + src_offset;
+        uint8*       dst = texture.pixels.data() + dst_offset;
+
+        for (int32 y = 0; y < dst_size.y; y++) {
+            for (int32 x = 0; x < dst_size.x; x++) {
+                // Odd extents clamp, the last row or column is counted twice
+                int32 xs[2] = {std::min(2 * x, src_size.x - 1), std::min(2 * x + 1, src_size.x - 1)};
+                int32 ys[2] = {std::min(2 * y, src_size.y - 1), std::min(2 * y + 1, src_size.y - 1)};
+                float sum[4] = {};
+                for (int32 sy : ys) {
+                    for (int32 sx : xs) {
+                        const uint8* texel = src + (sy * src_size.x + sx) * 4;
+                        for (uint32 c = 0; c < 3; c++) {
+                            if (srgb)
+                                sum[c] += srgb_table[texel[c]];
+                            else if (normal_map)
+                                sum[c] += texel[c] / 255.0f * 2.0f - 1.0f;
+                            else
+                                sum[c] += texel[c] / 255.0f;
+                        }
+                        sum[3] += texel[3] / 255.0f;
+                    }
+                }
+                uint8* texel = dst + (y * dst_size.x + x) * 4;
+                if (normal_map) {
+                    float length = std::sqrt(sum[0] * sum[0] + sum[1] * sum[1] + sum[2] * sum[2]);
+                    for (uint32 c = 0; c < 3; c++)
+                        texel[c] = _to_unorm8(length > 0.0f ? sum[c] / length * 0.5f + 0.5f : 0.5f);
+                } else {
+                    for (uint32 c = 0; c < 3; c++)
+                        texel[c] = _to_unorm8(srgb ? _linear_to_srgb(sum[c] / 4.0f) : sum[c] / 4.0f);
+                }
+                texel[3] = _to_unorm8(sum[3] / 4.0f);
+            }
+        }
+        src_offset = dst_offset;
+    }
+}
+
+struct BitWriter {
+    uint8* data;
+    uint32 position = 0;
+
+    void write(uint32 value, uint32 bits) {
+        for (uint32 i = 0; i < bits; i++, position++) {
+            if ((value >> i) & 1)
+                data[position / 8] |= uint8(1 << (position % 8));
+        }
+    }
+};
+
+struct BitReader {
+    const uint8* data;
+    uint32       position = 0;
+
+    uint32 read(uint32 bits) {
+        uint32 value = 0;
+        for (uint32 i = 0; i < bits; i++, position++)
+            value |= uint32((data[position / 8] >> (position % 8)) & 1) << i;
+        return value;
+    }
+};
+
+constexpr int32 bc7_weights4[16] = {0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64};
+
+struct BC7Mode6 {
+    // 7 bit endpoint channels and the shared low bit of each endpoint
+    uint8  endpoints[2][4];
+    uint8  pbits[2];
+    uint8  indices[16];
+    uint32 error = UINT32_MAX;
+};
+
+static uint32 _bc7_assign_indices(const uint8* rgba, BC7Mode6& mode) {
+    int32 palette[16][4];
+    for (uint32 i = 0; i < 16; i++) {
+        for (uint32 c = 0; c < 4; c++) {
+            int32 e0 = mode.endpoints[0][c] << 1 | mode.pbits[0];
+            int32 e1 = mode.endpoints[1][c] << 1 | mode.pbits[1];
+            palette[i][c] = ((64 - bc7_weights4[i]) * e0 + bc7_weights4[i] * e1 + 32) >> 6;
+        }
+    }
+    uint32 error = 0;
+    for (uint32 p = 0; p < 16; p++) {
+        uint32 best_error = UINT32_MAX;
+        for (uint32 i = 0; i < 16; i++) {
+            uint32 pixel_error = 0;
+            for (uint32 c = 0; c < 4; c++) {
+                int32 d = palette[i][c] - rgba[p * 4 + c];
+                pixel_error += d * d;
+            }
+            if (pixel_error < best_error) {
+                best_error      = pixel_error;
+                mode.indices[p] = i;
+            }
+        }
+        error += best_error;
+    }
+    return error;
+}
+
+// Tries the four p bit pairs for the float endpoints, keeping whichever quantizes closest overall
+static void _bc7_quantize(const uint8* rgba, const float ends[2][4], BC7Mode6& best) {
+    for (uint32 p0 = 0; p0 < 2; p0++) {
+        for (uint32 p1 = 0; p1 < 2; p1++) {
+            BC7Mode6 mode;
+            mode.pbits[0] = p0;
+            mode.pbits[1] = p1;
+            for (uint32 e = 0; e < 2; e++) {
+                for (uint32 c = 0; c < 4; c++)
+                    mode.endpoints[e][c] = uint8(std::clamp(int32(std::round((ends[e][c] - mode.pbits[e]) / 2.0f)), 0, 127));
+            }
+            mode.error = _bc7_assign_indices(rgba, mode);
+            if (mode.error < best.error)
+                best = mode;
+        }
+    }
+}
+
+void encode_bc7_block(const uint8* rgba, uint8* block) {
+    // Endpoints start at the extremes along the principal axis, then are refit to the indices they produced
+    float mean[4] = {};
+    for (uint32 p = 0; p < 16; p++)
+        for (uint32 c = 0; c < 4; c++)
+            mean[c] += rgba[p * 4 + c] / 16.0f;
+    float covariance[4][4] = {};
+    for (uint32 p = 0; p < 16; p++) {
+        for (uint32 i = 0; i < 4; i++)
+            for (uint32 j = 0; j < 4; j++)
+                covariance[i][j] += (rgba[p * 4 + i] - mean[i]) * (rgba[p * 4 + j] - mean[j]);
+    }
+    float axis[4] = {1.0f, 1.0f, 1.0f, 1.0f};
+    for (uint32 iteration = 0; iteration < 8; iteration++) {
+        float next[4] = {};
+        for (uint32 i = 0; i < 4; i++)
+            for (uint32 j = 0; j < 4; j++)
+                next[i] += covariance[i][j] * axis[j];
+        float length = std::sqrt(next[0] * next[0] + next[1] * next[1] + next[2] * next[2] + next[3] * next[3]);
+        if (length < 1e-6f)
+            break;
+        for (uint32 i = 0; i < 4; i++)
+            axis[i] = next[i] / length;
+    }
+    float t_min = FLT_MAX, t_max = -FLT_MAX;
+    for (uint32 p = 0; p < 16; p++) {
+        float t = 0.0f;
+        for (uint32 c = 0; c < 4; c++)
+            t += (rgba[p * 4 + c] - mean[c]) * axis[c];
+        t_min = std::min(t_min, t);
+        t_max = std::max(t_max, t);
+    }
+    float ends[2][4];
+    for (uint32 c = 0; c < 4; c++) {
+        ends[0][c] = std::clamp(mean[c] + t_min * axis[c], 0.0f, 255.0f);
+        ends[1][c] = std::clamp(mean[c] + t_max * axis[c], 0.0f, 255.0f);
+    }
+
+    BC7Mode6 best;
+    _bc7_quantize(rgba, ends, best);
+    for (uint32 iteration = 0; iteration < 2 && best.error > 0; iteration++) {
+        // Least squares endpoints for the current indices
+        float aa = 0.0f, ab = 0.0f, bb = 0.0f, ax[4] = {}, bx[4] = {};
+        for (uint32 p = 0; p < 16; p++) {
+            float b = bc7_weights4[best.indices[p]] / 64.0f;
+            float a = 1.0f - b;
+            aa += a * a;
+            ab += a * b;
+            bb += b * b;
+            for (uint32 c = 0; c < 4; c++) {
+                ax[c] += a * rgba[p * 4 + c];
+                bx[c] += b * rgba[p * 4 + c];
+            }
+        }
+        float determinant = aa * bb - ab * ab;
+        if (std::abs(determinant) < 1e-6f)
+            break;
+        for (uint32 c = 0; c < 4; c++) {
+            ends[0][c] = std::clamp((bb * ax[c] - ab * bx[c]) / determinant, 0.0f, 255.0f);
+            ends[1][c] = std::clamp((aa * bx[c] - ab * ax[c]) / determinant, 0.0f, 255.0f);
+        }
+        _bc7_quantize(rgba, ends, best);
+    }
+
+    // The first index is stored without its high bit, flip the endpoints so it's clear
+    if (best.indices[0] >= 8) {
+        std::swap(best.endpoints[0], best.endpoints[1]);
+        std::swap(best.pbits[0], best.pbits[1]);
+        for (uint8& index : best.indices)
+            index = 15 - index;
+    }
+
+    memset(block, 0, 16);
+    BitWriter writer = {block};
+    writer.write(1 << 6, 7);
+    for (uint32 c = 0; c < 4; c++) {
+        writer.write(best.endpoints[0][c], 7);
+        writer.write(best.endpoints[1][c], 7);
+    }
+    writer.write(best.pbits[0], 1);
+    writer.write(best.pbits[1], 1);
+    writer.write(best.indices[0], 3);
+    for (uint32 p = 1; p < 16; p++)
+        writer.write(best.indices[p], 4);
+}
+
+void decode_bc7_block(const uint8* block, uint8* rgba) {
+    BitReader reader = {block};
+    uint32 mode = 0;
+    while (mode < 8 && reader.read(1) == 0)
+        mode++;
+    if (mode != 6) {
+        // Only mode 6 is ever written
+        for (uint32 p = 0; p < 16; p++) {
+            rgba[p * 4 + 0] = 255;
+            rgba[p * 4 + 1] = 0;
+            rgba[p * 4 + 2] = 255;
+            rgba[p * 4 + 3] = 255;
+        }
+        return;
+    }
+    int32 endpoints[2][4];
+    for (uint32 c = 0; c < 4; c++) {
+        endpoints[0][c] = reader.read(7) << 1;
+        endpoints[1][c] = reader.read(7) << 1;
+    }
+    uint32 p0 = reader.read(1);
+    uint32 p1 = reader.read(1);
+    for (uint32 c = 0; c < 4; c++) {
+        endpoints[0][c] |= p0;
+        endpoints[1][c] |= p1;
+    }
+    for (uint32 p = 0; p < 16; p++) {
+        int32 weight = bc7_weights4[reader.read(p == 0 ? 3 : 4)];
+        for (uint32 c = 0; c < 4; c++)
+            rgba[p * 4 + c] = uint8(((64 - weight) * endpoints[0][c] + weight * endpoints[1][c] + 32) >> 6);
+    }
+}
+
+static void _bc4_palette(int32 e0, int32 e1, int32 palette[8]) {
+    palette[0] = e0;
+    palette[1] = e1;
+    if (e0 > e1) {
+        for (int32 i = 2; i < 8; i++)
+            palette[i] = ((8 - i) * e0 + (i - 1) * e1 + 3) / 7;
+    } else {
+        for (int32 i = 2; i < 6; i++)
+            palette[i] = ((6 - i) * e0 + (i - 1) * e1 + 2) / 5;
+        palette[6] = 0;
+        palette[7] = 255;
+    }
+}
+
+// One channel of RGBA8 pixels into 8 bytes, always in the 8 value mode
+static void _encode_bc4(const uint8* rgba, uint32 channel, uint8* block) {
+    int32 low = 255, high = 0;
+    for (uint32 p = 0; p < 16; p++) {
+        low  = std::min<int32>(low, rgba[p * 4 + channel]);
+        high = std::max<int32>(high, rgba[p * 4 + channel]);
+    }
+
+    uint8  best_indices[16] = {};
+    int32  best_ends[2]     = {high, low};
+    uint32 best_error       = UINT32_MAX;
+    // Insetting the endpoints trades the extremes for finer steps in between
+    int32 step = std::max((high - low) / 16, 1);
+    for (int32 inset_high = 0; inset_high < 3 && high > low; inset_high++) {
+        for (int32 inset_low = 0; inset_low < 3; inset_low++) {
+            int32 e0 = high - inset_high * step;
+            int32 e1 = low + inset_low * step;
+            if (e0 <= e1)
+                continue;
+            int32 palette[8];
+            _bc4_palette(e0, e1, palette);
+            uint8  indices[16];
+            uint32 error = 0;
+            for (uint32 p = 0; p < 16; p++) {
+                uint32 best = UINT32_MAX;
+                for (uint32 i = 0; i < 8; i++) {
+                    int32  d = palette[i] - rgba[p * 4 + channel];
+                    uint32 pixel_error = d * d;
+                    if (pixel_error < best) {
+                        best       = pixel_error;
+                        indices[p] = i;
+                    }
+                }
+                error += best;
+            }
+            if (error < best_error) {
+                best_error   = error;
+                best_ends[0] = e0;
+                best_ends[1] = e1;
+                memcpy(best_indices, indices, 16);
+            }
+        }
+    }
+
+    memset(block, 0, 8);
+    block[0] = uint8(best_ends[0]);
+    block[1] = uint8(best_ends[1]);
+    BitWriter writer = {block + 2};
+    for (uint32 p = 0; p < 16; p++)
+        writer.write(best_indices[p], 3);
+}
+
+static void _decode_bc4(const uint8* block, uint32 channel, uint8* rgba) {
+    int32 palette[8];
+    _bc4_palette(block[0], block[1], palette);
+    BitReader reader = {block + 2};
+    for (uint32 p = 0; p < 16; p++)
+        rgba[p * 4 + channel] = uint8(palette[reader.read(3)]);
+}
+
+void encode_bc5_block(const uint8* rgba, uint8* block) {
+    _encode_bc4(rgba, 0, block);
+    _encode_bc4(rgba, 1, block + 8);
+}
+
+void decode_bc5_block(const uint8* block, uint8* rgba) {
+    _decode_bc4(block, 0, rgba);
+    _decode_bc4(block + 8, 1, rgba);
+    for (uint32 p = 0; p < 16; p++) {
+        rgba[p * 4 + 2] = 0;
+        rgba[p * 4 + 3] = 255;
+    }
+}
+
+// Copies a 4x4 block out of a level, clamping at the edges of levels that aren't a multiple of 4
+static void _fetch_block(const uint8* pixels, v2i size, int32 block_x, int32 block_y, uint8* rgba) {
+    for (int32 y = 0; y < 4; y++) {
+        for (int32 x = 0; x < 4; x++) {
+            int32 sx = std::min(block_x * 4 + x, size.x - 1);
+            int32 sy = std::min(block_y * 4 + y, size.y - 1);
+            memcpy(rgba + (y * 4 + x) * 4, pixels + (sy * size.x + sx) * 4, 4);
+        }
+    }
+}
+
+void compress_texture(TextureCPU& texture, TextureCompression compression) {
+    ZoneScoped;
+    if (compression == TextureCompression_None)
+        return;
+    assert_else(texture.format == vuk::Format::eR8G8B8A8Srgb || texture.format == vuk::Format::eR8G8B8A8Unorm)
+        return;
+    assert_else(texture.size.x > 0 && texture.size.y > 0 && texture.pixels.bsize() >= texture_level_bsize(texture.format, texture.size))
+        return;
+    if (texture.mip_levels == 1)
+        generate_mips(texture, compression == TextureCompression_BC5);
+
+    vuk::Format format = compression == TextureCompression_BC5 ? vuk::Format::eBc5UnormBlock :
+        texture.format == vuk::Format::eR8G8B8A8Srgb ? vuk::Format::eBc7SrgbBlock : vuk::Format::eBc7UnormBlock;
+
+    struct Level {
+        v2i    size;
+        uint64 src_offset;
+        uint64 dst_offset;
+    };
+    struct Row {
+        uint32 level;
+        int32  block_y;
+    };
+    vector<Level> levels;
+    vector<Row>   rows;
+    uint64 src_offset = 0, dst_offset = 0;
+    for (uint32 level = 0; level < texture.mip_levels; level++) {
+        v2i size = texture_level_size(texture.size, level);
+        levels.push_back({size, src_offset, dst_offset});
+        for (int32 block_y = 0; block_y < (size.y + 3) / 4; block_y++)
+            rows.push_back({level, block_y});
+        src_offset += texture_level_bsize(texture.format, size);
+        dst_offset += texture_level_bsize(format, size);
+    }
+
+    vector<uint8> compressed;
+    compressed.resize(dst_offset);
+    // Rows of blocks are handed out one at a time so the small levels don't leave threads idle
+    std::atomic<uint32> next_row = 0;
+    auto work = [&]() {
+        uint8 rgba[64];
+        for (uint32 row = next_row++; row < rows.size(); row = next_row++) {
+            const Level& level = levels[rows[row].level];
+            int32 blocks_x = (level.size.x + 3) / 4;
+            for (int32 block_x = 0; block_x < blocks_x; block_x++) {
+                _fetch_block(texture.pixels.data() + level.src_offset, level.size, block_x, rows[row].block_y, rgba);
+                uint8* block = compressed.data() + level.dst_offset + (rows[row].block_y * blocks_x + block_x) * 16;
+                if (compression == TextureCompression_BC5)
+                    encode_bc5_block(rgba, block);
+                else
+                    encode_bc7_block(rgba, block);
+            }
+        }
+    };
+    uint32 thread_count = std::clamp<uint32>(std::thread::hardware_concurrency(), 1, rows.size());
+    vector<std::thread> threads;
+    for (uint32 i = 1; i < thread_count; i++)
+        threads.emplace_back(work);
+    work();
+    for (std::thread& thread : threads)
+        thread.join();
+
+    texture.pixels     = std::move(compressed);
+    texture.format     = format;
+    texture.needs_mips = false;
+}
+
+void decompress_texture(TextureCPU& texture) {
+    ZoneScoped;
+    if (!is_block_compressed(texture.format))
+        return;
+    bool bc5 = texture.format == vuk::Format::eBc5UnormBlock;
+    vuk::Format format = texture.format == vuk::Format::eBc7SrgbBlock ? vuk::Format::eR8G8B8A8Srgb : vuk::Format::eR8G8B8A8Unorm;
+
+    uint64 src_bsize = 0, dst_bsize = 0;
+    for (uint32 level = 0; level < texture.mip_levels; level++) {
+        src_bsize += texture_level_bsize(texture.format, texture_level_size(texture.size, level));
+        dst_bsize += texture_level_bsize(format, texture_level_size(texture.size, level));
+    }
+    assert_else(texture.pixels.bsize() >= src_bsize)
+        return;
+
+    vector<uint8> decoded;
+    decoded.resize(dst_bsize);
+    uint64 src_offset = 0, dst_offset = 0;
+    uint8 rgba[64];
+    for (uint32 level = 0; level < texture.mip_levels; level++) {
+        v2i size = texture_level_size(texture.size, level);
+        int32 blocks_x = (size.x + 3) / 4;
+        int32 blocks_y = (size.y + 3) / 4;
+        for (int32 block_y = 0; block_y < blocks_y; block_y++) {
+            for (int32 block_x = 0; block_x < blocks_x; block_x++) {
+                const uint8* block = texture.pixels.data() + src_offset + (block_y * blocks_x + block_x) * 16;
+                if (bc5)
+                    decode_bc5_block(block, rgba);
+                else
+                    decode_bc7_block(block, rgba);
+                // Blocks hanging over the edge of levels that aren't a multiple of 4 only keep their inside texels
+                for (int32 y = 0; y < 4 && block_y * 4 + y < size.y; y++) {
+                    int32 row_texels = std::min(4, size.x - block_x * 4);
+                    uint64 dst = dst_offset + (uint64(block_y * 4 + y) * size.x + block_x * 4) * 4;
+                    memcpy(decoded.data() + dst, rgba + y * 16, row_texels * 4);
+                }
+            }
+        }
+        src_offset += texture_level_bsize(texture.format, size);
+        dst_offset += texture_level_bsize(format, size);
+    }
+
+    texture.pixels = std::move(decoded);
+    texture.format = format;
+}
+
+// Over the top level, in the channels the format keeps
+static double _psnr(const TextureCPU& source, const TextureCPU& compressed) {
+    bool   bc5      = compressed.format == vuk::Format::eBc5UnormBlock;
+    uint32 channels = bc5 ? 2 : 4;
+    int32  blocks_x = (source.size.x + 3) / 4;
+    double squared_error = 0.0;
+    uint8  decoded[64];
+    for (int32 y = 0; y < source.size.y; y++) {
+        for (int32 x = 0; x < source.size.x; x++) {
+            // Decoding per texel keeps this simple, it only runs in the benchmark
+            if (x % 4 == 0) {
+                const uint8* block = compressed.pixels.data() + ((y / 4) * blocks_x + x / 4) * 16;
+                if (bc5)
+                    decode_bc5_block(block, decoded);
+                else
+                    decode_bc7_block(block, decoded);
+            }
+            for (uint32 c = 0; c < channels; c++) {
+                double d = double(decoded[((y % 4) * 4 + x % 4) * 4 + c]) - source.pixels[(y * source.size.x + x) * 4 + c];
+                squared_error += d * d;
+            }
+        }
+    }
+    double mse = squared_error / (double(source.size.x) * source.size.y * channels);
+    return mse > 0.0 ? 10.0 * std::log10(255.0 * 255.0 / mse) : 99.0;
+}
+
+string benchmark_texture_compression(int max_textures) {
+    using clock = std::chrono::steady_clock;
+    auto ms = [](clock::time_point t0, clock::time_point t1) { return std::chrono::duration<double, std::milli>(t1 - t0).count(); };
+
+    uset<uint64> normal_maps;
+    vector<FilePath> texture_paths;
+    for (const auto& entry : fs::recursive_directory_iterator(get_resource_folder().abs_path())) {
+        string extension = entry.path().extension().string();
+        if (extension == MaterialCPU::extension())
+            normal_maps.insert(hash_path(load_resource<MaterialCPU>(FilePath(entry.path())).normal_asset_path));
+        else if (extension == TextureCPU::extension())
+            texture_paths.push_back(FilePath(entry.path()));
+    }
+
+    string report;
+    uint32 compressed_count = 0, skipped = 0;
+    uint64 raw_vram = 0, compressed_vram = 0;
+    double encode_ms = 0.0, raw_upload_ms = 0.0, compressed_upload_ms = 0.0;
+    for (const FilePath& path : texture_paths) {
+        if (compressed_count >= uint32(max_textures))
+            break;
+        TextureCPU source = load_texture(path);
+        if (source.mip_levels != 1 || texture_level_bsize(source.format, source.size) != source.pixels.bsize() ||
+            (source.format != vuk::Format::eR8G8B8A8Srgb && source.format != vuk::Format::eR8G8B8A8Unorm)) {
+            skipped++;
+            continue;
+        }
+        bool normal_map = normal_maps.contains(hash_path(path));
+
+        TextureCPU compressed = source;
+        auto t0 = clock::now();
+        compress_texture(compressed, normal_map ? TextureCompression_BC5 : TextureCompression_BC7);
+        auto t1 = clock::now();
+        double psnr = _psnr(source, compressed);
+
+        // CPU side of the upload, the staging copy and for the raw texture recording the mip blits
+        source.file_path     = FilePath(fmt_("benchmark_raw_{}", compressed_count), FilePathLocation_Symbolic);
+        compressed.file_path = FilePath(fmt_("benchmark_bc_{}", compressed_count), FilePathLocation_Symbolic);
+        auto t2 = clock::now();
+        upload_texture(source);
+        auto t3 = clock::now();
+        // Without BC sampling the device gets the decoded levels, like the loader would hand over
+        if (get_renderer().bc_supported) {
+            upload_texture(compressed);
+        } else {
+            TextureCPU decoded = compressed;
+            decompress_texture(decoded);
+            upload_texture(decoded);
+        }
+        auto t4 = clock::now();
+        for (const FilePath& uploaded : {source.file_path, compressed.file_path}) {
+            get_gpu_asset_cache().erase_texture(hash_path(uploaded));
+            get_gpu_asset_cache().paths.erase(hash_path(uploaded));
+        }
+
+        uint64 raw_bsize = source.pixels.bsize() + source.pixels.bsize() / 3;
+        raw_vram             += raw_bsize;
+        compressed_vram      += compressed.pixels.bsize();
+        encode_ms            += ms(t0, t1);
+        raw_upload_ms        += ms(t2, t3);
+        compressed_upload_ms += ms(t3, t4);
+        compressed_count++;
+        report += fmt_("{} ({}x{}, {}): PSNR {:.2f}dB, {:.1f}KB -> {:.1f}KB, encode {:.1f}ms\n", path.rel_string(), source.size.x, source.size.y,
+            normal_map ? "BC5" : "BC7", psnr, raw_bsize / 1024.0, compressed.pixels.bsize() / 1024.0, ms(t0, t1));
+    }
+    report += fmt_("{} textures, {} skipped: VRAM with mips {:.1f}MB -> {:.1f}MB, encode {:.1f}ms, upload {:.2f}ms -> {:.2f}ms{}", compressed_count, skipped,
+        raw_vram / 1048576.0, compressed_vram / 1048576.0, encode_ms, raw_upload_ms, compressed_upload_ms,
+        get_renderer().bc_supported ? "" : " (no BC support, decoded before upload)");
+    return report;
+}
+
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <vuk/Types.hpp>
+
+#include "general/string.hpp"
+#include "general/math/geometry.hpp"
+
+namespace spellbook {
+
+struct TextureCPU;
+
+enum TextureCompression {
+    TextureCompression_None,
+    // Color, ORM and emissive maps, keeps the source's sRGB or unorm encoding
+    TextureCompression_BC7,
+    // Tangent space normal maps, only x and y are stored and the shader rebuilds z
+    TextureCompression_BC5
+};
+
+bool   is_block_compressed(vuk::Format format);
+uint32 texture_mip_count(v2i size);
+v2i    texture_level_size(v2i size, uint32 level);
+// Tightly packed, BC levels are padded out to whole 4x4 blocks
+uint64 texture_level_bsize(vuk::Format format, v2i size);
+
+// Appends a box filtered chain to an RGBA8 texture. sRGB levels are averaged in linear space, normal maps are
+// renormalized after averaging.
+void generate_mips(TextureCPU& texture, bool normal_map);
+// Generates the mip chain and encodes every level on worker threads, the result uploads without touching the pixels
+void compress_texture(TextureCPU& texture, TextureCompression compression);
+// Decodes every level of a BC7 or BC5 texture back to RGBA8, for devices that can't sample them. BC5 keeps x and y
+// in red and green, so normal maps still rebuild z the same way.
+void decompress_texture(TextureCPU& texture);
+
+// 4x4 blocks of row major RGBA8 pixels. BC7 is always written in mode 6, one subset with 16 interpolated colors.
+void encode_bc7_block(const uint8* rgba, uint8* block);
+void decode_bc7_block(const uint8* block, uint8* rgba);
+void encode_bc5_block(const uint8* rgba, uint8* block);
+void decode_bc5_block(const uint8* block, uint8* rgba);
+
+// Compresses the textures in the resource folder in memory, anything a material uses as its normal map goes to BC5.
+// Reports PSNR of the top level, VRAM with mips, encode time and the CPU time of uploading either variant.
+string benchmark_texture_compression(int max_textures);
+
+}
@@ -216,11 +216,9 @@ MeshCPU generate_formatted_dot(Camera* camera, FormattedVertex vertex) {
     }
     return mesh_cpu;
 }
-MeshCPU generate_formatted_line(Camera* camera, vector<FormattedVertex> vertices) {
-    string name = fmt_("line_hash:{:#x}", hash_data(vertices.data(), vertices.bsize()));
-    
+void append_formatted_line(Camera* camera, const vector<FormattedVertex>& vertices, vector<Vertex>& out_vertices, vector<uint32>& out_indices) {
     if (!(vertices.size() >= 2))
-        return {};
+        return;
     struct Segment {
         v3 left;
         v3 right;
@@ -231,7 +229,7 @@ MeshCPU generate_formatted_line(Camera* camera, vector<FormattedVertex> vertices
     vector<Segment> segments;
     segments.reserve(vertices.size() + (vertices.size() - 2) * 2);
     for (uint32 i = 0; i < vertices.size(); i++) {
-        FormattedVertex& vertex = vertices[i];
+        const FormattedVertex& vertex = vertices[i];
         v3 cam_vec = math::normalize(vertex.position - camera->position);
 
         if (vertex.color.a == 0.0f) {
@@ -243,8 +241,8 @@ MeshCPU generate_formatted_line(Camera* camera, vector<FormattedVertex> vertices
         bool none_before = i == 0;
         bool none_after = (i + 1) == vertices.size();
         if (!none_before && !none_after) {
-            FormattedVertex& vertex1 = vertices[i-1];
-            FormattedVertex& vertex3 = vertices[i+1];
+            const FormattedVertex& vertex1 = vertices[i-1];
+            const FormattedVertex& vertex3 = vertices[i+1];
             none_before |= vertex1.color.a == 0.0f;
             none_after |= vertex3.color.a == 0.0f;
         }
@@ -270,8 +268,8 @@ MeshCPU generate_formatted_line(Camera* camera, vector<FormattedVertex> vertices
         }
         // Take both rights of corner, use middle
         else {
-            FormattedVertex& vertex1 = vertices[i-1];
-            FormattedVertex& vertex3 = vertices[i+1];
+            const FormattedVertex& vertex1 = vertices[i-1];
+            const FormattedVertex& vertex3 = vertices[i+1];
             v3 vec1 = (vertex.position - vertex1.position);
             v3 vec2 = (vertex3.position - vertex.position);
             if (vec1 == v3(0)) vec1 = v3(1,0,0);
@@ -301,33 +299,38 @@ MeshCPU generate_formatted_line(Camera* camera, vector<FormattedVertex> vertices
         }
     }
 
+    // Consecutive quads share the edge between them
+    uint32 previous = UINT32_MAX;
+    for (uint32 i = 0; i < segments.size(); i++) {
+        Segment& seg = segments[i];
+        if (seg.separate) {
+            previous = UINT32_MAX;
+            continue;
+        }
+        uint32 current = out_vertices.size();
+        out_vertices.emplace_back(seg.left, v3(0,0,1), v3(1,0,0), seg.color.rgb, v2(0));
+        out_vertices.emplace_back(seg.right, v3(0,0,1), v3(1,0,0), seg.color.rgb, v2(0));
+        if (previous != UINT32_MAX) {
+            out_indices.push_back(previous + 0);
+            out_indices.push_back(previous + 1);
+            out_indices.push_back(current + 1);
+            out_indices.push_back(previous + 0);
+            out_indices.push_back(current + 1);
+            out_indices.push_back(current + 0);
+        }
+        previous = current;
+    }
+}
 
-    MeshCPU mesh_cpu;
-    mesh_cpu.file_path = FilePath(name, FilePathLocation_Symbolic);
-    int quad_count = segments.size() - 1;
-    mesh_cpu.vertices.reserve(quad_count * 6);
-    mesh_cpu.indices.reserve(quad_count * 6);
+MeshCPU generate_formatted_line(Camera* camera, vector<FormattedVertex> vertices) {
+    string name = fmt_("line_hash:{:#x}", hash_data(vertices.data(), vertices.bsize()));
     
-    for (int i = 0, j = 0; i < segments.size() - 1; i++) {
-        Segment& seg1 = segments[i+0];
-        Segment& seg2 = segments[i+1];
-        if (seg1.separate || seg2.separate)
-            continue;
+    if (!(vertices.size() >= 2))
+        return {};
 
-        mesh_cpu.vertices.emplace_back(seg1.left, v3(0,0,1), v3(1,0,0), seg1.color.rgb, v2(0));
-        mesh_cpu.vertices.emplace_back(seg1.right, v3(0,0,1), v3(1,0,0), seg1.color.rgb, v2(0));
-        mesh_cpu.vertices.emplace_back(seg2.right, v3(0,0,1), v3(1,0,0), seg2.color.rgb, v2(0));
-        mesh_cpu.vertices.emplace_back(seg1.left, v3(0,0,1), v3(1,0,0), seg1.color.rgb, v2(0));
-        mesh_cpu.vertices.emplace_back(seg2.right, v3(0,0,1), v3(1,0,0), seg2.color.rgb, v2(0));
-        mesh_cpu.vertices.emplace_back(seg2.left, v3(0,0,1), v3(1,0,0), seg2.color.rgb, v2(0));
-        mesh_cpu.indices.push_back(j*6+0);
-        mesh_cpu.indices.push_back(j*6+1);
-        mesh_cpu.indices.push_back(j*6+2);
-        mesh_cpu.indices.push_back(j*6+3);
-        mesh_cpu.indices.push_back(j*6+4);
-        mesh_cpu.indices.push_back(j*6+5);
-        j++;
-    }
+    MeshCPU mesh_cpu;
+    mesh_cpu.file_path = FilePath(name, FilePathLocation_Symbolic);
+    append_formatted_line(camera, vertices, mesh_cpu.vertices, mesh_cpu.indices);
     return mesh_cpu;
 }
 
@@ -786,13 +789,8 @@ void draw_path(RenderScene& render_scene, Path& path, const v3& pos) {
         {path.get_real_target(pos), palette::spellbook_1, 0.05f}
     };
 
-    auto line_mesh1 = generate_formatted_line(render_scene.viewport.camera, std::move(path_waypoints_vertices));
-    if (!line_mesh1.vertices.empty())
-        render_scene.quick_mesh(line_mesh1, true, true);
-
-    auto line_mesh2 = generate_formatted_line(render_scene.viewport.camera, std::move(target_vec_vertices));
-    if (!line_mesh2.vertices.empty())
-        render_scene.quick_mesh(line_mesh2, true, true);
+    render_scene.draw_line(render_scene.viewport.camera, path_waypoints_vertices, true);
+    render_scene.draw_line(render_scene.viewport.camera, target_vec_vertices, true);
 }
 
 
@@ -34,6 +34,8 @@ MeshCPU generate_cube(v3 center, v3 extents, Color vertex_color = palette::black
 MeshCPU generate_cylinder(v3 center, uint8 rotations, Color vertex_color = palette::black, v3 cap_axis = v3::Z, v3 axis_1 = v3::X, v3 axis_2 = v3::Y);
 MeshCPU generate_icosphere(int subdivisions);
 MeshCPU generate_formatted_line(Camera* camera, vector<FormattedVertex> vertices);
+// Appends the camera facing line as indexed quads, for batching many lines into one buffer
+void append_formatted_line(Camera* camera, const vector<FormattedVertex>& vertices, vector<Vertex>& out_vertices, vector<uint32>& out_indices);
 MeshCPU generate_formatted_dot(Camera* camera, FormattedVertex vertex);
 MeshCPU generate_formatted_3d_bitmask(Camera* camera, const Bitmask3D& bitmask);
 MeshCPU generate_outline(Camera* camera, const Bitmask3D& bitmask, const vector<v3i>& places, const Color& color, float thickness);
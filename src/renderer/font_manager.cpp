@@ -1,140 +1,290 @@
 ﻿#include "font_manager.hpp"
 
-#include <stb_rect_pack.h>
+#include <algorithm>
+#include <chrono>
+#include <imgui.h>
+#include <tracy/Tracy.hpp>
 #include <vuk/Context.hpp>
 
 #include "extension/fmt.hpp"
 #include "general/logger.hpp"
-#include "general/math/noise.hpp"
+#include "general/math/matrix_math.hpp"
 #include "renderer/gpu_asset_cache.hpp"
 #include "renderer/renderer.hpp"
 #include "renderer/render_scene.hpp"
 
 namespace spellbook {
 
+bool FontManager::setup_glyphs() {
+    auto error = FT_Init_FreeType(&library);
+    if (error)
+        return false;
+    atlas.reset(v2i(GlyphAtlas::initial_size));
+    return true;
+}
+
 void FontManager::setup() {
     if (initialized)
         return;
     initialized = true;
-    auto error = FT_Init_FreeType(&library);
-    if (error) {
+    if (!setup_glyphs()) {
         log_warning("Font manager initialization failure");
         return;
     }
 
     {
         vuk::PipelineBaseCreateInfo pci;
-        pci.add_glsl(get_contents("shaders/ui.vert"_distributed), "shaders/ui.vert"_distributed.abs_string());
-        pci.add_glsl(get_contents("shaders/ui.frag"_distributed), "shaders/ui.frag"_distributed.abs_string());
+        get_renderer().add_shader(pci, "shaders/ui.vert"_distributed);
+        get_renderer().add_shader(pci, "shaders/ui.frag"_distributed);
         get_renderer().context->create_named_pipeline("ui", pci);
     }
+    {
+        vuk::PipelineBaseCreateInfo pci;
+        get_renderer().add_shader(pci, "shaders/ui.vert"_distributed);
+        get_renderer().add_shader(pci, "shaders/text.frag"_distributed);
+        get_renderer().context->create_named_pipeline("text", pci);
+    }
 }
 
+void GlyphAtlas::reset(v2i size) {
+    texture.file_path = FilePath("font_atlas", FilePathLocation_Symbolic);
+    texture.format = vuk::Format::eR8Unorm;
+    texture.needs_mips = false;
+    texture.size = size;
+    texture.pixels.clear();
+    texture.pixels.resize(size.x * size.y);
+    id = hash_path(texture.file_path);
+
+    packer_nodes.resize(size.x);
+    stbrp_init_target(&packer, size.x, size.y, packer_nodes.data(), packer_nodes.size());
+    generation++;
+    glyph_count = 0;
+    used_pixels = 0;
+    dirty = true;
+    full = false;
+}
 
-Font* FontManager::load_font(const FilePath& path, uint32 font_size) {
-    FontRequestInfo request = {path, font_size};
-
-    FT_Face face;
-    string path_abs_string = path.abs_string();
-    auto error = FT_New_Face(library, path_abs_string.c_str(), 0, &face);
-    if (error) {
-        log_warning("Font loading error");
-        return nullptr;
+bool GlyphAtlas::pack(v2i size, v2i& position) {
+    // One pixel gutter so filtering never reads the neighboring glyph
+    stbrp_rect rect = {.w = size.x + 1, .h = size.y + 1};
+    if (stbrp_pack_rects(&packer, &rect, 1) != 1) {
+        full = true;
+        return false;
     }
+    position = {rect.x, rect.y};
+    glyph_count++;
+    used_pixels += rect.w * rect.h;
+    return true;
+}
 
-    fonts[request] = Font{};
-    Font& font = fonts.at(request);
-    font.size = font_size;
-
-    error = FT_Set_Pixel_Sizes(face, 0, font_size);
-
-    if (error) {
-        log_warning("Font size setting error");
-        FT_Done_Face(face);
-        return nullptr;
+// One dimensional squared distance transform of sampled function f, Felzenszwalb and Huttenlocher
+static void _distance_transform_1d(const float* f, float* d, int32* v, float* z, int32 n) {
+    int32 k = 0;
+    v[0] = 0;
+    z[0] = -FLT_MAX;
+    z[1] = FLT_MAX;
+    for (int32 q = 1; q < n; q++) {
+        float s = ((f[q] + q * q) - (f[v[k]] + v[k] * v[k])) / float(2 * q - 2 * v[k]);
+        while (s <= z[k]) {
+            k--;
+            s = ((f[q] + q * q) - (f[v[k]] + v[k] * v[k])) / float(2 * q - 2 * v[k]);
+        }
+        k++;
+        v[k] = q;
+        z[k] = s;
+        z[k + 1] = FLT_MAX;
     }
+    k = 0;
+    for (int32 q = 0; q < n; q++) {
+        while (z[k + 1] < q)
+            k++;
+        d[q] = float((q - v[k]) * (q - v[k])) + f[v[k]];
+    }
+}
 
-    TextureCPU texture;
-    texture.file_path = FilePath(fmt_("{}_font_size:{}", path.abs_string(), font_size), FilePathLocation_Symbolic);
-    font.id = hash_path(texture.file_path);
-
-    vector<vector<uint8>> glyph_buffers;
-    vector<stbrp_rect> rects;
-    for (uint16 i = 0; i < 128; i++) {
-        error = FT_Load_Char(face, i, FT_LOAD_RENDER);
-        if (error) {
-            glyph_buffers.push_back({});
-            continue;
-        }
+// Squared distance from every cell to the nearest cell with a zero in field, in place
+static void _distance_transform(vector<float>& field, v2i size) {
+    int32 n = std::max(size.x, size.y);
+    vector<float> f(n), d(n), z(n + 1);
+    vector<int32> v(n);
+    for (int32 x = 0; x < size.x; x++) {
+        for (int32 y = 0; y < size.y; y++)
+            f[y] = field[y * size.x + x];
+        _distance_transform_1d(f.data(), d.data(), v.data(), z.data(), size.y);
+        for (int32 y = 0; y < size.y; y++)
+            field[y * size.x + x] = d[y];
+    }
+    for (int32 y = 0; y < size.y; y++) {
+        _distance_transform_1d(&field[y * size.x], d.data(), v.data(), z.data(), size.x);
+        memcpy(&field[y * size.x], d.data(), size.x * sizeof(float));
+    }
+}
 
-        error = FT_Render_Glyph(face->glyph, FT_RENDER_MODE_NORMAL);
-        if (error) {
-            continue;
+const Glyph& FontFace::get_glyph(uint32 codepoint) {
+    if (generation != atlas->generation) {
+        glyphs.clear();
+        generation = atlas->generation;
+    }
+    auto it = glyphs.find(codepoint);
+    if (it != glyphs.end())
+        return it->second;
+
+    Glyph& glyph = glyphs[codepoint];
+    glyph = {};
+    constexpr int32 supersample = GlyphAtlas::supersample;
+    constexpr int32 spread = GlyphAtlas::spread;
+    // Unhinted, so the outline and metrics scale to every size
+    if (FT_Load_Char(face, codepoint, FT_LOAD_NO_HINTING | FT_LOAD_RENDER))
+        return glyph;
+    glyph.mesh_advance = {int32(std::lround(face->glyph->advance.x / (64.0f * supersample))), 0};
+    const FT_Bitmap& bitmap = face->glyph->bitmap;
+    if (bitmap.width == 0 || bitmap.rows == 0)
+        return glyph;
+
+    // The outline rasterized at supersample times the base size, with the spread as padding around it in base pixels
+    v2i bitmap_size = {int32(bitmap.width), int32(bitmap.rows)};
+    v2i start = {int32(std::floor(float(face->glyph->bitmap_left) / supersample)) - spread, -int32(std::ceil(float(face->glyph->bitmap_top) / supersample)) - spread};
+    v2i end = {int32(std::ceil(float(face->glyph->bitmap_left + bitmap_size.x) / supersample)) + spread, -int32(std::floor(float(face->glyph->bitmap_top - bitmap_size.y) / supersample)) + spread};
+    v2i size = {end.x - start.x, end.y - start.y};
+    // Drawn blank until the atlas grows at the end of the frame, after which it's paged again
+    if (!atlas->pack(size, glyph.atlas_position))
+        return glyph;
+
+    v2i fine_size = size * supersample;
+    v2i offset = {face->glyph->bitmap_left - start.x * supersample, -face->glyph->bitmap_top - start.y * supersample};
+    vector<float> outside(fine_size.x * fine_size.y, FLT_MAX);
+    vector<float> inside(fine_size.x * fine_size.y, 0.0f);
+    for (int32 y = 0; y < bitmap_size.y; y++) {
+        for (int32 x = 0; x < bitmap_size.x; x++) {
+            if (bitmap.buffer[y * bitmap.pitch + x] < 128)
+                continue;
+            int32 index = (offset.y + y) * fine_size.x + offset.x + x;
+            outside[index] = 0.0f;
+            inside[index] = FLT_MAX;
         }
-
-        auto& bitmap = face->glyph->bitmap;
-        v2i size = {int32(bitmap.width), int32(bitmap.rows)};
-        font.glyphs[i] = Glyph{
-            .atlas_position = {}, // Written in write glyphs step
-            .atlas_size = size,
-            .mesh_offset = {face->glyph->bitmap_left, -face->glyph->bitmap_top},
-            .mesh_size = size,
-            .mesh_advance = {face->glyph->advance.x / 64, face->glyph->advance.y}
-        };
-        glyph_buffers.push_back(vector<uint8>{bitmap.buffer, bitmap.buffer + bitmap.width * bitmap.rows});
-        rects.push_back(stbrp_rect{
-            .id = i,
-            .w = size.x,
-            .h = size.y
-        });
     }
-
-    // pack rects
-    stbrp_context rp_context;
-    stbrp_node nodes_storage[1000];
-    stbrp_init_target(&rp_context, 500, 1000, nodes_storage, 1000);
-    auto code = stbrp_pack_rects(&rp_context, rects.data(), rects.size());
-    if (code != 1) {
-        log_warning("Font atlas packing error");
-        FT_Done_Face(face);
-        return nullptr;
+    _distance_transform(outside, fine_size);
+    _distance_transform(inside, fine_size);
+
+    // Each base pixel averages the signed distance of the four fine pixels around its center
+    for (int32 y = 0; y < size.y; y++) {
+        uint8* dst = atlas->texture.pixels.data() + (glyph.atlas_position.y + y) * atlas->texture.size.x + glyph.atlas_position.x;
+        for (int32 x = 0; x < size.x; x++) {
+            float distance = 0.0f;
+            for (int32 i = 0; i < 4; i++) {
+                int32 index = (y * supersample + supersample / 2 - 1 + i / 2) * fine_size.x + x * supersample + supersample / 2 - 1 + i % 2;
+                // Fine pixel centers are half a pixel from the edge they border
+                distance += outside[index] > 0.0f ? 0.5f - std::sqrt(outside[index]) : std::sqrt(inside[index]) - 0.5f;
+            }
+            distance /= 4.0f * supersample;
+            dst[x] = uint8(std::clamp(0.5f + distance / (2.0f * spread), 0.0f, 1.0f) * 255.0f + 0.5f);
+        }
     }
+    glyph.atlas_size = size;
+    glyph.mesh_offset = v2(start);
+    glyph.mesh_size = v2(size);
+    atlas->dirty = true;
+    return glyph;
+}
 
-    // get total image size
-    for (const stbrp_rect& rect : rects) {
-        texture.size = math::max(texture.size, v2i{rect.x + rect.w, rect.y + rect.h});
+const Glyph& Font::get_glyph(uint32 codepoint) {
+    if (generation != face->atlas->generation) {
+        glyphs.clear();
+        generation = face->atlas->generation;
     }
-    texture.pixels.resize(texture.size.x * texture.size.y);
-    font.atlas_size = texture.size;
-
-    // write glyphs
-    for (const stbrp_rect& rect : rects) {
-        font.glyphs[rect.id].atlas_position = {rect.x, rect.y};
-        for (int32 y = 0; y < rect.h; y++) {
-            vector<uint8>& atlas_dst = texture.pixels;
-            uint32 dst_offset = (rect.y + y) * texture.size.x + (rect.x);
-
-            vector<uint8>& glyph_src = glyph_buffers[rect.id];
-            uint32 src_offset = y * rect.w;
+    auto it = glyphs.find(codepoint);
+    if (it != glyphs.end())
+        return it->second;
+
+    Glyph glyph = face->get_glyph(codepoint);
+    float scale = float(size) / float(GlyphAtlas::base_size);
+    glyph.mesh_offset = glyph.mesh_offset * scale;
+    glyph.mesh_size = glyph.mesh_size * scale;
+    glyph.mesh_advance = math::round_cast(v2(glyph.mesh_advance) * scale);
+    return glyphs[codepoint] = glyph;
+}
 
-            memcpy(atlas_dst.data() + dst_offset, glyph_src.data() + src_offset, rect.w);
+Font* FontManager::load_font(const FilePath& path, uint32 font_size) {
+    FontRequestInfo request = {path, font_size};
+    if (fonts.contains(request))
+        return &fonts.at(request);
+
+    uint64 face_id = hash_path(path);
+    auto face_it = faces.find(face_id);
+    if (face_it == faces.end()) {
+        FT_Face face;
+        string path_abs_string = path.abs_string();
+        auto error = FT_New_Face(library, path_abs_string.c_str(), 0, &face);
+        if (error) {
+            log_warning("Font loading error");
+            return nullptr;
+        }
+        error = FT_Set_Pixel_Sizes(face, 0, GlyphAtlas::base_size * GlyphAtlas::supersample);
+        if (error) {
+            log_warning("Font size setting error");
+            FT_Done_Face(face);
+            return nullptr;
         }
+        auto font_face = std::make_unique<FontFace>();
+        font_face->face = face;
+        font_face->atlas = &atlas;
+        font_face->generation = atlas.generation;
+        face_it = faces.emplace(face_id, std::move(font_face)).first;
     }
 
-    texture.format = vuk::Format::eR8Srgb;
-    texture.needs_mips = false;
+    fonts[request] = Font{};
+    Font& font = fonts.at(request);
+    font.size = font_size;
+    font.face = face_it->second.get();
+    font.generation = atlas.generation;
+    font.id = hash_path(FilePath(fmt_("{}_font_size:{}", path.abs_string(), font_size), FilePathLocation_Symbolic));
+    return &font;
+}
 
-    upload_texture(texture, false);
-    Sampler sampler = Sampler().address(Address_Clamp).filter(Filter_Nearest).mips(false);
-    TextureGPU* texture_gpu = get_gpu_asset_cache().get_texture(font.id);
+void FontManager::flush_atlas() {
+    ZoneScoped;
+    if (!atlas.dirty)
+        return;
+    atlas.dirty = false;
 
-    font.image = vuk::make_sampled_image(texture_gpu->value.view.get(), sampler.get());
+    upload_texture(atlas.texture, false);
+    Sampler sampler = Sampler().address(Address_Clamp).filter(Filter_Linear).mips(false);
+    TextureGPU* texture_gpu = get_gpu_asset_cache().get_texture(atlas.id);
+    atlas.image = vuk::make_sampled_image(texture_gpu->value.view.get(), sampler.get());
 
-    FT_Done_Face(face);
+    // The material holds the previous image
+    get_gpu_asset_cache().erase_material(atlas.id);
+    make_ui_material(atlas.id, atlas.image, "text");
+}
 
-    make_ui_material(font.id, font.image);
+void FontManager::end_frame() {
+    text_meshes.end_frame();
+    if (!atlas.full)
+        return;
+    if (atlas.texture.size.x >= GlyphAtlas::max_size) {
+        log_warning("Font atlas is full");
+        atlas.full = false;
+        return;
+    }
+    // Retained text meshes hold atlas coordinates, so they're rebuilt along with the glyphs
+    text_meshes.clear();
+    atlas.reset(atlas.texture.size * 2);
+}
 
-    return &font;
+uint32 _next_codepoint(string_view text, uint32& index) {
+    uint8 lead = text[index];
+    uint32 length = lead < 0x80 ? 1 : (lead >> 5) == 0x6 ? 2 : (lead >> 4) == 0xE ? 3 : (lead >> 3) == 0x1E ? 4 : 0;
+    if (length == 0 || index + length > text.size())
+        return 0xFFFD;
+    uint32 codepoint = length == 1 ? lead : lead & (0x7F >> length);
+    for (uint32 i = 1; i < length; i++) {
+        uint8 next = text[index + i];
+        if ((next & 0xC0) != 0x80)
+            return 0xFFFD;
+        codepoint = (codepoint << 6) | (next & 0x3F);
+    }
+    index += length - 1;
+    return codepoint;
 }
 
 range2i calc_text_region(const vector<string>& strings, const vector<Font*>& fonts, v2i position) {
@@ -145,7 +295,8 @@ range2i calc_text_region(const vector<string>& strings, const vector<Font*>& fon
     for (uint32 i = 0; i < strings.size(); i++) {
         const string& text = strings[i];
         Font* font = fonts[i];
-        for (char c : text) {
+        for (uint32 j = 0; j < text.size(); j++) {
+            uint32 c = _next_codepoint(text, j);
             if (reading_tag) {
                 if (c == '}') {
                     reading_tag = false;
@@ -162,10 +313,10 @@ range2i calc_text_region(const vector<string>& strings, const vector<Font*>& fon
                 position.y += font->size;
                 continue;
             }
-            Glyph& glyph = font->glyphs[c];
+            const Glyph& glyph = font->get_glyph(c);
 
-            v2i char_start = position + glyph.mesh_offset;
-            v2i char_end = char_start + glyph.mesh_size;
+            v2i char_start = position + math::round_cast(glyph.mesh_offset);
+            v2i char_end = char_start + math::round_cast(glyph.mesh_size);
 
             if (!region_initialized) {
                 region.start = math::min(char_start, char_end);
@@ -181,7 +332,7 @@ range2i calc_text_region(const vector<string>& strings, const vector<Font*>& fon
     }
     return region;
 }
-inline void _generate_text_mesh_add_quad(MeshUICPU& mesh, v2i top_left, v2i bottom_right, v2 uv_start, v2 uv_end, int32 depth, Color32 col) {
+inline void _generate_text_mesh_add_quad(MeshUICPU& mesh, v2 top_left, v2 bottom_right, v2 uv_start, v2 uv_end, int32 depth, Color32 col) {
     uint32 start_index = mesh.vertices.size();
     mesh.vertices.emplace_back(v3(top_left.x, top_left.y, depth), v2(uv_start.x, uv_start.y), col);
     mesh.vertices.emplace_back(v3(bottom_right.x, top_left.y, depth), v2(uv_end.x, uv_start.y), col);
@@ -222,28 +373,33 @@ inline void _read_tag(TextFormatState& state, umap<uint64, vector<TooltipRegion>
     state.tag.clear();
 }
 
-vector<Renderable*> upload_text_mesh(const vector<string>& strings, const vector<Font*>& fonts, v2i position, int32 depth, float distortion_amount, float distortion_time, umap<uint64, vector<TooltipRegion>>* tooltip_regions, uint64* hovered_id, uint32* hovered_index, RenderScene& render_scene, bool frame_allocated) {
-    v2i start_position = position;
-
-    vector<Renderable*> renderables;
+// Lays the text out from the origin, the distortion is applied per glyph by the ui shader
+static TextMesh _build_text_mesh(const vector<string>& strings, const vector<Font*>& fonts, int32 depth, uint64 id_seed, uint64* hovered_id, uint32* hovered_index, bool frame_allocated) {
+    v2i start_position = v2i(0);
+    v2i position = start_position;
+    TextMesh text_mesh;
+    umap<uint64, vector<TooltipRegion>> tooltip_regions;
 
     uint32 char_index = 0;
     for (uint8 i = 0; i < strings.size(); i++) {
         string_view text = strings[i];
-        const Font& font = *fonts[i];
+        Font& font = *fonts[i];
+        v2 atlas_size = v2(font.face->atlas->texture.size);
 
         MeshUICPU mesh_base = {};
         MeshUICPU mesh_shadow = {};
 
         TextFormatState state = {};
-        for (char c : text) {
+        for (uint32 j = 0; j < text.size(); j++) {
+            uint32 char_offset = j;
+            uint32 c = _next_codepoint(text, j);
             if (state.reading_tag) {
                 if (c == '}') {
-                    _read_tag(state, tooltip_regions, char_index);
+                    _read_tag(state, &tooltip_regions, char_index);
                     state.reading_tag = false;
                     continue;
                 }
-                state.tag.push_back(c);
+                state.tag.append(text.substr(char_offset, j + 1 - char_offset));
                 continue;
             }
             if (c == '{') {
@@ -260,9 +416,11 @@ vector<Renderable*> upload_text_mesh(const vector<string>& strings, const vector
                 state.lift += 2;
             }
 
-            const Glyph& glyph = font.glyphs[c];
-            v2i char_start = position + glyph.mesh_offset + v2i(0, -state.lift);
-            v2i char_end = char_start + glyph.mesh_size;
+            const Glyph& glyph = font.get_glyph(c);
+            v2 quad_start = v2(position + v2i(0, -state.lift)) + glyph.mesh_offset;
+            v2 quad_end = quad_start + glyph.mesh_size;
+            v2i char_start = math::round_cast(quad_start);
+            v2i char_end = math::round_cast(quad_end);
             if (state.tooltip != nullptr) {
                 if (!state.tooltip_initiated) {
                     state.tooltip->region = {char_start, char_end + v2i(0, state.lift)};
@@ -273,48 +431,273 @@ vector<Renderable*> upload_text_mesh(const vector<string>& strings, const vector
                     math::expand(state.tooltip->region, char_end + v2i(0, state.lift));
                 }
             }
-            v2 uv_start = v2(glyph.atlas_position) / v2(font.atlas_size);
-            v2 uv_end = v2(glyph.atlas_position + glyph.atlas_size) / v2(font.atlas_size);
-
-            v2 char_center = v2(char_start + char_end) / 2.0f;
-            v2 offset = {
-                distortion_amount * (1.0f - 2.0f * fractal_perlin_noise(v3(char_center, distortion_time), 0.02f, 2, 0.5f, 0)),
-                distortion_amount * (1.0f - 2.0f * fractal_perlin_noise(v3(char_center, distortion_time), 0.02f, 2, 0.5f, 1))
-            };
-            v2i offset_i = math::round_cast(offset);
+            v2 uv_start = v2(glyph.atlas_position) / atlas_size;
+            v2 uv_end = v2(glyph.atlas_position + glyph.atlas_size) / atlas_size;
 
-            _generate_text_mesh_add_quad(mesh_base, char_start + offset_i, char_end + offset_i, uv_start, uv_end, depth, state.color);
+            _generate_text_mesh_add_quad(mesh_base, quad_start, quad_end, uv_start, uv_end, depth, state.color);
             if (state.shadow)
-                _generate_text_mesh_add_quad(mesh_shadow, char_start + offset_i + v2i(2), char_end + offset_i + v2i(2), uv_start, uv_end, depth - 1, Color32(0, 0, 0, 127));
+                _generate_text_mesh_add_quad(mesh_shadow, quad_start + v2(2.0f), quad_end + v2(2.0f), uv_start, uv_end, depth - 1, Color32(0, 0, 0, 127));
             position.x += glyph.mesh_advance.x;
         }
-        mesh_base.id = hash_view(text) ^ font.id;
-        mesh_shadow.id = hash_view(text) ^ font.id ^ hash_view("shadow");
+        mesh_base.id = id_seed ^ hash_view(text) ^ font.id;
+        mesh_shadow.id = id_seed ^ hash_view(text) ^ font.id ^ hash_view("shadow");
 
         if (!mesh_base.vertices.empty()) {
             upload_mesh(mesh_base, frame_allocated);
-            Renderable r = {};
-            r.mesh_id = mesh_base.id;
-            r.material_id = font.id;
-            r.frame_allocated = frame_allocated;
-            r.sort_index = depth;
-
-            render_scene.ui_renderables.push_back(r);
-            renderables.push_back(&render_scene.ui_renderables.back());
+            text_mesh.parts.push_back({mesh_base.id, font.material_id(), depth});
         }
         if (!mesh_shadow.vertices.empty()) {
             upload_mesh(mesh_shadow, frame_allocated);
-            Renderable r = {};
-            r.mesh_id = mesh_shadow.id;
-            r.material_id = font.id;
-            r.frame_allocated = frame_allocated;
-            r.sort_index = depth - 1;
-
-            render_scene.ui_renderables.push_back(r);
-            renderables.push_back(&render_scene.ui_renderables.back());
+            text_mesh.parts.push_back({mesh_shadow.id, font.material_id(), depth - 1});
         }
     }
+    for (const auto& [id, regions] : tooltip_regions)
+        for (const TooltipRegion& region : regions)
+            text_mesh.tooltips.push_back(region);
+    return text_mesh;
+}
+
+static uint64 _text_mesh_key(const vector<string>& strings, const vector<Font*>& fonts, int32 depth, uint64* hovered_id, uint32* hovered_index) {
+    constexpr uint64 mix = 0x9E3779B97F4A7C15ull;
+    uint64 key = uint64(depth) * mix;
+    bool has_tooltips = false;
+    for (uint32 i = 0; i < strings.size(); i++) {
+        key = (key ^ hash_view(strings[i]) ^ fonts[i]->id) * mix;
+        has_tooltips |= strings[i].find("{tip=") != string::npos;
+    }
+    // Hovering lifts the hovered tooltip's text, so only text with tooltips depends on it
+    if (has_tooltips && hovered_id && hovered_index)
+        key = (key ^ *hovered_id ^ (uint64(*hovered_index) << 32)) * mix;
+    return key;
+}
+
+vector<Renderable*> upload_text_mesh(const vector<string>& strings, const vector<Font*>& fonts, v2i position, int32 depth, float distortion_amount, float distortion_time, umap<uint64, vector<TooltipRegion>>* tooltip_regions, uint64* hovered_id, uint32* hovered_index, RenderScene& render_scene, bool frame_allocated) {
+    TextMeshCache& cache = get_font_manager().text_meshes;
+    // Only frame allocated renderables can use retained meshes, since those are released when unused
+    bool retained = frame_allocated && cache.enabled;
+
+    TextMesh uncached;
+    TextMesh* text_mesh = &uncached;
+    if (retained) {
+        uint64 key = _text_mesh_key(strings, fonts, depth, hovered_id, hovered_index);
+        auto it = cache.meshes.find(key);
+        if (it == cache.meshes.end()) {
+            it = cache.meshes.emplace(key, _build_text_mesh(strings, fonts, depth, key, hovered_id, hovered_index, false)).first;
+            cache.misses++;
+        } else {
+            cache.hits++;
+        }
+        text_mesh = &it->second;
+        text_mesh->last_used = cache.frame;
+    } else {
+        uncached = _build_text_mesh(strings, fonts, depth, 0, hovered_id, hovered_index, frame_allocated);
+    }
+
+    if (tooltip_regions) {
+        for (TooltipRegion tooltip : text_mesh->tooltips) {
+            tooltip.region.start += position;
+            tooltip.region.end += position;
+            (*tooltip_regions)[tooltip.id].push_back(tooltip);
+        }
+    }
+
+    vector<Renderable*> renderables;
+    for (const TextMesh::Part& part : text_mesh->parts) {
+        Renderable r = {};
+        r.mesh_id = part.mesh_id;
+        r.material_id = part.material_id;
+        r.transform = m44GPU(math::translate(v3(v2(position), 0.0f)));
+        r.ui_distortion = v2(distortion_amount, distortion_time);
+        r.frame_allocated = frame_allocated;
+        r.sort_index = part.depth;
+
+        render_scene.ui_renderables.push_back(r);
+        renderables.push_back(&render_scene.ui_renderables.back());
+    }
     return renderables;
 }
 
+void TextMeshCache::end_frame() {
+    frame++;
+    if (meshes.size() <= capacity)
+        return;
+    // Drop down to three quarters so eviction doesn't run every frame
+    vector<std::pair<uint64, uint64>> by_age;
+    for (const auto& [key, text_mesh] : meshes)
+        by_age.emplace_back(text_mesh.last_used, key);
+    uint32 evict_count = meshes.size() - capacity * 3 / 4;
+    std::nth_element(by_age.begin(), by_age.begin() + evict_count, by_age.end());
+    for (uint32 i = 0; i < evict_count; i++) {
+        for (const TextMesh::Part& part : meshes[by_age[i].second].parts)
+            get_gpu_asset_cache().erase_mesh(part.mesh_id);
+        meshes.erase(by_age[i].second);
+    }
+}
+
+void TextMeshCache::clear() {
+    for (const auto& [key, text_mesh] : meshes)
+        for (const TextMesh::Part& part : text_mesh.parts)
+            get_gpu_asset_cache().erase_mesh(part.mesh_id);
+    meshes.clear();
+}
+
+void inspect(TextMeshCache* cache) {
+    ImGui::Checkbox("Enabled", &cache->enabled);
+    int capacity = cache->capacity;
+    if (ImGui::DragInt("Capacity", &capacity, 1.0f, 16, 65536))
+        cache->capacity = capacity;
+    ImGui::Text("Meshes: %u", uint32(cache->meshes.size()));
+    ImGui::Text("Hits: %u, Misses: %u", cache->hits, cache->misses);
+    if (ImGui::Button("Clear"))
+        cache->clear();
+}
+
+string benchmark_text(int label_count, int frames) {
+    using clock = std::chrono::steady_clock;
+    auto ms = [](auto from, auto to) { return std::chrono::duration<double, std::milli>(to - from).count(); };
+    FontManager& font_manager = get_font_manager();
+    Font* font = font_manager.load_font("resources/fonts/t.ttf"_content, 20);
+    if (font == nullptr)
+        return "font loading failed";
+
+    // A shop or tooltip heavy screen, a tenth of the labels are counters that change every frame
+    RenderScene render_scene;
+    vector<string> strings(1);
+    vector<Font*> fonts = {font};
+    auto run = [&](bool enabled) {
+        font_manager.text_meshes.enabled = enabled;
+        auto t0 = clock::now();
+        for (int frame = 0; frame < frames; frame++) {
+            for (int i = 0; i < label_count; i++) {
+                strings[0] = i % 10 == 0 ? fmt_("{{col=ffaa00}}Counter {}: {}", i, frame) : fmt_("{{shadow}}Label {}{{\\shadow}} with some text", i);
+                upload_text_mesh(strings, fonts, v2i(i % 40 * 50, i / 40 * 24), 500, 0.0f, 0.0f, nullptr, nullptr, nullptr, render_scene, true);
+            }
+            render_scene.ui_renderables.clear();
+            get_gpu_asset_cache().clear_frame_allocated_assets();
+            font_manager.text_meshes.end_frame();
+        }
+        return ms(t0, clock::now()) / frames;
+    };
+    bool was_enabled = font_manager.text_meshes.enabled;
+    double rebuilt = run(false);
+    double retained = run(true);
+    uint32 cached = font_manager.text_meshes.meshes.size();
+    font_manager.text_meshes.enabled = was_enabled;
+
+    return fmt_("{} labels: rebuilt {:.3f}ms/frame, retained {:.3f}ms/frame with {} cached meshes", label_count, rebuilt, retained, cached);
+}
+
+string verify_sdf_glyphs(int min_size, int max_size) {
+    using clock = std::chrono::steady_clock;
+    auto ms = [](auto from, auto to) { return std::chrono::duration<double, std::milli>(to - from).count(); };
+    FilePath path = "resources/fonts/t.ttf"_content;
+    string path_abs_string = path.abs_string();
+
+    // Printable ASCII and Latin-1
+    vector<uint32> codepoints;
+    for (uint32 c = 33; c < 127; c++)
+        codepoints.push_back(c);
+    for (uint32 c = 161; c < 256; c++)
+        codepoints.push_back(c);
+    vector<int32> sizes;
+    for (int size = min_size; size <= max_size; size += std::max((max_size - min_size) / 5, 1))
+        sizes.push_back(size);
+
+    FontManager manager;
+    if (!manager.setup_glyphs())
+        return "FreeType initialization failed";
+    FT_Face reference;
+    if (FT_New_Face(manager.library, path_abs_string.c_str(), 0, &reference)) {
+        FT_Done_FreeType(manager.library);
+        return "font loading failed";
+    }
+
+    // One atlas per size, as fonts were loaded before
+    auto t0 = clock::now();
+    uint64 per_size_bytes = 0;
+    for (int32 size : sizes) {
+        FT_Set_Pixel_Sizes(reference, 0, size);
+        vector<stbrp_rect> rects;
+        for (uint32 c : codepoints) {
+            if (FT_Load_Char(reference, c, FT_LOAD_RENDER))
+                continue;
+            rects.push_back({.id = int(c), .w = int(reference->glyph->bitmap.width), .h = int(reference->glyph->bitmap.rows)});
+        }
+        stbrp_context context;
+        vector<stbrp_node> nodes(1024);
+        stbrp_init_target(&context, 1024, 4096, nodes.data(), nodes.size());
+        stbrp_pack_rects(&context, rects.data(), rects.size());
+        v2i extent = {};
+        for (const stbrp_rect& rect : rects)
+            extent = math::max(extent, v2i{rect.x + rect.w, rect.y + rect.h});
+        per_size_bytes += extent.x * extent.y;
+    }
+    auto t1 = clock::now();
+    for (int32 size : sizes) {
+        Font* font = manager.load_font(path, size);
+        for (uint32 c : codepoints)
+            font->get_glyph(c);
+    }
+    auto t2 = clock::now();
+
+    // Sample the atlas the way text.frag does, at the centers of the pixels FreeType rasterizes directly
+    const TextureCPU& atlas = manager.atlas.texture;
+    auto sample = [&atlas](v2 texel) {
+        texel = texel - v2(0.5f);
+        v2i base = v2i(int32(std::floor(texel.x)), int32(std::floor(texel.y)));
+        v2 t = texel - v2(base);
+        auto at = [&atlas](int32 x, int32 y) {
+            x = std::clamp(x, 0, atlas.size.x - 1);
+            y = std::clamp(y, 0, atlas.size.y - 1);
+            return float(atlas.pixels[y * atlas.size.x + x]) / 255.0f;
+        };
+        float top = at(base.x, base.y) * (1.0f - t.x) + at(base.x + 1, base.y) * t.x;
+        float bottom = at(base.x, base.y + 1) * (1.0f - t.x) + at(base.x + 1, base.y + 1) * t.x;
+        return top * (1.0f - t.y) + bottom * t.y;
+    };
+
+    string result;
+    for (int32 size : sizes) {
+        Font* font = manager.load_font(path, size);
+        FT_Set_Pixel_Sizes(reference, 0, size);
+        double error = 0.0;
+        uint64 pixels = 0;
+        uint64 ink = 0;
+        uint64 flipped = 0;
+        for (uint32 c : codepoints) {
+            const Glyph& glyph = font->get_glyph(c);
+            if (glyph.atlas_size.x == 0 || FT_Load_Char(reference, c, FT_LOAD_RENDER | FT_LOAD_NO_HINTING))
+                continue;
+            const FT_Bitmap& bitmap = reference->glyph->bitmap;
+            v2 texels_per_pixel = v2(glyph.atlas_size) / glyph.mesh_size;
+            float width = texels_per_pixel.x / (2.0f * GlyphAtlas::spread);
+            // One pixel border catches coverage outside the reference bitmap
+            for (int32 y = -1; y <= int32(bitmap.rows); y++) {
+                for (int32 x = -1; x <= int32(bitmap.width); x++) {
+                    bool inside = x >= 0 && y >= 0 && x < int32(bitmap.width) && y < int32(bitmap.rows);
+                    float expected = inside ? float(bitmap.buffer[y * bitmap.pitch + x]) / 255.0f : 0.0f;
+                    v2 pixel = v2(reference->glyph->bitmap_left + x, -reference->glyph->bitmap_top + y) + v2(0.5f);
+                    v2 texel = v2(glyph.atlas_position) + (pixel - glyph.mesh_offset) * texels_per_pixel;
+                    float coverage = std::clamp((sample(texel) - 0.5f) / width + 0.5f, 0.0f, 1.0f);
+                    error += std::abs(coverage - expected);
+                    pixels++;
+                    ink += expected > 0.5f;
+                    flipped += (expected > 0.5f) != (coverage > 0.5f);
+                }
+            }
+        }
+        result += fmt_("{}px: {:.4f} mean coverage error, {:.1f}% of ink flipped\n", size, error / std::max(pixels, uint64(1)), 100.0 * flipped / std::max(ink, uint64(1)));
+    }
+
+    uint64 atlas_bytes = atlas.pixels.size();
+    result += fmt_("{} glyphs at {} sizes: per size atlases {}KB built in {:.2f}ms, shared atlas {}KB ({}KB used) built in {:.2f}ms",
+        codepoints.size(), sizes.size(), per_size_bytes / 1024, ms(t0, t1), atlas_bytes / 1024, manager.atlas.used_pixels / 1024, ms(t1, t2));
+
+    FT_Done_Face(reference);
+    for (auto& [id, face] : manager.faces)
+        FT_Done_Face(face->face);
+    FT_Done_FreeType(manager.library);
+    return result;
+}
+
 }
\ No newline at end of file
@@ -1,13 +1,16 @@
 ﻿#pragma once
 
+#include <memory>
 #include <ft2build.h>
 #include <freetype/freetype.h>
+#include <stb_rect_pack.h>
 #include <vuk/SampledImage.hpp>
 
 #include "general/file/file_path.hpp"
 #include "general/math/geometry.hpp"
 #include "renderer/renderable.hpp"
 #include "renderer/assets/mesh.hpp"
+#include "renderer/assets/texture.hpp"
 
 namespace spellbook {
 
@@ -33,31 +36,117 @@ struct std::hash<spellbook::FontRequestInfo> {
 
 namespace spellbook {
 
+// The quad is in pixels for the font's size, the atlas rect holds the distance field at the atlas' base size
 struct Glyph {
     v2i atlas_position;
     v2i atlas_size;
-    v2i mesh_offset;
-    v2i mesh_size;
+    v2  mesh_offset;
+    v2  mesh_size;
     v2i mesh_advance;
 };
 
+// Signed distance field glyphs of every font, generated once at base_size and scaled to any font size.
+// Glyphs are paged in the first time they're laid out, the texture is uploaded by FontManager::flush_atlas.
+struct GlyphAtlas {
+    static constexpr uint32 base_size    = 48;
+    // Distance in base size pixels covered by the field on either side of the outline
+    static constexpr int32  spread       = 6;
+    // Outlines are rasterized this many times finer than the field to measure distances
+    static constexpr int32  supersample  = 4;
+    static constexpr int32  initial_size = 1024;
+    static constexpr int32  max_size     = 4096;
+
+    uint64 id = 0;
+    TextureCPU texture;
+    stbrp_context packer;
+    vector<stbrp_node> packer_nodes;
+    vuk::SampledImage image = vuk::SampledImage(vuk::SampledImage::Global{});
+
+    // Bumped when the atlas is cleared, cached glyphs from older generations are paged in again
+    uint32 generation = 0;
+    uint32 glyph_count = 0;
+    uint64 used_pixels = 0;
+    // Pixels changed since the last upload
+    bool dirty = false;
+    // A glyph didn't fit, the atlas grows on the next flush
+    bool full = false;
+
+    void reset(v2i size);
+    // Returns false if the rect didn't fit
+    bool pack(v2i size, v2i& position);
+};
+
+// A font file opened once at the supersampled base size, its glyphs are shared by every size of it
+struct FontFace {
+    FT_Face face = nullptr;
+    GlyphAtlas* atlas = nullptr;
+    umap<uint32, Glyph> glyphs;
+    uint32 generation = 0;
+
+    const Glyph& get_glyph(uint32 codepoint);
+};
+
 struct Font {
     uint64 id;
     int32 size;
-    std::array<Glyph, 128> glyphs;
-    vuk::SampledImage image = vuk::SampledImage(vuk::SampledImage::Global{});
-    v2i atlas_size;
+    FontFace* face = nullptr;
+    umap<uint32, Glyph> glyphs;
+    uint32 generation = 0;
+
+    const Glyph& get_glyph(uint32 codepoint);
+    uint64 material_id() const { return face->atlas->id; }
+};
+
+struct TooltipRegion {
+    range2i region;
+    uint32 index;
+    uint64 id;
+};
+
+// Text mesh uploaded once and drawn at an offset, with tooltip regions relative to that offset
+struct TextMesh {
+    struct Part {
+        uint64 mesh_id;
+        uint64 material_id;
+        int32  depth;
+    };
+    vector<Part> parts;
+    vector<TooltipRegion> tooltips;
+    uint64 last_used = 0;
+};
+
+// Retained meshes for text drawn every frame, keyed by the strings, fonts, depth and hover state.
+// Least recently used meshes are released at the end of a frame once over capacity.
+struct TextMeshCache {
+    bool   enabled  = true;
+    uint32 capacity = 4096;
+    uint64 frame    = 0;
+    umap<uint64, TextMesh> meshes;
+    uint32 hits = 0;
+    uint32 misses = 0;
+
+    void end_frame();
+    void clear();
 };
 
 struct FontManager {
     bool initialized = false;
 
     FT_Library library;
+    umap<uint64, std::unique_ptr<FontFace>> faces;
     umap<FontRequestInfo, Font> fonts;
+    GlyphAtlas atlas;
+    TextMeshCache text_meshes;
 
     void setup();
+    // FreeType and the atlas, enough to lay out text without a renderer
+    bool setup_glyphs();
 
     Font* load_font(const FilePath& path, uint32 font_size);
+    // Uploads glyphs paged in since the last flush, called before rendering
+    void flush_atlas();
+    // Releases unused text meshes, and grows the atlas if a glyph didn't fit
+    void end_frame();
 };
 
 inline FontManager& get_font_manager() {
@@ -65,12 +154,6 @@ inline FontManager& get_font_manager() {
     return font_manager;
 }
 
-struct TooltipRegion {
-    range2i region;
-    uint32 index;
-    uint64 id;
-};
-
 struct TextFormatState {
     bool reading_tag = false;
     string tag = "";
@@ -86,5 +169,15 @@ vector<Renderable*> upload_text_mesh(const vector<string>& strings, const vector
 
 char _read_color_char(string_view s, int8 index);
 uint8 _interpret_hex_char(char c);
+// Decodes the UTF-8 sequence at index, leaving index on its last byte
+uint32 _next_codepoint(string_view text, uint32& index);
+
+void inspect(TextMeshCache* cache);
+
+// Uploads labels that mostly stay the same, with a few changing text every frame, with and without the cache
+string benchmark_text(int labels, int frames);
+// Compares coverage of the scaled distance field glyphs against FreeType rasterizing each size directly,
+// along with the memory and build time of one atlas per size, headless
+string verify_sdf_glyphs(int min_size, int max_size);
 
 }
\ No newline at end of file
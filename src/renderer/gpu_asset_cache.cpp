@@ -1,41 +1,152 @@
 ﻿#include "gpu_asset_cache.hpp"
 
+#include <algorithm>
+#include <imgui.h>
+#include <tracy/Tracy.hpp>
+
+#include "extension/fmt.hpp"
 #include "general/logger.hpp"
 
 #include "renderer/draw_functions.hpp"
+#include "renderer/renderer.hpp"
 #include "renderer/assets/material.hpp"
+#include "renderer/assets/texture_compression.hpp"
 
 namespace spellbook {
 
+template <typename T>
+static T* _find_asset(umap<uint64, T>& assets, umap<uint64, T>& transient, uint64 id, uint64 frame_index) {
+    auto it = assets.find(id);
+    if (it != assets.end()) {
+        it->second.last_used = frame_index;
+        return &it->second;
+    }
+    auto transient_it = transient.find(id);
+    return transient_it != transient.end() ? &transient_it->second : nullptr;
+}
+
+template <typename T>
+static T& _add_asset(umap<uint64, T>& assets, umap<uint64, T>& transient, GPUAssetCache::Residency& residency, uint64 id, T&& asset, uint64 frame_index) {
+    asset.last_used = frame_index;
+    if (asset.frame_allocated)
+        return transient[id] = std::move(asset);
+    auto it = assets.find(id);
+    if (it != assets.end()) {
+        residency.resident_bsize -= it->second.bsize;
+        residency.resident_count--;
+    }
+    residency.resident_bsize += asset.bsize;
+    residency.resident_count++;
+    return assets[id] = std::move(asset);
+}
+
+template <typename T>
+static void _erase_asset(umap<uint64, T>& assets, umap<uint64, T>& transient, GPUAssetCache::Residency& residency, uint64 id) {
+    auto it = assets.find(id);
+    if (it == assets.end()) {
+        transient.erase(id);
+        return;
+    }
+    residency.resident_bsize -= it->second.bsize;
+    residency.resident_count--;
+    assets.erase(it);
+}
+
 MeshGPU* GPUAssetCache::get_mesh(uint64 id) {
-    if (meshes.contains(id))
-        return &meshes[id];
-    return nullptr;
+    return _find_asset(meshes, frame.meshes, id, frame_index);
 }
 
 MaterialGPU* GPUAssetCache::get_material(uint64 id) {
-    if (materials.contains(id))
-        return &materials.at(id);
-    return nullptr;
+    return _find_asset(materials, frame.materials, id, frame_index);
 }
 
 TextureGPU* GPUAssetCache::get_texture(uint64 id) {
+    return _find_asset(textures, frame.textures, id, frame_index);
+}
+
+void GPUAssetCache::_record_reloadable(uint64 id, bool frame_allocated) {
+    if (frame_allocated)
+        return;
+    auto it = paths.find(id);
+    if (it != paths.end() && it->second.is_file() && fs::exists(it->second.abs_path()))
+        reloadable.insert(id);
+    else
+        reloadable.erase(id);
+}
+
+MeshGPU& GPUAssetCache::add_mesh(uint64 id, MeshGPU&& mesh) {
+    _record_reloadable(id, mesh.frame_allocated);
+    return _add_asset(meshes, frame.meshes, residency[AssetKind_Mesh], id, std::move(mesh), frame_index);
+}
+
+MaterialGPU& GPUAssetCache::add_material(uint64 id, MaterialGPU&& material) {
+    material.bsize = sizeof(MaterialGPU) + material.extra_material_data.size();
+    _record_reloadable(id, material.frame_allocated);
+    return _add_asset(materials, frame.materials, residency[AssetKind_Material], id, std::move(material), frame_index);
+}
+
+TextureGPU& GPUAssetCache::add_texture(uint64 id, TextureGPU&& texture) {
+    _record_reloadable(id, texture.frame_allocated);
+    return _add_asset(textures, frame.textures, residency[AssetKind_Texture], id, std::move(texture), frame_index);
+}
+
+void GPUAssetCache::erase_mesh(uint64 id) {
+    if (meshes.contains(id))
+        reloadable.erase(id);
+    _erase_asset(meshes, frame.meshes, residency[AssetKind_Mesh], id);
+}
+
+void GPUAssetCache::erase_material(uint64 id) {
+    set_material_textures(id, {});
+    if (materials.contains(id))
+        reloadable.erase(id);
+    _erase_asset(materials, frame.materials, residency[AssetKind_Material], id);
+}
+
+void GPUAssetCache::erase_texture(uint64 id) {
     if (textures.contains(id))
-        return &textures[id];
-    return nullptr;
+        reloadable.erase(id);
+    _erase_asset(textures, frame.textures, residency[AssetKind_Texture], id);
+}
+
+void GPUAssetCache::acquire(uint64 id) {
+    refs[id]++;
+}
+
+void GPUAssetCache::release(uint64 id) {
+    auto it = refs.find(id);
+    assert_else(it != refs.end())
+        return;
+    if (--it->second == 0)
+        refs.erase(it);
+}
+
+void GPUAssetCache::set_material_textures(uint64 material_id, vector<uint64> texture_ids) {
+    // Acquired first so textures shared by the old and new sets never drop to zero
+    for (uint64 texture_id : texture_ids)
+        acquire(texture_id);
+    auto it = material_textures.find(material_id);
+    if (it != material_textures.end()) {
+        for (uint64 texture_id : it->second)
+            release(texture_id);
+    }
+    if (texture_ids.empty())
+        material_textures.erase(material_id);
+    else
+        material_textures[material_id] = std::move(texture_ids);
 }
 
 MeshGPU& GPUAssetCache::get_mesh_or_upload(uint64 id) {
-    if (meshes.contains(id))
-        return meshes[id];
+    if (MeshGPU* mesh = get_mesh(id))
+        return *mesh;
     assert_else(paths.contains(id));
-    upload_mesh(load_mesh(paths[id]));
-    return meshes[id];
+    loader.request(AssetKind_Mesh, id, paths[id]);
+    return meshes[hash_path("default"_symbolic)];
 }
 
 MaterialGPU& GPUAssetCache::get_material_or_upload(uint64 id) {
-    if (materials.contains(id))
-        return materials.at(id);
+    if (MaterialGPU* material = get_material(id))
+        return *material;
     assert_else(paths.contains(id));
     upload_material(load_resource<MaterialCPU>(paths.at(id)));
     return materials.at(id);
@@ -44,12 +155,68 @@ MaterialGPU& GPUAssetCache::get_material_or_upload(uint64 id) {
 TextureGPU& GPUAssetCache::get_texture_or_upload(const FilePath& asset_path) {
     assert_else(asset_path.is_file());
     uint64 hash = hash_path(asset_path);
-    if (textures.contains(hash))
-        return textures[hash];
-    upload_texture(load_texture(asset_path));
+    pinned.insert(hash);
+    if (TextureGPU* texture = get_texture(hash))
+        return *texture;
+    TextureCPU texture_cpu = load_texture(asset_path);
+    if (!get_renderer().bc_supported)
+        decompress_texture(texture_cpu);
+    upload_texture(texture_cpu);
     return textures[hash];
 }
 
+TextureGPU& GPUAssetCache::get_texture_or_request(const FilePath& asset_path, uint64 dependent_material) {
+    assert_else(asset_path.is_file());
+    uint64 hash = hash_path(asset_path);
+    if (TextureGPU* texture = get_texture(hash))
+        return *texture;
+    loader.request(AssetKind_Texture, hash, asset_path);
+    if (dependent_material != 0)
+        texture_dependents[hash].insert(dependent_material);
+    return textures[hash_path("white"_symbolic)];
+}
+
+void GPUAssetCache::flush_loads() {
+    ZoneScoped;
+    loader.take_results(ready);
+    uint64 uploaded = 0;
+    uint32 taken = 0;
+    for (; taken < ready.size() && uploaded < upload_budget; taken++) {
+        AssetLoader::Result& result = ready[taken];
+        if (!result.error.empty()) {
+            // Broken containers keep the stand in, json fallback can't read them either
+            log_error(result.error, "renderer");
+            loader.finish(result.id);
+            continue;
+        }
+        // Legacy json files are loaded here, see AssetLoader
+        if (result.kind == AssetKind_Mesh) {
+            if (!result.loaded)
+                result.mesh = load_mesh(result.path);
+            upload_mesh(result.mesh);
+            uploaded += result.mesh.vertices.bsize() + result.mesh.packed_vertices.bsize() + result.mesh.indices.bsize();
+        } else {
+            if (!result.loaded) {
+                result.texture = load_texture(result.path);
+                if (!get_renderer().bc_supported)
+                    decompress_texture(result.texture);
+            }
+            upload_texture(result.texture);
+            uploaded += result.texture.pixels.bsize();
+            if (texture_dependents.contains(result.id)) {
+                for (uint64 material_id : texture_dependents[result.id]) {
+                    MaterialGPU* material = get_material(material_id);
+                    if (material && paths.contains(material_id))
+                        material->update_from_cpu(load_resource<MaterialCPU>(paths.at(material_id)));
+                }
+                texture_dependents.erase(result.id);
+            }
+        }
+        loader.finish(result.id);
+    }
+    ready.erase(ready.begin(), ready.begin() + taken);
+}
+
 
 void GPUAssetCache::upload_defaults() {
     TextureCPU tex_white_upload {
@@ -96,35 +263,114 @@ void GPUAssetCache::upload_defaults() {
     MeshCPU default_mesh   = generate_cube(v3(0), v3(1));
     default_mesh.file_path = "default"_symbolic;
     upload_mesh(default_mesh);
+
+    // Stand ins for whatever is still loading, never evicted
+    for (const FilePath& path : {"white"_symbolic, "grid"_symbolic, "default"_symbolic})
+        pinned.insert(hash_path(path));
 }
 
 void GPUAssetCache::clear_frame_allocated_assets() {
-    auto mesh_it = meshes.begin();
-    while (mesh_it != meshes.end()) {
-        if (mesh_it->second.frame_allocated)
-            mesh_it = meshes.erase(mesh_it);
-        else
-            mesh_it++;
+    for (const auto& [id, material] : frame.materials)
+        set_material_textures(id, {});
+    frame.meshes.clear();
+    frame.materials.clear();
+    frame.textures.clear();
+}
+
+void GPUAssetCache::end_frame() {
+    ZoneScoped;
+    clear_frame_allocated_assets();
+    // Materials first, evicting them releases their textures
+    evict(AssetKind_Material);
+    evict(AssetKind_Mesh);
+    evict(AssetKind_Texture);
+    frame_index++;
+}
+
+void GPUAssetCache::evict(AssetKind kind) {
+    Residency& budget = residency[kind];
+    if (budget.resident_bsize <= budget.budget)
+        return;
+    ZoneScoped;
+
+    // Only what can be loaded again from disk, oldest first
+    vector<std::pair<uint64, uint64>> by_age;
+    auto collect = [&](auto& assets) {
+        for (const auto& [id, asset] : assets) {
+            if (refs.contains(id) || pinned.contains(id) || asset.last_used + eviction_grace_frames > frame_index)
+                continue;
+            if (!reloadable.contains(id))
+                continue;
+            by_age.emplace_back(asset.last_used, id);
+        }
+    };
+    switch (kind) {
+        case AssetKind_Mesh: collect(meshes); break;
+        case AssetKind_Material: collect(materials); break;
+        case AssetKind_Texture: collect(textures); break;
+        default: return;
     }
-    auto tex_it = textures.begin();
-    while (tex_it != textures.end()) {
-        if (tex_it->second.frame_allocated)
-            tex_it = textures.erase(tex_it);
-        else
-            tex_it++;
+    std::sort(by_age.begin(), by_age.end());
+
+    for (const auto& [last_used, id] : by_age) {
+        if (budget.resident_bsize <= budget.budget)
+            break;
+        switch (kind) {
+            case AssetKind_Mesh: erase_mesh(id); break;
+            case AssetKind_Material: erase_material(id); break;
+            case AssetKind_Texture: erase_texture(id); break;
+            default: break;
+        }
+        budget.evictions++;
     }
-    auto mat_it = materials.begin();
+}
 
-    while (mat_it != materials.end()) {
-        if (mat_it->second.frame_allocated)
-            mat_it = materials.erase(mat_it);
-        else
-            mat_it++;
+void inspect(GPUAssetCache* cache) {
+    const char* names[AssetKind_Count] = {"Meshes", "Textures", "Materials"};
+    if (ImGui::BeginTable("residency", 5, ImGuiTableFlags_Borders | ImGuiTableFlags_RowBg)) {
+        ImGui::TableSetupColumn("Class");
+        ImGui::TableSetupColumn("Count");
+        ImGui::TableSetupColumn("Resident");
+        ImGui::TableSetupColumn("Budget");
+        ImGui::TableSetupColumn("Evictions");
+        ImGui::TableHeadersRow();
+        for (uint32 kind = 0; kind < AssetKind_Count; kind++) {
+            GPUAssetCache::Residency& residency = cache->residency[kind];
+            ImGui::TableNextRow();
+            ImGui::TableNextColumn();
+            ImGui::Text("%s", names[kind]);
+            ImGui::TableNextColumn();
+            ImGui::Text("%u", residency.resident_count);
+            ImGui::TableNextColumn();
+            ImGui::ProgressBar(float(residency.resident_bsize) / float(residency.budget), ImVec2(-FLT_MIN, 0), fmt_("{:.1f}MB", residency.resident_bsize / 1048576.0).c_str());
+            ImGui::TableNextColumn();
+            ImGui::Text("%.0fMB", residency.budget / 1048576.0);
+            ImGui::TableNextColumn();
+            ImGui::Text("%u", residency.evictions);
+        }
+        ImGui::EndTable();
     }
+    ImGui::Text("Frame arena: %u meshes, %u materials, %u textures", uint32(cache->frame.meshes.size()), uint32(cache->frame.materials.size()), uint32(cache->frame.textures.size()));
+    ImGui::Text("Referenced: %u, pinned: %u", uint32(cache->refs.size()), uint32(cache->pinned.size()));
+    ImGui::Text("Loads pending: %u, ready: %u", uint32(cache->loader.pending.size()), uint32(cache->ready.size()));
 }
 
 
 void GPUAssetCache::clear() {
+    loader.stop();
+    ready.clear();
+    texture_dependents.clear();
+    frame.meshes.clear();
+    frame.materials.clear();
+    frame.textures.clear();
+    refs.clear();
+    material_textures.clear();
+    pinned.clear();
+    reloadable.clear();
+    for (Residency& budget : residency) {
+        budget.resident_bsize = 0;
+        budget.resident_count = 0;
+    }
     meshes.clear();
     materials.clear();
     textures.clear();
@@ -7,27 +7,94 @@
 #include "assets/mesh.hpp"
 #include "assets/material.hpp"
 #include "assets/texture.hpp"
+#include "asset_loader.hpp"
 
 namespace spellbook {
 
 struct GPUAssetCache {
+    // Persistent assets, over budget the least recently used ones that nothing references are evicted
     umap<uint64, MeshGPU>     meshes;
     umap<uint64, MaterialGPU> materials;
     umap<uint64, TextureGPU>  textures;
     umap<uint64, FilePath>    paths;
 
+    // Frame allocated assets live apart so the end of frame reset never walks the persistent maps
+    struct FrameArena {
+        umap<uint64, MeshGPU>     meshes;
+        umap<uint64, MaterialGPU> materials;
+        umap<uint64, TextureGPU>  textures;
+    };
+    FrameArena frame;
+
+    struct Residency {
+        uint64 budget;
+        uint64 resident_bsize = 0;
+        uint32 resident_count = 0;
+        uint32 evictions      = 0;
+    };
+    // Indexed by AssetKind
+    Residency residency[AssetKind_Count] = {{256 * 1024 * 1024}, {512 * 1024 * 1024}, {8 * 1024 * 1024}};
+
+    // Held by renderables on their mesh and material, and by materials on their textures
+    umap<uint64, uint32>         refs;
+    umap<uint64, vector<uint64>> material_textures;
+    // Defaults and textures whose views are kept outside of materials
+    uset<uint64> pinned;
+    // Persistent assets that had a file on disk when they were added, only these are evicted
+    uset<uint64> reloadable;
+    // The GPU may still be reading what was drawn in the last frames in flight
+    uint32 eviction_grace_frames = 3;
+    uint64 frame_index = 0;
+
+    AssetLoader loader;
+    // Loaded but over the frame's upload budget
+    vector<AssetLoader::Result> ready;
+    // Materials sampling the placeholder until the texture is resident
+    umap<uint64, uset<uint64>> texture_dependents;
+    uint64 upload_budget = 32 * 1024 * 1024;
+
     void upload_defaults();
+    // Lookups mark persistent assets as used this frame
     MeshGPU* get_mesh(uint64 id);
     MaterialGPU* get_material(uint64 id);
     TextureGPU* get_texture(uint64 id);
+    // Requests the mesh and returns the default cube until it's resident, draws skip it meanwhile
     MeshGPU& get_mesh_or_upload(uint64 id);
+    // The material is uploaded right away, its textures are requested
     MaterialGPU& get_material_or_upload(uint64 id);
+    // Blocks on the load and pins the texture, for textures whose view is kept outside a material
     TextureGPU& get_texture_or_upload(const FilePath& asset_path);
+    // Returns white until the texture is resident, then the dependent material is rebuilt
+    TextureGPU& get_texture_or_request(const FilePath& asset_path, uint64 dependent_material = 0);
+
+    // Frame allocated assets go to the arena, anything else is counted against its budget
+    MeshGPU&     add_mesh(uint64 id, MeshGPU&& mesh);
+    MaterialGPU& add_material(uint64 id, MaterialGPU&& material);
+    TextureGPU&  add_texture(uint64 id, TextureGPU&& texture);
+    void erase_mesh(uint64 id);
+    void erase_material(uint64 id);
+    void erase_texture(uint64 id);
+    // Set the asset's path before adding it, the file is checked here so eviction never touches the disk
+    void _record_reloadable(uint64 id, bool frame_allocated);
+
+    void acquire(uint64 id);
+    void release(uint64 id);
+    // Takes references on the material's textures and drops the ones on its previous textures
+    void set_material_textures(uint64 material_id, vector<uint64> texture_ids);
+
+    // Uploads finished loads within the budget, once per frame so the transfers go out in one submit
+    void flush_loads();
+    bool loads_pending() const { return !loader.pending.empty(); }
 
     void clear_frame_allocated_assets();
+    // Resets the frame arena, then evicts down to the budgets
+    void end_frame();
+    void evict(AssetKind kind);
     void clear();
 };
 
+void inspect(GPUAssetCache* cache);
+
 inline GPUAssetCache& get_gpu_asset_cache() {
     static GPUAssetCache gpu_asset_cache;
     return gpu_asset_cache;
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <algorithm>
+#include <tuple>
 #include <plf_colony.h>
 #include <vuk/vuk_fwd.hpp>
 #include <vuk/Buffer.hpp>
@@ -10,9 +12,12 @@
 #include "general/math/geometry.hpp"
 #include "general/math/quaternion.hpp"
 #include "general/color.hpp"
+#include "general/umap.hpp"
 
 #include "renderer/viewport.hpp"
 #include "renderer/renderable.hpp"
+#include "renderer/aabb_tree.hpp"
+#include "renderer/vertex.hpp"
 #include "renderer/assets/particles.hpp"
 
 namespace spellbook {
@@ -23,6 +28,8 @@ using mat_id = uint64;
 struct MeshCPU;
 struct MaterialCPU;
 struct SkeletonGPU;
+struct Camera;
+struct FormattedVertex;
 
 struct SceneData {
     Color ambient;
@@ -53,6 +60,95 @@ struct PostProcessData {
     float time;
 };
 
+enum RenderView {
+    RenderView_Camera,
+    RenderView_Sun,
+    RenderView_Top,
+    RenderView_Count
+};
+
+// Renderables bucketed by material then mesh. Patched as renderables are added and removed instead of being
+// rebuilt every frame, each item remembers its index in its batch so removal is a swap.
+template <typename T>
+struct DrawList {
+    struct Batch {
+        mat_id     material;
+        mesh_id    mesh;
+        uint32     first_instance = 0;
+        vector<T*> items;
+    };
+    vector<Batch> batches;
+    uint32 count = 0;
+    // Set when membership changes and the batches need new instance ranges
+    bool layout_dirty = false;
+
+    auto _lower_bound(mat_id material, mesh_id mesh) {
+        return std::lower_bound(batches.begin(), batches.end(), std::tie(material, mesh), [](const Batch& batch, const auto& key) {
+            return std::tie(batch.material, batch.mesh) < key;
+        });
+    }
+
+    void add(T* item) {
+        auto it = _lower_bound(item->material_id, item->mesh_id);
+        if (it == batches.end() || it->material != item->material_id || it->mesh != item->mesh_id)
+            it = batches.insert(it, Batch{item->material_id, item->mesh_id});
+        item->draw_index = it->items.size();
+        it->items.push_back(item);
+        count++;
+        layout_dirty = true;
+    }
+
+    void remove(T* item) {
+        auto it = _lower_bound(item->material_id, item->mesh_id);
+        assert_else(it != batches.end() && item->draw_index < it->items.size() && it->items[item->draw_index] == item)
+            return;
+        T* last = it->items.back();
+        it->items[item->draw_index] = last;
+        last->draw_index = item->draw_index;
+        it->items.pop_back();
+        item->draw_index = UINT32_MAX;
+        if (it->items.empty())
+            batches.erase(it);
+        count--;
+        layout_dirty = true;
+    }
+
+    // Gives each batch a contiguous range of instances
+    void layout() {
+        uint32 first = 0;
+        for (Batch& batch : batches) {
+            batch.first_instance = first;
+            first += batch.items.size();
+        }
+        layout_dirty = false;
+    }
+
+    void clear() {
+        for (Batch& batch : batches)
+            for (T* item : batch.items)
+                item->draw_index = UINT32_MAX;
+        batches.clear();
+        count = 0;
+        layout_dirty = true;
+    }
+};
+
+// Frame allocated lines appended into one vertex and index buffer, drawn with a single call
+struct LineBatch {
+    vector<Vertex> vertices;
+    vector<uint32> indices;
+    vuk::Buffer vertex_buffer;
+    vuk::Buffer index_buffer;
+    // Indices uploaded this frame, lines added after setup are dropped with the frame
+    uint32 index_count = 0;
+
+    void clear() {
+        vertices.clear();
+        indices.clear();
+        index_count = 0;
+    }
+};
+
 struct RenderScene {
     string              name;
     
@@ -78,6 +174,8 @@ struct RenderScene {
 
     bool render_grid = false;
     bool render_widgets = true;
+    // Never set up or rendered, quick draws are recorded without uploading anything
+    bool headless = false;
 
     vuk::Buffer buffer_camera_data;
     vuk::Buffer buffer_sun_camera_data;
@@ -87,17 +185,44 @@ struct RenderScene {
     vuk::Buffer buffer_ids;
     vuk::Buffer buffer_ui_view;
 
-    struct BuiltRenderable {
-        uint32 id;
-        m44GPU* mat;
-    };
-    struct BuiltRiggedRenderable {
-        uint32 id;
-        m44GPU* mat;
-        SkeletonGPU* skeleton;
+    // Every skeleton's palette packed into one buffer per frame, indexed per dynamic instance by the offsets
+    vuk::Buffer buffer_bones;
+    vuk::Buffer buffer_bone_offsets;
+    umap<SkeletonGPU*, uint32> skeleton_offsets;
+    uint32 bone_count = 0;
+
+    DrawList<StaticRenderable> static_draws;
+    DrawList<Renderable> draws;
+    DrawList<Renderable> rigged_draws;
+
+    // Static instances persist across frames, only the dirty range is copied in. Each frame in flight gets its own
+    // copy, so the range is never written while the GPU may still be reading it.
+    struct StaticInstanceBuffer {
+        vuk::Unique<vuk::Buffer> model_mats;
+        uint32 capacity = 0;
+        uint32 dirty_start = UINT32_MAX;
+        uint32 dirty_end = 0;
     };
-    umap<mat_id, umap<mesh_id, vector<BuiltRenderable>>> renderables_built;
-    umap<mat_id, umap<mesh_id, vector<BuiltRiggedRenderable>>> rigged_renderables_built;
+    // Matches the renderer's frames in flight
+    static constexpr uint32 static_instance_frames = 3;
+    StaticInstanceBuffer static_instance_buffers[static_instance_frames];
+    uint32 static_instance_frame = 0;
+    // Statics aren't selectable, so one zeroed buffer serves every frame
+    vuk::Unique<vuk::Buffer> buffer_static_ids;
+    uint32 static_capacity = 0;
+
+    // Renderables without mesh bounds have no proxy and are never culled
+    AABBTree culling_tree;
+    uset<StaticRenderable*> unbounded_statics;
+    bool culling_enabled = true;
+    uint32 cull_frame = 0;
+    m44GPU view_projections[RenderView_Count];
+    uint32 visible_counts[RenderView_Count] = {};
+
+    LineBatch lines;
+    LineBatch widget_lines;
+    // Identity transform placed after the dynamic instances for the line batches
+    uint32 line_model_index = 0;
 
     void        setup(vuk::Allocator& allocator);
     void        image(v2i size);
@@ -121,20 +246,39 @@ struct RenderScene {
 
     void        cleanup(vuk::Allocator& allocator);
 
-    Renderable* add_renderable(const Renderable& renderable);
-    void        delete_renderable(Renderable* renderable);
-    void        delete_renderable(StaticRenderable* renderable);
+    Renderable*       add_renderable(const Renderable& renderable);
+    StaticRenderable* add_static_renderable(const StaticRenderable& renderable);
+    void              delete_renderable(Renderable* renderable);
+    void              delete_renderable(StaticRenderable* renderable);
+    // Static transforms must go through here so the instance buffer is updated
+    void              set_transform(StaticRenderable* renderable, const m44GPU& transform);
+    void              delete_frame_allocated();
 
     Renderable& quick_mesh(const MeshCPU& mesh_cpu, bool frame_allocated, bool widget);
     Renderable& quick_material(const MaterialCPU& material_cpu, bool frame_allocated);
     Renderable& quick_renderable(const MeshCPU& mesh_id, uint64 mat_id, bool frame_allocated);
     Renderable& quick_renderable(uint64 mesh_id, uint64 mat_id, bool frame_allocated);
     Renderable& quick_renderable(uint64 mesh_id, const MaterialCPU& mat_id, bool frame_allocated);
+    // Cleared with the other frame allocated renderables
+    void        draw_line(Camera* camera, const vector<FormattedVertex>& vertices, bool widget = false);
 
     void _upload_buffer_objects(vuk::Allocator& frame_allocator);
+    void _upload_static_instances();
+    void _mark_static_dirty(uint32 start, uint32 end);
+    void _render_draws(vuk::CommandBuffer& command_buffer, RenderView view, bool bind_materials);
+
+    void cull();
+    bool is_visible(const Visibility& visibility, RenderView view) const;
 
 
     void setup_renderables_for_passes(vuk::Allocator& allocator);
 };
 
+// CPU time to prepare instance buffers and draw lists for the given number of static and dynamic renderables
+string benchmark_render_scene(int renderables, int frames);
+// Packing cost and draw count for animated models sharing a mesh and material
+string benchmark_skinning(int models, int frames);
+// Per line meshes against the shared line batch
+string benchmark_lines(int lines, int frames);
+
 }
@@ -36,7 +36,7 @@ void render_widget(Renderable& renderable, vuk::CommandBuffer& command_buffer, i
 
     // Bind mesh
     command_buffer
-        .bind_vertex_buffer(0, mesh->vertex_buffer.get(), 0, Vertex::get_widget_format())
+        .bind_vertex_buffer(0, mesh->vertex_buffer.get(), 0, mesh->layout == VertexLayout_Packed ? VertexPacked::get_widget_format() : Vertex::get_widget_format())
         .bind_index_buffer(mesh->index_buffer.get(), vuk::IndexType::eUint32);
 
     // Bind Material
@@ -10,10 +10,22 @@ struct MeshGPU;
 struct MaterialGPU;
 struct SkeletonGPU;
 
+// Culling state, see RenderScene::cull
+struct Visibility {
+    int32  proxy = -1;
+    uint32 frame = 0;
+    uint8  views = 0;
+};
+
 struct StaticRenderable {
     uint64 mesh_id;
     uint64 material_id;
     m44GPU transform = m44GPU(m44::identity());
+
+    // Position in the scene's draw list and static instance buffer, see RenderScene::set_transform
+    uint32 draw_index = UINT32_MAX;
+    uint32 instance_index = UINT32_MAX;
+    Visibility visibility;
 };
 
 struct Renderable {
@@ -27,6 +39,12 @@ struct Renderable {
     uint32 selection_id        = 0;
     int32 sort_index = 0;
 
+    uint32 draw_index = UINT32_MAX;
+    Visibility visibility;
+
+    // Text drawn by the ui pipeline, amount and time of the per glyph wobble
+    v2 ui_distortion = v2(0.0f);
+
     bool operator<(const Renderable& rhs) const {
         return sort_index < rhs.sort_index;
     }
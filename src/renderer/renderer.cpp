@@ -6,6 +6,8 @@
 #include <backends/imgui_impl_glfw.h>
 #include <tracy/Tracy.hpp>
 #include <stb_image.h>
+#include <fstream>
+#include <sstream>
 
 #include "extension/glfw.hpp"
 #include "extension/fmt.hpp"
@@ -16,6 +18,7 @@
 #include "general/logger.hpp"
 #include "general/input.hpp"
 #include "renderer/draw_functions.hpp"
+#include "renderer/font_manager.hpp"
 #include "renderer/render_scene.hpp"
 #include "renderer/samplers.hpp"
 #include "renderer/utils.hpp"
@@ -28,7 +31,14 @@ Renderer& get_renderer() {
     return renderer;
 }
 
+using clock = std::chrono::steady_clock;
+
+static double ms_since(clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(clock::now() - start).count();
+}
+
 Renderer::Renderer() : imgui_data() {
+    startup.start = clock::now();
     vkb::InstanceBuilder builder;
     builder
         .request_validation_layers(false)
@@ -72,10 +82,17 @@ Renderer::Renderer() : imgui_data() {
 
     selector.set_surface(surface)
             .set_minimum_version(1, 0)
-            .set_required_features(vkfeatures)
             .add_required_extension(VK_KHR_SYNCHRONIZATION_2_EXTENSION_NAME)
             .add_required_extension(VK_EXT_CONSERVATIVE_RASTERIZATION_EXTENSION_NAME);
-    auto phys_ret = selector.select();
+    // BC sampling is preferred but optional, the selector enables what it requires on the device
+    VkPhysicalDeviceFeatures bc_features = vkfeatures;
+    bc_features.textureCompressionBC = VK_TRUE;
+    auto phys_ret = selector.set_required_features(bc_features).select();
+    bc_supported = phys_ret.has_value();
+    if (!bc_supported) {
+        log_warning("Device can't sample BC textures, they're decoded on load", "renderer");
+        phys_ret = selector.set_required_features(vkfeatures).select();
+    }
     assert_else(phys_ret.has_value());
     vkb::PhysicalDevice vkbphysical_device = phys_ret.value();
     physical_device                        = vkbphysical_device.physical_device;
@@ -134,6 +151,60 @@ Renderer::Renderer() : imgui_data() {
 
     global_allocator->allocate_semaphores(*present_ready);
     global_allocator->allocate_semaphores(*render_complete);
+
+    load_pipeline_cache();
+    startup.device_ms = ms_since(startup.start);
+}
+
+void Renderer::load_pipeline_cache() {
+    std::ifstream file(("pipeline_cache.bin"_config).abs_path(), std::ios::binary | std::ios::ate);
+    if (!file)
+        return;
+    std::vector<std::byte> data(file.tellg());
+    file.seekg(0);
+    file.read((char*) data.data(), data.size());
+    // Drivers should reject a cache from another device themselves, not all of them do
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(physical_device, &properties);
+    VkPipelineCacheHeaderVersionOne header;
+    if (data.size() < sizeof(header))
+        return;
+    memcpy(&header, data.data(), sizeof(header));
+    if (header.headerVersion != VK_PIPELINE_CACHE_HEADER_VERSION_ONE || header.vendorID != properties.vendorID || header.deviceID != properties.deviceID ||
+        memcmp(header.pipelineCacheUUID, properties.pipelineCacheUUID, VK_UUID_SIZE) != 0) {
+        log_warning("Pipeline cache is from another device or driver, starting cold", "renderer");
+        return;
+    }
+    startup.warm = context->load_pipeline_cache(std::span(data));
+}
+
+void Renderer::save_pipeline_cache() {
+    std::vector<std::byte> data = context->save_pipeline_cache();
+    if (data.empty())
+        return;
+    FilePath cache_path = "pipeline_cache.bin"_config;
+    fs::create_directories(cache_path.abs_path().parent_path());
+    std::ofstream file(cache_path.abs_path(), std::ios::binary | std::ios::trunc);
+    file.write((const char*) data.data(), data.size());
+}
+
+void Renderer::add_shader(vuk::PipelineBaseCreateInfo& pci, const FilePath& path, bool packed_vertex) {
+    fs::path source = path.abs_path();
+    FilePath spirv_path = FilePath(source.parent_path() / "spirv" / (source.filename().string() + (packed_vertex ? ".packed.spv" : ".spv")));
+    // The build tracks includes with depfiles, here only the shader and the shared include are checked for later edits
+    std::error_code error;
+    fs::file_time_type spirv_time = fs::last_write_time(spirv_path.abs_path(), error);
+    if (!error && spirv_time >= fs::last_write_time(source) && spirv_time >= fs::last_write_time(("shaders/include.glsli"_distributed).abs_path())) {
+        pci.add_spirv(get_contents_uint32(spirv_path), path.abs_string());
+        startup.spirv_shaders++;
+        return;
+    }
+    string contents = get_contents(path);
+    // The define has to come after #version
+    if (packed_vertex)
+        contents.insert(contents.find('\n') + 1, "#define PACKED_VERTEX\n");
+    pci.add_glsl(contents, path.abs_string());
+    startup.glsl_shaders++;
 }
 
 void Renderer::enqueue_setup(vuk::Future&& fut) {
@@ -149,6 +220,7 @@ void Renderer::add_scene(RenderScene* scene) {
 }
 
 void Renderer::setup() {
+    auto setup_start = clock::now();
     IMGUI_CHECKVERSION();
     ImGui::CreateContext();
     ImGui::StyleColorsSpellbook();
@@ -172,42 +244,22 @@ void Renderer::setup() {
 
     {
         vuk::PipelineBaseCreateInfo pci;
-        pci.add_glsl(get_contents("shaders/postprocess.comp"_distributed), "shaders/postprocess.comp"_distributed.abs_string());
+        add_shader(pci, "shaders/postprocess.comp"_distributed);
         context->create_named_pipeline("postprocess", pci);
     }
     {
         vuk::PipelineBaseCreateInfo pci;
-        pci.add_glsl(get_contents("shaders/blur.comp"_distributed), "shaders/blur.comp"_distributed.abs_string());
+        add_shader(pci, "shaders/blur.comp"_distributed);
         context->create_named_pipeline("blur", pci);
     }
+    create_mesh_pipeline("textured_model", "shaders/standard_3d.vert"_distributed, "shaders/textured_3d.frag"_distributed);
+    create_mesh_pipeline("desert_rocks", "shaders/standard_3d.vert"_distributed, "shaders/desert_rocks.frag"_distributed);
+    create_mesh_pipeline("point_depth", "shaders/standard_3d.vert"_distributed, "shaders/point_depth.frag"_distributed);
+    create_mesh_pipeline("directional_depth", "shaders/directional_depth.vert"_distributed, "shaders/directional_depth.frag"_distributed);
     {
         vuk::PipelineBaseCreateInfo pci;
-        pci.add_glsl(get_contents("shaders/standard_3d.vert"_distributed), "shaders/standard_3d.vert"_distributed.abs_string());
-        pci.add_glsl(get_contents("shaders/textured_3d.frag"_distributed), "shaders/textured_3d.frag"_distributed.abs_string());
-        context->create_named_pipeline("textured_model", pci);
-    }
-    {
-        vuk::PipelineBaseCreateInfo pci;
-        pci.add_glsl(get_contents("shaders/standard_3d.vert"_distributed), "shaders/standard_3d.vert"_distributed.abs_string());
-        pci.add_glsl(get_contents("shaders/desert_rocks.frag"_distributed), "shaders/desert_rocks.frag"_distributed.abs_string());
-        context->create_named_pipeline("desert_rocks", pci);
-    }
-    {
-        vuk::PipelineBaseCreateInfo pci;
-        pci.add_glsl(get_contents("shaders/standard_3d.vert"_distributed), "shaders/standard_3d.vert"_distributed.abs_string());
-        pci.add_glsl(get_contents("shaders/point_depth.frag"_distributed), "shaders/point_depth.frag"_distributed.abs_string());
-        context->create_named_pipeline("point_depth", pci);
-    }
-    {
-        vuk::PipelineBaseCreateInfo pci;
-        pci.add_glsl(get_contents("shaders/directional_depth.vert"_distributed), "shaders/directional_depth.vert"_distributed.abs_string());
-        pci.add_glsl(get_contents("shaders/directional_depth.frag"_distributed), "shaders/directional_depth.frag"_distributed.abs_string());
-        context->create_named_pipeline("directional_depth", pci);
-    }
-    {
-        vuk::PipelineBaseCreateInfo pci;
-        pci.add_glsl(get_contents("shaders/infinite_plane.vert"_distributed), "shaders/infinite_plane.vert"_distributed.abs_string());
-        pci.add_glsl(get_contents("shaders/grid.frag"_distributed), "shaders/grid.frag"_distributed.abs_string());
+        add_shader(pci, "shaders/infinite_plane.vert"_distributed);
+        add_shader(pci, "shaders/grid.frag"_distributed);
         context->create_named_pipeline("grid_3d", pci);
     }
 
@@ -223,6 +275,7 @@ void Renderer::setup() {
     wait_for_futures();
 
     stage = RenderStage_Inactive;
+    startup.setup_ms = ms_since(setup_start);
 
     Input::add_callback<ResizeCallback>(InputCallbackInfo<ResizeCallback>{
         .callback = [](ResizeCallbackArgs args)-> bool {
@@ -258,6 +311,8 @@ void Renderer::render() {
     assert_else(stage == RenderStage_Inactive)
         return;
 
+    get_font_manager().flush_atlas();
+    get_gpu_asset_cache().flush_loads();
     wait_for_futures();
 
     stage = RenderStage_BuildingRG;
@@ -299,35 +354,53 @@ void Renderer::render() {
     imgui_images.clear();
 
     for (auto scene : scenes) {
-        for (auto it = scene->renderables.begin(); it != scene->renderables.end();) {
-            if (it->frame_allocated)
-                it = scene->renderables.erase(it);
-            else
-                ++it;
-        }
-        for (auto it = scene->widget_renderables.begin(); it != scene->widget_renderables.end();) {
-            if (it->frame_allocated)
-                it = scene->widget_renderables.erase(it);
-            else
-                ++it;
-        }
-
-        for (auto it = scene->ui_renderables.begin(); it != scene->ui_renderables.end();) {
-            if (it->frame_allocated)
-                it = scene->ui_renderables.remove(it);
-            else
-                ++it;
-        }
+        scene->delete_frame_allocated();
     }
 
-    get_gpu_asset_cache().clear_frame_allocated_assets();
+    get_gpu_asset_cache().end_frame();
+    get_font_manager().end_frame();
     frame_allocator.reset();
 
     stage = RenderStage_Inactive;
+
+    if (!startup.recorded) {
+        // Pipelines are created on first use, so the first frame is where a cold cache shows
+        startup.first_frame_ms = ms_since(startup.start);
+        startup.recorded = true;
+        std::ofstream file(("startup.log"_config).abs_path(), std::ios::app);
+        file << fmt_("{} {:.1f} {:.1f} {:.1f} {} {}\n", startup.warm ? "warm" : "cold", startup.device_ms, startup.setup_ms, startup.first_frame_ms,
+            startup.spirv_shaders, startup.glsl_shaders);
+    }
+}
+
+// New vertex shaders used here go in PACKED_VERTEX_SHADERS in shaders/CMakeLists.txt to get their packed SPIR-V
+void Renderer::create_mesh_pipeline(string_view name, const FilePath& vert_path, const FilePath& frag_path) {
+    {
+        vuk::PipelineBaseCreateInfo pci;
+        add_shader(pci, vert_path);
+        add_shader(pci, frag_path);
+        context->create_named_pipeline(vuk::Name(name), pci);
+    }
+    {
+        vuk::PipelineBaseCreateInfo pci;
+        add_shader(pci, vert_path, true);
+        add_shader(pci, frag_path);
+        context->create_named_pipeline(vuk::Name(fmt_("{}_packed", name)), pci);
+    }
+    packed_pipelines.insert(string(name));
+}
+
+vuk::PipelineBaseInfo* Renderer::get_pipeline(string_view name, VertexLayout layout) {
+    if (layout == VertexLayout_Full)
+        return context->get_named_pipeline(vuk::Name(name));
+    if (!packed_pipelines.contains(string(name)))
+        return nullptr;
+    return context->get_named_pipeline(vuk::Name(fmt_("{}_packed", name)));
 }
 
 void Renderer::cleanup() {
     context->wait_idle();
+    save_pipeline_cache();
     for (auto scene : scenes) {
         scene->cleanup(*global_allocator);
     }
@@ -380,10 +453,61 @@ void Renderer::debug_window(bool* p_open) {
         ImGui::Text(fmt_("Window Size: {}", window_size).c_str());
 
         frame_timer.inspect();
+
+        if (ImGui::CollapsingHeader("Assets"))
+            inspect(&get_gpu_asset_cache());
     }
     ImGui::End();
 }
 
+string report_startup_times(int launches) {
+    struct Average {
+        uint32 count = 0;
+        double device_ms = 0.0, setup_ms = 0.0, first_frame_ms = 0.0;
+        uint32 spirv_shaders = 0, glsl_shaders = 0;
+    };
+    vector<string> lines;
+    std::ifstream file(("startup.log"_config).abs_path());
+    for (string line; std::getline(file, line);)
+        lines.push_back(line);
+
+    Average averages[2];
+    for (int i = int(lines.size()) - 1; i >= 0; i--) {
+        std::istringstream stream(lines[i]);
+        string kind;
+        double device_ms, setup_ms, first_frame_ms;
+        uint32 spirv_shaders, glsl_shaders;
+        if (!(stream >> kind >> device_ms >> setup_ms >> first_frame_ms >> spirv_shaders >> glsl_shaders))
+            continue;
+        Average& average = averages[kind == "warm"];
+        if (average.count >= uint32(launches))
+            continue;
+        average.count++;
+        average.device_ms      += device_ms;
+        average.setup_ms       += setup_ms;
+        average.first_frame_ms += first_frame_ms;
+        // The latest launch's shader split is what the next one will see
+        if (average.count == 1) {
+            average.spirv_shaders = spirv_shaders;
+            average.glsl_shaders  = glsl_shaders;
+        }
+    }
+
+    string report;
+    const char* names[2] = {"cold", "warm"};
+    for (uint32 i = 0; i < 2; i++) {
+        Average& average = averages[i];
+        if (average.count == 0) {
+            report += fmt_("{}: no launches{}", names[i], i == 0 ? "; " : "");
+            continue;
+        }
+        report += fmt_("{}: {} launches, device {:.1f}ms, setup {:.1f}ms, first frame at {:.1f}ms, {} SPIR-V / {} GLSL shaders{}", names[i], average.count,
+            average.device_ms / average.count, average.setup_ms / average.count, average.first_frame_ms / average.count,
+            average.spirv_shaders, average.glsl_shaders, i == 0 ? "; " : "");
+    }
+    return report;
+}
+
 void FrameTimer::update() {
     int last_index   = ptr;
     float last_time    = frame_times[ptr];
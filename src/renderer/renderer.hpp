@@ -3,6 +3,7 @@
 #include <optional>
 #include <mutex>
 #include <array>
+#include <chrono>
 
 #include <vuk/resources/DeviceFrameResource.hpp>
 #include <vuk/Context.hpp>
@@ -11,6 +12,7 @@
 
 #include "extension/vuk_imgui.hpp"
 #include "general/vector.hpp"
+#include "general/umap.hpp"
 #include "general/math/geometry.hpp"
 #include "renderer/assets/material.hpp"
 #include "renderer/assets/mesh.hpp"
@@ -33,6 +35,7 @@ namespace spellbook {
 #define NORMAL_BINDING 7
 #define EMISSIVE_BINDING 8
 #define SPARE_BINDING_1 9
+#define BONE_OFFSETS_BINDING 10
 #define PARTICLES_BINDING MODEL_BINDING
 
 // font
@@ -49,6 +52,19 @@ struct FrameTimer {
     void inspect();
 };
 
+// Appended to startup.log once the first frame is presented, see report_startup_times
+struct StartupTimings {
+    std::chrono::steady_clock::time_point start;
+    double device_ms      = 0.0;
+    double setup_ms       = 0.0;
+    double first_frame_ms = 0.0;
+    uint32 spirv_shaders  = 0;
+    uint32 glsl_shaders   = 0;
+    // A pipeline cache from a previous launch was accepted
+    bool   warm     = false;
+    bool   recorded = false;
+};
+
 struct RenderScene;
 struct FontManager;
 
@@ -78,6 +94,9 @@ struct Renderer {
 
     vuk::Compiler compiler;
 
+    // Pipelines that also have a _packed variant reading VertexPacked meshes
+    uset<string> packed_pipelines;
+
     ImGuiData                      imgui_data;
     plf::colony<vuk::SampledImage> imgui_images;
     char* imgui_ini_path;
@@ -86,6 +105,10 @@ struct Renderer {
     vuk::Unique<array<VkSemaphore, 3>> render_complete;
 
     bool suspend = false;
+    // Without it BC7 and BC5 textures are decoded to RGBA8 on load
+    bool bc_supported = false;
+
+    StartupTimings startup;
     
     Renderer();
     void setup();
@@ -99,6 +122,16 @@ struct Renderer {
 
     void add_scene(RenderScene*);
 
+    // Uses the SPIR-V built by the shaders target when it's newer than the source, otherwise compiles the GLSL
+    void add_shader(vuk::PipelineBaseCreateInfo& pci, const FilePath& path, bool packed_vertex = false);
+    void load_pipeline_cache();
+    void save_pipeline_cache();
+
+    // Creates the pipeline along with its packed vertex variant
+    void create_mesh_pipeline(string_view name, const FilePath& vert_path, const FilePath& frag_path);
+    // Null if there is no variant for the layout
+    vuk::PipelineBaseInfo* get_pipeline(string_view name, VertexLayout layout);
+
     void resize(v2i new_size);
 
     void debug_window(bool* p_open);
@@ -106,4 +139,7 @@ struct Renderer {
 
 Renderer& get_renderer();
 
+// Averages the last launches in startup.log, split by whether the pipeline cache was warm
+string report_startup_times(int launches);
+
 }
@@ -1,6 +1,129 @@
 ﻿#include "vertex.hpp"
 
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "general/math/math.hpp"
 
 namespace spellbook {
 
+static void pack_octahedral(v3 n, int16* out) {
+    float sum = std::abs(n.x) + std::abs(n.y) + std::abs(n.z);
+    v2 p = sum > 0.0f ? v2(n.x / sum, n.y / sum) : v2(0.0f);
+    // Lower hemisphere folds over the diagonals
+    if (sum > 0.0f && n.z < 0.0f)
+        p = v2((1.0f - std::abs(p.y)) * (p.x >= 0.0f ? 1.0f : -1.0f), (1.0f - std::abs(p.x)) * (p.y >= 0.0f ? 1.0f : -1.0f));
+    out[0] = int16(std::round(std::clamp(p.x, -1.0f, 1.0f) * 32767.0f));
+    out[1] = int16(std::round(std::clamp(p.y, -1.0f, 1.0f) * 32767.0f));
+}
+
+// Matches octahedral_decode in include.glsli
+static v3 unpack_octahedral(const int16* in) {
+    v2 p = v2(std::max(in[0] / 32767.0f, -1.0f), std::max(in[1] / 32767.0f, -1.0f));
+    v3 n = v3(p.x, p.y, 1.0f - std::abs(p.x) - std::abs(p.y));
+    float t = std::max(-n.z, 0.0f);
+    n.x += n.x >= 0.0f ? -t : t;
+    n.y += n.y >= 0.0f ? -t : t;
+    return math::normalize(n);
+}
+
+static uint16 float_to_half(float value) {
+    uint32 bits;
+    memcpy(&bits, &value, sizeof(float));
+    uint32 sign = (bits >> 16) & 0x8000;
+    int32 exponent = int32((bits >> 23) & 0xff) - 127 + 15;
+    uint32 mantissa = bits & 0x7fffff;
+    if (exponent <= 0) {
+        if (exponent < -10)
+            return sign;
+        mantissa |= 0x800000;
+        uint32 shift = 14 - exponent;
+        uint32 half = (mantissa >> shift) + ((mantissa >> (shift - 1)) & 1);
+        return sign | half;
+    }
+    if (exponent >= 31)
+        return sign | 0x7c00;
+    // Rounding can carry into the exponent, which is still the nearest half
+    return (sign | (uint32(exponent) << 10) | (mantissa >> 13)) + ((mantissa >> 12) & 1);
+}
+
+static float half_to_float(uint16 half) {
+    uint32 sign = uint32(half & 0x8000) << 16;
+    uint32 exponent = (half >> 10) & 0x1f;
+    uint32 mantissa = half & 0x3ff;
+    if (exponent == 0) {
+        float value = float(mantissa) / 16777216.0f;
+        return sign ? -value : value;
+    }
+    uint32 bits = exponent == 31 ? sign | 0x7f800000 | (mantissa << 13) : sign | ((exponent + 112) << 23) | (mantissa << 13);
+    float value;
+    memcpy(&value, &bits, sizeof(float));
+    return value;
+}
+
+static uint8 pack_unorm8(float value) {
+    return uint8(std::round(std::clamp(value, 0.0f, 1.0f) * 255.0f));
+}
+
+VertexPacked pack_vertex(const Vertex& vertex) {
+    VertexPacked packed;
+    packed.position = vertex.position;
+    pack_octahedral(vertex.normal, packed.normal);
+    pack_octahedral(vertex.tangent, packed.tangent);
+    for (int i = 0; i < 3; i++)
+        packed.color[i] = pack_unorm8(vertex.color[i]);
+    packed.color[3] = 255;
+    packed.uv[0] = float_to_half(vertex.uv.x);
+    packed.uv[1] = float_to_half(vertex.uv.y);
+
+    int32 total = 0;
+    int32 largest = 0;
+    for (int i = 0; i < 4; i++) {
+        if (vertex.bone_ids[i] < 0)
+            continue;
+        packed.bone_ids[i] = uint8(vertex.bone_ids[i]);
+        packed.bone_weights[i] = pack_unorm8(vertex.bone_weights[i]);
+        total += packed.bone_weights[i];
+        if (packed.bone_weights[i] > packed.bone_weights[largest])
+            largest = i;
+    }
+    // Weights that summed to one still do, otherwise skinned positions shrink toward the origin
+    if (total > 0 && std::abs(total - 255) <= 2)
+        packed.bone_weights[largest] = uint8(packed.bone_weights[largest] + 255 - total);
+    return packed;
+}
+
+Vertex unpack_vertex(const VertexPacked& packed) {
+    Vertex vertex;
+    vertex.position = packed.position;
+    vertex.normal = unpack_octahedral(packed.normal);
+    vertex.tangent = unpack_octahedral(packed.tangent);
+    vertex.color = v3(packed.color[0], packed.color[1], packed.color[2]) / 255.0f;
+    vertex.uv = v2(half_to_float(packed.uv[0]), half_to_float(packed.uv[1]));
+    for (int i = 0; i < 4; i++) {
+        vertex.bone_ids[i] = packed.bone_ids[i] == 255 ? -1 : packed.bone_ids[i];
+        vertex.bone_weights[i] = packed.bone_weights[i] / 255.0f;
+    }
+    return vertex;
+}
+
+bool can_pack_vertex(const Vertex& vertex) {
+    // Half a texel of a 2048 texture
+    constexpr float max_uv_error = 0.5f / 2048.0f;
+    for (int i = 0; i < 3; i++) {
+        if (vertex.color[i] < 0.0f || vertex.color[i] > 1.0f)
+            return false;
+    }
+    for (int i = 0; i < 4; i++) {
+        if (vertex.bone_ids[i] >= 255)
+            return false;
+    }
+    for (int i = 0; i < 2; i++) {
+        if (!(std::abs(vertex.uv[i]) < 65504.0f) || std::abs(half_to_float(float_to_half(vertex.uv[i])) - vertex.uv[i]) > max_uv_error)
+            return false;
+    }
+    return true;
+}
+
 }
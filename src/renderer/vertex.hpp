@@ -7,6 +7,8 @@
 
 namespace spellbook {
 
+enum VertexLayout { VertexLayout_Full, VertexLayout_Packed };
+
 struct Vertex {
 	v3 position = {};
 	v3 normal = {};
@@ -38,6 +40,45 @@ struct Vertex {
     }
 };
 
+// 36 bytes instead of 88, read by the _packed pipeline variants. Normals and tangents are octahedral, uvs are
+// half floats, colors and weights are unorm8 and a bone id of 255 is unused.
+struct VertexPacked {
+    v3 position = {};
+    int16 normal[2] = {};
+    int16 tangent[2] = {};
+    uint8 color[4] = {};
+    uint16 uv[2] = {};
+    uint8 bone_ids[4] = {255, 255, 255, 255};
+    uint8 bone_weights[4] = {};
+
+    static inline vuk::Packed get_format() {
+        return vuk::Packed {
+            vuk::Format::eR32G32B32Sfloat, // position
+            vuk::Format::eR16G16Snorm,     // normal
+            vuk::Format::eR16G16Snorm,     // tangent
+            vuk::Format::eR8G8B8A8Unorm,   // color
+            vuk::Format::eR16G16Sfloat,    // uv
+            vuk::Format::eR8G8B8A8Uint,    // bone id
+            vuk::Format::eR8G8B8A8Unorm    // bone weight
+        };
+    }
+
+    static inline vuk::Packed get_widget_format() {
+        return vuk::Packed {
+            vuk::Format::eR32G32B32Sfloat, // position
+            vuk::Ignore{ sizeof(VertexPacked::normal) + sizeof(VertexPacked::tangent) }, // normal
+            vuk::Format::eR8G8B8A8Unorm,   // color
+            vuk::Ignore{ sizeof(VertexPacked::uv) + sizeof(VertexPacked::bone_ids) + sizeof(VertexPacked::bone_weights) }
+        };
+    }
+};
+static_assert(sizeof(VertexPacked) == 36);
+
+VertexPacked pack_vertex(const Vertex& vertex);
+Vertex       unpack_vertex(const VertexPacked& vertex);
+// Colors outside of unorm, bone ids past 254 or uvs too large for half precision need the full layout
+bool         can_pack_vertex(const Vertex& vertex);
+
 struct VertexUI {
     v3 position = {0.0f, 0.0f, 0.0f};
     v2 uv = {0.0f, 0.0f};